@@ -52,7 +52,7 @@ Application* Application_new(const char* const filename) {
 
     Events_setup();
 
-    self->score = Score_new(filename);
+    self->score = Score_new(filename, true);
     self->renderWindow = RenderWindow_new();
     self->renderer = Renderer_new();
     self->editView = EditView_new(self->score);
@@ -36,6 +36,7 @@ const char INPUT_CHAR_N = 'n';
 const char INPUT_CHAR_Q = 'q';
 const char INPUT_CHAR_R = 'r';
 const char INPUT_CHAR_T = 't';
+const char INPUT_CHAR_U = 'u';
 const char INPUT_CHAR_V = 'v';
 const char INPUT_CHAR_W = 'w';
 
@@ -34,6 +34,7 @@ extern const char INPUT_CHAR_N;
 extern const char INPUT_CHAR_Q;
 extern const char INPUT_CHAR_R;
 extern const char INPUT_CHAR_T;
+extern const char INPUT_CHAR_U;
 extern const char INPUT_CHAR_V;
 extern const char INPUT_CHAR_W;
 
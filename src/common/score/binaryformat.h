@@ -0,0 +1,86 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Fixed-layout tables in host byte order, meant to be read straight from an
+// mmap'ed file. Offsets are in bytes from the start of the file, except for
+// string offsets, which point into the NUL-separated string table.
+
+static const char* const BINARY_FILE_EXTENSION = ".gsb";
+static const char BINARY_FORMAT_MAGIC[4] = {'G', 'S', 'B', '\0'};
+
+enum {
+    BINARY_FORMAT_VERSION = 1,
+    BINARY_TABLE_ALIGNMENT = 4,
+    BINARY_BLOCKDEF_NONE = -1,
+};
+
+static const uint32_t BINARY_STRING_NONE = UINT32_MAX;
+
+typedef struct {
+    char magic[4];
+    uint32_t formatVersion;
+    uint32_t ticksPerBeat;
+    int32_t tempoBpm;
+    int32_t nBeatsPerMeasure;
+    uint32_t keySignatureString;
+    uint32_t versionString;
+    uint32_t metadataString;  // BINARY_STRING_NONE if the score has no metadata
+    uint32_t nBlockDefs;
+    uint32_t blockDefsOffset;
+    uint32_t nNotes;
+    uint32_t notesOffset;
+    uint32_t nTracks;
+    uint32_t tracksOffset;
+    uint32_t nBlocks;
+    uint32_t blocksOffset;
+    uint32_t stringsSize;
+    uint32_t stringsOffset;
+} BinaryHeader;
+
+typedef struct {
+    uint32_t nameString;
+    uint32_t colorString;
+    uint32_t iNoteFirst;
+    uint32_t nNotes;
+} BinaryBlockDef;
+
+// Ordered by pitch, then tick, within each blockdef
+typedef struct {
+    int32_t pitch;
+    int32_t tick;
+    int32_t duration;
+    float velocity;
+} BinaryNote;
+
+typedef struct {
+    uint32_t programString;
+    float velocity;
+    uint32_t ignoreNoteOff;
+    uint32_t iBlockFirst;
+    uint32_t nBlocks;
+} BinaryTrack;
+
+// One per time slot, up to the last non-empty one
+typedef struct {
+    int32_t iBlockDef;  // BINARY_BLOCKDEF_NONE for empty time slots
+    float velocity;
+} BinaryBlock;
@@ -0,0 +1,377 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#include "blockdef.h"
+
+#include "common/constants/fluidmidi.h"
+#include "common/structs/color.h"
+#include "common/structs/midimessage.h"
+#include "common/structs/note.h"
+#include "common/util/alloc.h"
+#include "common/util/colors.h"
+#include "common/util/log.h"
+#include "common/util/midimessages.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+enum {
+    HEX_COLOR_BUFFER_SIZE = 7,
+    NOTES_ALLOCATED_INITIAL = 16,
+};
+
+// Notes of a single pitch as parallel columns, ordered by tickOn.
+// ticksOffMax[i] is the latest tickOff among notes 0..i, which makes the
+// first note that can overlap a given tick range a binary search away.
+typedef struct {
+    size_t nNotes;
+    size_t nNotesAllocated;
+    int* ticksOn;
+    int* ticksOff;
+    int* ticksOffMax;
+    float* velocities;
+} PitchNotes;
+
+// The sorted midi messages for the notes are compiled on demand and kept
+// until the notes change.
+struct BlockDef {
+    char* name;
+    int index;  // position in the score's blockdef list
+    char hexColor[HEX_COLOR_BUFFER_SIZE];
+    Color color;
+    size_t nNotes;
+    PitchNotes pitchNotes[MIDI_MESSAGE_PITCH_COUNT];
+    MidiMessage* midiMessages;
+    size_t nMidiMessages;
+    size_t nMidiMessagesAllocated;
+    bool isMidiMessagesDirty;
+};
+
+
+static PitchNotes* BlockDef_getPitchNotes(BlockDef* self, int pitch);
+static void BlockDef_reserveNotes(PitchNotes* pitchNotes, size_t nNotes);
+static void BlockDef_insertNote(PitchNotes* pitchNotes, size_t iNote, int tickOn, int tickOff, float velocity);
+static size_t BlockDef_findFirstNoteEndingAfter(PitchNotes* pitchNotes, int tick);
+static size_t BlockDef_findFirstNoteStartingAt(PitchNotes* pitchNotes, int tick);
+static size_t BlockDef_findFirstNoteStartingAfter(PitchNotes* pitchNotes, int tick);
+static void BlockDef_updateTicksOffMax(PitchNotes* pitchNotes, size_t iNoteStart);
+static void BlockDef_compileMidiMessages(BlockDef* self);
+
+
+BlockDef* BlockDef_new(const char* name, const char* hexColor) {
+    BlockDef* self = ecalloc(1, sizeof(*self));
+    self->name = estrdup(name);
+    self->isMidiMessagesDirty = true;
+    BlockDef_setHexColor(self, hexColor);
+    return self;
+}
+
+
+void BlockDef_free(BlockDef** pself) {
+    BlockDef* self = *pself;
+    for (int pitch = 0; pitch < MIDI_MESSAGE_PITCH_COUNT; pitch++) {
+        PitchNotes* pitchNotes = &self->pitchNotes[pitch];
+        if (pitchNotes->nNotesAllocated) {
+            sfree((void**)&pitchNotes->ticksOn);
+            sfree((void**)&pitchNotes->ticksOff);
+            sfree((void**)&pitchNotes->ticksOffMax);
+            sfree((void**)&pitchNotes->velocities);
+        }
+    }
+    if (self->nMidiMessagesAllocated) {
+        sfree((void**)&self->midiMessages);
+    }
+    sfree((void**)&self->name);
+    sfree((void**)pself);
+}
+
+
+const char* BlockDef_getName(BlockDef* self) {
+    return self->name;
+}
+
+
+void BlockDef_setName(BlockDef* self, const char* name) {
+    char* nameNew = estrdup(name);
+    sfree((void**)&self->name);
+    self->name = nameNew;
+}
+
+
+int BlockDef_getIndex(BlockDef* self) {
+    return self->index;
+}
+
+
+void BlockDef_setIndex(BlockDef* self, int index) {
+    self->index = index;
+}
+
+
+const char* BlockDef_getHexColor(BlockDef* self) {
+    return self->hexColor;
+}
+
+
+Color BlockDef_getColor(BlockDef* self) {
+    return self->color;
+}
+
+
+void BlockDef_setHexColor(BlockDef* self, const char* hexColor) {
+    self->color = parseHexColor(hexColor);
+    snprintf(self->hexColor, HEX_COLOR_BUFFER_SIZE, "%s", hexColor);
+}
+
+
+size_t BlockDef_countNotes(BlockDef* self) {
+    return self->nNotes;
+}
+
+
+size_t BlockDef_countNotesWithPitch(BlockDef* self, int pitch) {
+    return BlockDef_getPitchNotes(self, pitch)->nNotes;
+}
+
+
+Note BlockDef_getNoteWithPitch(BlockDef* self, int pitch, size_t iNote) {
+    PitchNotes* pitchNotes = BlockDef_getPitchNotes(self, pitch);
+    Log_assert(iNote < pitchNotes->nNotes, "Note index out of range (expected %zu < %zu)", iNote, pitchNotes->nNotes);
+    Note note = {
+        pitch,
+        pitchNotes->ticksOn[iNote],
+        pitchNotes->ticksOff[iNote] - pitchNotes->ticksOn[iNote],
+        pitchNotes->velocities[iNote],
+    };
+    return note;
+}
+
+
+Note BlockDef_addNote(BlockDef* self, int pitch, int tickOn, int tickOff, float velocity) {
+    Log_assert(tickOff > tickOn, "Note must end after it starts (expected %d > %d)", tickOff, tickOn);
+    PitchNotes* pitchNotes = BlockDef_getPitchNotes(self, pitch);
+
+    size_t iNote = BlockDef_findFirstNoteStartingAfter(pitchNotes, tickOn);
+    BlockDef_insertNote(pitchNotes, iNote, tickOn, tickOff, velocity);
+    self->nNotes++;
+    BlockDef_invalidateMidiMessages(self);
+    return BlockDef_getNoteWithPitch(self, pitch, iNote);
+}
+
+
+Note* BlockDef_removeNotes(BlockDef* self, int pitch, int tickStart, int tickEnd, size_t* outAmount) {
+    PitchNotes* pitchNotes = BlockDef_getPitchNotes(self, pitch);
+
+    // Only notes in [iNoteFirst, iNoteLast) can overlap the range
+    size_t iNoteFirst = BlockDef_findFirstNoteEndingAfter(pitchNotes, tickStart);
+    size_t iNoteLast = BlockDef_findFirstNoteStartingAt(pitchNotes, tickEnd);
+    if (iNoteLast < iNoteFirst) {
+        iNoteLast = iNoteFirst;
+    }
+
+    Note* notesRemoved = ecalloc(iNoteLast - iNoteFirst, sizeof(Note));
+    size_t nNotesRemoved = 0;
+    size_t iNoteKept = iNoteFirst;
+
+    for (size_t iNote = iNoteFirst; iNote < iNoteLast; iNote++) {
+        if (pitchNotes->ticksOff[iNote] > tickStart) {
+            notesRemoved[nNotesRemoved] = BlockDef_getNoteWithPitch(self, pitch, iNote);
+            nNotesRemoved++;
+        } else {
+            pitchNotes->ticksOn[iNoteKept] = pitchNotes->ticksOn[iNote];
+            pitchNotes->ticksOff[iNoteKept] = pitchNotes->ticksOff[iNote];
+            pitchNotes->velocities[iNoteKept] = pitchNotes->velocities[iNote];
+            iNoteKept++;
+        }
+    }
+
+    if (nNotesRemoved > 0) {
+        size_t nNotesAfter = pitchNotes->nNotes - iNoteLast;
+        memmove(&pitchNotes->ticksOn[iNoteKept], &pitchNotes->ticksOn[iNoteLast], nNotesAfter * sizeof(int));
+        memmove(&pitchNotes->ticksOff[iNoteKept], &pitchNotes->ticksOff[iNoteLast], nNotesAfter * sizeof(int));
+        memmove(&pitchNotes->velocities[iNoteKept], &pitchNotes->velocities[iNoteLast], nNotesAfter * sizeof(float));
+        pitchNotes->nNotes -= nNotesRemoved;
+        self->nNotes -= nNotesRemoved;
+
+        BlockDef_updateTicksOffMax(pitchNotes, iNoteFirst);
+        BlockDef_invalidateMidiMessages(self);
+    }
+
+    *outAmount = nNotesRemoved;
+    return notesRemoved;
+}
+
+
+const MidiMessage* BlockDef_getMidiMessages(BlockDef* self, size_t* outAmount) {
+    if (self->isMidiMessagesDirty) {
+        BlockDef_compileMidiMessages(self);
+    }
+    *outAmount = self->nMidiMessages;
+    return self->midiMessages;
+}
+
+
+void BlockDef_invalidateMidiMessages(BlockDef* self) {
+    self->isMidiMessagesDirty = true;
+}
+
+
+static PitchNotes* BlockDef_getPitchNotes(BlockDef* self, int pitch) {
+    Log_assert(pitch >= 0 && pitch < MIDI_MESSAGE_PITCH_COUNT, "Invalid pitch %d", pitch);
+    return &self->pitchNotes[pitch];
+}
+
+
+static void BlockDef_reserveNotes(PitchNotes* pitchNotes, size_t nNotes) {
+    if (nNotes <= pitchNotes->nNotesAllocated) {
+        return;
+    }
+
+    size_t nNotesAllocated = pitchNotes->nNotesAllocated ? pitchNotes->nNotesAllocated : NOTES_ALLOCATED_INITIAL;
+    while (nNotesAllocated < nNotes) {
+        nNotesAllocated *= 2;
+    }
+
+    pitchNotes->ticksOn = erealloc(pitchNotes->ticksOn, nNotesAllocated, sizeof(int));
+    pitchNotes->ticksOff = erealloc(pitchNotes->ticksOff, nNotesAllocated, sizeof(int));
+    pitchNotes->ticksOffMax = erealloc(pitchNotes->ticksOffMax, nNotesAllocated, sizeof(int));
+    pitchNotes->velocities = erealloc(pitchNotes->velocities, nNotesAllocated, sizeof(float));
+    pitchNotes->nNotesAllocated = nNotesAllocated;
+}
+
+
+static void BlockDef_insertNote(PitchNotes* pitchNotes, size_t iNote, int tickOn, int tickOff, float velocity) {
+    Log_assert(iNote <= pitchNotes->nNotes, "Note index out of range (expected %zu <= %zu)", iNote, pitchNotes->nNotes);
+    BlockDef_reserveNotes(pitchNotes, pitchNotes->nNotes + 1);
+
+    size_t nNotesAfter = pitchNotes->nNotes - iNote;
+    memmove(&pitchNotes->ticksOn[iNote + 1], &pitchNotes->ticksOn[iNote], nNotesAfter * sizeof(int));
+    memmove(&pitchNotes->ticksOff[iNote + 1], &pitchNotes->ticksOff[iNote], nNotesAfter * sizeof(int));
+    memmove(&pitchNotes->velocities[iNote + 1], &pitchNotes->velocities[iNote], nNotesAfter * sizeof(float));
+    memmove(&pitchNotes->ticksOffMax[iNote + 1], &pitchNotes->ticksOffMax[iNote], nNotesAfter * sizeof(int));
+
+    pitchNotes->ticksOn[iNote] = tickOn;
+    pitchNotes->ticksOff[iNote] = tickOff;
+    pitchNotes->velocities[iNote] = velocity;
+    pitchNotes->nNotes++;
+
+    // The running maximum can only grow, and stops changing at the first later note ending after this one
+    pitchNotes->ticksOffMax[iNote] = tickOff;
+    if (iNote > 0 && pitchNotes->ticksOffMax[iNote - 1] > tickOff) {
+        pitchNotes->ticksOffMax[iNote] = pitchNotes->ticksOffMax[iNote - 1];
+    }
+    for (size_t iNoteAfter = iNote + 1; iNoteAfter < pitchNotes->nNotes && pitchNotes->ticksOffMax[iNoteAfter] < tickOff; iNoteAfter++) {
+        pitchNotes->ticksOffMax[iNoteAfter] = tickOff;
+    }
+}
+
+
+static size_t BlockDef_findFirstNoteEndingAfter(PitchNotes* pitchNotes, int tick) {
+    size_t iLow = 0;
+    size_t iHigh = pitchNotes->nNotes;
+    while (iLow < iHigh) {
+        size_t iMid = iLow + (iHigh - iLow) / 2;
+        if (pitchNotes->ticksOffMax[iMid] > tick) {
+            iHigh = iMid;
+        } else {
+            iLow = iMid + 1;
+        }
+    }
+    return iLow;
+}
+
+
+static size_t BlockDef_findFirstNoteStartingAt(PitchNotes* pitchNotes, int tick) {
+    size_t iLow = 0;
+    size_t iHigh = pitchNotes->nNotes;
+    while (iLow < iHigh) {
+        size_t iMid = iLow + (iHigh - iLow) / 2;
+        if (pitchNotes->ticksOn[iMid] >= tick) {
+            iHigh = iMid;
+        } else {
+            iLow = iMid + 1;
+        }
+    }
+    return iLow;
+}
+
+
+static size_t BlockDef_findFirstNoteStartingAfter(PitchNotes* pitchNotes, int tick) {
+    size_t iLow = 0;
+    size_t iHigh = pitchNotes->nNotes;
+    while (iLow < iHigh) {
+        size_t iMid = iLow + (iHigh - iLow) / 2;
+        if (pitchNotes->ticksOn[iMid] > tick) {
+            iHigh = iMid;
+        } else {
+            iLow = iMid + 1;
+        }
+    }
+    return iLow;
+}
+
+
+// Recompute ticksOffMax from iNoteStart onwards after notes were removed there
+static void BlockDef_updateTicksOffMax(PitchNotes* pitchNotes, size_t iNoteStart) {
+    for (size_t iNote = iNoteStart; iNote < pitchNotes->nNotes; iNote++) {
+        int tickOffMax = pitchNotes->ticksOff[iNote];
+        if (iNote > 0 && pitchNotes->ticksOffMax[iNote - 1] > tickOffMax) {
+            tickOffMax = pitchNotes->ticksOffMax[iNote - 1];
+        }
+        pitchNotes->ticksOffMax[iNote] = tickOffMax;
+    }
+}
+
+
+static void BlockDef_compileMidiMessages(BlockDef* self) {
+    size_t nMidiMessages = 2 * self->nNotes;
+    if (nMidiMessages > self->nMidiMessagesAllocated) {
+        self->midiMessages = erealloc(self->midiMessages, nMidiMessages, sizeof(MidiMessage));
+        self->nMidiMessagesAllocated = nMidiMessages;
+    }
+
+    size_t iMidiMessage = 0;
+    for (int pitch = 0; pitch < MIDI_MESSAGE_PITCH_COUNT; pitch++) {
+        PitchNotes* pitchNotes = &self->pitchNotes[pitch];
+        for (size_t iNote = 0; iNote < pitchNotes->nNotes; iNote++) {
+            MidiMessage* midiMessageOn = &self->midiMessages[iMidiMessage];
+            midiMessageOn->type = MIDI_MESSAGE_TYPE_NOTEON;
+            midiMessageOn->channel = 0;
+            midiMessageOn->pitch = pitch;
+            midiMessageOn->velocity = (float)MIDI_MESSAGE_VELOCITY_MAX * pitchNotes->velocities[iNote];
+            midiMessageOn->tick = pitchNotes->ticksOn[iNote];
+
+            MidiMessage* midiMessageOff = &self->midiMessages[iMidiMessage + 1];
+            midiMessageOff->type = MIDI_MESSAGE_TYPE_NOTEOFF;
+            midiMessageOff->channel = 0;
+            midiMessageOff->pitch = pitch;
+            midiMessageOff->velocity = 0;
+            midiMessageOff->tick = pitchNotes->ticksOff[iNote];
+
+            iMidiMessage += 2;
+        }
+    }
+
+    if (nMidiMessages > 0) {
+        sortMidiMessages(self->midiMessages, nMidiMessages);
+    }
+
+    self->nMidiMessages = nMidiMessages;
+    self->isMidiMessagesDirty = false;
+}
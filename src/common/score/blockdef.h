@@ -0,0 +1,44 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#pragma once
+
+#include "common/structs/color.h"
+#include "common/structs/midimessage.h"
+#include "common/structs/note.h"
+
+#include <stddef.h>
+
+typedef struct BlockDef BlockDef;
+
+BlockDef* BlockDef_new(const char* name, const char* hexColor);
+void BlockDef_free(BlockDef** pself);
+const char* BlockDef_getName(BlockDef* self);
+void BlockDef_setName(BlockDef* self, const char* name);
+int BlockDef_getIndex(BlockDef* self);
+void BlockDef_setIndex(BlockDef* self, int index);
+const char* BlockDef_getHexColor(BlockDef* self);
+Color BlockDef_getColor(BlockDef* self);
+void BlockDef_setHexColor(BlockDef* self, const char* hexColor);
+size_t BlockDef_countNotes(BlockDef* self);
+size_t BlockDef_countNotesWithPitch(BlockDef* self, int pitch);
+Note BlockDef_getNoteWithPitch(BlockDef* self, int pitch, size_t iNote);
+Note BlockDef_addNote(BlockDef* self, int pitch, int tickOn, int tickOff, float velocity);
+Note* BlockDef_removeNotes(BlockDef* self, int pitch, int tickStart, int tickEnd, size_t* outAmount);
+const MidiMessage* BlockDef_getMidiMessages(BlockDef* self, size_t* outAmount);
+void BlockDef_invalidateMidiMessages(BlockDef* self);
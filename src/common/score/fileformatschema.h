@@ -22,7 +22,8 @@ const char* const FILE_FORMAT_SCHEMA =
 "                        <xs:sequence>\n"
 "                          <xs:element name=\"message\" minOccurs=\"0\" maxOccurs=\"unbounded\">\n"
 "                            <xs:complexType>\n"
-"                              <xs:attribute name=\"time\" type=\"xs:decimal\" use=\"required\"/>\n"
+"                              <xs:attribute name=\"tick\" type=\"xs:nonNegativeInteger\"/>\n"
+"                              <xs:attribute name=\"time\" type=\"xs:decimal\"/>\n"
 "                              <xs:attribute name=\"type\" type=\"xs:nonNegativeInteger\" use=\"required\"/>\n"
 "                              <xs:attribute name=\"pitch\" type=\"xs:nonNegativeInteger\" use=\"required\"/>\n"
 "                              <xs:attribute name=\"velocity\" type=\"xs:decimal\" use=\"required\"/>\n"
@@ -61,6 +62,7 @@ const char* const FILE_FORMAT_SCHEMA =
 "            <xs:attribute name=\"tempo\" type=\"xs:positiveInteger\" use=\"required\"/>\n"
 "            <xs:attribute name=\"keysignature\" type=\"xs:string\" use=\"required\"/>\n"
 "            <xs:attribute name=\"beatspermeasure\" type=\"xs:positiveInteger\" use=\"required\"/>\n"
+"            <xs:attribute name=\"ticksperbeat\" type=\"xs:positiveInteger\"/>\n"
 "          </xs:complexType>\n"
 "        </xs:element>\n"
 "      </xs:sequence>\n"
@@ -0,0 +1,240 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#include "history.h"
+
+#include "common/util/alloc.h"
+#include "common/util/log.h"
+
+#include <string.h>
+
+enum {
+    HISTORY_STEPS_SIZE_INITIAL = 64,
+};
+
+// An undoable step holds the edits it made and the edits that revert them,
+// both in the order they are applied. Entries own their strings.
+typedef struct {
+    JournalEntry* redoEntries;
+    size_t nRedoEntries;
+    JournalEntry* undoEntries;
+    size_t nUndoEntries;
+    size_t size;  // bytes held by the step, counted against the history size limit
+} HistoryStep;
+
+// Edits are recorded into the open step until the outermost group ends, so
+// that e.g. a drag across several notes is undone in one go. Steps before
+// nStepsDone can be undone, the ones after it redone.
+struct History {
+    size_t sizeMax;
+    size_t size;
+    HistoryStep* steps;  // oldest first
+    size_t nSteps;
+    size_t nStepsDone;
+    size_t stepsSize;
+    HistoryStep stepOpen;
+    int groupDepth;
+};
+
+
+static void History_closeStep(History* self);
+static void History_removeStepsAfter(History* self, size_t iStep);
+static void History_evictOldestStep(History* self);
+static size_t appendEntryCopy(JournalEntry** entries, size_t* nEntries, const JournalEntry* entry);
+static void freeEntries(JournalEntry** entries, size_t nEntries);
+static void freeStep(HistoryStep* step);
+
+
+History* History_new(size_t sizeMax) {
+    History* self = ecalloc(1, sizeof(*self));
+    self->sizeMax = sizeMax;
+    self->stepsSize = HISTORY_STEPS_SIZE_INITIAL;
+    self->steps = ecalloc(self->stepsSize, sizeof(HistoryStep));
+    return self;
+}
+
+
+void History_free(History** pself) {
+    History* self = *pself;
+    History_removeStepsAfter(self, 0);
+    freeStep(&self->stepOpen);
+    sfree((void**)&self->steps);
+    sfree((void**)pself);
+}
+
+
+void History_beginGroup(History* self) {
+    self->groupDepth++;
+}
+
+
+void History_endGroup(History* self) {
+    Log_assert(self->groupDepth > 0, "Unbalanced history group");
+    self->groupDepth--;
+    if (self->groupDepth == 0) {
+        History_closeStep(self);
+    }
+}
+
+
+bool History_isGroupOpen(History* self) {
+    return self->groupDepth > 0;
+}
+
+
+// Either entry may be NULL, for edits that are one-way or have nothing to revert
+void History_record(History* self, const JournalEntry* redoEntry, const JournalEntry* undoEntry) {
+    HistoryStep* step = &self->stepOpen;
+    if (redoEntry) {
+        step->size += appendEntryCopy(&step->redoEntries, &step->nRedoEntries, redoEntry);
+    }
+    if (undoEntry) {
+        step->size += appendEntryCopy(&step->undoEntries, &step->nUndoEntries, undoEntry);
+    }
+
+    if (self->groupDepth == 0) {
+        History_closeStep(self);
+    }
+}
+
+
+// Returns the entries reverting the most recent step, or NULL if there is none.
+// They stay valid until the next call that records into the history.
+const JournalEntry* History_undo(History* self, size_t* outAmount) {
+    *outAmount = 0;
+    if (self->groupDepth > 0 || self->nStepsDone == 0) {
+        return NULL;
+    }
+
+    self->nStepsDone--;
+    HistoryStep* step = &self->steps[self->nStepsDone];
+    *outAmount = step->nUndoEntries;
+    return step->undoEntries;
+}
+
+
+const JournalEntry* History_redo(History* self, size_t* outAmount) {
+    *outAmount = 0;
+    if (self->groupDepth > 0 || self->nStepsDone == self->nSteps) {
+        return NULL;
+    }
+
+    HistoryStep* step = &self->steps[self->nStepsDone];
+    self->nStepsDone++;
+    *outAmount = step->nRedoEntries;
+    return step->redoEntries;
+}
+
+
+static void History_closeStep(History* self) {
+    HistoryStep step = self->stepOpen;
+    self->stepOpen = (HistoryStep){0};
+
+    if (!step.nRedoEntries && !step.nUndoEntries) {
+        freeStep(&step);
+        return;
+    }
+
+    // Undo the edits of the step newest first
+    for (size_t i = 0; i < step.nUndoEntries / 2; i++) {
+        JournalEntry entry = step.undoEntries[i];
+        step.undoEntries[i] = step.undoEntries[step.nUndoEntries - 1 - i];
+        step.undoEntries[step.nUndoEntries - 1 - i] = entry;
+    }
+
+    History_removeStepsAfter(self, self->nStepsDone);
+
+    if (self->nSteps == self->stepsSize) {
+        self->stepsSize *= 2;
+        self->steps = erealloc(self->steps, self->stepsSize, sizeof(HistoryStep));
+    }
+    self->steps[self->nSteps] = step;
+    self->nSteps++;
+    self->nStepsDone++;
+    self->size += step.size;
+
+    while (self->size > self->sizeMax && self->nSteps > 0) {
+        if (self->nSteps == 1) {
+            Log_warning("Edit too large to be undone (%zu bytes)", step.size);
+        }
+        History_evictOldestStep(self);
+    }
+}
+
+
+static void History_removeStepsAfter(History* self, size_t iStep) {
+    while (self->nSteps > iStep) {
+        self->nSteps--;
+        self->size -= self->steps[self->nSteps].size;
+        freeStep(&self->steps[self->nSteps]);
+    }
+    if (self->nStepsDone > self->nSteps) {
+        self->nStepsDone = self->nSteps;
+    }
+}
+
+
+static void History_evictOldestStep(History* self) {
+    self->size -= self->steps[0].size;
+    freeStep(&self->steps[0]);
+    self->nSteps--;
+    self->nStepsDone--;
+    memmove(&self->steps[0], &self->steps[1], self->nSteps * sizeof(HistoryStep));
+}
+
+
+static size_t appendEntryCopy(JournalEntry** entries, size_t* nEntries, const JournalEntry* entry) {
+    *entries = erealloc(*entries, *nEntries + 1, sizeof(JournalEntry));
+
+    JournalEntry* entryCopy = &(*entries)[*nEntries];
+    *entryCopy = *entry;
+    entryCopy->name = entry->name ? estrdup(entry->name) : NULL;
+    entryCopy->text = entry->text ? estrdup(entry->text) : NULL;
+    (*nEntries)++;
+
+    size_t size = sizeof(JournalEntry);
+    if (entry->name) {
+        size += strlen(entry->name) + 1;
+    }
+    if (entry->text) {
+        size += strlen(entry->text) + 1;
+    }
+    return size;
+}
+
+
+static void freeEntries(JournalEntry** entries, size_t nEntries) {
+    for (size_t i = 0; i < nEntries; i++) {
+        if ((*entries)[i].name) {
+            sfree((void**)&(*entries)[i].name);
+        }
+        if ((*entries)[i].text) {
+            sfree((void**)&(*entries)[i].text);
+        }
+    }
+    if (*entries) {
+        sfree((void**)entries);
+    }
+}
+
+
+static void freeStep(HistoryStep* step) {
+    freeEntries(&step->redoEntries, step->nRedoEntries);
+    freeEntries(&step->undoEntries, step->nUndoEntries);
+    *step = (HistoryStep){0};
+}
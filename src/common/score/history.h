@@ -0,0 +1,34 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#pragma once
+
+#include "common/score/journal.h"
+
+#include <stddef.h>
+
+typedef struct History History;
+
+History* History_new(size_t sizeMax);
+void History_free(History** pself);
+void History_beginGroup(History* self);
+void History_endGroup(History* self);
+bool History_isGroupOpen(History* self);
+void History_record(History* self, const JournalEntry* redoEntry, const JournalEntry* undoEntry);
+const JournalEntry* History_undo(History* self, size_t* outAmount);
+const JournalEntry* History_redo(History* self, size_t* outAmount);
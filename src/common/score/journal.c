@@ -0,0 +1,413 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#include "journal.h"
+
+#include "common/util/alloc.h"
+#include "common/util/hash.h"
+#include "common/util/log.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char* const JOURNAL_FILE_EXTENSION = ".journal";
+static const char* const JOURNAL_TEMP_FILE_EXTENSION = ".journal.tmp";
+static const char JOURNAL_FORMAT_MAGIC[4] = {'G', 'S', 'J', '\0'};
+
+enum {
+    JOURNAL_FORMAT_VERSION = 3,
+    JOURNAL_STRING_SIZE_MAX = 4096,
+};
+
+// Score files are recognized by their size and modification time
+typedef struct {
+    int64_t size;
+    int64_t modifiedSeconds;
+    int64_t modifiedNanoseconds;
+} JournalScoreStamp;
+
+// The journal applies on top of the score file it was started for. A save
+// first records the file about to replace it as a checkpoint, which the
+// entries after checkpointOffset apply to, so the journal stays usable
+// until it is compacted.
+typedef struct {
+    char magic[4];
+    uint32_t formatVersion;
+    JournalScoreStamp score;
+    JournalScoreStamp checkpointScore;  // zero unless a save is in progress
+    uint64_t checkpointOffset;
+} JournalHeader;
+
+// Followed by nameSize + textSize bytes of NUL-terminated strings
+typedef struct {
+    uint32_t size;  // of the record and its strings
+    uint32_t checksum;  // CRC-32 of the record and its strings, taken with this field zero
+    uint32_t type;
+    int32_t iTrack;
+    int32_t iTimeSlot;
+    int32_t pitch;
+    int32_t tick;
+    int32_t tickEnd;
+    int32_t value;
+    float velocity;
+    uint32_t nameSize;  // 0 for no string
+    uint32_t textSize;
+} JournalRecord;
+
+// Entries are appended and flushed one by one, so a crash loses at most the
+// entry being written. Its torn remains are cut off when the journal is read,
+// along with any entry that fails its checksum and everything after it.
+struct Journal {
+    char* scoreFilename;
+    char* filename;
+    FILE* file;  // NULL until the first entry is read or appended
+    size_t size;  // bytes of entries after the header
+    size_t entrySize;  // bytes of the entry last read
+    char* strings;  // backs the strings of the last read entry
+    bool isBroken;  // a failed truncate left the file in an unknown state
+};
+
+
+static JournalHeader Journal_getScoreHeader(Journal* self);
+static JournalScoreStamp getScoreStamp(const char* scoreFilename);
+static bool Journal_create(Journal* self);
+static bool Journal_readString(Journal* self, uint32_t stringSize, char* string);
+static void Journal_truncate(Journal* self, size_t size);
+static uint32_t getRecordChecksum(const JournalRecord* record, const char* name, const char* text);
+
+
+// Returns NULL if an existing journal cannot be opened for writing
+Journal* Journal_new(const char* scoreFilename) {
+    Journal* self = ecalloc(1, sizeof(*self));
+    self->scoreFilename = estrdup(scoreFilename);
+    self->filename = ecalloc(strlen(scoreFilename) + strlen(JOURNAL_TEMP_FILE_EXTENSION) + 1, sizeof(char));
+    strcat(strcpy(self->filename, scoreFilename), JOURNAL_FILE_EXTENSION);
+    self->strings = ecalloc(2 * JOURNAL_STRING_SIZE_MAX, sizeof(char));
+
+    if (access(self->filename, F_OK) == -1) {
+        return self;  // Created once there is something to record
+    }
+
+    self->file = fopen(self->filename, "r+b");
+    if (!self->file) {
+        Log_warning("Journal '%s' could not be opened", self->filename);
+        Journal_free(&self);
+        return NULL;
+    }
+
+    JournalHeader header = {0};
+    JournalHeader headerExpected = Journal_getScoreHeader(self);
+    bool isHeaderRead = fread(&header, sizeof(header), 1, self->file) == 1
+        && !memcmp(header.magic, headerExpected.magic, sizeof(header.magic))
+        && header.formatVersion == headerExpected.formatVersion;
+
+    if (isHeaderRead && !memcmp(&header.score, &headerExpected.score, sizeof(header.score))) {
+        return self;
+    }
+
+    // Saved, but not compacted before the program ended
+    if (isHeaderRead && header.checkpointScore.size > 0
+        && !memcmp(&header.checkpointScore, &headerExpected.score, sizeof(header.score))
+        && fseek(self->file, sizeof(header) + header.checkpointOffset, SEEK_SET) == 0) {
+        self->size = header.checkpointOffset;
+        return self;
+    }
+
+    Log_warning("Discarding journal '%s', it does not belong to the current '%s'", self->filename, self->scoreFilename);
+    fclose(self->file);
+    self->file = NULL;
+    unlink(self->filename);
+    return self;
+}
+
+
+void Journal_free(Journal** pself) {
+    Journal* self = *pself;
+    if (self->file) {
+        fclose(self->file);
+    }
+    sfree((void**)&self->strings);
+    sfree((void**)&self->filename);
+    sfree((void**)&self->scoreFilename);
+    sfree((void**)pself);
+}
+
+
+// Reads the entries in the order they were appended. Once it returns false
+// the journal is positioned for appending.
+bool Journal_readEntry(Journal* self, JournalEntry* outEntry) {
+    if (!self->file) {
+        return false;
+    }
+
+    long offset = sizeof(JournalHeader) + self->size;
+    JournalRecord record = {0};
+    char* name = self->strings;
+    char* text = self->strings + JOURNAL_STRING_SIZE_MAX;
+
+    bool isRecordRead = fread(&record, sizeof(record), 1, self->file) == 1;
+    if (!isRecordRead && feof(self->file) && ftell(self->file) == offset) {
+        fseek(self->file, offset, SEEK_SET);
+        return false;
+    }
+
+    bool isRead = isRecordRead
+        && Journal_readString(self, record.nameSize, name)
+        && Journal_readString(self, record.textSize, text)
+        && record.size == sizeof(record) + record.nameSize + record.textSize
+        && record.checksum == getRecordChecksum(&record, name, text);
+    if (!isRead) {
+        Log_warning("Discarding a torn or corrupt entry and everything after it in journal '%s'", self->filename);
+        Journal_truncate(self, self->size);
+        return false;
+    }
+
+    self->entrySize = record.size;
+    self->size += record.size;
+    *outEntry = (JournalEntry){
+        .type = record.type,
+        .iTrack = record.iTrack,
+        .iTimeSlot = record.iTimeSlot,
+        .pitch = record.pitch,
+        .tick = record.tick,
+        .tickEnd = record.tickEnd,
+        .value = record.value,
+        .velocity = record.velocity,
+        .name = record.nameSize ? name : NULL,
+        .text = record.textSize ? text : NULL,
+    };
+    return true;
+}
+
+
+// Returns false if the entry could not be written, the journal is of no
+// further use then
+bool Journal_append(Journal* self, const JournalEntry* entry) {
+    if (self->isBroken || (!self->file && !Journal_create(self))) {
+        return false;
+    }
+
+    JournalRecord record = {
+        .type = entry->type,
+        .iTrack = entry->iTrack,
+        .iTimeSlot = entry->iTimeSlot,
+        .pitch = entry->pitch,
+        .tick = entry->tick,
+        .tickEnd = entry->tickEnd,
+        .value = entry->value,
+        .velocity = entry->velocity,
+        .nameSize = entry->name ? strlen(entry->name) + 1 : 0,
+        .textSize = entry->text ? strlen(entry->text) + 1 : 0,
+    };
+    Log_assert(record.nameSize <= JOURNAL_STRING_SIZE_MAX && record.textSize <= JOURNAL_STRING_SIZE_MAX, "Journal entry string too long");
+    record.size = sizeof(record) + record.nameSize + record.textSize;
+    record.checksum = getRecordChecksum(&record, entry->name, entry->text);
+
+    bool isWritten = fwrite(&record, sizeof(record), 1, self->file) == 1
+        && (!entry->name || fwrite(entry->name, sizeof(char), record.nameSize, self->file) == record.nameSize)
+        && (!entry->text || fwrite(entry->text, sizeof(char), record.textSize, self->file) == record.textSize)
+        && fflush(self->file) == 0;
+    if (!isWritten) {
+        Log_warning("Failed to append to journal '%s'", self->filename);
+        self->isBroken = true;
+        return false;
+    }
+
+    self->size += record.size;
+    return true;
+}
+
+
+// Appends only reach the operating system, this makes them survive a power
+// loss as well. Returns false if the journal could not be synced.
+bool Journal_sync(Journal* self) {
+    if (!self->file || self->isBroken) {
+        return !self->isBroken;
+    }
+
+    if (fflush(self->file) != 0 || fsync(fileno(self->file)) != 0) {
+        Log_warning("Failed to sync journal '%s'", self->filename);
+        self->isBroken = true;
+        return false;
+    }
+    return true;
+}
+
+
+// For entries that read back intact but cannot be applied. The entry last
+// read and everything after it are dropped, and appending continues there.
+void Journal_discardFromLastEntry(Journal* self) {
+    Log_assert(self->file && self->entrySize <= self->size, "No journal entry to discard");
+    Journal_truncate(self, self->size - self->entrySize);
+    self->entrySize = 0;
+}
+
+
+size_t Journal_getSize(Journal* self) {
+    return self->size;
+}
+
+
+// Called before newScoreFilename is moved over the score file, with the
+// entries up to offset written into it. Returns false if the checkpoint
+// could not be recorded.
+bool Journal_checkpoint(Journal* self, const char* newScoreFilename, size_t offset) {
+    Log_assert(offset <= self->size, "Journal offset %zu out of range", offset);
+    if (!self->file) {
+        return true;
+    }
+
+    JournalHeader header = {0};
+    long position = ftell(self->file);
+    bool isWritten = fseek(self->file, 0, SEEK_SET) == 0
+        && fread(&header, sizeof(header), 1, self->file) == 1;
+
+    header.checkpointScore = getScoreStamp(newScoreFilename);
+    header.checkpointOffset = offset;
+    isWritten = isWritten
+        && header.checkpointScore.size > 0
+        && fseek(self->file, 0, SEEK_SET) == 0
+        && fwrite(&header, sizeof(header), 1, self->file) == 1
+        && fflush(self->file) == 0
+        && fsync(fileno(self->file)) == 0
+        && fseek(self->file, position, SEEK_SET) == 0;
+    if (!isWritten) {
+        Log_warning("Failed to checkpoint journal '%s'", self->filename);
+        self->isBroken = true;
+    }
+    return isWritten;
+}
+
+
+// Called after the score file was rewritten with everything up to offset.
+// The entries after offset are kept, on top of the new score file. Returns
+// false if the journal could not be rewritten.
+bool Journal_compact(Journal* self, size_t offset) {
+    Log_assert(offset <= self->size, "Journal offset %zu out of range", offset);
+    if (!self->file) {
+        return true;
+    }
+
+    size_t tailSize = self->size - offset;
+    char* tail = ecalloc(tailSize + 1, sizeof(char));
+    bool isRead = fseek(self->file, sizeof(JournalHeader) + offset, SEEK_SET) == 0
+        && fread(tail, sizeof(char), tailSize, self->file) == tailSize;
+
+    // Swapped in by rename, so a crash leaves either journal intact
+    char* tempFilename = ecalloc(strlen(self->scoreFilename) + strlen(JOURNAL_TEMP_FILE_EXTENSION) + 1, sizeof(char));
+    strcat(strcpy(tempFilename, self->scoreFilename), JOURNAL_TEMP_FILE_EXTENSION);
+
+    JournalHeader header = Journal_getScoreHeader(self);
+    FILE* file = isRead ? fopen(tempFilename, "w+b") : NULL;
+    bool isWritten = file
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(tail, sizeof(char), tailSize, file) == tailSize
+        && fflush(file) == 0
+        && fsync(fileno(file)) == 0
+        && rename(tempFilename, self->filename) == 0;
+
+    if (isWritten) {
+        fclose(self->file);
+        self->file = file;
+        self->size = tailSize;
+        Log_info("Journal compacted (%zu bytes of edits made while saving kept)", tailSize);
+    } else {
+        Log_warning("Failed to compact journal '%s'", self->filename);
+        if (file) {
+            fclose(file);
+            unlink(tempFilename);
+        }
+    }
+
+    sfree((void**)&tempFilename);
+    sfree((void**)&tail);
+    return isWritten;
+}
+
+
+static JournalHeader Journal_getScoreHeader(Journal* self) {
+    JournalHeader header = {0};
+    memcpy(header.magic, JOURNAL_FORMAT_MAGIC, sizeof(header.magic));
+    header.formatVersion = JOURNAL_FORMAT_VERSION;
+    header.score = getScoreStamp(self->scoreFilename);
+    return header;
+}
+
+
+static JournalScoreStamp getScoreStamp(const char* scoreFilename) {
+    JournalScoreStamp stamp = {0};
+    struct stat fileStat;
+    if (stat(scoreFilename, &fileStat) == 0) {
+        stamp.size = fileStat.st_size;
+        stamp.modifiedSeconds = fileStat.st_mtim.tv_sec;
+        stamp.modifiedNanoseconds = fileStat.st_mtim.tv_nsec;
+    }
+    return stamp;
+}
+
+
+static bool Journal_create(Journal* self) {
+    JournalHeader header = Journal_getScoreHeader(self);
+    self->file = fopen(self->filename, "w+b");
+    bool isWritten = self->file
+        && fwrite(&header, sizeof(header), 1, self->file) == 1
+        && fflush(self->file) == 0;
+    if (!isWritten) {
+        Log_warning("Journal '%s' could not be created", self->filename);
+        if (self->file) {
+            fclose(self->file);
+            self->file = NULL;
+        }
+        return false;
+    }
+    self->size = 0;
+    return true;
+}
+
+
+static void Journal_truncate(Journal* self, size_t size) {
+    long offset = sizeof(JournalHeader) + size;
+    if (ftruncate(fileno(self->file), offset) != 0) {
+        Log_warning("Journal '%s' could not be truncated", self->filename);
+        self->isBroken = true;
+    }
+    fseek(self->file, offset, SEEK_SET);
+    self->size = size;
+}
+
+
+static uint32_t getRecordChecksum(const JournalRecord* record, const char* name, const char* text) {
+    JournalRecord recordUnchecked = *record;
+    recordUnchecked.checksum = 0;
+    uint32_t checksum = hashCrc32(0, &recordUnchecked, sizeof(recordUnchecked));
+    checksum = hashCrc32(checksum, name, record->nameSize);
+    return hashCrc32(checksum, text, record->textSize);
+}
+
+
+static bool Journal_readString(Journal* self, uint32_t stringSize, char* string) {
+    if (stringSize == 0) {
+        return true;
+    }
+    return stringSize <= JOURNAL_STRING_SIZE_MAX
+        && fread(string, sizeof(char), stringSize, self->file) == stringSize
+        && string[stringSize - 1] == '\0';
+}
@@ -0,0 +1,65 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct Journal Journal;
+
+typedef enum {
+    JOURNAL_ENTRY_ADD_NOTE = 1,
+    JOURNAL_ENTRY_REMOVE_NOTES,
+    JOURNAL_ENTRY_ADD_BLOCK_INSTANCE,
+    JOURNAL_ENTRY_REMOVE_BLOCK_INSTANCE,
+    JOURNAL_ENTRY_CREATE_BLOCKDEF,
+    JOURNAL_ENTRY_SET_BLOCKDEF_COLOR,
+    JOURNAL_ENTRY_RENAME_BLOCKDEF,
+    JOURNAL_ENTRY_SET_TEMPO,
+    JOURNAL_ENTRY_SET_KEY_SIGNATURE,
+    JOURNAL_ENTRY_SET_TRACK_VELOCITY,
+    JOURNAL_ENTRY_SET_TRACK_IGNORE_NOTEOFF,
+    JOURNAL_ENTRY_SET_TRACK_PROGRAM,
+} JournalEntryType;
+
+// Fields not used by an entry type are left zero. The strings are not owned:
+// appended entries point at the caller's strings, read entries at a buffer
+// that stays valid until the next read.
+typedef struct {
+    JournalEntryType type;
+    int iTrack;
+    int iTimeSlot;
+    int pitch;
+    int tick;
+    int tickEnd;
+    int value;  // tempo, key signature index or ignore note off flag
+    float velocity;
+    const char* name;  // blockdef name
+    const char* text;  // new blockdef name, hex color or synth program
+} JournalEntry;
+
+Journal* Journal_new(const char* scoreFilename);
+void Journal_free(Journal** pself);
+bool Journal_readEntry(Journal* self, JournalEntry* outEntry);
+bool Journal_append(Journal* self, const JournalEntry* entry);
+bool Journal_sync(Journal* self);
+void Journal_discardFromLastEntry(Journal* self);
+size_t Journal_getSize(Journal* self);
+bool Journal_checkpoint(Journal* self, const char* newScoreFilename, size_t offset);
+bool Journal_compact(Journal* self, size_t offset);
@@ -20,7 +20,12 @@
 
 #include "common/constants/fluidmidi.h"
 #include "common/constants/keysignatures.h"
+#include "common/score/binaryformat.h"
+#include "common/score/blockdef.h"
 #include "common/score/fileformatschema.h"
+#include "common/score/history.h"
+#include "common/score/journal.h"
+#include "common/score/timeline.h"
 #include "common/score/xmlconstants.h"
 #include "common/structs/blockinstance.h"
 #include "common/structs/color.h"
@@ -28,25 +33,35 @@
 #include "common/structs/note.h"
 #include "common/structs/queryrequest.h"
 #include "common/structs/queryresult.h"
+#include "common/structs/sequencechange.h"
 #include "common/structs/sequencerrequest.h"
 #include "common/structs/synthprogramchange.h"
 #include "common/util/alloc.h"
 #include "common/util/colors.h"
-#include "common/util/hashset.h"
 #include "common/util/log.h"
+#include "common/util/math.h"
+#include "common/util/midimessages.h"
 #include "common/util/stringmap.h"
-#include "common/util/stringset.h"
 #include "common/util/version.h"
 #include "config/config.h"
 #include "events/events.h"
+#include "export/midifile.h"
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
+#include <libxml/xmlwriter.h>
 #include <libxml/xmlschemas.h>
 
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 static const char* const REQUEST_KEY_CHANGE_KEY_SIGNATURE = "REQUEST_KEY_CHANGE_KEY_SIGNATURE";
@@ -55,73 +70,205 @@ static const char* const REQUEST_KEY_CHANGE_BLOCK_COLOR = "REQUEST_KEY_CHANGE_BL
 static const char* const REQUEST_KEY_CHANGE_TRACK_VELOCITY = "REQUEST_KEY_CHANGE_TRACK_VELOCITY";
 static const char* const REQUEST_KEY_RENAME_BLOCK = "REQUEST_KEY_RENAME_BLOCK";
 static const char* const REQUEST_KEY_SET_TEMPO_BPM = "REQUEST_KEY_SET_TEMPO_BPM";
+static const char* const TEMP_FILE_EXTENSION = ".tmp";
 
 enum {
     XML_BUFFER_SIZE = 1024,
     HEX_COLOR_BUFFER_SIZE = 7,
     SECONDS_PER_MINUTE = 60,
+    BLOCK_NAME_LENGTH_MAX = 255,
+    BLOCK_LIST_STRING_SIZE_INITIAL = 1024,
+    XML_LOAD_MESSAGES_SIZE_INITIAL = 256,
 };
 
+static const char* const XML_INDENT_STRING = "  ";
 static const float BLOCK_NEW_COLOR_VARIATION = 0.2f;
 
+typedef struct {
+    BlockDef* blockDef;  // NULL for empty time slots
+    float velocity;
+} BlockSlot;
+
+typedef struct {
+    int type;
+    int pitch;
+    int tick;
+    float velocity;
+} BlockMessage;
+
+typedef struct {
+    char* program;
+    float velocity;
+    bool ignoreNoteOff;
+    int nTimeSlotsUsed;  // one past the last time slot that has held a block
+} Track;
+
+typedef struct {
+    int nTicksPerBeatFile;  // 0 for files that predate integer ticks
+    size_t nMessagesMigrated;
+    size_t nMessagesInvalid;
+    BlockDef* blockDef;  // block definition whose messages are being read
+    BlockMessage* blockMessages;
+    size_t nBlockMessages;
+    size_t blockMessagesSize;
+    int iTimeSlot;
+} XmlLoadState;
+
+typedef struct {
+    BinaryHeader header;
+    BinaryBlockDef* blockDefs;
+    BinaryNote* notes;
+    BinaryTrack* tracks;
+    BinaryBlock* blocks;
+    char* strings;
+    size_t stringsSize;
+} ScoreSnapshot;
+
+typedef struct {
+    ScoreSnapshot* snapshot;
+    char* filename;
+    char* tempFilename;  // written by the save thread, moved over filename once done
+    pthread_t thread;
+    pthread_mutex_t mutex;  // guards isDone and isWritten
+    size_t journalSize;  // journal entries up to here are in the snapshot
+    bool isDone;
+    bool isWritten;
+} SaveJob;
+
 struct Score {
     char* filename;
-    xmlDocPtr xmlDoc;
-    xmlNodePtr nodeScore;
-    xmlNodePtr nodeBlockDefs;
-    xmlNodePtr nodeTracks;
-    xmlNodePtr nodeBlockDefCurrent;
-    xmlNodePtr nodeBlockDefPrev;
+    char* version;
+    int tempoBpm;
+    int nBeatsPerMeasure;
+    int iKeySignature;
+    xmlNodePtr nodeMetadata;
+    int nBlockDefs;
+    BlockDef** blockDefs;
+    StringMap* blockDefsByName;
+    int nTracks;
+    Track* tracks;
+    BlockSlot* blockSlots;  // one row of SCORE_LENGTH_MAX time slots per track
+    Timeline* timeline;  // flattened playback messages, kept in sync with blockSlots
+    BlockDef* blockDefCurrent;
+    BlockDef* blockDefPrev;
     xmlSchemaParserCtxtPtr parserContext;
     xmlSchemaPtr schema;
     xmlSchemaValidCtxtPtr validationContext;
     char* blockListString;
+    size_t blockListStringLength;
+    size_t blockListStringSize;
     int iLastQueriedTrack;
+    SaveJob* saveJob;  // NULL unless a background save is running or unreported
+    Journal* journal;  // edits since the score file was last written, NULL while replaying
+    History* history;
+    bool isPlayingScore;  // edits to what is playing are sent on to the sequencer
+    BlockDef* blockDefPlaying;  // NULL unless a block plays on its own
+    int iPlayingChannel;
+    bool isPlayingIgnoreNoteOff;
 };
 
 
 static void Score_onQueryResult(Score* self, void* sender, QueryResult* queryResult);
 static void Score_onSynthInstrumentChanged(Score* self, void* sender, SynthProgramChange* synthProgramChange);
+static void Score_onProcessFrame(Score* self, void* sender, float* deltaTime);
+static void Score_onSequencerStopped(Score* self, void* sender, void* unused);
 static bool Score_fileExists(Score* self);
 static void Score_createNew(Score* self);
 static void Score_loadFromFile(Score* self);
-static bool Score_isXmlDocValid(Score* self);
-static xmlNodePtr Score_createNewBlockDef(Score* self, const char* blockName);
-static xmlNodePtr Score_createNewTrack(Score* self);
-static void Score_requestBlockDefNotes(Score* self, xmlNodePtr nodeBlockDef);
+static void Score_loadXmlElementStart(Score* self, xmlTextReaderPtr reader, XmlLoadState* state, const char* nodeName);
+static void Score_loadXmlElementEnd(Score* self, XmlLoadState* state, const char* nodeName);
+static void Score_loadXmlMessage(Score* self, xmlTextReaderPtr reader, XmlLoadState* state);
+static void Score_loadFromBinaryFile(Score* self);
+static ScoreSnapshot* Score_createSnapshot(Score* self);
+static void Score_startSaveJob(Score* self, const char* filename);
+static void Score_finishSaveJob(Score* self);
+static int Score_countTimeSlotsToSave(Score* self, int iTrack);
+static int Score_countTracksToSave(Score* self);
+static bool* Score_findBlockDefsToSave(Score* self);
+static void Score_replayJournal(Score* self, Journal* journal);
+static bool Score_isJournalEntryValid(const JournalEntry* entry);
+static void Score_applyJournalEntry(Score* self, const JournalEntry* entry);
+static void Score_appendJournalEntry(Score* self, const JournalEntry* entry);
+static void Score_syncJournal(Score* self);
+static void Score_closeJournal(Score* self);
+static void Score_recordEdit(Score* self, const JournalEntry* redoEntry, const JournalEntry* undoEntry);
+static void Score_applyHistoryEntries(Score* self, const JournalEntry* entries, size_t nEntries);
+static void Score_addNoteToBlockDef(Score* self, BlockDef* blockDef, int pitch, int tick, int duration, float velocity);
+static Note* Score_removeNotesFromBlockDef(Score* self, BlockDef* blockDef, int pitch, int tickStart, int tickEnd, size_t* outAmount);
+static Note* Score_takeNotesFromBlockDef(Score* self, BlockDef* blockDef, int pitch, int tickStart, int tickEnd, size_t* outAmount);
+static void Score_placeBlockInstance(Score* self, int iTrack, int iTimeSlot, BlockDef* blockDef, float velocity);
+static bool Score_clearBlockInstance(Score* self, int iTrack, int iTimeSlot);
+static bool Score_emptyBlockSlot(Score* self, int iTrack, int iTimeSlot);
+static void Score_setKeySignature(Score* self, int iKeySignature);
+static void Score_setBlockDefColor(Score* self, BlockDef* blockDef, const char* hexColor);
+static void Score_setTrackVelocity(Score* self, int iTrack, float velocity);
+static void Score_setTrackIgnoreNoteOff(Score* self, int iTrack, bool ignoreNoteOff);
+static void Score_setTrackProgram(Score* self, int iTrack, const char* program);
+static BlockDef* Score_createNewBlockDef(Score* self, const char* blockName);
+static BlockDef* Score_getOrCreateBlockDef(Score* self, const char* blockName);
+static Track* Score_createNewTrack(Score* self);
+static BlockSlot* Score_getBlockSlot(Score* self, int iTrack, int iTimeSlot);
+static void Score_requestBlockDefNotes(Score* self, BlockDef* blockDef);
+static void Score_addBlockDef(Score* self, BlockDef* blockDef);
+static void Score_renameBlockDef(Score* self, BlockDef* blockDef, const char* blockNameNew);
 static bool Score_blockDefExists(Score* self, const char* blockName);
-static xmlNodePtr Score_getNodeBlockDefByName(Score* self, const char* blockName);
-static void Score_updateBlockListString(Score* self);
-static void Score_setActiveBlockdef(Score* self, xmlNodePtr nodeBlockDef);
-static float Score_getBlockDurationSeconds(Score* self);
-static MidiMessage* Score_getMidiMessagesFromBlockdef(Score* self, xmlNodePtr nodeBlockDef, float startTimeFraction, bool ignoreNoteOff, int iChannel, size_t* outAmount);
-static xmlNodePtr findXmlNodeByName(xmlNodePtr node, const char* const nodeName);
-static Note createNoteFromXmlNodes(xmlNodePtr nodeMessageOn, xmlNodePtr nodeMessageOff);
-static int getXmlNodeChildCount(xmlNodePtr node);
-static xmlNodePtr getXmlChildNodeByIndex(xmlNodePtr node, int index);
-static bool hasXmlNodeProperty(xmlNodePtr node, const char* propertyKey);
-static const char* getXmlNodePropertyString(xmlNodePtr node, const char* propertyKey);
-static int getXmlNodePropertyInt(xmlNodePtr node, const char* propertyKey);
-static float getXmlNodePropertyFloat(xmlNodePtr node, const char* propertyKey);
-static void setXmlNodePropertyString(xmlNodePtr node, const char* propertyKey, const char* propertyValue);
-static void setXmlNodePropertyInt(xmlNodePtr node, const char* propertyKey, int propertyValue);
-static void setXmlNodePropertyFloat(xmlNodePtr node, const char* propertyKey, float propertyValue);
-static void unsetXmlNodeProperty(xmlNodePtr node, const char* propertyKey);
-static xmlNodePtr addMidiMessageToBlockDef(xmlNodePtr nodeBlockDef, int messageType, int pitch, float time, float velocity);
-static xmlDocPtr pruneScore(xmlDocPtr xmlDoc);
+static BlockDef* Score_getBlockDefByName(Score* self, const char* blockName);
+static void Score_spliceBlockListString(Score* self, size_t offset, size_t nCharsRemoved, const char* charsInserted);
+static void Score_setActiveBlockdef(Score* self, BlockDef* blockDef);
+static void Score_updateTimelineTimeSlot(Score* self, int iTrack, int iTimeSlot);
+static MidiMessage* Score_getTimeSlotMidiMessages(Score* self, int iTrack, int iTimeSlot, bool ignoreNoteOff, size_t* outAmount);
+static void Score_rebuildTimelineTrack(Score* self, int iTrack);
+static void Score_invalidateTimelineTracksWithBlockDef(Score* self, BlockDef* blockDef);
+static float Score_getSecondsPerTick(Score* self);
+static MidiMessage* Score_getPreviewMidiMessages(Score* self, int iChannel, int startTick, bool ignoreNoteOff, size_t* outAmount);
+static MidiMessage* Score_getMidiMessagesFromBlockdef(Score* self, BlockDef* blockDef, int startTick, bool ignoreNoteOff, int iChannel, size_t* outAmount);
+static MidiMessage* Score_getPlayingTimeSlotMidiMessages(Score* self, int iTrack, int iTimeSlot, size_t* outAmount);
+static MidiMessage* Score_getPlayingNoteMidiMessages(Score* self, BlockDef* blockDef, const Note* notes, size_t nNotes, size_t* outAmount);
+static void Score_changePlayingNotes(Score* self, BlockDef* blockDef, const Note* notesRemoved, size_t nNotesRemoved, const Note* notesAdded, size_t nNotesAdded);
+static void Score_changeSequence(Score* self, MidiMessage* midiMessagesRemoved, size_t nMidiMessagesRemoved, MidiMessage* midiMessagesAdded, size_t nMidiMessagesAdded);
+static bool hasXmlReaderAttribute(xmlTextReaderPtr reader, const char* attributeKey);
+static const char* getXmlReaderAttributeString(xmlTextReaderPtr reader, const char* attributeKey);
+static int getXmlReaderAttributeInt(xmlTextReaderPtr reader, const char* attributeKey);
+static float getXmlReaderAttributeFloat(xmlTextReaderPtr reader, const char* attributeKey);
+static void writeXmlAttributeString(xmlTextWriterPtr writer, const char* attributeKey, const char* attributeValue);
+static void writeXmlAttributeInt(xmlTextWriterPtr writer, const char* attributeKey, int attributeValue);
+static void writeXmlAttributeFloat(xmlTextWriterPtr writer, const char* attributeKey, float attributeValue);
+static void writeXmlMidiMessage(xmlTextWriterPtr writer, int messageType, int pitch, int tick, float velocity);
+static void writeXmlNode(xmlTextWriterPtr writer, xmlNodePtr node);
+static BlockMessage* getBlockMessagesFromBinaryNotes(const BinaryNote* notes, size_t nNotes, size_t* outAmount);
+static void addBlockMessagesToBlockDef(BlockDef* blockDef, const BlockMessage* blockMessages, size_t nBlockMessages);
+static bool writeSnapshotXmlFile(const ScoreSnapshot* snapshot, const char* filename);
+static void writeSnapshotXmlDocument(const ScoreSnapshot* snapshot, xmlTextWriterPtr writer);
+static bool writeSnapshotBinaryFile(const ScoreSnapshot* snapshot, const char* filename);
+static bool writeSnapshotFile(const ScoreSnapshot* snapshot, const char* filename, const char* tempFilename);
+static bool moveTempFile(const char* tempFilename, const char* filename);
+static char* getTempFilename(const char* filename);
+static void freeSnapshot(ScoreSnapshot** psnapshot);
+static void* runSaveJob(void* data);
 static int getKeySignatureIndex(const char* keySignatureName);
-static void sortMidiMessages(MidiMessage* midiMessages, size_t nMidiMessages);
-static int compareMidiMessages(const void* midiMessage, const void* midiMessageOther);
-static int compareMidiMessageNodes(xmlNodePtr midiMessageNode, xmlNodePtr midiMessageNodeOther);
-
-
-Score* Score_new(const char* const filename) {
+static bool isBinaryFilename(const char* filename);
+static const void* getBinaryTable(const char* data, size_t dataSize, uint32_t offset, uint32_t nEntries, size_t entrySize);
+static const char* getBinaryString(const char* strings, uint32_t stringsSize, uint32_t offset);
+static uint32_t addBinaryString(char** strings, size_t* stringsSize, const char* string);
+static TimelineNote* getNotesFromMidiMessages(const MidiMessage* midiMessages, size_t nMidiMessages, size_t* outAmount);
+static MidiMessage* getChaseMidiMessages(const TimelineNote* heldNotes, size_t nHeldNotes, int tick, int iChannel, bool ignoreNoteOff, size_t* outAmount);
+static size_t addNoteMidiMessages(MidiMessage* midiMessages, const Note* notes, size_t nNotes, int iChannel, int tickOffset, float velocityScale, bool ignoreNoteOff);
+static int getMidiVelocity(float velocity);
+static int compareBlockMessages(const void* blockMessage, const void* blockMessageOther);
+
+
+// Scores opened without a journal leave the files next to them untouched,
+// and their edits are lost unless saved
+Score* Score_new(const char* const filename, bool isJournaled) {
     Score* self = ecalloc(1, sizeof(*self));
     self->filename = estrdup(filename);
 
     // Pretty print XML
     xmlKeepBlanksDefault(0);
 
+    // Scores are also written from the save thread
+    xmlInitParser();
+
     self->parserContext = xmlSchemaNewMemParserCtxt(FILE_FORMAT_SCHEMA, strlen(FILE_FORMAT_SCHEMA));
     Log_assert(self->parserContext, "Could not create XSD-schema parsing context");
     self->schema = xmlSchemaParse(self->parserContext);
@@ -129,17 +276,40 @@ Score* Score_new(const char* const filename) {
     self->validationContext = xmlSchemaNewValidCtxt(self->schema);
     Log_assert(self->validationContext, "Could not create XSD-schema validation context");
 
-    if (Score_fileExists(self)) {
+    self->blockDefsByName = StringMap_new(BLOCK_NAME_LENGTH_MAX);
+    self->blockListStringSize = BLOCK_LIST_STRING_SIZE_INITIAL;
+    self->blockListString = ecalloc(self->blockListStringSize, sizeof(char));
+    self->timeline = Timeline_new();
+
+    if (Score_fileExists(self) && isBinaryFilename(self->filename)) {
+        Score_loadFromBinaryFile(self);
+    } else if (Score_fileExists(self)) {
         Score_loadFromFile(self);
     } else {
         Score_createNew(self);
     }
 
-    self->nodeBlockDefCurrent = findXmlNodeByName(self->nodeBlockDefs, XMLNODE_BLOCKDEF);
-    Score_updateBlockListString(self);
+    if (!self->nBlockDefs) {
+        Score_createNewBlockDef(self, BLOCK_NAME_DEFAULT);
+    }
+
+    self->blockDefCurrent = self->blockDefs[0];
+
+    if (isJournaled) {
+        Journal* journal = Journal_new(self->filename);
+        if (journal) {
+            Score_replayJournal(self, journal);
+            self->journal = journal;
+        } else {
+            Log_warning("Continuing without a journal, unsaved edits are lost on a crash");
+        }
+    }
+    self->history = History_new(UNDO_HISTORY_SIZE_MAX);
 
     Event_subscribe(EVENT_QUERY_RESULT, self, EVENT_CALLBACK(Score_onQueryResult), sizeof(QueryResult));
     Event_subscribe(EVENT_SYNTH_INSTRUMENT_CHANGED, self, EVENT_CALLBACK(Score_onSynthInstrumentChanged), sizeof(SynthProgramChange));
+    Event_subscribe(EVENT_PROCESS_FRAME, self, EVENT_CALLBACK(Score_onProcessFrame), sizeof(float));
+    Event_subscribe(EVENT_SEQUENCER_STOPPED, self, EVENT_CALLBACK(Score_onSequencerStopped), 0);
 
     return self;
 }
@@ -148,8 +318,16 @@ Score* Score_new(const char* const filename) {
 void Score_free(Score** pself) {
     Score* self = *pself;
 
+    Score_finishSaveJob(self);
+    if (self->journal) {
+        Journal_free(&self->journal);
+    }
+    History_free(&self->history);
+
     Event_unsubscribe(EVENT_QUERY_RESULT, self, EVENT_CALLBACK(Score_onQueryResult), sizeof(QueryResult));
     Event_unsubscribe(EVENT_SYNTH_INSTRUMENT_CHANGED, self, EVENT_CALLBACK(Score_onSynthInstrumentChanged), sizeof(SynthProgramChange));
+    Event_unsubscribe(EVENT_PROCESS_FRAME, self, EVENT_CALLBACK(Score_onProcessFrame), sizeof(float));
+    Event_unsubscribe(EVENT_SEQUENCER_STOPPED, self, EVENT_CALLBACK(Score_onSequencerStopped), 0);
 
     if (self->parserContext) {
         xmlSchemaFreeParserCtxt(self->parserContext);
@@ -163,316 +341,429 @@ void Score_free(Score** pself) {
         xmlSchemaFreeValidCtxt(self->validationContext);
         self->validationContext = NULL;
     }
-    if (self->xmlDoc) {
-        xmlFreeDoc(self->xmlDoc);
-        self->xmlDoc = NULL;
+    if (self->nodeMetadata) {
+        xmlFreeNode(self->nodeMetadata);
+        self->nodeMetadata = NULL;
+    }
+
+    for (int iTrack = 0; iTrack < self->nTracks; iTrack++) {
+        sfree((void**)&self->tracks[iTrack].program);
+    }
+    if (self->tracks) {
+        sfree((void**)&self->tracks);
+        sfree((void**)&self->blockSlots);
+    }
+    Timeline_free(&self->timeline);
+
+    for (int iBlockDef = 0; iBlockDef < self->nBlockDefs; iBlockDef++) {
+        BlockDef_free(&self->blockDefs[iBlockDef]);
     }
+    sfree((void**)&self->blockDefs);
+    StringMap_free(&self->blockDefsByName);
 
     sfree((void**)&self->filename);
+    sfree((void**)&self->version);
     sfree((void**)&self->blockListString);
     sfree((void**)pself);
 }
 
 
-void Score_addNote(Score* self, int pitch, float time, float duration, float velocity) {
-    Score_removeNotes(self, pitch, time, time + duration);
+void Score_addNote(Score* self, int pitch, int tick, int duration, float velocity) {
+    const char* blockName = BlockDef_getName(self->blockDefCurrent);
+    JournalEntry entry = {
+        .type = JOURNAL_ENTRY_ADD_NOTE,
+        .name = blockName,
+        .pitch = pitch,
+        .tick = tick,
+        .tickEnd = tick + duration,
+        .velocity = velocity,
+    };
+
+    // The overlapped notes are removed first, so that undo brings them back
+    Score_beginEditGroup(self);
+    Score_removeNotes(self, pitch, tick, tick + duration);
+    Score_addNoteToBlockDef(self, self->blockDefCurrent, pitch, tick, duration, velocity);
+    Score_appendJournalEntry(self, &entry);
+    Score_recordEdit(self, &entry, &(JournalEntry){
+        .type = JOURNAL_ENTRY_REMOVE_NOTES,
+        .name = blockName,
+        .pitch = pitch,
+        .tick = tick,
+        .tickEnd = tick + duration,
+    });
+    Score_endEditGroup(self);
+}
+
 
-    xmlNodePtr nodeMessageOn = addMidiMessageToBlockDef(self->nodeBlockDefCurrent, MIDI_MESSAGE_TYPE_NOTEON, pitch, time, velocity);
-    xmlNodePtr nodeMessageOff = addMidiMessageToBlockDef(self->nodeBlockDefCurrent, MIDI_MESSAGE_TYPE_NOTEOFF, pitch, time + duration, 0.0);
+void Score_removeNotes(Score* self, int pitch, int tickStart, int tickEnd) {
+    const char* blockName = BlockDef_getName(self->blockDefCurrent);
+    size_t nNotesRemoved = 0;
+    Note* notesRemoved = Score_removeNotesFromBlockDef(self, self->blockDefCurrent, pitch, tickStart, tickEnd, &nNotesRemoved);
+
+    if (nNotesRemoved > 0) {
+        JournalEntry entry = {
+            .type = JOURNAL_ENTRY_REMOVE_NOTES,
+            .name = blockName,
+            .pitch = pitch,
+            .tick = tickStart,
+            .tickEnd = tickEnd,
+        };
+        Score_beginEditGroup(self);
+        Score_appendJournalEntry(self, &entry);
+        Score_recordEdit(self, &entry, NULL);
+        for (size_t iNote = 0; iNote < nNotesRemoved; iNote++) {
+            Note note = notesRemoved[iNote];
+            Score_recordEdit(self, NULL, &(JournalEntry){
+                .type = JOURNAL_ENTRY_ADD_NOTE,
+                .name = blockName,
+                .pitch = note.pitch,
+                .tick = note.tick,
+                .tickEnd = note.tick + note.duration,
+                .velocity = note.velocity,
+            });
+        }
+        Score_endEditGroup(self);
+    }
 
-    Note note = createNoteFromXmlNodes(nodeMessageOn, nodeMessageOff);
-    Event_post(self, EVENT_NOTE_ADDED, &note, sizeof(note));
+    sfree((void**)&notesRemoved);
 }
 
 
-void Score_removeNotes(Score* self, int pitch, float timeStart, float timeEnd) {
-    size_t childCount = 0;
-    for (xmlNodePtr nodeMessage = self->nodeBlockDefCurrent->children; nodeMessage; nodeMessage = nodeMessage->next) {
-        childCount++;
+void Score_undo(Score* self) {
+    size_t nEntries = 0;
+    const JournalEntry* entries = History_undo(self->history, &nEntries);
+    if (!entries) {
+        Log_info("Nothing to undo");
+        return;
     }
-    xmlNodePtr* nodesOnToRemove = ecalloc(childCount, sizeof(xmlNodePtr));
-    xmlNodePtr* nodesOffToRemove = ecalloc(childCount, sizeof(xmlNodePtr));
+    Score_applyHistoryEntries(self, entries, nEntries);
+}
 
-    size_t nNotesToRemove = 0;
 
-    for (xmlNodePtr nodeMessage = self->nodeBlockDefCurrent->children; nodeMessage; nodeMessage = nodeMessage->next) {
-        if (nodeMessage->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_MESSAGE, (char*)nodeMessage->name)) {
-            int midiMessageType = getXmlNodePropertyInt(nodeMessage, XMLATTRIB_TYPE);
-            if (midiMessageType != MIDI_MESSAGE_TYPE_NOTEON) {
-                continue;
-            }
-            int midiMessagePitch = getXmlNodePropertyInt(nodeMessage, XMLATTRIB_PITCH);
-            if (midiMessagePitch != pitch) {
-                continue;
-            }
-            float midiMessageTime = getXmlNodePropertyFloat(nodeMessage, XMLATTRIB_TIME);
-            if (midiMessageTime >= timeEnd) {
-                continue;
-            }
-            for (xmlNodePtr nodeMessageOther = nodeMessage; nodeMessageOther; nodeMessageOther = nodeMessageOther->next) {
-                if (nodeMessageOther->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_MESSAGE, (char*)nodeMessageOther->name)) {
-                    int midiMessageTypeOther = getXmlNodePropertyInt(nodeMessageOther, XMLATTRIB_TYPE);
-                    if (midiMessageTypeOther != MIDI_MESSAGE_TYPE_NOTEOFF) {
-                        continue;
-                    }
-                    int midiMessagePitchOther = getXmlNodePropertyInt(nodeMessageOther, XMLATTRIB_PITCH);
-                    if (midiMessagePitchOther != pitch) {
-                        continue;
-                    }
-                    float midiMessageTimeOther = getXmlNodePropertyFloat(nodeMessageOther, XMLATTRIB_TIME);
-                    if (midiMessageTimeOther <= timeStart) {
-                        break;
-                    }
-
-                    nodesOnToRemove[nNotesToRemove] = nodeMessage;
-                    nodesOffToRemove[nNotesToRemove] = nodeMessageOther;
-                    nNotesToRemove++;
-
-                    break;
-                }
-            }
-        }
+void Score_redo(Score* self) {
+    size_t nEntries = 0;
+    const JournalEntry* entries = History_redo(self->history, &nEntries);
+    if (!entries) {
+        Log_info("Nothing to redo");
+        return;
     }
+    Score_applyHistoryEntries(self, entries, nEntries);
+}
 
-    for (size_t i = 0; i < nNotesToRemove; i++) {
-        xmlNodePtr nodeMessageOn = nodesOnToRemove[i];
-        xmlNodePtr nodeMessageOff = nodesOffToRemove[i];
 
-        Note note = createNoteFromXmlNodes(nodeMessageOn, nodeMessageOff);
-        Event_post(self, EVENT_NOTE_REMOVED, &note, sizeof(note));
+// Edits made until the matching Score_endEditGroup() are undone as one
+void Score_beginEditGroup(Score* self) {
+    History_beginGroup(self->history);
+}
 
-        xmlUnlinkNode(nodeMessageOn);
-        xmlUnlinkNode(nodeMessageOff);
-        xmlFreeNode(nodeMessageOn);
-        xmlFreeNode(nodeMessageOff);
-    }
 
-    sfree((void**)&nodesOnToRemove);
-    sfree((void**)&nodesOffToRemove);
+void Score_endEditGroup(Score* self) {
+    History_endGroup(self->history);
+    Score_syncJournal(self);
 }
 
 
+// Writes a snapshot of the score from a background thread, EVENT_SCORE_SAVED follows once it is done
 void Score_saveToFile(Score* self) {
-    Log_info("Saving score as '%s'...", self->filename);
+    Score_startSaveJob(self, self->filename);
+}
 
-    Log_assert(Score_isXmlDocValid(self), "XML document is invalid prior to saving?");
 
-    xmlDocPtr xmlDocPruned = pruneScore(self->xmlDoc);
+// The format follows the file extension, which also makes this the XML <-> binary converter
+bool Score_writeToFile(Score* self, const char* filename) {
+    Log_info("Saving score as '%s'...", filename);
 
-    int bytesWritten = xmlSaveFormatFileEnc(self->filename, xmlDocPruned, XML_ENCODING, 1);
-    if (bytesWritten >= 0) {
-        Log_info("Score saved (%d bytes).", bytesWritten);
-    } else {
-        Log_error("Failed to write score to '%s'", self->filename);
+    ScoreSnapshot* snapshot = Score_createSnapshot(self);
+    char* tempFilename = getTempFilename(filename);
+    bool isWritten = writeSnapshotFile(snapshot, filename, tempFilename)
+        && moveTempFile(tempFilename, filename);
+    sfree((void**)&tempFilename);
+    freeSnapshot(&snapshot);
+    return isWritten;
+}
+
+
+// Standard midi file with a tempo track followed by one track per score track.
+// The time slot runs of each track are merged while writing, so nothing
+// score-sized is allocated on top of the timeline. Tracks with notes get a
+// midi channel each, in order. Tracks that ignore note offs get them back,
+// since other programs would hold their notes forever.
+bool Score_exportMidi(Score* self, const char* filename) {
+    Log_info("Exporting score as '%s'...", filename);
+
+    int nTracks = Score_countTracksToSave(self);
+    int* trackChannels = ecalloc(nTracks > 0 ? nTracks : 1, sizeof(int));
+    int nChannelsUsed = 0;
+    for (int iTrack = 0; iTrack < nTracks; iTrack++) {
+        if (!Timeline_isTrackValid(self->timeline, iTrack)) {
+            Score_rebuildTimelineTrack(self, iTrack);
+        }
+        size_t nTrackMidiMessages = 0;
+        Timeline_getMidiMessages(self->timeline, iTrack, 0, &nTrackMidiMessages);
+        trackChannels[iTrack] = nChannelsUsed % MIDI_FILE_CHANNEL_COUNT;
+        if (nTrackMidiMessages > 0) {
+            nChannelsUsed++;
+        }
+    }
+    if (nChannelsUsed > MIDI_FILE_CHANNEL_COUNT) {
+        Log_warning("%d tracks have notes but a midi file has %d channels, tracks past the %dth share channels with earlier ones",
+            nChannelsUsed, MIDI_FILE_CHANNEL_COUNT, MIDI_FILE_CHANNEL_COUNT);
     }
 
-    xmlFreeDoc(xmlDocPruned);
-}
+    MidiFile* midiFile = MidiFile_new(filename, nTracks + 1, TICKS_PER_BEAT);
 
+    MidiFile_beginTrack(midiFile);
+    MidiFile_writeTimeSignature(midiFile, self->nBeatsPerMeasure);
+    MidiFile_writeTempo(midiFile, self->tempoBpm);
+    MidiFile_endTrack(midiFile);
 
-void Score_playCurrentBlockDef(Score* self, int iChannel, float startTimeFraction, bool ignoreNoteOff) {
-    size_t nMidiMessages = 0;
-    MidiMessage* midiMessages = Score_getMidiMessagesFromBlockdef(self, self->nodeBlockDefCurrent, startTimeFraction, ignoreNoteOff, iChannel, &nMidiMessages);
+    const MidiMessage** runs = ecalloc(SCORE_LENGTH_MAX, sizeof(MidiMessage*));
+    size_t* nRunMidiMessages = ecalloc(SCORE_LENGTH_MAX, sizeof(size_t));
 
-    for (size_t i = 0; i < nMidiMessages; i++) {
-        midiMessages[i].velocity *= BLOCK_VELOCITY_DEFAULT * TRACK_VELOCITY_DEFAULT;
+    for (int iTrack = 0; iTrack < nTracks; iTrack++) {
+        Track* track = &self->tracks[iTrack];
+
+        // Runs only overlap where notes reach past the end of their block
+        for (int iTimeSlot = 0; iTimeSlot < track->nTimeSlotsUsed; iTimeSlot++) {
+            if (!track->ignoreNoteOff) {
+                runs[iTimeSlot] = Timeline_getTimeSlotMidiMessages(self->timeline, iTrack, iTimeSlot, &nRunMidiMessages[iTimeSlot]);
+            } else if (Score_getBlockSlot(self, iTrack, iTimeSlot)->blockDef) {
+                runs[iTimeSlot] = Score_getTimeSlotMidiMessages(self, iTrack, iTimeSlot, false, &nRunMidiMessages[iTimeSlot]);
+            } else {
+                runs[iTimeSlot] = NULL;
+                nRunMidiMessages[iTimeSlot] = 0;
+            }
+        }
+
+        MidiFile_beginTrack(midiFile);
+        MidiFile_writeTrackName(midiFile, track->program);
+
+        MidiMessageMerge* merge = MidiMessageMerge_new(runs, nRunMidiMessages, track->nTimeSlotsUsed);
+        for (const MidiMessage* midiMessage = MidiMessageMerge_next(merge); midiMessage; midiMessage = MidiMessageMerge_next(merge)) {
+            MidiFile_writeMessage(midiFile, midiMessage, trackChannels[iTrack]);
+        }
+        MidiMessageMerge_free(&merge);
+
+        MidiFile_endTrack(midiFile);
+
+        if (track->ignoreNoteOff) {
+            for (int iTimeSlot = 0; iTimeSlot < track->nTimeSlotsUsed; iTimeSlot++) {
+                if (runs[iTimeSlot]) {
+                    sfree((void**)&runs[iTimeSlot]);
+                }
+            }
+        }
     }
 
-    sortMidiMessages(midiMessages, nMidiMessages);
+    sfree((void**)&nRunMidiMessages);
+    sfree((void**)&runs);
+    sfree((void**)&trackChannels);
+
+    bool isWritten = MidiFile_close(&midiFile);
+    if (isWritten) {
+        Log_info("Exported %d track(s) to '%s'", nTracks, filename);
+    } else {
+        Log_warning("Failed to export score as '%s'", filename);
+    }
+    return isWritten;
+}
+
 
-    float blockDurationSeconds = Score_getBlockDurationSeconds(self);
-    float startTimeSeconds = startTimeFraction * blockDurationSeconds;
+// Loops repeat the whole block, also when the first pass starts at startTick
+void Score_playCurrentBlockDef(Score* self, int iChannel, int startTick, bool ignoreNoteOff, bool isLooping) {
+    size_t nMidiMessages = 0;
+    MidiMessage* midiMessages = Score_getPreviewMidiMessages(self, iChannel, startTick, ignoreNoteOff, &nMidiMessages);
+
+    size_t nLoopMidiMessages = 0;
+    MidiMessage* loopMidiMessages = NULL;
+    if (isLooping && startTick > 0) {
+        loopMidiMessages = Score_getPreviewMidiMessages(self, iChannel, 0, ignoreNoteOff, &nLoopMidiMessages);
+    } else if (isLooping) {
+        nLoopMidiMessages = nMidiMessages;
+    }
 
     SequencerRequest sequencerRequest = {
-        .timestampStart = startTimeSeconds,
-        .timestampEnd = blockDurationSeconds,
+        .tickStart = startTick,
+        .tickEnd = Score_getBlockDurationTicks(self),
+        .secondsPerTick = Score_getSecondsPerTick(self),
         .nMidiMessages = nMidiMessages,
         .midiMessages = midiMessages,
+        .isLooping = isLooping,
+        .tickLoopStart = 0,
+        .nLoopMidiMessages = nLoopMidiMessages,
+        .loopMidiMessages = loopMidiMessages ? loopMidiMessages : midiMessages,
     };
 
+    self->isPlayingScore = false;
+    self->blockDefPlaying = self->blockDefCurrent;
+    self->iPlayingChannel = iChannel;
+    self->isPlayingIgnoreNoteOff = ignoreNoteOff;
     Event_post(self, EVENT_REQUEST_SEQUENCER_START, &sequencerRequest, sizeof(sequencerRequest));
 
+    if (loopMidiMessages) {
+        sfree((void**)&loopMidiMessages);
+    }
     sfree((void**)&midiMessages);
 }
 
 
-void Score_playEntireScore(Score* self, int iTimeSlotStart) {
-    float blockDurationSeconds = Score_getBlockDurationSeconds(self);
-    float startTimeSeconds = blockDurationSeconds * iTimeSlotStart;
-    float endTimeSeconds = blockDurationSeconds * SCORE_LENGTH_MAX;
-
-    StringMap* midiMessagesPerBlock = StringMap_new(64);
-    StringMap* nMidiMessagesPerBlock = StringMap_new(64);
+// Loops repeat the time slots that have blocks, also when the first pass
+// starts at a later time slot
+void Score_playEntireScore(Score* self, int iTimeSlotStart, bool isLooping) {
+    SequencerRequest sequencerRequest = Score_getEntireScoreSequencerRequest(self, iTimeSlotStart);
+    SequencerRequest loopSequencerRequest = {0};
 
-    for (xmlNodePtr nodeBlockDef = self->nodeBlockDefs->children; nodeBlockDef; nodeBlockDef = nodeBlockDef->next) {
-        if (nodeBlockDef->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCKDEF, (char*)nodeBlockDef->name)) {
-            size_t nMidiMessages = 0;
-            MidiMessage* midiMessages = Score_getMidiMessagesFromBlockdef(self, nodeBlockDef, 0.0, false, 0, &nMidiMessages);
-            uintptr_t nMidiMessagesUintptr = nMidiMessages;
+    if (isLooping) {
+        int nTimeSlots = iTimeSlotStart + 1;
+        for (int iTrack = 0; iTrack < self->nTracks; iTrack++) {
+            nTimeSlots = Math_max(nTimeSlots, Score_countTimeSlotsToSave(self, iTrack));
+        }
 
-            const char* blockDefName = getXmlNodePropertyString(nodeBlockDef, XMLATTRIB_NAME);
-            StringMap_addItem(midiMessagesPerBlock, blockDefName, midiMessages);
-            StringMap_addItem(nMidiMessagesPerBlock, blockDefName, (void*)nMidiMessagesUintptr);
-            sfree((void**)&blockDefName);
+        if (iTimeSlotStart > 0) {
+            loopSequencerRequest = Score_getEntireScoreSequencerRequest(self, 0);
+        } else {
+            loopSequencerRequest = sequencerRequest;
         }
+
+        sequencerRequest.tickEnd = Score_getBlockDurationTicks(self) * nTimeSlots;
+        sequencerRequest.isLooping = true;
+        sequencerRequest.tickLoopStart = 0;
+        sequencerRequest.nLoopMidiMessages = loopSequencerRequest.nMidiMessages;
+        sequencerRequest.loopMidiMessages = loopSequencerRequest.midiMessages;
     }
 
-    HashSet* allMidiMessages = HashSet_new(sizeof(MidiMessage));
-
-    int iTrack = 0;
-    for (xmlNodePtr nodeTrack = self->nodeTracks->children; nodeTrack; nodeTrack = nodeTrack->next) {
-        if (nodeTrack->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_TRACK, (char*)nodeTrack->name)) {
-            float trackVelocity = getXmlNodePropertyFloat(nodeTrack, XMLATTRIB_VELOCITY);
-            bool trackIgnoreNoteOff = getXmlNodePropertyInt(nodeTrack, XMLATTRIB_IGNORENOTEOFF);
-            int iTimeSlot = 0;
-            for (xmlNodePtr nodeBlock = nodeTrack->children; nodeBlock; nodeBlock = nodeBlock->next) {
-                if (nodeBlock->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCK, (char*)nodeBlock->name)) {
-                    if (hasXmlNodeProperty(nodeBlock, XMLATTRIB_NAME) && iTimeSlot >= iTimeSlotStart) {
-                        float blockVelocity = getXmlNodePropertyFloat(nodeBlock, XMLATTRIB_VELOCITY);
-                        const char* blockName = getXmlNodePropertyString(nodeBlock, XMLATTRIB_NAME);
-                        MidiMessage* blockMidiMessages = StringMap_getItem(midiMessagesPerBlock, blockName);
-                        uintptr_t nBlockMidiMessages = (uintptr_t)StringMap_getItem(nMidiMessagesPerBlock, blockName);
-
-                        for (uintptr_t i = 0; i < nBlockMidiMessages; i++) {
-                            MidiMessage midiMessage = {
-                                .type = blockMidiMessages[i].type,
-                                .channel = iTrack + 1, // Channel 0 is editview synth channel
-                                .pitch = blockMidiMessages[i].pitch,
-                                .velocity = blockMidiMessages[i].velocity * blockVelocity * trackVelocity,
-                                .timestampSeconds = iTimeSlot * blockDurationSeconds + blockMidiMessages[i].timestampSeconds,
-                            };
-
-                            if (midiMessage.type == MIDI_MESSAGE_TYPE_NOTEON) {
-                                HashSet_addItem(allMidiMessages, &midiMessage);
-                            } else if (midiMessage.type == MIDI_MESSAGE_TYPE_NOTEOFF) {
-                                if (!trackIgnoreNoteOff) {
-                                    HashSet_addItem(allMidiMessages, &midiMessage);
-                                }
-                            } else {
-                                Log_fatal("Unknown MIDI message type %d", midiMessage.type);
-                            }
-                        }
-
-                        sfree((void**)&blockName);
-                    }
-                    iTimeSlot++;
-                }
+    self->isPlayingScore = true;
+    self->blockDefPlaying = NULL;
+    Event_post(self, EVENT_REQUEST_SEQUENCER_START, &sequencerRequest, sizeof(sequencerRequest));
+
+    if (iTimeSlotStart > 0 && isLooping) {
+        sfree((void**)&loopSequencerRequest.midiMessages);
+    }
+    sfree((void**)&sequencerRequest.midiMessages);
+}
+
+
+// The whole score flattened into one sorted stream of midi messages, from
+// the start of a time slot on. Notes still held from earlier time slots are
+// restarted with it. The caller frees the midi messages.
+SequencerRequest Score_getEntireScoreSequencerRequest(Score* self, int iTimeSlotStart) {
+    int blockDurationTicks = Score_getBlockDurationTicks(self);
+
+    // One extra stream restarts the notes of earlier time slots still held at the start
+    const MidiMessage** trackMidiMessages = ecalloc(self->nTracks + 1, sizeof(MidiMessage*));
+    size_t* nTrackMidiMessages = ecalloc(self->nTracks + 1, sizeof(size_t));
+    MidiMessage** trackMidiMessagesSorted = ecalloc(self->nTracks, sizeof(MidiMessage*));
+    MidiMessage* chaseMidiMessages = NULL;
+    size_t nChaseMidiMessages = 0;
+
+    for (int iTrack = 0; iTrack < self->nTracks; iTrack++) {
+        if (!Timeline_isTrackValid(self->timeline, iTrack)) {
+            Score_rebuildTimelineTrack(self, iTrack);
+        }
+        trackMidiMessages[iTrack] = Timeline_getMidiMessages(self->timeline, iTrack, iTimeSlotStart, &nTrackMidiMessages[iTrack]);
+
+        // Notes reaching past the end of their block make time slot runs overlap
+        if (!areMidiMessagesSorted(trackMidiMessages[iTrack], nTrackMidiMessages[iTrack])) {
+            trackMidiMessagesSorted[iTrack] = ecalloc(nTrackMidiMessages[iTrack], sizeof(MidiMessage));
+            memcpy(trackMidiMessagesSorted[iTrack], trackMidiMessages[iTrack], nTrackMidiMessages[iTrack] * sizeof(MidiMessage));
+            sortMidiMessages(trackMidiMessagesSorted[iTrack], nTrackMidiMessages[iTrack]);
+            trackMidiMessages[iTrack] = trackMidiMessagesSorted[iTrack];
+        }
+
+        if (iTimeSlotStart > 0 && iTimeSlotStart < SCORE_LENGTH_MAX) {
+            size_t nHeldNotes = 0;
+            const TimelineNote* heldNotes = Timeline_getHeldNotes(self->timeline, iTrack, iTimeSlotStart, blockDurationTicks, &nHeldNotes);
+            if (nHeldNotes > 0) {
+                size_t nTrackChaseMidiMessages = 0;
+                MidiMessage* trackChaseMidiMessages = getChaseMidiMessages(heldNotes, nHeldNotes, blockDurationTicks * iTimeSlotStart, iTrack + 1, self->tracks[iTrack].ignoreNoteOff, &nTrackChaseMidiMessages);
+                chaseMidiMessages = erealloc(chaseMidiMessages, nChaseMidiMessages + nTrackChaseMidiMessages, sizeof(MidiMessage));
+                memcpy(&chaseMidiMessages[nChaseMidiMessages], trackChaseMidiMessages, nTrackChaseMidiMessages * sizeof(MidiMessage));
+                nChaseMidiMessages += nTrackChaseMidiMessages;
+                sfree((void**)&trackChaseMidiMessages);
             }
-            iTrack++;
         }
     }
 
-    for (const char* blockName = StringMap_iterateInit(midiMessagesPerBlock); blockName; blockName = StringMap_iterateNext(midiMessagesPerBlock, blockName)) {
-        MidiMessage* blockMidiMessages = StringMap_getItem(midiMessagesPerBlock, blockName);
-        sfree((void**)&blockMidiMessages);
+    if (nChaseMidiMessages > 0) {
+        sortMidiMessages(chaseMidiMessages, nChaseMidiMessages);
+        trackMidiMessages[self->nTracks] = chaseMidiMessages;
+        nTrackMidiMessages[self->nTracks] = nChaseMidiMessages;
     }
-    StringMap_free(&midiMessagesPerBlock);
-    StringMap_free(&nMidiMessagesPerBlock);
 
-    size_t nMidiMessages = HashSet_countItems(allMidiMessages);
+    size_t nMidiMessages = 0;
+    MidiMessage* midiMessages = mergeMidiMessages(trackMidiMessages, nTrackMidiMessages, self->nTracks + 1, &nMidiMessages);
 
-    MidiMessage* midiMessages = ecalloc(nMidiMessages, sizeof(MidiMessage));
-    size_t iMidiMessage = 0;
-    for (MidiMessage* midiMessage = HashSet_iterateInit(allMidiMessages); midiMessage; midiMessage = HashSet_iterateNext(allMidiMessages, midiMessage)) {
-        midiMessages[iMidiMessage] = *midiMessage;
-        iMidiMessage++;
+    for (int iTrack = 0; iTrack < self->nTracks; iTrack++) {
+        if (trackMidiMessagesSorted[iTrack]) {
+            sfree((void**)&trackMidiMessagesSorted[iTrack]);
+        }
     }
-
-    sortMidiMessages(midiMessages, nMidiMessages);
-
-    HashSet_free(&allMidiMessages);
+    if (chaseMidiMessages) {
+        sfree((void**)&chaseMidiMessages);
+    }
+    sfree((void**)&trackMidiMessagesSorted);
+    sfree((void**)&nTrackMidiMessages);
+    sfree((void**)&trackMidiMessages);
 
     SequencerRequest sequencerRequest = {
-        .timestampStart = startTimeSeconds,
-        .timestampEnd = endTimeSeconds,
+        .tickStart = blockDurationTicks * iTimeSlotStart,
+        .tickEnd = blockDurationTicks * SCORE_LENGTH_MAX,
+        .secondsPerTick = Score_getSecondsPerTick(self),
         .nMidiMessages = nMidiMessages,
         .midiMessages = midiMessages,
     };
-
-    Event_post(self, EVENT_REQUEST_SEQUENCER_START, &sequencerRequest, sizeof(sequencerRequest));
-
-    sfree((void**)&midiMessages);
+    return sequencerRequest;
 }
 
 
 void Score_requestCurrentBlockDefNotes(Score* self) {
-    Score_requestBlockDefNotes(self, self->nodeBlockDefCurrent);
+    Score_requestBlockDefNotes(self, self->blockDefCurrent);
 }
 
 
 void Score_requestPrevBlockDefNotes(Score* self) {
-    Score_requestBlockDefNotes(self, self->nodeBlockDefPrev);
+    Score_requestBlockDefNotes(self, self->blockDefPrev);
 }
 
 
 void Score_requestCurrentBlockDefColor(Score* self) {
-    const char* hexColor = getXmlNodePropertyString(self->nodeBlockDefCurrent, XMLATTRIB_COLOR);
-    Color color = parseHexColor(hexColor);
+    Color color = BlockDef_getColor(self->blockDefCurrent);
     Event_post(self, EVENT_BLOCK_COLOR_CHANGED, &color, sizeof(color));
-    sfree((void**)&hexColor);
 }
 
 
 void Score_requestKeySignature(Score* self) {
-    const char* keySignatureName = getXmlNodePropertyString(self->nodeScore, XMLATTRIB_KEYSIGNATURE);
-    int iKeySignature = getKeySignatureIndex(keySignatureName);
-    Log_assert(iKeySignature >= 0, "Invalid key signature name: '%s'", keySignatureName);
+    int iKeySignature = self->iKeySignature;
     Event_post(self, EVENT_KEY_SIGNATURE_CHANGED, &iKeySignature, sizeof(iKeySignature));
-    sfree((void**)&keySignatureName);
 }
 
 
 void Score_requestBlockInstances(Score* self) {
-    int iTrack = 0;
-    for (xmlNodePtr nodeTrack = self->nodeTracks->children; nodeTrack; nodeTrack = nodeTrack->next) {
-        if (nodeTrack->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_TRACK, (char*)nodeTrack->name)) {
-            int iTimeSlot = 0;
-            for (xmlNodePtr nodeBlock = nodeTrack->children; nodeBlock; nodeBlock = nodeBlock->next) {
-                if (nodeBlock->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCK, (char*)nodeBlock->name)) {
-                    if (hasXmlNodeProperty(nodeBlock, XMLATTRIB_NAME)) {
-                        const char* blockName = getXmlNodePropertyString(nodeBlock, XMLATTRIB_NAME);
-                        xmlNodePtr nodeBlockDef = Score_getNodeBlockDefByName(self, blockName);
-                        sfree((void**)&blockName);
-
-                        const char* hexColor = getXmlNodePropertyString(nodeBlockDef, XMLATTRIB_COLOR);
-                        Color color = parseHexColor(hexColor);
-                        sfree((void**)&hexColor);
-
-                        BlockInstance blockInstance = {
-                            .iTrack = iTrack,
-                            .iTimeSlot = iTimeSlot,
-                            .color = color,
-                        };
-
-                        Event_post(self, EVENT_BLOCK_INSTANCE_ADDED, &blockInstance, sizeof(blockInstance));
-                    }
-                    iTimeSlot++;
-                }
+    for (int iTrack = 0; iTrack < self->nTracks; iTrack++) {
+        Track* track = &self->tracks[iTrack];
+        for (int iTimeSlot = 0; iTimeSlot < track->nTimeSlotsUsed; iTimeSlot++) {
+            BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+            if (blockSlot->blockDef) {
+                BlockInstance blockInstance = {
+                    .iTrack = iTrack,
+                    .iTimeSlot = iTimeSlot,
+                    .color = BlockDef_getColor(blockSlot->blockDef),
+                };
+
+                Event_post(self, EVENT_BLOCK_INSTANCE_ADDED, &blockInstance, sizeof(blockInstance));
             }
-            iTrack++;
         }
     }
 }
 
 
 void Score_requestSynthPrograms(Score* self) {
-    int iTrack = 0;
-    for (xmlNodePtr nodeTrack = self->nodeTracks->children; nodeTrack; nodeTrack = nodeTrack->next) {
-        if (nodeTrack->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_TRACK, (char*)nodeTrack->name)) {
-            if (hasXmlNodeProperty(nodeTrack, XMLATTRIB_PROGRAM)) {
-                const char* synthProgramName = getXmlNodePropertyString(nodeTrack, XMLATTRIB_PROGRAM);
-
-                SynthProgramChange synthProgramChange = {0};
-                snprintf(synthProgramChange.name, SYNTH_PROGRAM_CHANGE_NAME_BUFFER_SIZE, "%s", synthProgramName);
-                synthProgramChange.iChannel = iTrack + 1;
-                Event_post(self, EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT, &synthProgramChange, sizeof(synthProgramChange));
-
-                sfree((void**)&synthProgramName);
-            };
-            iTrack++;
-        }
+    for (int iTrack = 0; iTrack < self->nTracks; iTrack++) {
+        SynthProgramChange synthProgramChange = {0};
+        snprintf(synthProgramChange.name, SYNTH_PROGRAM_CHANGE_NAME_BUFFER_SIZE, "%s", self->tracks[iTrack].program);
+        synthProgramChange.iChannel = iTrack + 1;
+        Event_post(self, EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT, &synthProgramChange, sizeof(synthProgramChange));
     }
-
 }
 
 
@@ -502,88 +793,70 @@ void Score_changeActiveBlockDef(Score* self) {
 
 
 void Score_toggleActiveBlockDef(Score* self) {
-    Score_setActiveBlockdef(self, self->nodeBlockDefPrev);
+    Score_setActiveBlockdef(self, self->blockDefPrev);
 }
 
 
 void Score_pickBlockDef(Score* self, int iTrack, int iTimeSlot) {
-    if (iTrack < getXmlNodeChildCount(self->nodeTracks)) {
-        xmlNodePtr nodeTrack = getXmlChildNodeByIndex(self->nodeTracks, iTrack);
-        if (iTimeSlot < getXmlNodeChildCount(nodeTrack)) {
-            xmlNodePtr nodeBlock = getXmlChildNodeByIndex(nodeTrack, iTimeSlot);
-
-            if (hasXmlNodeProperty(nodeBlock, XMLATTRIB_NAME)) {
-                const char* blockName = getXmlNodePropertyString(nodeBlock, XMLATTRIB_NAME);
-                xmlNodePtr nodeBlockDef = Score_getNodeBlockDefByName(self, blockName);
-                sfree((void**)&blockName);
-
-                Score_setActiveBlockdef(self, nodeBlockDef);
-            }
+    BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+    if (!blockSlot) {
+        return;
+    }
 
-            if (hasXmlNodeProperty(nodeTrack, XMLATTRIB_PROGRAM)) {
-                const char* synthProgramName = getXmlNodePropertyString(nodeTrack, XMLATTRIB_PROGRAM);
+    if (blockSlot->blockDef) {
+        Score_setActiveBlockdef(self, blockSlot->blockDef);
+    }
 
-                SynthProgramChange synthProgramChange = {0};
-                snprintf(synthProgramChange.name, SYNTH_PROGRAM_CHANGE_NAME_BUFFER_SIZE, "%s", synthProgramName);
-                sfree((void**)&synthProgramName);
+    Track* track = &self->tracks[iTrack];
 
-                synthProgramChange.iChannel = 0; // edit view
-                Event_post(self, EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT, &synthProgramChange, sizeof(synthProgramChange));
-            }
+    SynthProgramChange synthProgramChange = {0};
+    snprintf(synthProgramChange.name, SYNTH_PROGRAM_CHANGE_NAME_BUFFER_SIZE, "%s", track->program);
+    synthProgramChange.iChannel = 0; // edit view
+    Event_post(self, EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT, &synthProgramChange, sizeof(synthProgramChange));
 
-            if (hasXmlNodeProperty(nodeTrack, XMLATTRIB_IGNORENOTEOFF)) {
-                int ignoreNoteOff = getXmlNodePropertyInt(nodeTrack, XMLATTRIB_IGNORENOTEOFF);
-                Event_post(self, EVENT_REQUEST_IGNORE_NOTEOFF, &ignoreNoteOff, sizeof(ignoreNoteOff));
-            }
-        }
-    }
+    int ignoreNoteOff = track->ignoreNoteOff;
+    Event_post(self, EVENT_REQUEST_IGNORE_NOTEOFF, &ignoreNoteOff, sizeof(ignoreNoteOff));
 }
 
 
 void Score_changeCurrentBlockDefColor(Score* self) {
-    const char* currentHexColor = getXmlNodePropertyString(self->nodeBlockDefCurrent, XMLATTRIB_COLOR);
     QueryRequest queryRequest = {
         .key = REQUEST_KEY_CHANGE_BLOCK_COLOR,
         .prompt = "Set block color:",
-        .items = currentHexColor,
+        .items = BlockDef_getHexColor(self->blockDefCurrent),
     };
     Event_post(self, EVENT_REQUEST_QUERY, &queryRequest, sizeof(queryRequest));
-    sfree((void**)&currentHexColor);
 }
 
 
 void Score_renameCurrentBlockDef(Score* self) {
-    const char* currentBlockName = getXmlNodePropertyString(self->nodeBlockDefCurrent, XMLATTRIB_NAME);
     QueryRequest queryRequest = {
         .key = REQUEST_KEY_RENAME_BLOCK,
         .prompt = "Rename block:",
-        .items = currentBlockName,
+        .items = BlockDef_getName(self->blockDefCurrent),
     };
     Event_post(self, EVENT_REQUEST_QUERY, &queryRequest, sizeof(queryRequest));
-    sfree((void**)&currentBlockName);
 }
 
 
 void Score_setTempoBpm(Score* self) {
-    const char* currentTempoBpm = getXmlNodePropertyString(self->nodeScore, XMLATTRIB_TEMPO);
+    char buffer[XML_BUFFER_SIZE] = {0};
+    snprintf(buffer, XML_BUFFER_SIZE, "%d", self->tempoBpm);
+
     QueryRequest queryRequest = {
         .key = REQUEST_KEY_SET_TEMPO_BPM,
         .prompt = "Set tempo (BPM):",
-        .items = currentTempoBpm,
+        .items = buffer,
     };
     Event_post(self, EVENT_REQUEST_QUERY, &queryRequest, sizeof(queryRequest));
-    sfree((void**)&currentTempoBpm);
 }
 
 
 void Score_changeTrackVelocity(Score* self, int iTrack) {
     float velocityPrev = TRACK_VELOCITY_DEFAULT;
 
-    if (iTrack < getXmlNodeChildCount(self->nodeTracks)) {
-        xmlNodePtr nodeTrack = getXmlChildNodeByIndex(self->nodeTracks, iTrack);
-        if (hasXmlNodeProperty(nodeTrack, XMLATTRIB_VELOCITY)) {
-            velocityPrev = getXmlNodePropertyFloat(nodeTrack, XMLATTRIB_VELOCITY);
-        }
+    if (iTrack < self->nTracks) {
+        velocityPrev = self->tracks[iTrack].velocity;
     }
 
     char buffer[XML_BUFFER_SIZE] = {0};
@@ -601,81 +874,124 @@ void Score_changeTrackVelocity(Score* self, int iTrack) {
 
 
 void Score_addBlockInstance(Score* self, int iTrack, int iTimeSlot) {
-    Score_removeBlockInstance(self, iTrack, iTimeSlot);
+    JournalEntry entry = {
+        .type = JOURNAL_ENTRY_ADD_BLOCK_INSTANCE,
+        .name = BlockDef_getName(self->blockDefCurrent),
+        .iTrack = iTrack,
+        .iTimeSlot = iTimeSlot,
+        .velocity = BLOCK_VELOCITY_DEFAULT,
+    };
+    JournalEntry undoEntry = {
+        .type = JOURNAL_ENTRY_REMOVE_BLOCK_INSTANCE,
+        .iTrack = iTrack,
+        .iTimeSlot = iTimeSlot,
+    };
 
-    while (getXmlNodeChildCount(self->nodeTracks) < iTrack + 1) {
-        Score_createNewTrack(self);
+    BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+    bool isUnchanged = false;
+    if (blockSlot && blockSlot->blockDef) {
+        undoEntry.type = JOURNAL_ENTRY_ADD_BLOCK_INSTANCE;
+        undoEntry.name = BlockDef_getName(blockSlot->blockDef);
+        undoEntry.velocity = blockSlot->velocity;
+        isUnchanged = blockSlot->blockDef == self->blockDefCurrent && blockSlot->velocity == entry.velocity;
     }
 
-    xmlNodePtr nodeTrack = getXmlChildNodeByIndex(self->nodeTracks, iTrack);
-
-    while (getXmlNodeChildCount(nodeTrack) < iTimeSlot + 1) {
-        xmlNewChild(nodeTrack, NULL, BAD_CAST XMLNODE_BLOCK, NULL);
+    Score_placeBlockInstance(self, iTrack, iTimeSlot, self->blockDefCurrent, BLOCK_VELOCITY_DEFAULT);
+    Score_appendJournalEntry(self, &entry);
+    if (!isUnchanged) {
+        Score_recordEdit(self, &entry, &undoEntry);
     }
+}
 
-    xmlNodePtr nodeBlock = getXmlChildNodeByIndex(nodeTrack, iTimeSlot);
-
-    const char* blockName = getXmlNodePropertyString(self->nodeBlockDefCurrent, XMLATTRIB_NAME);
-    setXmlNodePropertyString(nodeBlock, XMLATTRIB_NAME, blockName);
-    sfree((void**)&blockName);
-
-    setXmlNodePropertyFloat(nodeBlock, XMLATTRIB_VELOCITY, BLOCK_VELOCITY_DEFAULT);
 
-    const char* hexColor = getXmlNodePropertyString(self->nodeBlockDefCurrent, XMLATTRIB_COLOR);
-    Color color = parseHexColor(hexColor);
-    sfree((void**)&hexColor);
+void Score_removeBlockInstance(Score* self, int iTrack, int iTimeSlot) {
+    BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+    if (!blockSlot || !blockSlot->blockDef) {
+        return;
+    }
 
-    BlockInstance blockInstance = {
+    JournalEntry entry = {
+        .type = JOURNAL_ENTRY_REMOVE_BLOCK_INSTANCE,
         .iTrack = iTrack,
         .iTimeSlot = iTimeSlot,
-        .color = color,
     };
+    Score_recordEdit(self, &entry, &(JournalEntry){
+        .type = JOURNAL_ENTRY_ADD_BLOCK_INSTANCE,
+        .name = BlockDef_getName(blockSlot->blockDef),
+        .iTrack = iTrack,
+        .iTimeSlot = iTimeSlot,
+        .velocity = blockSlot->velocity,
+    });
 
-    Event_post(self, EVENT_BLOCK_INSTANCE_ADDED, &blockInstance, sizeof(blockInstance));
+    Score_clearBlockInstance(self, iTrack, iTimeSlot);
+    Score_appendJournalEntry(self, &entry);
 }
 
 
-void Score_removeBlockInstance(Score* self, int iTrack, int iTimeSlot) {
-    if (iTrack < getXmlNodeChildCount(self->nodeTracks)) {
-        xmlNodePtr nodeTrack = getXmlChildNodeByIndex(self->nodeTracks, iTrack);
-        if (iTimeSlot < getXmlNodeChildCount(nodeTrack)) {
-            xmlNodePtr nodeBlock = getXmlChildNodeByIndex(nodeTrack, iTimeSlot);
-
-            if (hasXmlNodeProperty(nodeBlock, XMLATTRIB_NAME) || hasXmlNodeProperty(nodeBlock, XMLATTRIB_VELOCITY)) {
-                unsetXmlNodeProperty(nodeBlock, XMLATTRIB_NAME);
-                unsetXmlNodeProperty(nodeBlock, XMLATTRIB_VELOCITY);
+void Score_toggleIgnoreNoteOff(Score* self, int iTrack) {
+    if (iTrack < self->nTracks) {
+        bool ignoreNoteOff = !self->tracks[iTrack].ignoreNoteOff;
+        Score_setTrackIgnoreNoteOff(self, iTrack, ignoreNoteOff);
+        Log_info("Ignore note off for track %d: %s", iTrack, ignoreNoteOff ? "true" : "false");
+        JournalEntry entry = {
+            .type = JOURNAL_ENTRY_SET_TRACK_IGNORE_NOTEOFF,
+            .iTrack = iTrack,
+            .value = ignoreNoteOff,
+        };
+        Score_appendJournalEntry(self, &entry);
+        Score_recordEdit(self, &entry, &(JournalEntry){
+            .type = JOURNAL_ENTRY_SET_TRACK_IGNORE_NOTEOFF,
+            .iTrack = iTrack,
+            .value = !ignoreNoteOff,
+        });
+    }
+}
 
-                const char* hexColor = getXmlNodePropertyString(self->nodeBlockDefCurrent, XMLATTRIB_COLOR);
-                Color color = parseHexColor(hexColor);
-                sfree((void**)&hexColor);
 
-                BlockInstance blockInstance = {
-                    .iTrack = iTrack,
-                    .iTimeSlot = iTimeSlot,
-                    .color = color,
-                };
+int Score_getBlockDurationTicks(Score* self) {
+    int nBeatsPerMeasure = self->nBeatsPerMeasure;
+    Log_assert(nBeatsPerMeasure > 0, "Expected beats per measure to be larger than 0, but was %d", nBeatsPerMeasure);
 
-                Event_post(self, EVENT_BLOCK_INSTANCE_REMOVED, &blockInstance, sizeof(blockInstance));
-            }
-        }
-    }
+    return N_BLOCK_MEASURES * nBeatsPerMeasure * TICKS_PER_BEAT;
 }
 
 
-void Score_toggleIgnoreNoteOff(Score* self, int iTrack) {
-    if (iTrack < getXmlNodeChildCount(self->nodeTracks)) {
-        xmlNodePtr nodeTrack = getXmlChildNodeByIndex(self->nodeTracks, iTrack);
+ScoreStats Score_getStats(Score* self) {
+    ScoreStats stats = {
+        .tempoBpm = self->tempoBpm,
+        .nTracks = Score_countTracksToSave(self),
+        .nBlockDefs = self->nBlockDefs,
+    };
 
-        bool ignoreNoteOffPrev = false;
+    for (int iBlockDef = 0; iBlockDef < self->nBlockDefs; iBlockDef++) {
+        stats.nNotes += BlockDef_countNotes(self->blockDefs[iBlockDef]);
+    }
 
-        if (hasXmlNodeProperty(nodeTrack, XMLATTRIB_IGNORENOTEOFF)) {
-            ignoreNoteOffPrev = getXmlNodePropertyInt(nodeTrack, XMLATTRIB_IGNORENOTEOFF);
+    for (int iTrack = 0; iTrack < stats.nTracks; iTrack++) {
+        int nTimeSlots = Score_countTimeSlotsToSave(self, iTrack);
+        stats.nTimeSlots = Math_max(stats.nTimeSlots, nTimeSlots);
+        for (int iTimeSlot = 0; iTimeSlot < nTimeSlots; iTimeSlot++) {
+            if (Score_getBlockSlot(self, iTrack, iTimeSlot)->blockDef) {
+                stats.nBlockInstances++;
+            }
         }
 
-        bool ignoreNoteOff = !ignoreNoteOffPrev;
-        setXmlNodePropertyInt(nodeTrack, XMLATTRIB_IGNORENOTEOFF, ignoreNoteOff);
-        Log_info("Ignore note off for track %d: %s", iTrack, ignoreNoteOff ? "true" : "false");
+        if (!Timeline_isTrackValid(self->timeline, iTrack)) {
+            Score_rebuildTimelineTrack(self, iTrack);
+        }
+        size_t nMidiMessages = 0;
+        Timeline_getMidiMessages(self->timeline, iTrack, 0, &nMidiMessages);
+        stats.nMidiMessages += nMidiMessages;
     }
+
+    stats.durationSeconds = stats.nTimeSlots * Score_getBlockDurationTicks(self) * Score_getSecondsPerTick(self);
+    return stats;
+}
+
+
+// As written to files, for new scores
+const char* Score_getDefaultKeySignatureName(void) {
+    return KEY_SIGNATURE_NAMES[KEY_SIGNATURE_DEFAULT];
 }
 
 
@@ -685,657 +1001,1763 @@ static void Score_onQueryResult(Score* self, void* sender, QueryResult* queryRes
         const char* keySignatureName = queryResult->value;
         int iKeySignature = getKeySignatureIndex(keySignatureName);
         if (iKeySignature >= 0) {
-            setXmlNodePropertyString(self->nodeScore, XMLATTRIB_KEYSIGNATURE, keySignatureName);
-            Event_post(self, EVENT_KEY_SIGNATURE_CHANGED, &iKeySignature, sizeof(iKeySignature));
+            JournalEntry entry = {.type = JOURNAL_ENTRY_SET_KEY_SIGNATURE, .value = iKeySignature};
+            Score_recordEdit(self, &entry, &(JournalEntry){.type = JOURNAL_ENTRY_SET_KEY_SIGNATURE, .value = self->iKeySignature});
+            Score_setKeySignature(self, iKeySignature);
+            Score_appendJournalEntry(self, &entry);
         } else {
             Log_warning("Invalid key signature name: '%s'", keySignatureName);
         }
     } else if (!strcmp(queryResult->key, REQUEST_KEY_CHANGE_ACTIVE_BLOCK)) {
         const char* blockName = queryResult->value;
-        xmlNodePtr nodeBlockDef = NULL;
+        BlockDef* blockDef = NULL;
+        size_t blockNameLength = strlen(blockName);
+        if (blockNameLength == 0 || blockNameLength > BLOCK_NAME_LENGTH_MAX) {
+            Log_warning("Invalid block name length %zu (expected 1 to %d characters)", blockNameLength, BLOCK_NAME_LENGTH_MAX);
+            return;
+        }
         if (Score_blockDefExists(self, blockName)) {
-            nodeBlockDef = Score_getNodeBlockDefByName(self, blockName);
+            blockDef = Score_getBlockDefByName(self, blockName);
         } else {
             Log_info("Creating new block: '%s'", blockName);
-            nodeBlockDef = Score_createNewBlockDef(self, blockName);
-            Score_updateBlockListString(self);
+            blockDef = Score_createNewBlockDef(self, blockName);
+            Score_appendJournalEntry(self, &(JournalEntry){
+                .type = JOURNAL_ENTRY_CREATE_BLOCKDEF,
+                .name = blockName,
+                .text = BlockDef_getHexColor(blockDef),
+            });
         }
-        Score_setActiveBlockdef(self, nodeBlockDef);
+        Score_setActiveBlockdef(self, blockDef);
     } else if (!strcmp(queryResult->key, REQUEST_KEY_CHANGE_BLOCK_COLOR)) {
         const char* hexColor = queryResult->value;
-        Color color = parseHexColor(hexColor);
-        setXmlNodePropertyString(self->nodeBlockDefCurrent, XMLATTRIB_COLOR, hexColor);
-        Event_post(self, EVENT_BLOCK_COLOR_CHANGED, &color, sizeof(color));
+        char hexColorPrev[HEX_COLOR_BUFFER_SIZE] = {0};
+        snprintf(hexColorPrev, HEX_COLOR_BUFFER_SIZE, "%s", BlockDef_getHexColor(self->blockDefCurrent));
+
+        Score_setBlockDefColor(self, self->blockDefCurrent, hexColor);
+        JournalEntry entry = {
+            .type = JOURNAL_ENTRY_SET_BLOCKDEF_COLOR,
+            .name = BlockDef_getName(self->blockDefCurrent),
+            .text = BlockDef_getHexColor(self->blockDefCurrent),
+        };
+        Score_appendJournalEntry(self, &entry);
+        Score_recordEdit(self, &entry, &(JournalEntry){
+            .type = JOURNAL_ENTRY_SET_BLOCKDEF_COLOR,
+            .name = entry.name,
+            .text = hexColorPrev,
+        });
     } else if (!strcmp(queryResult->key, REQUEST_KEY_RENAME_BLOCK)) {
-        const char* blockNamePrev = getXmlNodePropertyString(self->nodeBlockDefCurrent, XMLATTRIB_NAME);
-
         const char* blockNameNew = queryResult->value;
-        if (strcmp(blockNameNew, blockNamePrev)) {
-            setXmlNodePropertyString(self->nodeBlockDefCurrent, XMLATTRIB_NAME, blockNameNew);
-            Score_updateBlockListString(self);
-
-            for (xmlNodePtr nodeTrack = self->nodeTracks->children; nodeTrack; nodeTrack = nodeTrack->next) {
-                if (nodeTrack->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_TRACK, (char*)nodeTrack->name)) {
-                    for (xmlNodePtr nodeBlock = nodeTrack->children; nodeBlock; nodeBlock = nodeBlock->next) {
-                        if (nodeBlock->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCK, (char*)nodeBlock->name)) {
-                            if (hasXmlNodeProperty(nodeBlock, XMLATTRIB_NAME)) {
-                                const char* blockName = getXmlNodePropertyString(nodeBlock, XMLATTRIB_NAME);
-                                if (!strcmp(blockName, blockNamePrev)) {
-                                    setXmlNodePropertyString(nodeBlock, XMLATTRIB_NAME, blockNameNew);
-                                }
-                                sfree((void**)&blockName);
-                            }
-                        }
-                    }
-                }
+        size_t blockNameLength = strlen(blockNameNew);
+        if (blockNameLength == 0 || blockNameLength > BLOCK_NAME_LENGTH_MAX) {
+            Log_warning("Invalid block name length %zu (expected 1 to %d characters)", blockNameLength, BLOCK_NAME_LENGTH_MAX);
+        } else if (strcmp(blockNameNew, BlockDef_getName(self->blockDefCurrent))) {
+            if (Score_blockDefExists(self, blockNameNew)) {
+                Log_warning("Block with name '%s' already exists", blockNameNew);
+            } else {
+                JournalEntry entry = {
+                    .type = JOURNAL_ENTRY_RENAME_BLOCKDEF,
+                    .name = BlockDef_getName(self->blockDefCurrent),
+                    .text = blockNameNew,
+                };
+                Score_appendJournalEntry(self, &entry);
+                Score_recordEdit(self, &entry, &(JournalEntry){
+                    .type = JOURNAL_ENTRY_RENAME_BLOCKDEF,
+                    .name = blockNameNew,
+                    .text = entry.name,
+                });
+                Score_renameBlockDef(self, self->blockDefCurrent, blockNameNew);
             }
         }
-        sfree((void**)&blockNamePrev);
     } else if (!strcmp(queryResult->key, REQUEST_KEY_SET_TEMPO_BPM)) {
         const char* tempoBpmString = queryResult->value;
         int tempoBpm = atoi(tempoBpmString);
-        if (tempoBpm) {
-            setXmlNodePropertyString(self->nodeScore, XMLATTRIB_TEMPO, tempoBpmString);
+        if (tempoBpm > 0) {
+            JournalEntry entry = {.type = JOURNAL_ENTRY_SET_TEMPO, .value = tempoBpm};
+            Score_recordEdit(self, &entry, &(JournalEntry){.type = JOURNAL_ENTRY_SET_TEMPO, .value = self->tempoBpm});
+            self->tempoBpm = tempoBpm;
+            Score_appendJournalEntry(self, &entry);
         } else {
             Log_warning("Invalid tempo BPM '%s'", tempoBpmString);
         }
     } else if (!strcmp(queryResult->key, REQUEST_KEY_CHANGE_TRACK_VELOCITY)) {
         const char* trackVelocityString = queryResult->value;
-        float trackVelocity = atof(trackVelocityString);
-
-        if (self->iLastQueriedTrack < getXmlNodeChildCount(self->nodeTracks)) {
-            xmlNodePtr nodeTrack = getXmlChildNodeByIndex(self->nodeTracks, self->iLastQueriedTrack);
-            setXmlNodePropertyFloat(nodeTrack, XMLATTRIB_VELOCITY, trackVelocity);
+        char* trackVelocityEnd = NULL;
+        float trackVelocity = strtof(trackVelocityString, &trackVelocityEnd);
+
+        // Also rejects NaN
+        if (trackVelocityEnd == trackVelocityString || !(trackVelocity >= 0.0f && trackVelocity <= 1.0f)) {
+            Log_warning("Invalid track velocity '%s', expected a value from 0 to 1", trackVelocityString);
+        } else if (self->iLastQueriedTrack < self->nTracks) {
+            JournalEntry entry = {
+                .type = JOURNAL_ENTRY_SET_TRACK_VELOCITY,
+                .iTrack = self->iLastQueriedTrack,
+                .velocity = trackVelocity,
+            };
+            Score_recordEdit(self, &entry, &(JournalEntry){
+                .type = JOURNAL_ENTRY_SET_TRACK_VELOCITY,
+                .iTrack = self->iLastQueriedTrack,
+                .velocity = self->tracks[self->iLastQueriedTrack].velocity,
+            });
+            Score_setTrackVelocity(self, self->iLastQueriedTrack, trackVelocity);
+            Score_appendJournalEntry(self, &entry);
         }
     }
 }
 
 
 static void Score_onSynthInstrumentChanged(Score* self, void* sender, SynthProgramChange* synthProgramChange) {
+    (void)sender;
     if (synthProgramChange->iChannel > 0) {
         int iTrack = synthProgramChange->iChannel - 1;
 
-        while (getXmlNodeChildCount(self->nodeTracks) < iTrack + 1) {
-            Score_createNewTrack(self);
+        // Also echoed back for the programs sent to the synth at startup
+        if (iTrack < self->nTracks && !strcmp(self->tracks[iTrack].program, synthProgramChange->name)) {
+            return;
         }
 
-        xmlNodePtr nodeTrack = getXmlChildNodeByIndex(self->nodeTracks, iTrack);
-        setXmlNodePropertyString(nodeTrack, XMLATTRIB_PROGRAM, synthProgramChange->name);
+        JournalEntry entry = {
+            .type = JOURNAL_ENTRY_SET_TRACK_PROGRAM,
+            .iTrack = iTrack,
+            .text = synthProgramChange->name,
+        };
+        Score_recordEdit(self, &entry, &(JournalEntry){
+            .type = JOURNAL_ENTRY_SET_TRACK_PROGRAM,
+            .iTrack = iTrack,
+            .text = iTrack < self->nTracks ? self->tracks[iTrack].program : SYNTH_PROGRAM_NAME_DEFAULT,
+        });
+        Score_setTrackProgram(self, iTrack, synthProgramChange->name);
+        Score_appendJournalEntry(self, &entry);
     }
 }
 
 
-static bool Score_fileExists(Score* self) {
-    return access(self->filename, F_OK) != -1;
+static void Score_onProcessFrame(Score* self, void* sender, float* deltaTime) {
+    (void)sender;
+    (void)deltaTime;
+
+    if (!self->saveJob) {
+        return;
+    }
+
+    pthread_mutex_lock(&self->saveJob->mutex);
+    bool isDone = self->saveJob->isDone;
+    pthread_mutex_unlock(&self->saveJob->mutex);
+
+    if (isDone) {
+        Score_finishSaveJob(self);
+    }
 }
 
 
-static void Score_createNew(Score* self) {
-    Log_assert(!self->xmlDoc, "An XML document is already loaded");
+static void Score_onSequencerStopped(Score* self, void* sender, void* unused) {
+    (void)sender; (void)unused;
+    self->isPlayingScore = false;
+    self->blockDefPlaying = NULL;
+}
 
-    self->xmlDoc = xmlNewDoc(BAD_CAST XML_VERSION);
-    xmlNodePtr nodeGscore = xmlNewNode(NULL, BAD_CAST XMLNODE_GSCORE);
-    xmlDocSetRootElement(self->xmlDoc, nodeGscore);
-    setXmlNodePropertyString(nodeGscore, XMLATTRIB_VERSION, VERSION);
 
-    self->nodeScore = xmlNewChild(nodeGscore, NULL, BAD_CAST XMLNODE_SCORE, NULL);
-    {
-        char buffer[XML_BUFFER_SIZE] = {0};
-        snprintf(buffer, XML_BUFFER_SIZE, "%d", TEMPO_BPM_DEFAULT);
-        setXmlNodePropertyString(self->nodeScore, XMLATTRIB_TEMPO, buffer);
-    }
-    {
-        char buffer[XML_BUFFER_SIZE] = {0};
-        snprintf(buffer, XML_BUFFER_SIZE, "%d", N_BEATS_PER_MEASURE_DEFAULT);
-        setXmlNodePropertyString(self->nodeScore, XMLATTRIB_BEATSPERMEASURE, buffer);
-    }
-    setXmlNodePropertyString(self->nodeScore, XMLATTRIB_KEYSIGNATURE, KEY_SIGNATURE_NAMES[KEY_SIGNATURE_DEFAULT]);
+static bool Score_fileExists(Score* self) {
+    return access(self->filename, F_OK) != -1;
+}
 
-    xmlNodePtr nodeMetadata = xmlNewNode(NULL, BAD_CAST XMLNODE_METADATA);
-    xmlAddChild(self->nodeScore, xmlCopyNodeList(nodeMetadata));
-    xmlFreeNode(nodeMetadata);
 
-    self->nodeBlockDefs = xmlNewChild(self->nodeScore, NULL, BAD_CAST XMLNODE_BLOCKDEFS, NULL);
-    Score_createNewBlockDef(self, BLOCK_NAME_DEFAULT);
+static void Score_createNew(Score* self) {
+    self->version = estrdup(VERSION);
+    self->tempoBpm = TEMPO_BPM_DEFAULT;
+    self->nBeatsPerMeasure = N_BEATS_PER_MEASURE_DEFAULT;
+    self->iKeySignature = KEY_SIGNATURE_DEFAULT;
+    self->nodeMetadata = xmlNewNode(NULL, BAD_CAST XMLNODE_METADATA);
 
-    self->nodeTracks = xmlNewChild(self->nodeScore, NULL, BAD_CAST XMLNODE_TRACKS, NULL);
+    Score_createNewBlockDef(self, BLOCK_NAME_DEFAULT);
     Score_createNewTrack(self);
-
-    Log_assert(Score_isXmlDocValid(self), "Newly created XML document is invalid?");
 }
 
 
 static void Score_loadFromFile(Score* self) {
-    Log_assert(!self->xmlDoc, "An XML document is already loaded");
-    self->xmlDoc = xmlReadFile(self->filename, NULL, 0);
-    Log_assert(Score_isXmlDocValid(self), "File '%s' could not be read", self->filename);
+    xmlTextReaderPtr reader = xmlReaderForFile(self->filename, NULL, 0);
+    Log_assert(reader, "File '%s' could not be opened", self->filename);
+    Log_assert(xmlTextReaderSchemaValidateCtxt(reader, self->validationContext, 0) == 0, "Could not attach XSD-schema to XML reader");
+
+    XmlLoadState state = {0};
+
+    // The schema is checked while streaming, so every element is known to be well placed once it is read
+    int readResult = xmlTextReaderRead(reader);
+    while (readResult == 1) {
+        Log_assert(xmlTextReaderIsValid(reader) == 1, "File '%s' could not be read", self->filename);
+
+        int nodeType = xmlTextReaderNodeType(reader);
+        const char* nodeName = (const char*)xmlTextReaderConstName(reader);
+
+        if (nodeType == XML_READER_TYPE_ELEMENT && !strcmp(nodeName, XMLNODE_METADATA)) {
+            xmlNodePtr nodeMetadata = xmlTextReaderExpand(reader);
+            Log_assert(nodeMetadata, "Error when reading %s xml node", XMLNODE_METADATA);
+            self->nodeMetadata = xmlCopyNode(nodeMetadata, 1);
+            Log_assert(self->nodeMetadata, "Error when copying %s xml node", XMLNODE_METADATA);
+            readResult = xmlTextReaderNext(reader);
+            continue;
+        }
+
+        if (nodeType == XML_READER_TYPE_ELEMENT) {
+            bool isEmptyElement = xmlTextReaderIsEmptyElement(reader);
+            Score_loadXmlElementStart(self, reader, &state, nodeName);
+            if (isEmptyElement) {
+                Score_loadXmlElementEnd(self, &state, nodeName);
+            }
+        } else if (nodeType == XML_READER_TYPE_END_ELEMENT) {
+            Score_loadXmlElementEnd(self, &state, nodeName);
+        }
 
-    self->nodeScore = findXmlNodeByName(xmlDocGetRootElement(self->xmlDoc), XMLNODE_SCORE);
-    Log_assert(self->nodeScore, "%s xml node not found", XMLNODE_SCORE);
+        readResult = xmlTextReaderRead(reader);
+    }
+    Log_assert(readResult == 0 && xmlTextReaderIsValid(reader) == 1, "File '%s' could not be read", self->filename);
 
-    self->nodeBlockDefs = findXmlNodeByName(self->nodeScore, XMLNODE_BLOCKDEFS);
-    Log_assert(self->nodeBlockDefs, "%s xml node not found", XMLNODE_BLOCKDEFS);
+    if (state.nMessagesMigrated > 0) {
+        Log_info("Converted %zu legacy midi message time(s) to %d ticks per beat", state.nMessagesMigrated, TICKS_PER_BEAT);
+    }
+    if (state.nMessagesInvalid > 0) {
+        Log_warning("Discarding %zu midi message(s) with an unknown type, an invalid pitch or no time", state.nMessagesInvalid);
+    }
 
-    self->nodeTracks = findXmlNodeByName(self->nodeScore, XMLNODE_TRACKS);
-    Log_assert(self->nodeTracks, "%s xml node not found", XMLNODE_TRACKS);
+    sfree((void**)&state.blockMessages);
+    xmlFreeTextReader(reader);
 }
 
 
-static bool Score_isXmlDocValid(Score* self) {
-    return self->xmlDoc && xmlSchemaValidateDoc(self->validationContext, self->xmlDoc) == 0;
+static void Score_loadXmlElementStart(Score* self, xmlTextReaderPtr reader, XmlLoadState* state, const char* nodeName) {
+    if (!strcmp(nodeName, XMLNODE_GSCORE)) {
+        self->version = (char*)getXmlReaderAttributeString(reader, XMLATTRIB_VERSION);
+    } else if (!strcmp(nodeName, XMLNODE_SCORE)) {
+        self->tempoBpm = getXmlReaderAttributeInt(reader, XMLATTRIB_TEMPO);
+        self->nBeatsPerMeasure = getXmlReaderAttributeInt(reader, XMLATTRIB_BEATSPERMEASURE);
+
+        const char* keySignatureName = getXmlReaderAttributeString(reader, XMLATTRIB_KEYSIGNATURE);
+        self->iKeySignature = getKeySignatureIndex(keySignatureName);
+        Log_assert(self->iKeySignature >= 0, "Invalid key signature name: '%s'", keySignatureName);
+        sfree((void**)&keySignatureName);
+
+        // Files without a tick resolution predate integer ticks
+        if (hasXmlReaderAttribute(reader, XMLATTRIB_TICKSPERBEAT)) {
+            state->nTicksPerBeatFile = getXmlReaderAttributeInt(reader, XMLATTRIB_TICKSPERBEAT);
+        }
+    } else if (!strcmp(nodeName, XMLNODE_BLOCKDEF)) {
+        const char* blockName = getXmlReaderAttributeString(reader, XMLATTRIB_NAME);
+        Log_assert(strlen(blockName) <= BLOCK_NAME_LENGTH_MAX, "Block name '%s' is too long", blockName);
+        Log_assert(!Score_blockDefExists(self, blockName), "Duplicate block definition '%s'", blockName);
+        const char* hexColor = getXmlReaderAttributeString(reader, XMLATTRIB_COLOR);
+
+        state->blockDef = BlockDef_new(blockName, hexColor);
+        state->nBlockMessages = 0;
+        Score_addBlockDef(self, state->blockDef);
+
+        sfree((void**)&blockName);
+        sfree((void**)&hexColor);
+    } else if (!strcmp(nodeName, XMLNODE_MESSAGE)) {
+        Score_loadXmlMessage(self, reader, state);
+    } else if (!strcmp(nodeName, XMLNODE_TRACK)) {
+        Track* track = Score_createNewTrack(self);
+        sfree((void**)&track->program);
+        track->program = (char*)getXmlReaderAttributeString(reader, XMLATTRIB_PROGRAM);
+        track->velocity = getXmlReaderAttributeFloat(reader, XMLATTRIB_VELOCITY);
+        track->ignoreNoteOff = getXmlReaderAttributeInt(reader, XMLATTRIB_IGNORENOTEOFF);
+        state->iTimeSlot = 0;
+    } else if (!strcmp(nodeName, XMLNODE_BLOCK)) {
+        int iTrack = self->nTracks - 1;
+        Log_assert(state->iTimeSlot < SCORE_LENGTH_MAX, "Track %d is longer than %d time slots", iTrack, SCORE_LENGTH_MAX);
+        if (hasXmlReaderAttribute(reader, XMLATTRIB_NAME)) {
+            BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, state->iTimeSlot);
+            self->tracks[iTrack].nTimeSlotsUsed = state->iTimeSlot + 1;
+            const char* blockName = getXmlReaderAttributeString(reader, XMLATTRIB_NAME);
+            blockSlot->blockDef = Score_getBlockDefByName(self, blockName);
+            sfree((void**)&blockName);
+
+            blockSlot->velocity = BLOCK_VELOCITY_DEFAULT;
+            if (hasXmlReaderAttribute(reader, XMLATTRIB_VELOCITY)) {
+                blockSlot->velocity = getXmlReaderAttributeFloat(reader, XMLATTRIB_VELOCITY);
+            }
+        }
+        state->iTimeSlot++;
+    }
 }
 
 
-static xmlNodePtr Score_createNewBlockDef(Score* self, const char* blockName) {
-    Log_assert(!Score_blockDefExists(self, blockName), "Block with name '%s' already exists!", blockName);
+static void Score_loadXmlElementEnd(Score* self, XmlLoadState* state, const char* nodeName) {
+    if (!strcmp(nodeName, XMLNODE_BLOCKDEF)) {
+        addBlockMessagesToBlockDef(state->blockDef, state->blockMessages, state->nBlockMessages);
+        state->blockDef = NULL;
+    } else if (!strcmp(nodeName, XMLNODE_TRACK)) {
+        Timeline_invalidateTrack(self->timeline, self->nTracks - 1);
+    }
+}
 
-    xmlNodePtr nodeBlockDef = xmlNewChild(self->nodeBlockDefs, NULL, BAD_CAST XMLNODE_BLOCKDEF, NULL);
-    setXmlNodePropertyString(nodeBlockDef, XMLATTRIB_NAME, blockName);
 
-    Color blockColorLerpTarget = generateColorFromString(blockName);
-    float blockColorLerpWeight = BLOCK_NEW_COLOR_VARIATION;
+// Messages that cannot be placed are skipped, addBlockMessagesToBlockDef()
+// then drops the notes left without a note on or off
+static void Score_loadXmlMessage(Score* self, xmlTextReaderPtr reader, XmlLoadState* state) {
+    BlockMessage blockMessage = {0};
+    blockMessage.type = getXmlReaderAttributeInt(reader, XMLATTRIB_TYPE);
+    blockMessage.pitch = getXmlReaderAttributeInt(reader, XMLATTRIB_PITCH);
+    blockMessage.velocity = getXmlReaderAttributeFloat(reader, XMLATTRIB_VELOCITY);
+
+    bool isTypeValid = blockMessage.type == MIDI_MESSAGE_TYPE_NOTEON || blockMessage.type == MIDI_MESSAGE_TYPE_NOTEOFF;
+    bool isPitchValid = blockMessage.pitch >= 0 && blockMessage.pitch <= MIDI_MESSAGE_PITCH_MAX;
+    bool hasTick = hasXmlReaderAttribute(reader, XMLATTRIB_TICK) && state->nTicksPerBeatFile > 0;
+    bool hasTime = !hasXmlReaderAttribute(reader, XMLATTRIB_TICK) && hasXmlReaderAttribute(reader, XMLATTRIB_TIME);
+    if (!isTypeValid || !isPitchValid || !(hasTick || hasTime)) {
+        state->nMessagesInvalid++;
+        return;
+    }
 
-    if (!strcmp(blockName, BLOCK_NAME_DEFAULT)) {
-        blockColorLerpWeight = 0.0;
+    if (hasTick) {
+        int tick = getXmlReaderAttributeInt(reader, XMLATTRIB_TICK);
+        blockMessage.tick = lround((double)tick * TICKS_PER_BEAT / state->nTicksPerBeatFile);
+    } else {
+        float time = getXmlReaderAttributeFloat(reader, XMLATTRIB_TIME);
+        blockMessage.tick = lround(time * Score_getBlockDurationTicks(self));
+        state->nMessagesMigrated++;
     }
 
-    Color blockColor = lerpColor(BLOCK_COLOR_DEFAULT, blockColorLerpTarget, blockColorLerpWeight);
+    if (state->nBlockMessages == state->blockMessagesSize) {
+        state->blockMessagesSize = state->blockMessagesSize ? 2 * state->blockMessagesSize : XML_LOAD_MESSAGES_SIZE_INITIAL;
+        state->blockMessages = erealloc(state->blockMessages, state->blockMessagesSize, sizeof(BlockMessage));
+    }
+    state->blockMessages[state->nBlockMessages++] = blockMessage;
+}
 
-    char hexColor[HEX_COLOR_BUFFER_SIZE] = {0};
-    unsigned int r = 255.0f * blockColor.r;
-    unsigned int g = 255.0f * blockColor.g;
-    unsigned int b = 255.0f * blockColor.b;
-    snprintf(hexColor, HEX_COLOR_BUFFER_SIZE, "%02X%02X%02X", r, g, b);
-    setXmlNodePropertyString(nodeBlockDef, XMLATTRIB_COLOR, hexColor);
 
-    return nodeBlockDef;
+static void Score_loadFromBinaryFile(Score* self) {
+    int fileDescriptor = open(self->filename, O_RDONLY);
+    Log_assert(fileDescriptor != -1, "File '%s' could not be opened", self->filename);
+
+    struct stat fileStat;
+    Log_assert(fstat(fileDescriptor, &fileStat) == 0, "File '%s' could not be read", self->filename);
+    size_t dataSize = fileStat.st_size;
+    Log_assert(dataSize >= sizeof(BinaryHeader), "File '%s' is too small to be a binary score", self->filename);
+
+    const char* data = mmap(NULL, dataSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    Log_assert(data != MAP_FAILED, "File '%s' could not be mapped", self->filename);
+    close(fileDescriptor);
+
+    const BinaryHeader* header = (const BinaryHeader*)data;
+    Log_assert(!memcmp(header->magic, BINARY_FORMAT_MAGIC, sizeof(header->magic)), "File '%s' is not a binary score", self->filename);
+    Log_assert(header->formatVersion == BINARY_FORMAT_VERSION, "Unsupported binary score version %u (expected %d)", header->formatVersion, BINARY_FORMAT_VERSION);
+    Log_assert(header->ticksPerBeat == TICKS_PER_BEAT, "Unsupported binary score resolution %u (expected %d ticks per beat)", header->ticksPerBeat, TICKS_PER_BEAT);
+
+    const BinaryBlockDef* blockDefs = getBinaryTable(data, dataSize, header->blockDefsOffset, header->nBlockDefs, sizeof(BinaryBlockDef));
+    const BinaryNote* notes = getBinaryTable(data, dataSize, header->notesOffset, header->nNotes, sizeof(BinaryNote));
+    const BinaryTrack* tracks = getBinaryTable(data, dataSize, header->tracksOffset, header->nTracks, sizeof(BinaryTrack));
+    const BinaryBlock* blocks = getBinaryTable(data, dataSize, header->blocksOffset, header->nBlocks, sizeof(BinaryBlock));
+    const char* strings = getBinaryTable(data, dataSize, header->stringsOffset, header->stringsSize, sizeof(char));
+    Log_assert(header->stringsSize > 0 && strings[header->stringsSize - 1] == '\0', "Unterminated binary score string table");
+
+    self->version = estrdup(getBinaryString(strings, header->stringsSize, header->versionString));
+    self->tempoBpm = header->tempoBpm;
+    Log_assert(self->tempoBpm > 0, "Invalid tempo BPM %d", self->tempoBpm);
+    self->nBeatsPerMeasure = header->nBeatsPerMeasure;
+    Log_assert(self->nBeatsPerMeasure > 0, "Invalid beats per measure %d", self->nBeatsPerMeasure);
+
+    const char* keySignatureName = getBinaryString(strings, header->stringsSize, header->keySignatureString);
+    self->iKeySignature = getKeySignatureIndex(keySignatureName);
+    Log_assert(self->iKeySignature >= 0, "Invalid key signature name: '%s'", keySignatureName);
+
+    if (header->metadataString != BINARY_STRING_NONE) {
+        const char* metadata = getBinaryString(strings, header->stringsSize, header->metadataString);
+        xmlDocPtr xmlDocMetadata = xmlReadMemory(metadata, strlen(metadata), NULL, XML_ENCODING, 0);
+        Log_assert(xmlDocMetadata, "Could not parse %s of binary score", XMLNODE_METADATA);
+        self->nodeMetadata = xmlCopyNode(xmlDocGetRootElement(xmlDocMetadata), 1);
+        Log_assert(self->nodeMetadata, "Error when copying %s xml node", XMLNODE_METADATA);
+        xmlFreeDoc(xmlDocMetadata);
+    }
 
-}
+    for (uint32_t iBlockDef = 0; iBlockDef < header->nBlockDefs; iBlockDef++) {
+        const BinaryBlockDef* binaryBlockDef = &blockDefs[iBlockDef];
+        const char* blockName = getBinaryString(strings, header->stringsSize, binaryBlockDef->nameString);
+        Log_assert(strlen(blockName) <= BLOCK_NAME_LENGTH_MAX, "Block name '%s' is too long", blockName);
+        Log_assert(!Score_blockDefExists(self, blockName), "Duplicate block definition '%s'", blockName);
+        const char* hexColor = getBinaryString(strings, header->stringsSize, binaryBlockDef->colorString);
+
+        BlockDef* blockDef = BlockDef_new(blockName, hexColor);
+        Score_addBlockDef(self, blockDef);
+
+        Log_assert(binaryBlockDef->iNoteFirst <= header->nNotes && binaryBlockDef->nNotes <= header->nNotes - binaryBlockDef->iNoteFirst, "Notes of block '%s' out of range", blockName);
+        for (uint32_t iNote = binaryBlockDef->iNoteFirst; iNote < binaryBlockDef->iNoteFirst + binaryBlockDef->nNotes; iNote++) {
+            const BinaryNote* note = &notes[iNote];
+            Log_assert(note->pitch >= 0 && note->pitch <= MIDI_MESSAGE_PITCH_MAX, "Invalid MIDI pitch %d", note->pitch);
+            Log_assert(note->tick >= 0 && note->duration > 0, "Invalid note at tick %d with duration %d", note->tick, note->duration);
+            BlockDef_addNote(blockDef, note->pitch, note->tick, note->tick + note->duration, note->velocity);
+        }
+    }
 
+    for (uint32_t iBinaryTrack = 0; iBinaryTrack < header->nTracks; iBinaryTrack++) {
+        const BinaryTrack* binaryTrack = &tracks[iBinaryTrack];
+        Track* track = Score_createNewTrack(self);
+        int iTrack = self->nTracks - 1;
+
+        sfree((void**)&track->program);
+        track->program = estrdup(getBinaryString(strings, header->stringsSize, binaryTrack->programString));
+        track->velocity = binaryTrack->velocity;
+        track->ignoreNoteOff = binaryTrack->ignoreNoteOff;
+
+        Log_assert(binaryTrack->nBlocks <= SCORE_LENGTH_MAX, "Track %d is longer than %d time slots", iTrack, SCORE_LENGTH_MAX);
+        Log_assert(binaryTrack->iBlockFirst <= header->nBlocks && binaryTrack->nBlocks <= header->nBlocks - binaryTrack->iBlockFirst, "Blocks of track %d out of range", iTrack);
+        for (uint32_t iTimeSlot = 0; iTimeSlot < binaryTrack->nBlocks; iTimeSlot++) {
+            const BinaryBlock* block = &blocks[binaryTrack->iBlockFirst + iTimeSlot];
+            if (block->iBlockDef == BINARY_BLOCKDEF_NONE) {
+                continue;
+            }
+            Log_assert(block->iBlockDef >= 0 && block->iBlockDef < self->nBlockDefs, "Invalid block definition index %d", block->iBlockDef);
 
-static xmlNodePtr Score_createNewTrack(Score* self) {
-    xmlNodePtr nodeTrack = xmlNewChild(self->nodeTracks, NULL, BAD_CAST XMLNODE_TRACK, NULL);
+            BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+            blockSlot->blockDef = self->blockDefs[block->iBlockDef];
+            blockSlot->velocity = block->velocity;
+            track->nTimeSlotsUsed = iTimeSlot + 1;
+        }
 
-    char buffer[XML_BUFFER_SIZE] = {0};
-    setXmlNodePropertyString(nodeTrack, XMLATTRIB_PROGRAM, SYNTH_PROGRAM_NAME_DEFAULT);
-    snprintf(buffer, XML_BUFFER_SIZE, "%f", TRACK_VELOCITY_DEFAULT);
-    setXmlNodePropertyString(nodeTrack, XMLATTRIB_VELOCITY, buffer);
-    snprintf(buffer, XML_BUFFER_SIZE, "%d", 0);
-    setXmlNodePropertyString(nodeTrack, XMLATTRIB_IGNORENOTEOFF, buffer);
+        Timeline_invalidateTrack(self->timeline, iTrack);
+    }
 
-    return nodeTrack;
+    munmap((void*)data, dataSize);
 }
 
 
-static void Score_requestBlockDefNotes(Score* self, xmlNodePtr nodeBlockDef) {
-    if (!nodeBlockDef) {
-        return;
+// The pruned score flattened into the tables of the binary format. It owns
+// copies of everything it refers to, so it can be written while editing goes on.
+static ScoreSnapshot* Score_createSnapshot(Score* self) {
+    ScoreSnapshot* snapshot = ecalloc(1, sizeof(*snapshot));
+    BinaryHeader* header = &snapshot->header;
+
+    bool* isBlockDefSaved = Score_findBlockDefsToSave(self);
+    int* iBinaryBlockDefs = ecalloc(self->nBlockDefs, sizeof(int));
+
+    memcpy(header->magic, BINARY_FORMAT_MAGIC, sizeof(header->magic));
+    header->formatVersion = BINARY_FORMAT_VERSION;
+    header->ticksPerBeat = TICKS_PER_BEAT;
+    header->tempoBpm = self->tempoBpm;
+    header->nBeatsPerMeasure = self->nBeatsPerMeasure;
+
+    header->keySignatureString = addBinaryString(&snapshot->strings, &snapshot->stringsSize, KEY_SIGNATURE_NAMES[self->iKeySignature]);
+    header->versionString = addBinaryString(&snapshot->strings, &snapshot->stringsSize, self->version);
+    header->metadataString = BINARY_STRING_NONE;
+    if (self->nodeMetadata) {
+        xmlBufferPtr xmlBuffer = xmlBufferCreate();
+        xmlNodeDump(xmlBuffer, NULL, self->nodeMetadata, 0, 0);
+        header->metadataString = addBinaryString(&snapshot->strings, &snapshot->stringsSize, (const char*)xmlBufferContent(xmlBuffer));
+        xmlBufferFree(xmlBuffer);
     }
 
-    for (xmlNodePtr nodeMessage = nodeBlockDef->children; nodeMessage; nodeMessage = nodeMessage->next) {
-        if (nodeMessage->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_MESSAGE, (char*)nodeMessage->name)) {
-            int midiMessageType = getXmlNodePropertyInt(nodeMessage, XMLATTRIB_TYPE);
-            if (midiMessageType != MIDI_MESSAGE_TYPE_NOTEON) {
-                continue;
-            }
-            int midiMessagePitch = getXmlNodePropertyInt(nodeMessage, XMLATTRIB_PITCH);
-            float midiMessageTime = getXmlNodePropertyFloat(nodeMessage, XMLATTRIB_TIME);
-            for (xmlNodePtr nodeMessageOther = nodeMessage; nodeMessageOther; nodeMessageOther = nodeMessageOther->next) {
-                if (nodeMessageOther->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_MESSAGE, (char*)nodeMessageOther->name)) {
-                    int midiMessageTypeOther = getXmlNodePropertyInt(nodeMessageOther, XMLATTRIB_TYPE);
-                    if (midiMessageTypeOther != MIDI_MESSAGE_TYPE_NOTEOFF) {
-                        continue;
-                    }
-                    int midiMessagePitchOther = getXmlNodePropertyInt(nodeMessageOther, XMLATTRIB_PITCH);
-                    if (midiMessagePitchOther != midiMessagePitch) {
-                        continue;
-                    }
-                    float midiMessageTimeOther = getXmlNodePropertyFloat(nodeMessageOther, XMLATTRIB_TIME);
-                    Log_assert(midiMessageTimeOther > midiMessageTime, "Midi messages unordered? (expected %f > %f)", midiMessageTimeOther, midiMessageTime);
-
-                    Note note = createNoteFromXmlNodes(nodeMessage, nodeMessageOther);
-                    Event_post(self, EVENT_NOTE_ADDED, &note, sizeof(note));
-
-                    break;
-                }
-            }
+    size_t nNotes = 0;
+    for (int iBlockDef = 0; iBlockDef < self->nBlockDefs; iBlockDef++) {
+        if (isBlockDefSaved[iBlockDef]) {
+            iBinaryBlockDefs[iBlockDef] = header->nBlockDefs;
+            header->nBlockDefs++;
+            nNotes += BlockDef_countNotes(self->blockDefs[iBlockDef]);
         }
     }
-}
 
+    snapshot->blockDefs = ecalloc(header->nBlockDefs, sizeof(BinaryBlockDef));
+    snapshot->notes = ecalloc(nNotes, sizeof(BinaryNote));
+    for (int iBlockDef = 0; iBlockDef < self->nBlockDefs; iBlockDef++) {
+        if (!isBlockDefSaved[iBlockDef]) {
+            continue;
+        }
 
-static bool Score_blockDefExists(Score* self, const char* blockName) {
-    for (xmlNodePtr nodeBlockDef = self->nodeBlockDefs->children; nodeBlockDef; nodeBlockDef = nodeBlockDef->next) {
-        if (nodeBlockDef->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCKDEF, (char*)nodeBlockDef->name)) {
-            const char* xmlBlockDefName = getXmlNodePropertyString(nodeBlockDef, XMLATTRIB_NAME);
-            bool matches = !strcmp(xmlBlockDefName, blockName);
-            sfree((void**)&xmlBlockDefName);
-            if (matches) {
-                return true;
+        BlockDef* blockDef = self->blockDefs[iBlockDef];
+        BinaryBlockDef* binaryBlockDef = &snapshot->blockDefs[iBinaryBlockDefs[iBlockDef]];
+        binaryBlockDef->nameString = addBinaryString(&snapshot->strings, &snapshot->stringsSize, BlockDef_getName(blockDef));
+        binaryBlockDef->colorString = addBinaryString(&snapshot->strings, &snapshot->stringsSize, BlockDef_getHexColor(blockDef));
+        binaryBlockDef->iNoteFirst = header->nNotes;
+
+        for (int pitch = 0; pitch < MIDI_MESSAGE_PITCH_COUNT; pitch++) {
+            size_t nNotesWithPitch = BlockDef_countNotesWithPitch(blockDef, pitch);
+            for (size_t iNote = 0; iNote < nNotesWithPitch; iNote++) {
+                Note note = BlockDef_getNoteWithPitch(blockDef, pitch, iNote);
+                snapshot->notes[header->nNotes] = (BinaryNote){note.pitch, note.tick, note.duration, note.velocity};
+                header->nNotes++;
             }
         }
+        binaryBlockDef->nNotes = header->nNotes - binaryBlockDef->iNoteFirst;
     }
-    return false;
-}
 
+    header->nTracks = Score_countTracksToSave(self);
+    size_t nBlocks = 0;
+    for (uint32_t iTrack = 0; iTrack < header->nTracks; iTrack++) {
+        nBlocks += Score_countTimeSlotsToSave(self, iTrack);
+    }
 
-static xmlNodePtr Score_getNodeBlockDefByName(Score* self, const char* blockName) {
-    for (xmlNodePtr nodeBlockDef = self->nodeBlockDefs->children; nodeBlockDef; nodeBlockDef = nodeBlockDef->next) {
-        if (nodeBlockDef->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCKDEF, (char*)nodeBlockDef->name)) {
-            const char* xmlBlockDefName = getXmlNodePropertyString(nodeBlockDef, XMLATTRIB_NAME);
-            bool matches = !strcmp(xmlBlockDefName, blockName);
-            sfree((void**)&xmlBlockDefName);
-            if (matches) {
-                return nodeBlockDef;
+    snapshot->tracks = ecalloc(header->nTracks, sizeof(BinaryTrack));
+    snapshot->blocks = ecalloc(nBlocks, sizeof(BinaryBlock));
+    for (uint32_t iTrack = 0; iTrack < header->nTracks; iTrack++) {
+        int nTimeSlots = Score_countTimeSlotsToSave(self, iTrack);
+        Track* track = &self->tracks[iTrack];
+        snapshot->tracks[iTrack] = (BinaryTrack){
+            .programString = addBinaryString(&snapshot->strings, &snapshot->stringsSize, track->program),
+            .velocity = track->velocity,
+            .ignoreNoteOff = track->ignoreNoteOff,
+            .iBlockFirst = header->nBlocks,
+            .nBlocks = nTimeSlots,
+        };
+
+        for (int iTimeSlot = 0; iTimeSlot < nTimeSlots; iTimeSlot++) {
+            BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+            snapshot->blocks[header->nBlocks] = (BinaryBlock){BINARY_BLOCKDEF_NONE, 0.0f};
+            if (blockSlot->blockDef) {
+                int iBlockDef = BlockDef_getIndex(blockSlot->blockDef);
+                snapshot->blocks[header->nBlocks] = (BinaryBlock){iBinaryBlockDefs[iBlockDef], blockSlot->velocity};
             }
+            header->nBlocks++;
         }
     }
-    Log_fatal("No such blockdef: '%s'", blockName);
-    return NULL;
-}
 
+    // Tables follow the header back to back, all entry sizes keep them aligned
+    size_t offset = sizeof(BinaryHeader);
+    header->blockDefsOffset = offset;
+    offset += header->nBlockDefs * sizeof(BinaryBlockDef);
+    header->notesOffset = offset;
+    offset += header->nNotes * sizeof(BinaryNote);
+    header->tracksOffset = offset;
+    offset += header->nTracks * sizeof(BinaryTrack);
+    header->blocksOffset = offset;
+    offset += header->nBlocks * sizeof(BinaryBlock);
+    header->stringsOffset = offset;
+    header->stringsSize = snapshot->stringsSize;
+    offset += snapshot->stringsSize;
+    Log_assert(offset <= UINT32_MAX, "Score is too large for the binary format (%zu bytes)", offset);
+
+    sfree((void**)&iBinaryBlockDefs);
+    sfree((void**)&isBlockDefSaved);
+    return snapshot;
+}
 
-static void Score_updateBlockListString(Score* self) {
-    if (self->blockListString) {
-        sfree((void**)&self->blockListString);
-    }
 
-    size_t blockListStringLength = 1;  // space for null-terminator
+static void Score_startSaveJob(Score* self, const char* filename) {
+    Score_finishSaveJob(self);
 
-    for (xmlNodePtr nodeBlockDef = self->nodeBlockDefs->children; nodeBlockDef; nodeBlockDef = nodeBlockDef->next) {
-        if (nodeBlockDef->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCKDEF, (char*)nodeBlockDef->name)) {
-            const char* xmlBlockDefName = getXmlNodePropertyString(nodeBlockDef, XMLATTRIB_NAME);
-            blockListStringLength += strlen(xmlBlockDefName);
-            blockListStringLength += strlen("\n");
-            sfree((void**)&xmlBlockDefName);
-        }
-    }
+    Log_info("Saving score as '%s' in the background...", filename);
 
-    self->blockListString = ecalloc(blockListStringLength, sizeof(char));
+    SaveJob* saveJob = ecalloc(1, sizeof(*saveJob));
+    saveJob->snapshot = Score_createSnapshot(self);
+    saveJob->filename = estrdup(filename);
+    saveJob->tempFilename = getTempFilename(filename);
+    saveJob->journalSize = self->journal ? Journal_getSize(self->journal) : 0;
+    Log_assert(pthread_mutex_init(&saveJob->mutex, NULL) == 0, "Could not create save job mutex");
+    Log_assert(pthread_create(&saveJob->thread, NULL, runSaveJob, saveJob) == 0, "Could not start save thread");
 
-    for (xmlNodePtr nodeBlockDef = self->nodeBlockDefs->children; nodeBlockDef; nodeBlockDef = nodeBlockDef->next) {
-        if (nodeBlockDef->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCKDEF, (char*)nodeBlockDef->name)) {
-            const char* xmlBlockDefName = getXmlNodePropertyString(nodeBlockDef, XMLATTRIB_NAME);
-            strcat(self->blockListString, xmlBlockDefName);
-            strcat(self->blockListString, "\n");
-            sfree((void**)&xmlBlockDefName);
-        }
-    }
+    self->saveJob = saveJob;
 }
 
 
-static void Score_setActiveBlockdef(Score* self, xmlNodePtr nodeBlockDef) {
-    if (!nodeBlockDef || nodeBlockDef == self->nodeBlockDefCurrent) {
+// Waits for the running save, if any, and reports how it went. The journal
+// is checkpointed before the new file replaces the score file, so the edits
+// made while saving survive a crash at any point in between.
+static void Score_finishSaveJob(Score* self) {
+    SaveJob* saveJob = self->saveJob;
+    if (!saveJob) {
         return;
     }
 
-    self->nodeBlockDefPrev = self->nodeBlockDefCurrent;
-    self->nodeBlockDefCurrent = nodeBlockDef;
+    pthread_join(saveJob->thread, NULL);
+    pthread_mutex_destroy(&saveJob->mutex);
+    int isWritten = saveJob->isWritten;
+    bool isScoreFile = !strcmp(saveJob->filename, self->filename);
 
-    const char* blockDefName = getXmlNodePropertyString(nodeBlockDef, XMLATTRIB_NAME);
-    Log_info("Active block set: '%s'", blockDefName);
-    sfree((void**)&blockDefName);
+    if (isWritten && isScoreFile && self->journal
+        && !Journal_checkpoint(self->journal, saveJob->tempFilename, saveJob->journalSize)) {
+        Score_closeJournal(self);
+    }
+    isWritten = isWritten && moveTempFile(saveJob->tempFilename, saveJob->filename);
+    if (isWritten && isScoreFile && self->journal
+        && !Journal_compact(self->journal, saveJob->journalSize)) {
+        Score_closeJournal(self);
+    }
 
-    const char* hexColor = getXmlNodePropertyString(self->nodeBlockDefCurrent, XMLATTRIB_COLOR);
-    Color color = parseHexColor(hexColor);
+    freeSnapshot(&saveJob->snapshot);
+    sfree((void**)&saveJob->tempFilename);
+    sfree((void**)&saveJob->filename);
+    sfree((void**)&self->saveJob);
 
-    Event_post(self, EVENT_ACTIVE_BLOCK_CHANGED, &color, sizeof(color));
+    Event_post(self, EVENT_SCORE_SAVED, &isWritten, sizeof(isWritten));
+}
 
-    sfree((void**)&hexColor);
+
+// Trailing empty time slots are not saved
+static int Score_countTimeSlotsToSave(Score* self, int iTrack) {
+    int nTimeSlots = self->tracks[iTrack].nTimeSlotsUsed;
+    while (nTimeSlots > 0 && !Score_getBlockSlot(self, iTrack, nTimeSlots - 1)->blockDef) {
+        nTimeSlots--;
+    }
+    return nTimeSlots;
 }
 
 
-static MidiMessage* Score_getMidiMessagesFromBlockdef(Score* self, xmlNodePtr nodeBlockDef, float startTimeFraction, bool ignoreNoteOff, int iChannel, size_t* outAmount) {
-    float blockDurationSeconds = Score_getBlockDurationSeconds(self);
+// Empty tracks in between are kept so that journaled track indices stay valid
+static int Score_countTracksToSave(Score* self) {
+    int nTracks = self->nTracks;
+    while (nTracks > 0 && !Score_countTimeSlotsToSave(self, nTracks - 1)) {
+        nTracks--;
+    }
+    return nTracks;
+}
 
-    size_t nMidiMessages = 0;
-    for (xmlNodePtr nodeMessage = nodeBlockDef->children; nodeMessage; nodeMessage = nodeMessage->next) {
-        if (nodeMessage->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_MESSAGE, (char*)nodeMessage->name)) {
-            if (ignoreNoteOff && getXmlNodePropertyInt(nodeMessage, XMLATTRIB_TYPE) == MIDI_MESSAGE_TYPE_NOTEOFF) {
-                continue;
-            }
 
-            float midiMessageTime = getXmlNodePropertyFloat(nodeMessage, XMLATTRIB_TIME);
-            if (midiMessageTime >= startTimeFraction) {
-                nMidiMessages++;
+// Trailing empty tracks and unused blocks are not saved
+static bool* Score_findBlockDefsToSave(Score* self) {
+    bool* isBlockDefUsed = ecalloc(self->nBlockDefs, sizeof(bool));
+    int nTracks = Score_countTracksToSave(self);
+    int nEmptyTracks = self->nTracks - nTracks;
+
+    for (int iTrack = 0; iTrack < nTracks; iTrack++) {
+        int nTimeSlots = Score_countTimeSlotsToSave(self, iTrack);
+        for (int iTimeSlot = 0; iTimeSlot < nTimeSlots; iTimeSlot++) {
+            BlockDef* blockDef = Score_getBlockSlot(self, iTrack, iTimeSlot)->blockDef;
+            if (blockDef) {
+                isBlockDefUsed[BlockDef_getIndex(blockDef)] = true;
             }
         }
     }
-    MidiMessage* midiMessages = ecalloc(nMidiMessages, sizeof(MidiMessage));
-    size_t i = 0;
 
-    for (xmlNodePtr nodeMessage = nodeBlockDef->children; nodeMessage; nodeMessage = nodeMessage->next) {
-        if (nodeMessage->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_MESSAGE, (char*)nodeMessage->name)) {
-            if (ignoreNoteOff && getXmlNodePropertyInt(nodeMessage, XMLATTRIB_TYPE) == MIDI_MESSAGE_TYPE_NOTEOFF) {
-                continue;
-            }
+    if (nEmptyTracks > 0) {
+        Log_warning("Discarding %d empty instrument track(s)", nEmptyTracks);
+    }
 
-            float midiMessageTime = getXmlNodePropertyFloat(nodeMessage, XMLATTRIB_TIME);
-            if (midiMessageTime >= startTimeFraction) {
-                Log_assert(i < nMidiMessages, "index too large? (expected %zu < %zu)", i, nMidiMessages);
-                midiMessages[i].type = getXmlNodePropertyInt(nodeMessage, XMLATTRIB_TYPE);
-                midiMessages[i].channel = iChannel;
-                midiMessages[i].pitch = getXmlNodePropertyInt(nodeMessage, XMLATTRIB_PITCH);
-                midiMessages[i].velocity = (float)MIDI_MESSAGE_VELOCITY_MAX * getXmlNodePropertyFloat(nodeMessage, XMLATTRIB_VELOCITY);
-                midiMessages[i].timestampSeconds = midiMessageTime * blockDurationSeconds;
+    size_t nUnusedBlockDefs = 0;
+    for (int iBlockDef = 0; iBlockDef < self->nBlockDefs; iBlockDef++) {
+        if (!isBlockDefUsed[iBlockDef]) {
+            nUnusedBlockDefs++;
+        }
+    }
+    if (nUnusedBlockDefs > 0) {
+        Log_warning("Discarding %zu unused block definition(s):", nUnusedBlockDefs);
+    }
+    for (int iBlockDef = 0; iBlockDef < self->nBlockDefs; iBlockDef++) {
+        if (!isBlockDefUsed[iBlockDef]) {
+            BlockDef* blockDef = self->blockDefs[iBlockDef];
+            Log_warning("    %s (%zu midi messages)", BlockDef_getName(blockDef), 2 * BlockDef_countNotes(blockDef));
+        }
+    }
 
-                i++;
-            }
+    return isBlockDefUsed;
+}
+
+
+static void Score_replayJournal(Score* self, Journal* journal) {
+    size_t nEntries = 0;
+    JournalEntry entry;
+    while (Journal_readEntry(journal, &entry)) {
+        if (!Score_isJournalEntryValid(&entry)) {
+            Log_warning("Journal entry %zu (type %d) is out of range, discarding it and the rest of the journal", nEntries + 1, entry.type);
+            Journal_discardFromLastEntry(journal);
+            break;
         }
+        Score_applyJournalEntry(self, &entry);
+        nEntries++;
     }
 
-    sortMidiMessages(midiMessages, nMidiMessages);
+    if (nEntries > 0) {
+        Log_info("Recovered %zu unsaved edit(s) from the journal", nEntries);
+    }
+}
 
-    *outAmount = nMidiMessages;
-    return midiMessages;
+
+// The journal is checksummed, but a bug or a hand-edited file could still
+// hold entries that the asserting score functions must never see. Anything
+// the user interface could not have produced is rejected.
+static bool Score_isJournalEntryValid(const JournalEntry* entry) {
+    bool isNameValid = entry->name && strlen(entry->name) > 0 && strlen(entry->name) <= BLOCK_NAME_LENGTH_MAX;
+    bool isTrackValid = entry->iTrack >= 0 && entry->iTrack < N_SYNTH_TRACKS;
+    bool isVelocityValid = isfinite(entry->velocity) && entry->velocity >= 0.0f;
+
+    switch (entry->type) {
+        case JOURNAL_ENTRY_ADD_NOTE:
+            return isNameValid && isVelocityValid
+                && entry->pitch >= 0 && entry->pitch <= MIDI_MESSAGE_PITCH_MAX
+                && entry->tick >= 0 && entry->tickEnd > entry->tick;
+        case JOURNAL_ENTRY_REMOVE_NOTES:
+            return isNameValid
+                && entry->pitch >= 0 && entry->pitch <= MIDI_MESSAGE_PITCH_MAX
+                && entry->tick >= 0 && entry->tickEnd >= entry->tick;
+        case JOURNAL_ENTRY_ADD_BLOCK_INSTANCE:
+            return isNameValid && isTrackValid && isVelocityValid
+                && entry->iTimeSlot >= 0 && entry->iTimeSlot < SCORE_LENGTH_MAX;
+        case JOURNAL_ENTRY_REMOVE_BLOCK_INSTANCE:
+            return isTrackValid && entry->iTimeSlot >= 0 && entry->iTimeSlot < SCORE_LENGTH_MAX;
+        case JOURNAL_ENTRY_CREATE_BLOCKDEF:
+        case JOURNAL_ENTRY_SET_BLOCKDEF_COLOR:
+            return isNameValid && entry->text && isHexColor(entry->text);
+        case JOURNAL_ENTRY_RENAME_BLOCKDEF:
+            return isNameValid && entry->text && strlen(entry->text) > 0 && strlen(entry->text) <= BLOCK_NAME_LENGTH_MAX;
+        case JOURNAL_ENTRY_SET_TEMPO:
+            return entry->value > 0;
+        case JOURNAL_ENTRY_SET_KEY_SIGNATURE:
+            return entry->value >= 0 && entry->value < KEY_SIGNATURE_COUNT;
+        case JOURNAL_ENTRY_SET_TRACK_VELOCITY:
+            return isTrackValid && isVelocityValid;
+        case JOURNAL_ENTRY_SET_TRACK_IGNORE_NOTEOFF:
+            return isTrackValid && (entry->value == 0 || entry->value == 1);
+        case JOURNAL_ENTRY_SET_TRACK_PROGRAM:
+            return isTrackValid && entry->text && strlen(entry->text) > 0 && strlen(entry->text) < SYNTH_PROGRAM_CHANGE_NAME_BUFFER_SIZE;
+        default:
+            return false;
+    }
 }
 
 
-static float Score_getBlockDurationSeconds(Score* self) {
-    int tempoBpm = getXmlNodePropertyInt(self->nodeScore, XMLATTRIB_TEMPO);
-    Log_assert(tempoBpm > 0, "Expected tempo BPM to be larger than 0, but was %d", tempoBpm);
+static void Score_applyJournalEntry(Score* self, const JournalEntry* entry) {
+    switch (entry->type) {
+        case JOURNAL_ENTRY_ADD_NOTE:
+            Score_addNoteToBlockDef(self, Score_getOrCreateBlockDef(self, entry->name), entry->pitch, entry->tick, entry->tickEnd - entry->tick, entry->velocity);
+            break;
+        case JOURNAL_ENTRY_REMOVE_NOTES:;
+            size_t nNotesRemoved = 0;
+            Note* notesRemoved = Score_removeNotesFromBlockDef(self, Score_getOrCreateBlockDef(self, entry->name), entry->pitch, entry->tick, entry->tickEnd, &nNotesRemoved);
+            sfree((void**)&notesRemoved);
+            break;
+        case JOURNAL_ENTRY_ADD_BLOCK_INSTANCE:
+            Score_placeBlockInstance(self, entry->iTrack, entry->iTimeSlot, Score_getOrCreateBlockDef(self, entry->name), entry->velocity);
+            break;
+        case JOURNAL_ENTRY_REMOVE_BLOCK_INSTANCE:
+            Score_clearBlockInstance(self, entry->iTrack, entry->iTimeSlot);
+            break;
+        case JOURNAL_ENTRY_CREATE_BLOCKDEF:
+            if (!Score_blockDefExists(self, entry->name)) {
+                Score_addBlockDef(self, BlockDef_new(entry->name, entry->text));
+            }
+            break;
+        case JOURNAL_ENTRY_SET_BLOCKDEF_COLOR:
+            Score_setBlockDefColor(self, Score_getOrCreateBlockDef(self, entry->name), entry->text);
+            break;
+        case JOURNAL_ENTRY_RENAME_BLOCKDEF:
+            if (Score_blockDefExists(self, entry->name) && !Score_blockDefExists(self, entry->text)) {
+                Score_renameBlockDef(self, Score_getBlockDefByName(self, entry->name), entry->text);
+            }
+            break;
+        case JOURNAL_ENTRY_SET_TEMPO:
+            self->tempoBpm = entry->value;
+            break;
+        case JOURNAL_ENTRY_SET_KEY_SIGNATURE:
+            Score_setKeySignature(self, entry->value);
+            break;
+        case JOURNAL_ENTRY_SET_TRACK_VELOCITY:
+            Score_setTrackVelocity(self, entry->iTrack, entry->velocity);
+            break;
+        case JOURNAL_ENTRY_SET_TRACK_IGNORE_NOTEOFF:
+            Score_setTrackIgnoreNoteOff(self, entry->iTrack, entry->value);
+            break;
+        case JOURNAL_ENTRY_SET_TRACK_PROGRAM:
+            Score_setTrackProgram(self, entry->iTrack, entry->text);
+            break;
+        default:
+            Log_warning("Skipping unknown journal entry type %d", entry->type);
+            break;
+    }
+}
 
-    int nBeatsPerMeasure = getXmlNodePropertyInt(self->nodeScore, XMLATTRIB_BEATSPERMEASURE);
-    Log_assert(nBeatsPerMeasure > 0, "Expected beats per measure to be larger than 0, but was %d", nBeatsPerMeasure);
 
-    return (float)(N_BLOCK_MEASURES * nBeatsPerMeasure * SECONDS_PER_MINUTE) / (float)tempoBpm;
+// Large journals are folded into the score file by a background save
+static void Score_appendJournalEntry(Score* self, const JournalEntry* entry) {
+    if (!self->journal) {
+        return;
+    }
+
+    if (!Journal_append(self->journal, entry)) {
+        Score_closeJournal(self);
+        return;
+    }
+    Score_syncJournal(self);
+    if (self->journal && Journal_getSize(self->journal) > JOURNAL_COMPACT_SIZE && !self->saveJob) {
+        Score_startSaveJob(self, self->filename);
+    }
+}
+
+
+// Edits grouped for undo are synced to disk once, when the group ends
+static void Score_syncJournal(Score* self) {
+    if (!self->journal || (self->history && History_isGroupOpen(self->history))) {
+        return;
+    }
+
+    if (!Journal_sync(self->journal)) {
+        Score_closeJournal(self);
+    }
 }
 
 
-static xmlNodePtr findXmlNodeByName(xmlNodePtr node, const char* const nodeName) {
-    while (node) {
-        if (node->type == XML_ELEMENT_NODE && !strcmp((const char*)node->name, nodeName)) {
-            return node;
+// Called once the journal failed, the score keeps working without one
+static void Score_closeJournal(Score* self) {
+    Log_warning("Continuing without a journal, unsaved edits are lost on a crash");
+    Journal_free(&self->journal);
+}
+
+
+// Undo keeps the inverse of each edit rather than copies of the score, so
+// its memory use follows the size of the edits
+static void Score_recordEdit(Score* self, const JournalEntry* redoEntry, const JournalEntry* undoEntry) {
+    if (!self->history) {
+        return;
+    }
+    History_record(self->history, redoEntry, undoEntry);
+}
+
+
+static void Score_applyHistoryEntries(Score* self, const JournalEntry* entries, size_t nEntries) {
+    Score_beginEditGroup(self);
+    for (size_t iEntry = 0; iEntry < nEntries; iEntry++) {
+        const JournalEntry* entry = &entries[iEntry];
+
+        // Show the block being changed
+        if (entry->type == JOURNAL_ENTRY_ADD_NOTE || entry->type == JOURNAL_ENTRY_REMOVE_NOTES) {
+            Score_setActiveBlockdef(self, Score_getOrCreateBlockDef(self, entry->name));
         }
 
-        xmlNodePtr result = findXmlNodeByName(node->children, nodeName);
-        if (result) {
-            return result;
+        Score_applyJournalEntry(self, entry);
+        Score_appendJournalEntry(self, entry);
+
+        if (entry->type == JOURNAL_ENTRY_SET_TRACK_PROGRAM) {
+            SynthProgramChange synthProgramChange = {0};
+            snprintf(synthProgramChange.name, SYNTH_PROGRAM_CHANGE_NAME_BUFFER_SIZE, "%s", entry->text);
+            synthProgramChange.iChannel = entry->iTrack + 1;
+            Event_post(self, EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT, &synthProgramChange, sizeof(synthProgramChange));
         }
+    }
+    Score_endEditGroup(self);
+}
+
+
+static void Score_addNoteToBlockDef(Score* self, BlockDef* blockDef, int pitch, int tick, int duration, float velocity) {
+    size_t nNotesRemoved = 0;
+    Note* notesRemoved = Score_takeNotesFromBlockDef(self, blockDef, pitch, tick, tick + duration, &nNotesRemoved);
 
-        node = node->next;
+    Note note = BlockDef_addNote(blockDef, pitch, tick, tick + duration, velocity);
+    Score_invalidateTimelineTracksWithBlockDef(self, blockDef);
+    Score_changePlayingNotes(self, blockDef, notesRemoved, nNotesRemoved, &note, 1);
+    sfree((void**)&notesRemoved);
+    if (blockDef == self->blockDefCurrent) {
+        Event_post(self, EVENT_NOTE_ADDED, &note, sizeof(note));
     }
-    return NULL;
 }
 
 
-static Note createNoteFromXmlNodes(xmlNodePtr nodeMessageOn, xmlNodePtr nodeMessageOff) {
-    int messageOnType = getXmlNodePropertyInt(nodeMessageOn, XMLATTRIB_TYPE);
-    Log_assert(messageOnType == MIDI_MESSAGE_TYPE_NOTEON, "Expected midi message to be of type %d, but was %d", MIDI_MESSAGE_TYPE_NOTEON, messageOnType);
+// Returns the removed notes, to be freed by the caller
+static Note* Score_removeNotesFromBlockDef(Score* self, BlockDef* blockDef, int pitch, int tickStart, int tickEnd, size_t* outAmount) {
+    Note* notesRemoved = Score_takeNotesFromBlockDef(self, blockDef, pitch, tickStart, tickEnd, outAmount);
+    Score_changePlayingNotes(self, blockDef, notesRemoved, *outAmount, NULL, 0);
+    return notesRemoved;
+}
+
+
+// As Score_removeNotesFromBlockDef(), but leaves telling the sequencer to the caller
+static Note* Score_takeNotesFromBlockDef(Score* self, BlockDef* blockDef, int pitch, int tickStart, int tickEnd, size_t* outAmount) {
+    size_t nNotesRemoved = 0;
+    Note* notesRemoved = BlockDef_removeNotes(blockDef, pitch, tickStart, tickEnd, &nNotesRemoved);
+    if (nNotesRemoved > 0) {
+        Score_invalidateTimelineTracksWithBlockDef(self, blockDef);
+    }
+
+    for (size_t i = 0; i < nNotesRemoved && blockDef == self->blockDefCurrent; i++) {
+        Event_post(self, EVENT_NOTE_REMOVED, &notesRemoved[i], sizeof(notesRemoved[i]));
+    }
+
+    *outAmount = nNotesRemoved;
+    return notesRemoved;
+}
+
+
+static void Score_placeBlockInstance(Score* self, int iTrack, int iTimeSlot, BlockDef* blockDef, float velocity) {
+    Log_assert(iTrack >= 0, "Invalid track index %d", iTrack);
+    Log_assert(iTimeSlot >= 0 && iTimeSlot < SCORE_LENGTH_MAX, "Invalid time slot index %d", iTimeSlot);
 
-    int messageOffType = getXmlNodePropertyInt(nodeMessageOff, XMLATTRIB_TYPE);
-    Log_assert(messageOffType == MIDI_MESSAGE_TYPE_NOTEOFF, "Expected midi message to be of type %d, but was %d", MIDI_MESSAGE_TYPE_NOTEOFF, messageOffType);
+    size_t nMidiMessagesRemoved = 0;
+    MidiMessage* midiMessagesRemoved = Score_getPlayingTimeSlotMidiMessages(self, iTrack, iTimeSlot, &nMidiMessagesRemoved);
+    Score_emptyBlockSlot(self, iTrack, iTimeSlot);
 
-    int messagePitch = getXmlNodePropertyInt(nodeMessageOn, XMLATTRIB_PITCH);
-    float messageTimeOn = getXmlNodePropertyFloat(nodeMessageOn, XMLATTRIB_TIME);
-    float messageTimeOff = getXmlNodePropertyFloat(nodeMessageOff, XMLATTRIB_TIME);
-    float messageVelocity = getXmlNodePropertyFloat(nodeMessageOn, XMLATTRIB_VELOCITY);
+    while (self->nTracks < iTrack + 1) {
+        Score_createNewTrack(self);
+    }
 
-    Note note = {
-        messagePitch,
-        messageTimeOn,
-        messageTimeOff - messageTimeOn,
-        messageVelocity,
+    Track* track = &self->tracks[iTrack];
+    track->nTimeSlotsUsed = Math_max(track->nTimeSlotsUsed, iTimeSlot + 1);
+
+    BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+    blockSlot->blockDef = blockDef;
+    blockSlot->velocity = velocity;
+    Score_updateTimelineTimeSlot(self, iTrack, iTimeSlot);
+
+    size_t nMidiMessagesAdded = 0;
+    MidiMessage* midiMessagesAdded = Score_getPlayingTimeSlotMidiMessages(self, iTrack, iTimeSlot, &nMidiMessagesAdded);
+    Score_changeSequence(self, midiMessagesRemoved, nMidiMessagesRemoved, midiMessagesAdded, nMidiMessagesAdded);
+    if (midiMessagesAdded) {
+        sfree((void**)&midiMessagesAdded);
+    }
+    if (midiMessagesRemoved) {
+        sfree((void**)&midiMessagesRemoved);
+    }
+
+    BlockInstance blockInstance = {
+        .iTrack = iTrack,
+        .iTimeSlot = iTimeSlot,
+        .color = BlockDef_getColor(blockDef),
     };
 
-    return note;
+    Event_post(self, EVENT_BLOCK_INSTANCE_ADDED, &blockInstance, sizeof(blockInstance));
 }
 
 
-static int getXmlNodeChildCount(xmlNodePtr node) {
-    int childCount = 0;
+static bool Score_clearBlockInstance(Score* self, int iTrack, int iTimeSlot) {
+    size_t nMidiMessagesRemoved = 0;
+    MidiMessage* midiMessagesRemoved = Score_getPlayingTimeSlotMidiMessages(self, iTrack, iTimeSlot, &nMidiMessagesRemoved);
+    bool isCleared = Score_emptyBlockSlot(self, iTrack, iTimeSlot);
+    if (midiMessagesRemoved) {
+        Score_changeSequence(self, midiMessagesRemoved, nMidiMessagesRemoved, NULL, 0);
+        sfree((void**)&midiMessagesRemoved);
+    }
+    return isCleared;
+}
 
-    for (xmlNodePtr child = node->children; child; child = child->next) {
-        if (child->type == XML_ELEMENT_NODE) {
-            childCount++;
-        }
+
+// As Score_clearBlockInstance(), but leaves telling the sequencer to the caller
+static bool Score_emptyBlockSlot(Score* self, int iTrack, int iTimeSlot) {
+    BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+    if (!blockSlot || !blockSlot->blockDef) {
+        return false;
     }
 
-    return childCount;
+    blockSlot->blockDef = NULL;
+    blockSlot->velocity = 0.0f;
+    Score_updateTimelineTimeSlot(self, iTrack, iTimeSlot);
+
+    BlockInstance blockInstance = {
+        .iTrack = iTrack,
+        .iTimeSlot = iTimeSlot,
+        .color = BlockDef_getColor(self->blockDefCurrent),
+    };
+
+    Event_post(self, EVENT_BLOCK_INSTANCE_REMOVED, &blockInstance, sizeof(blockInstance));
+    return true;
 }
 
 
-static xmlNodePtr getXmlChildNodeByIndex(xmlNodePtr node, int iChild) {
-    int i = 0;
+static void Score_setKeySignature(Score* self, int iKeySignature) {
+    Log_assert(iKeySignature >= 0 && iKeySignature < KEY_SIGNATURE_COUNT, "Invalid key signature index %d", iKeySignature);
+    self->iKeySignature = iKeySignature;
+    Event_post(self, EVENT_KEY_SIGNATURE_CHANGED, &iKeySignature, sizeof(iKeySignature));
+}
+
 
-    for (xmlNodePtr child = node->children; child; child = child->next) {
-        if (child->type == XML_ELEMENT_NODE) {
-            if (i == iChild) {
-                return child;
-            }
-            i++;
-        }
+static void Score_setBlockDefColor(Score* self, BlockDef* blockDef, const char* hexColor) {
+    BlockDef_setHexColor(blockDef, hexColor);
+    if (blockDef == self->blockDefCurrent) {
+        Color color = BlockDef_getColor(blockDef);
+        Event_post(self, EVENT_BLOCK_COLOR_CHANGED, &color, sizeof(color));
     }
+}
 
-    Log_fatal("Failed to get child xml node at index %zu", iChild);
-    return NULL;
+
+static void Score_setTrackVelocity(Score* self, int iTrack, float velocity) {
+    while (self->nTracks < iTrack + 1) {
+        Score_createNewTrack(self);
+    }
+    self->tracks[iTrack].velocity = velocity;
+    Timeline_invalidateTrack(self->timeline, iTrack);
 }
 
 
-static bool hasXmlNodeProperty(xmlNodePtr node, const char* propertyKey) {
-    char* propertyValue = (char*)xmlGetProp(node, BAD_CAST propertyKey);
-    if (propertyValue) {
-        xmlFree(propertyValue);
-        return true;
-    } else {
-        return false;
+static void Score_setTrackIgnoreNoteOff(Score* self, int iTrack, bool ignoreNoteOff) {
+    while (self->nTracks < iTrack + 1) {
+        Score_createNewTrack(self);
     }
+    self->tracks[iTrack].ignoreNoteOff = ignoreNoteOff;
+    Timeline_invalidateTrack(self->timeline, iTrack);
 }
 
 
-static const char* getXmlNodePropertyString(xmlNodePtr node, const char* propertyKey) {
-    Log_assert(node, "Cannot get property '%s' from null node", propertyKey);
-    char* propertyValue = (char*)xmlGetProp(node, BAD_CAST propertyKey);
-    Log_assert(propertyValue, "Failed to get value of XML property '%s'", propertyKey);
-    Log_assert(strlen(propertyValue) > 0, "Value of XML property '%s' is empty", propertyKey);
-    const char* propertyValueString = estrdup(propertyValue);
-    xmlFree(propertyValue);
-    return propertyValueString;
+static void Score_setTrackProgram(Score* self, int iTrack, const char* program) {
+    while (self->nTracks < iTrack + 1) {
+        Score_createNewTrack(self);
+    }
+    Track* track = &self->tracks[iTrack];
+    sfree((void**)&track->program);
+    track->program = estrdup(program);
 }
 
 
-static int getXmlNodePropertyInt(xmlNodePtr node, const char* propertyKey) {
-    const char* propertyValueString = getXmlNodePropertyString(node, propertyKey);
-    int propertyValueInt = atoi(propertyValueString);
-    sfree((void**)&propertyValueString);
-    return propertyValueInt;
+static BlockDef* Score_createNewBlockDef(Score* self, const char* blockName) {
+    Log_assert(!Score_blockDefExists(self, blockName), "Block with name '%s' already exists!", blockName);
+
+    Color blockColorLerpTarget = generateColorFromString(blockName);
+    float blockColorLerpWeight = BLOCK_NEW_COLOR_VARIATION;
+
+    if (!strcmp(blockName, BLOCK_NAME_DEFAULT)) {
+        blockColorLerpWeight = 0.0;
+    }
+
+    Color blockColor = lerpColor(BLOCK_COLOR_DEFAULT, blockColorLerpTarget, blockColorLerpWeight);
+
+    char hexColor[HEX_COLOR_BUFFER_SIZE] = {0};
+    unsigned int r = 255.0f * blockColor.r;
+    unsigned int g = 255.0f * blockColor.g;
+    unsigned int b = 255.0f * blockColor.b;
+    snprintf(hexColor, HEX_COLOR_BUFFER_SIZE, "%02X%02X%02X", r, g, b);
+
+    BlockDef* blockDef = BlockDef_new(blockName, hexColor);
+    Score_addBlockDef(self, blockDef);
+
+    return blockDef;
 }
 
 
-static float getXmlNodePropertyFloat(xmlNodePtr node, const char* propertyKey) {
-    const char* propertyValueString = getXmlNodePropertyString(node, propertyKey);
-    float propertyValueFloat = atof(propertyValueString);
-    sfree((void**)&propertyValueString);
-    return propertyValueFloat;
+static BlockDef* Score_getOrCreateBlockDef(Score* self, const char* blockName) {
+    if (Score_blockDefExists(self, blockName)) {
+        return Score_getBlockDefByName(self, blockName);
+    }
+    return Score_createNewBlockDef(self, blockName);
 }
 
 
-static void setXmlNodePropertyString(xmlNodePtr node, const char* propertyKey, const char* propertyValue) {
-    Log_assert(node, "Cannot get property '%s'='%s' on null node", propertyKey, propertyValue);
-    xmlSetProp(node, BAD_CAST propertyKey, BAD_CAST propertyValue);
+static Track* Score_createNewTrack(Score* self) {
+    self->tracks = erealloc(self->tracks, self->nTracks + 1, sizeof(Track));
+    self->blockSlots = erealloc(self->blockSlots, (self->nTracks + 1) * SCORE_LENGTH_MAX, sizeof(BlockSlot));
+    memset(&self->blockSlots[self->nTracks * SCORE_LENGTH_MAX], 0, SCORE_LENGTH_MAX * sizeof(BlockSlot));
+
+    Track* track = &self->tracks[self->nTracks];
+    self->nTracks++;
+    Timeline_addTrack(self->timeline);
+
+    track->program = estrdup(SYNTH_PROGRAM_NAME_DEFAULT);
+    track->velocity = TRACK_VELOCITY_DEFAULT;
+    track->ignoreNoteOff = false;
+    track->nTimeSlotsUsed = 0;
+
+    return track;
 }
 
 
-static void setXmlNodePropertyInt(xmlNodePtr node, const char* propertyKey, int propertyValue) {
-    char buffer[XML_BUFFER_SIZE] = {0};
-    snprintf(buffer, XML_BUFFER_SIZE, "%d", propertyValue);
-    setXmlNodePropertyString(node, propertyKey, buffer);
+static BlockSlot* Score_getBlockSlot(Score* self, int iTrack, int iTimeSlot) {
+    if (iTrack < 0 || iTrack >= self->nTracks || iTimeSlot < 0 || iTimeSlot >= SCORE_LENGTH_MAX) {
+        return NULL;
+    }
+    return &self->blockSlots[iTrack * SCORE_LENGTH_MAX + iTimeSlot];
 }
 
 
-static void setXmlNodePropertyFloat(xmlNodePtr node, const char* propertyKey, float propertyValue) {
-    char buffer[XML_BUFFER_SIZE] = {0};
-    snprintf(buffer, XML_BUFFER_SIZE, "%f", propertyValue);
-    setXmlNodePropertyString(node, propertyKey, buffer);
+static void Score_requestBlockDefNotes(Score* self, BlockDef* blockDef) {
+    if (!blockDef) {
+        return;
+    }
+
+    for (int pitch = 0; pitch < MIDI_MESSAGE_PITCH_COUNT; pitch++) {
+        size_t nNotes = BlockDef_countNotesWithPitch(blockDef, pitch);
+        for (size_t iNote = 0; iNote < nNotes; iNote++) {
+            Note note = BlockDef_getNoteWithPitch(blockDef, pitch, iNote);
+            Event_post(self, EVENT_NOTE_ADDED, &note, sizeof(note));
+        }
+    }
 }
 
 
-static void unsetXmlNodeProperty(xmlNodePtr node, const char* propertyKey) {
-    if (hasXmlNodeProperty(node, propertyKey)) {
-        xmlUnsetProp(node, BAD_CAST propertyKey);
-    } else {
-        Log_warning("Tried to remove non-existing property '%s' from xml node %p", propertyKey, (void*)node);
+static void Score_addBlockDef(Score* self, BlockDef* blockDef) {
+    const char* blockName = BlockDef_getName(blockDef);
+
+    self->blockDefs = erealloc(self->blockDefs, self->nBlockDefs + 1, sizeof(BlockDef*));
+    self->blockDefs[self->nBlockDefs] = blockDef;
+    BlockDef_setIndex(blockDef, self->nBlockDefs);
+    self->nBlockDefs++;
+
+    StringMap_addItem(self->blockDefsByName, blockName, blockDef);
+
+    Score_spliceBlockListString(self, self->blockListStringLength, 0, blockName);
+    Score_spliceBlockListString(self, self->blockListStringLength, 0, "\n");
+}
+
+
+static void Score_renameBlockDef(Score* self, BlockDef* blockDef, const char* blockNameNew) {
+    // The block list holds one line per blockdef, in blockdef order
+    size_t offset = 0;
+    for (int iBlockDef = 0; self->blockDefs[iBlockDef] != blockDef; iBlockDef++) {
+        offset += strlen(BlockDef_getName(self->blockDefs[iBlockDef])) + strlen("\n");
+    }
+    Score_spliceBlockListString(self, offset, strlen(BlockDef_getName(blockDef)), blockNameNew);
+
+    StringMap_removeItem(self->blockDefsByName, BlockDef_getName(blockDef));
+    StringMap_addItem(self->blockDefsByName, blockNameNew, blockDef);
+
+    // Block instances refer to the blockdef itself, so they follow along
+    BlockDef_setName(blockDef, blockNameNew);
+}
+
+
+static bool Score_blockDefExists(Score* self, const char* blockName) {
+    return strlen(blockName) <= BLOCK_NAME_LENGTH_MAX && StringMap_containsItem(self->blockDefsByName, blockName);
+}
+
+
+static BlockDef* Score_getBlockDefByName(Score* self, const char* blockName) {
+    BlockDef* blockDef = NULL;
+    if (Score_blockDefExists(self, blockName)) {
+        blockDef = (BlockDef*)StringMap_getItem(self->blockDefsByName, blockName);
     }
+    Log_assert(blockDef, "No such blockdef: '%s'", blockName);
+    return blockDef;
 }
 
 
-static xmlNodePtr addMidiMessageToBlockDef(xmlNodePtr nodeBlockDef, int messageType, int pitch, float time, float velocity) {
-    xmlNodePtr nodeMessage = xmlNewNode(NULL, BAD_CAST XMLNODE_MESSAGE);
-    setXmlNodePropertyFloat(nodeMessage, XMLATTRIB_TIME, time);
-    setXmlNodePropertyInt(nodeMessage, XMLATTRIB_TYPE, messageType);
-    setXmlNodePropertyInt(nodeMessage, XMLATTRIB_PITCH, pitch);
-    setXmlNodePropertyFloat(nodeMessage, XMLATTRIB_VELOCITY, velocity);
+static void Score_spliceBlockListString(Score* self, size_t offset, size_t nCharsRemoved, const char* charsInserted) {
+    Log_assert(offset + nCharsRemoved <= self->blockListStringLength, "Block list splice out of range");
 
-    xmlNodePtr nodeMessageOtherFirst = nodeBlockDef->children;
-    xmlNodePtr nodeMessageOtherLast = nodeBlockDef->last;
+    size_t nCharsInserted = strlen(charsInserted);
+    size_t blockListStringLength = self->blockListStringLength - nCharsRemoved + nCharsInserted;
 
-    if (!nodeMessageOtherFirst || !nodeMessageOtherLast) {
-        Log_assert(!nodeMessageOtherFirst && !nodeMessageOtherLast, "Inconsistent xml children");
-        xmlAddChild(nodeBlockDef, nodeMessage);
-    } else if (compareMidiMessageNodes(nodeMessage, nodeMessageOtherFirst) < 0) {
-        xmlAddPrevSibling(nodeMessageOtherFirst, nodeMessage);
-    } else if (compareMidiMessageNodes(nodeMessage, nodeMessageOtherLast) > 0) {
-        xmlAddNextSibling(nodeMessageOtherLast, nodeMessage);
-    } else {
-        bool nodeAdded = false;
-        for (xmlNodePtr nodeMessageOther = nodeMessageOtherFirst; nodeMessageOther != nodeMessageOtherLast; nodeMessageOther = nodeMessageOther->next) {
-            if (compareMidiMessageNodes(nodeMessage, nodeMessageOther) > 0 && compareMidiMessageNodes(nodeMessage, nodeMessageOther->next) < 0) {
-                xmlAddNextSibling(nodeMessageOther, nodeMessage);
-                nodeAdded = true;
-                break;
-            }
+    if (blockListStringLength + 1 > self->blockListStringSize) {
+        while (blockListStringLength + 1 > self->blockListStringSize) {
+            self->blockListStringSize *= 2;
         }
-        Log_assert(nodeAdded, "Failed to add midi message of type %d at time %f", messageType, time);
+        self->blockListString = erealloc(self->blockListString, self->blockListStringSize, sizeof(char));
     }
 
-    return nodeMessage;
+    size_t tailLength = self->blockListStringLength - offset - nCharsRemoved;
+    memmove(&self->blockListString[offset + nCharsInserted], &self->blockListString[offset + nCharsRemoved], tailLength);
+    memcpy(&self->blockListString[offset], charsInserted, nCharsInserted);
+
+    self->blockListStringLength = blockListStringLength;
+    self->blockListString[blockListStringLength] = '\0';
 }
 
 
-static xmlDocPtr pruneScore(xmlDocPtr xmlDoc) {
-    xmlDocPtr xmlDocPruned = xmlCopyDoc(xmlDoc, 1);
-    Log_assert(xmlDocPruned, "Error when copying XML document");
+static void Score_setActiveBlockdef(Score* self, BlockDef* blockDef) {
+    if (!blockDef || blockDef == self->blockDefCurrent) {
+        return;
+    }
+
+    self->blockDefPrev = self->blockDefCurrent;
+    self->blockDefCurrent = blockDef;
+
+    Log_info("Active block set: '%s'", BlockDef_getName(blockDef));
+
+    Color color = BlockDef_getColor(self->blockDefCurrent);
+    Event_post(self, EVENT_ACTIVE_BLOCK_CHANGED, &color, sizeof(color));
+}
 
-    xmlNodePtr nodeScore = findXmlNodeByName(xmlDocGetRootElement(xmlDocPruned), XMLNODE_SCORE);
-    Log_assert(nodeScore, "%s xml node not found", XMLNODE_SCORE);
 
-    xmlNodePtr nodeBlockDefs = findXmlNodeByName(nodeScore, XMLNODE_BLOCKDEFS);
-    Log_assert(nodeBlockDefs, "%s xml node not found", XMLNODE_BLOCKDEFS);
+// The current block at preview velocity, sorted
+static MidiMessage* Score_getPreviewMidiMessages(Score* self, int iChannel, int startTick, bool ignoreNoteOff, size_t* outAmount) {
+    size_t nMidiMessages = 0;
+    MidiMessage* midiMessages = Score_getMidiMessagesFromBlockdef(self, self->blockDefCurrent, startTick, ignoreNoteOff, iChannel, &nMidiMessages);
+
+    for (size_t i = 0; i < nMidiMessages; i++) {
+        midiMessages[i].velocity = getMidiVelocity(midiMessages[i].velocity * BLOCK_VELOCITY_DEFAULT * TRACK_VELOCITY_DEFAULT);
+    }
+
+    sortMidiMessages(midiMessages, nMidiMessages);
 
-    xmlNodePtr nodeTracks = findXmlNodeByName(nodeScore, XMLNODE_TRACKS);
-    Log_assert(nodeTracks, "%s xml node not found", XMLNODE_TRACKS);
+    *outAmount = nMidiMessages;
+    return midiMessages;
+}
 
-    /* Prune empty tracks */ {
-        HashSet* emptyTracks = HashSet_new(sizeof(xmlNodePtr));
 
-        for (xmlNodePtr nodeTrack = nodeTracks->children; nodeTrack; nodeTrack = nodeTrack->next) {
-            if (nodeTrack->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_TRACK, (char*)nodeTrack->name)) {
-                HashSet_addItem(emptyTracks, &nodeTrack);
+// Notes that started before startTick and are still held are restarted at it
+static MidiMessage* Score_getMidiMessagesFromBlockdef(Score* self, BlockDef* blockDef, int startTick, bool ignoreNoteOff, int iChannel, size_t* outAmount) {
+    (void)self;
+
+    size_t nBlockMidiMessages = 0;
+    const MidiMessage* blockMidiMessages = BlockDef_getMidiMessages(blockDef, &nBlockMidiMessages);
+    size_t iBlockMidiMessageStart = searchMidiMessages(blockMidiMessages, nBlockMidiMessages, startTick);
+
+    size_t nChaseMidiMessages = 0;
+    MidiMessage* chaseMidiMessages = NULL;
+    if (iBlockMidiMessageStart > 0) {
+        size_t nNotes = 0;
+        TimelineNote* notes = getNotesFromMidiMessages(blockMidiMessages, nBlockMidiMessages, &nNotes);
+        size_t nHeldNotes = 0;
+        for (size_t i = 0; i < nNotes; i++) {
+            if (notes[i].tickOn < startTick && notes[i].tickOff > startTick) {
+                notes[nHeldNotes] = notes[i];
+                nHeldNotes++;
             }
         }
+        chaseMidiMessages = getChaseMidiMessages(notes, nHeldNotes, startTick, iChannel, ignoreNoteOff, &nChaseMidiMessages);
+        sfree((void**)&notes);
+    }
 
-        for (xmlNodePtr nodeTrack = nodeTracks->children; nodeTrack; nodeTrack = nodeTrack->next) {
-            if (nodeTrack->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_TRACK, (char*)nodeTrack->name)) {
-                for (xmlNodePtr nodeBlock = nodeTrack->children; nodeBlock; nodeBlock = nodeBlock->next) {
-                    if (nodeBlock->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCK, (char*)nodeBlock->name)) {
-                        if (hasXmlNodeProperty(nodeBlock, XMLATTRIB_NAME)) {
-                            if (HashSet_containsItem(emptyTracks, &nodeTrack)) {
-                                HashSet_removeItem(emptyTracks, &nodeTrack);
-                            }
-                        }
-                    }
-                }
-            }
+    MidiMessage* midiMessages = ecalloc(nBlockMidiMessages - iBlockMidiMessageStart + nChaseMidiMessages, sizeof(MidiMessage));
+    size_t nMidiMessages = 0;
+
+    if (chaseMidiMessages) {
+        memcpy(midiMessages, chaseMidiMessages, nChaseMidiMessages * sizeof(MidiMessage));
+        nMidiMessages = nChaseMidiMessages;
+        sfree((void**)&chaseMidiMessages);
+    }
+
+    for (size_t i = iBlockMidiMessageStart; i < nBlockMidiMessages; i++) {
+        if (ignoreNoteOff && blockMidiMessages[i].type == MIDI_MESSAGE_TYPE_NOTEOFF) {
+            continue;
         }
+        midiMessages[nMidiMessages] = blockMidiMessages[i];
+        midiMessages[nMidiMessages].channel = iChannel;
+        nMidiMessages++;
+    }
 
-        size_t nEmptyTracks = HashSet_countItems(emptyTracks);
-        if (nEmptyTracks > 0) {
-            Log_warning("Discarding %zu empty instrument track(s)", nEmptyTracks);
-            for (xmlNodePtr* emptyTrack = HashSet_iterateInit(emptyTracks); emptyTrack; emptyTrack = HashSet_iterateNext(emptyTracks, emptyTrack)) {
-                xmlUnlinkNode(*emptyTrack);
-                xmlFreeNode(*emptyTrack);
+    *outAmount = nMidiMessages;
+    return midiMessages;
+}
+
+
+// NULL unless the score is playing and the time slot holds a block
+static MidiMessage* Score_getPlayingTimeSlotMidiMessages(Score* self, int iTrack, int iTimeSlot, size_t* outAmount) {
+    *outAmount = 0;
+    BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+    if (!self->isPlayingScore || !blockSlot || !blockSlot->blockDef) {
+        return NULL;
+    }
+    return Score_getTimeSlotMidiMessages(self, iTrack, iTimeSlot, self->tracks[iTrack].ignoreNoteOff, outAmount);
+}
+
+
+// The notes of a block as the playing sequence has them, once for every time
+// slot the block plays in. NULL if the block is not playing.
+static MidiMessage* Score_getPlayingNoteMidiMessages(Score* self, BlockDef* blockDef, const Note* notes, size_t nNotes, size_t* outAmount) {
+    *outAmount = 0;
+    if (nNotes == 0) {
+        return NULL;
+    }
+
+    if (blockDef == self->blockDefPlaying) {
+        MidiMessage* midiMessages = ecalloc(2 * nNotes, sizeof(MidiMessage));
+        *outAmount = addNoteMidiMessages(midiMessages, notes, nNotes, self->iPlayingChannel, 0,
+            BLOCK_VELOCITY_DEFAULT * TRACK_VELOCITY_DEFAULT, self->isPlayingIgnoreNoteOff);
+        return midiMessages;
+    }
+    if (!self->isPlayingScore) {
+        return NULL;
+    }
+
+    int blockDurationTicks = Score_getBlockDurationTicks(self);
+    MidiMessage* midiMessages = NULL;
+    size_t nMidiMessages = 0;
+
+    for (int iTrack = 0; iTrack < self->nTracks; iTrack++) {
+        Track* track = &self->tracks[iTrack];
+        for (int iTimeSlot = 0; iTimeSlot < track->nTimeSlotsUsed; iTimeSlot++) {
+            BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+            if (blockSlot->blockDef != blockDef) {
+                continue;
             }
+            midiMessages = erealloc(midiMessages, nMidiMessages + 2 * nNotes, sizeof(MidiMessage));
+            nMidiMessages += addNoteMidiMessages(&midiMessages[nMidiMessages], notes, nNotes, iTrack + 1, iTimeSlot * blockDurationTicks,
+                blockSlot->velocity * track->velocity, track->ignoreNoteOff);
         }
+    }
+
+    *outAmount = nMidiMessages;
+    return midiMessages;
+}
+
+
+static void Score_changePlayingNotes(Score* self, BlockDef* blockDef, const Note* notesRemoved, size_t nNotesRemoved, const Note* notesAdded, size_t nNotesAdded) {
+    size_t nMidiMessagesRemoved = 0;
+    MidiMessage* midiMessagesRemoved = Score_getPlayingNoteMidiMessages(self, blockDef, notesRemoved, nNotesRemoved, &nMidiMessagesRemoved);
+    size_t nMidiMessagesAdded = 0;
+    MidiMessage* midiMessagesAdded = Score_getPlayingNoteMidiMessages(self, blockDef, notesAdded, nNotesAdded, &nMidiMessagesAdded);
 
-        HashSet_free(&emptyTracks);
+    Score_changeSequence(self, midiMessagesRemoved, nMidiMessagesRemoved, midiMessagesAdded, nMidiMessagesAdded);
+
+    if (midiMessagesAdded) {
+        sfree((void**)&midiMessagesAdded);
+    }
+    if (midiMessagesRemoved) {
+        sfree((void**)&midiMessagesRemoved);
     }
+}
 
-    /* Prune end of tracks */ {
-        HashSet* nullBlockInstances = HashSet_new(sizeof(xmlNodePtr));
 
-        for (xmlNodePtr nodeTrack = nodeTracks->children; nodeTrack; nodeTrack = nodeTrack->next) {
-            if (nodeTrack->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_TRACK, (char*)nodeTrack->name)) {
-                for (xmlNodePtr nodeBlock = nodeTrack->last; nodeBlock; nodeBlock = nodeBlock->prev) {
-                    if (nodeBlock->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCK, (char*)nodeBlock->name)) {
-                        if (hasXmlNodeProperty(nodeBlock, XMLATTRIB_NAME)) {
-                            break;
-                        } else {
-                            HashSet_addItem(nullBlockInstances, &nodeBlock);
-                        }
-                    }
-                }
-            }
+// Lets the sequencer patch the messages it has yet to play instead of
+// restarting. Messages that are both removed and added are left out, which
+// sorts the rest in place.
+static void Score_changeSequence(Score* self, MidiMessage* midiMessagesRemoved, size_t nMidiMessagesRemoved, MidiMessage* midiMessagesAdded, size_t nMidiMessagesAdded) {
+    if (nMidiMessagesRemoved > 0) {
+        sortMidiMessages(midiMessagesRemoved, nMidiMessagesRemoved);
+    }
+    if (nMidiMessagesAdded > 0) {
+        sortMidiMessages(midiMessagesAdded, nMidiMessagesAdded);
+    }
+
+    size_t iRemoved = 0;
+    size_t iAdded = 0;
+    size_t nRemovedKept = 0;
+    size_t nAddedKept = 0;
+    while (iRemoved < nMidiMessagesRemoved || iAdded < nMidiMessagesAdded) {
+        int comparison = 0;
+        if (iRemoved == nMidiMessagesRemoved) {
+            comparison = 1;
+        } else if (iAdded == nMidiMessagesAdded) {
+            comparison = -1;
+        } else {
+            comparison = compareMidiMessages(&midiMessagesRemoved[iRemoved], &midiMessagesAdded[iAdded]);
         }
 
-        for (xmlNodePtr* nullBlock = HashSet_iterateInit(nullBlockInstances); nullBlock; nullBlock = HashSet_iterateNext(nullBlockInstances, nullBlock)) {
-            xmlUnlinkNode(*nullBlock);
-            xmlFreeNode(*nullBlock);
+        if (comparison < 0) {
+            midiMessagesRemoved[nRemovedKept++] = midiMessagesRemoved[iRemoved++];
+        } else if (comparison > 0) {
+            midiMessagesAdded[nAddedKept++] = midiMessagesAdded[iAdded++];
+        } else {
+            iRemoved++;
+            iAdded++;
         }
+    }
 
-        HashSet_free(&nullBlockInstances);
-    }
-
-    /* Prune unused block defs */ {
-        StringSet* usedBlockDefNames = StringSet_new(64);
-        for (xmlNodePtr nodeTrack = nodeTracks->children; nodeTrack; nodeTrack = nodeTrack->next) {
-            if (nodeTrack->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_TRACK, (char*)nodeTrack->name)) {
-                for (xmlNodePtr nodeBlock = nodeTrack->children; nodeBlock; nodeBlock = nodeBlock->next) {
-                    if (nodeBlock->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCK, (char*)nodeBlock->name)) {
-                        if (hasXmlNodeProperty(nodeBlock, XMLATTRIB_NAME)) {
-                            const char* blockName = getXmlNodePropertyString(nodeBlock, XMLATTRIB_NAME);
-                            StringSet_addItem(usedBlockDefNames, blockName);
-                            sfree((void**)&blockName);
-                        }
-                    }
-                }
+    if (nRemovedKept == 0 && nAddedKept == 0) {
+        return;
+    }
+
+    SequenceChange sequenceChange = {
+        .nMidiMessagesRemoved = nRemovedKept,
+        .midiMessagesRemoved = midiMessagesRemoved,
+        .nMidiMessagesAdded = nAddedKept,
+        .midiMessagesAdded = midiMessagesAdded,
+    };
+    Event_post(self, EVENT_SEQUENCE_CHANGED, &sequenceChange, sizeof(sequenceChange));
+}
+
+
+static void Score_updateTimelineTimeSlot(Score* self, int iTrack, int iTimeSlot) {
+    if (!Timeline_isTrackValid(self->timeline, iTrack)) {
+        return;  // Rebuilt in full before the next playback
+    }
+
+    BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+    if (!blockSlot->blockDef) {
+        Timeline_setTimeSlot(self->timeline, iTrack, iTimeSlot, NULL, 0, NULL, 0);
+        return;
+    }
+
+    Track* track = &self->tracks[iTrack];
+    int blockDurationTicks = Score_getBlockDurationTicks(self);
+
+    size_t nMidiMessages = 0;
+    MidiMessage* midiMessages = Score_getTimeSlotMidiMessages(self, iTrack, iTimeSlot, track->ignoreNoteOff, &nMidiMessages);
+
+    // Note offs ignored by the track still end the notes for playback started in the middle of them
+    size_t nBlockMidiMessages = 0;
+    const MidiMessage* blockMidiMessages = BlockDef_getMidiMessages(blockSlot->blockDef, &nBlockMidiMessages);
+    size_t nNotes = 0;
+    TimelineNote* notes = getNotesFromMidiMessages(blockMidiMessages, nBlockMidiMessages, &nNotes);
+    for (size_t i = 0; i < nNotes; i++) {
+        notes[i].velocity = getMidiVelocity(notes[i].velocity * blockSlot->velocity * track->velocity);
+        notes[i].tickOn += iTimeSlot * blockDurationTicks;
+        notes[i].tickOff += iTimeSlot * blockDurationTicks;
+    }
+
+    Timeline_setTimeSlot(self->timeline, iTrack, iTimeSlot, midiMessages, nMidiMessages, notes, nNotes);
+    if (notes) {
+        sfree((void**)&notes);
+    }
+    sfree((void**)&midiMessages);
+}
+
+
+// The block in a time slot as the timeline plays it, sorted, with the note
+// offs left out if ignoreNoteOff. The time slot must hold a block.
+static MidiMessage* Score_getTimeSlotMidiMessages(Score* self, int iTrack, int iTimeSlot, bool ignoreNoteOff, size_t* outAmount) {
+    BlockSlot* blockSlot = Score_getBlockSlot(self, iTrack, iTimeSlot);
+    Track* track = &self->tracks[iTrack];
+    int blockDurationTicks = Score_getBlockDurationTicks(self);
+
+    size_t nBlockMidiMessages = 0;
+    const MidiMessage* blockMidiMessages = BlockDef_getMidiMessages(blockSlot->blockDef, &nBlockMidiMessages);
+
+    MidiMessage* midiMessages = ecalloc(nBlockMidiMessages, sizeof(MidiMessage));
+    size_t nMidiMessages = 0;
+
+    for (size_t i = 0; i < nBlockMidiMessages; i++) {
+        if (ignoreNoteOff && blockMidiMessages[i].type == MIDI_MESSAGE_TYPE_NOTEOFF) {
+            continue;
+        }
+
+        midiMessages[nMidiMessages] = (MidiMessage){
+            .type = blockMidiMessages[i].type,
+            .channel = iTrack + 1, // Channel 0 is editview synth channel
+            .pitch = blockMidiMessages[i].pitch,
+            .velocity = getMidiVelocity(blockMidiMessages[i].velocity * blockSlot->velocity * track->velocity),
+            .tick = iTimeSlot * blockDurationTicks + blockMidiMessages[i].tick,
+        };
+        nMidiMessages++;
+    }
+
+    *outAmount = nMidiMessages;
+    return midiMessages;
+}
+
+
+static void Score_rebuildTimelineTrack(Score* self, int iTrack) {
+    Timeline_clearTrack(self->timeline, iTrack);
+    for (int iTimeSlot = 0; iTimeSlot < self->tracks[iTrack].nTimeSlotsUsed; iTimeSlot++) {
+        Score_updateTimelineTimeSlot(self, iTrack, iTimeSlot);
+    }
+}
+
+
+static void Score_invalidateTimelineTracksWithBlockDef(Score* self, BlockDef* blockDef) {
+    for (int iTrack = 0; iTrack < self->nTracks; iTrack++) {
+        for (int iTimeSlot = 0; iTimeSlot < self->tracks[iTrack].nTimeSlotsUsed; iTimeSlot++) {
+            if (Score_getBlockSlot(self, iTrack, iTimeSlot)->blockDef == blockDef) {
+                Timeline_invalidateTrack(self->timeline, iTrack);
+                break;
             }
         }
+    }
+}
 
-        HashSet* unusedBlockDefs = HashSet_new(sizeof(xmlNodePtr));
-        for (xmlNodePtr nodeBlockDef = nodeBlockDefs->children; nodeBlockDef; nodeBlockDef = nodeBlockDef->next) {
-            if (nodeBlockDef->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_BLOCKDEF, (char*)nodeBlockDef->name)) {
-                const char* blockName = getXmlNodePropertyString(nodeBlockDef, XMLATTRIB_NAME);
-                if (!StringSet_containsItem(usedBlockDefNames, blockName)) {
-                    HashSet_addItem(unusedBlockDefs, &nodeBlockDef);
-                }
-                sfree((void**)&blockName);
+
+static float Score_getSecondsPerTick(Score* self) {
+    int tempoBpm = self->tempoBpm;
+    Log_assert(tempoBpm > 0, "Expected tempo BPM to be larger than 0, but was %d", tempoBpm);
+
+    return (float)SECONDS_PER_MINUTE / (float)(tempoBpm * TICKS_PER_BEAT);
+}
+
+
+static bool hasXmlReaderAttribute(xmlTextReaderPtr reader, const char* attributeKey) {
+    xmlChar* attributeValue = xmlTextReaderGetAttribute(reader, BAD_CAST attributeKey);
+    bool hasAttribute = attributeValue != NULL;
+    xmlFree(attributeValue);
+    return hasAttribute;
+}
+
+
+static const char* getXmlReaderAttributeString(xmlTextReaderPtr reader, const char* attributeKey) {
+    char* attributeValue = (char*)xmlTextReaderGetAttribute(reader, BAD_CAST attributeKey);
+    Log_assert(attributeValue, "Failed to get value of XML property '%s'", attributeKey);
+    Log_assert(strlen(attributeValue) > 0, "Value of XML property '%s' is empty", attributeKey);
+    const char* attributeValueString = estrdup(attributeValue);
+    xmlFree(attributeValue);
+    return attributeValueString;
+}
+
+
+static int getXmlReaderAttributeInt(xmlTextReaderPtr reader, const char* attributeKey) {
+    const char* attributeValueString = getXmlReaderAttributeString(reader, attributeKey);
+    int attributeValueInt = atoi(attributeValueString);
+    sfree((void**)&attributeValueString);
+    return attributeValueInt;
+}
+
+
+static float getXmlReaderAttributeFloat(xmlTextReaderPtr reader, const char* attributeKey) {
+    const char* attributeValueString = getXmlReaderAttributeString(reader, attributeKey);
+    float attributeValueFloat = atof(attributeValueString);
+    sfree((void**)&attributeValueString);
+    return attributeValueFloat;
+}
+
+
+static void writeXmlAttributeString(xmlTextWriterPtr writer, const char* attributeKey, const char* attributeValue) {
+    xmlTextWriterWriteAttribute(writer, BAD_CAST attributeKey, BAD_CAST attributeValue);
+}
+
+
+static void writeXmlAttributeInt(xmlTextWriterPtr writer, const char* attributeKey, int attributeValue) {
+    char buffer[XML_BUFFER_SIZE] = {0};
+    snprintf(buffer, XML_BUFFER_SIZE, "%d", attributeValue);
+    writeXmlAttributeString(writer, attributeKey, buffer);
+}
+
+
+static void writeXmlAttributeFloat(xmlTextWriterPtr writer, const char* attributeKey, float attributeValue) {
+    char buffer[XML_BUFFER_SIZE] = {0};
+    snprintf(buffer, XML_BUFFER_SIZE, "%f", attributeValue);
+    writeXmlAttributeString(writer, attributeKey, buffer);
+}
+
+
+static void writeXmlMidiMessage(xmlTextWriterPtr writer, int messageType, int pitch, int tick, float velocity) {
+    xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_MESSAGE);
+    writeXmlAttributeInt(writer, XMLATTRIB_TICK, tick);
+    writeXmlAttributeInt(writer, XMLATTRIB_TYPE, messageType);
+    writeXmlAttributeInt(writer, XMLATTRIB_PITCH, pitch);
+    writeXmlAttributeFloat(writer, XMLATTRIB_VELOCITY, velocity);
+    xmlTextWriterEndElement(writer);
+}
+
+
+// Copies a loaded subtree (the score metadata) to the writer
+static void writeXmlNode(xmlTextWriterPtr writer, xmlNodePtr node) {
+    switch (node->type) {
+        case XML_ELEMENT_NODE:
+            xmlTextWriterStartElementNS(writer, node->ns ? node->ns->prefix : NULL, node->name, NULL);
+            for (xmlNsPtr ns = node->nsDef; ns; ns = ns->next) {
+                xmlTextWriterWriteAttributeNS(writer, ns->prefix ? BAD_CAST "xmlns" : NULL, ns->prefix ? ns->prefix : BAD_CAST "xmlns", NULL, ns->href);
+            }
+            for (xmlAttrPtr attribute = node->properties; attribute; attribute = attribute->next) {
+                xmlChar* attributeValue = xmlNodeListGetString(node->doc, attribute->children, 1);
+                xmlTextWriterWriteAttributeNS(writer, attribute->ns ? attribute->ns->prefix : NULL, attribute->name, NULL, attributeValue);
+                xmlFree(attributeValue);
+            }
+            for (xmlNodePtr child = node->children; child; child = child->next) {
+                writeXmlNode(writer, child);
             }
+            xmlTextWriterEndElement(writer);
+            break;
+        case XML_TEXT_NODE:
+            xmlTextWriterWriteString(writer, node->content);
+            break;
+        case XML_CDATA_SECTION_NODE:
+            xmlTextWriterWriteCDATA(writer, node->content);
+            break;
+        case XML_COMMENT_NODE:
+            xmlTextWriterWriteComment(writer, node->content);
+            break;
+        case XML_PI_NODE:
+            xmlTextWriterWritePI(writer, node->name, node->content);
+            break;
+        default:
+            Log_warning("Skipping unsupported XML node type %d in %s", node->type, XMLNODE_METADATA);
+            break;
+    }
+}
+
+
+static BlockMessage* getBlockMessagesFromBinaryNotes(const BinaryNote* notes, size_t nNotes, size_t* outAmount) {
+    BlockMessage* blockMessages = ecalloc(2 * nNotes, sizeof(BlockMessage));
+
+    for (size_t iNote = 0; iNote < nNotes; iNote++) {
+        const BinaryNote* note = &notes[iNote];
+        blockMessages[2 * iNote] = (BlockMessage){MIDI_MESSAGE_TYPE_NOTEON, note->pitch, note->tick, note->velocity};
+        blockMessages[2 * iNote + 1] = (BlockMessage){MIDI_MESSAGE_TYPE_NOTEOFF, note->pitch, note->tick + note->duration, 0.0f};
+    }
+
+    qsort(blockMessages, 2 * nNotes, sizeof(BlockMessage), compareBlockMessages);
+
+    *outAmount = 2 * nNotes;
+    return blockMessages;
+}
+
+
+static void addBlockMessagesToBlockDef(BlockDef* blockDef, const BlockMessage* blockMessages, size_t nBlockMessages) {
+    if (!nBlockMessages) {
+        return;
+    }
+
+    // Pair each note on with the first following note off of the same pitch
+    int ticksOff[MIDI_MESSAGE_PITCH_COUNT];
+    bool hasTickOff[MIDI_MESSAGE_PITCH_COUNT] = {0};
+    int* ticksNoteOff = ecalloc(nBlockMessages, sizeof(int));
+    bool* isNoteOn = ecalloc(nBlockMessages, sizeof(bool));
+    size_t nMessagesUnmatched = 0;
+
+    for (size_t i = nBlockMessages; i > 0; i--) {
+        const BlockMessage* blockMessage = &blockMessages[i - 1];
+        int pitch = blockMessage->pitch;
+        if (blockMessage->type == MIDI_MESSAGE_TYPE_NOTEOFF) {
+            ticksOff[pitch] = blockMessage->tick;
+            hasTickOff[pitch] = true;
+        } else if (hasTickOff[pitch]) {
+            ticksNoteOff[i - 1] = ticksOff[pitch];
+            isNoteOn[i - 1] = true;
+        } else {
+            nMessagesUnmatched++;
         }
+    }
 
-        size_t nUnusedBlockDefs = HashSet_countItems(unusedBlockDefs);
-        if (nUnusedBlockDefs > 0) {
-            Log_warning("Discarding %zu unused block definition(s):", nUnusedBlockDefs);
-            for (xmlNodePtr* unusedBlockDef = HashSet_iterateInit(unusedBlockDefs); unusedBlockDef; unusedBlockDef = HashSet_iterateNext(unusedBlockDefs, unusedBlockDef)) {
-                const char* blockName = getXmlNodePropertyString(*unusedBlockDef, XMLATTRIB_NAME);
-                size_t nMidiMessages = 0;
-                for (xmlNodePtr nodeMessage = (*unusedBlockDef)->children; nodeMessage; nodeMessage = nodeMessage->next) {
-                    if (nodeMessage->type == XML_ELEMENT_NODE && !strcmp(XMLNODE_MESSAGE, (char*)nodeMessage->name)) {
-                        nMidiMessages++;
-                    }
-                }
-                Log_warning("    %s (%zu midi messages)", blockName, nMidiMessages);
-                sfree((void**)&blockName);
+    // Rounding legacy times to ticks can leave a note with no length
+    size_t nNotes = 0;
+    size_t nNotesEmpty = 0;
+    for (size_t iMessage = 0; iMessage < nBlockMessages; iMessage++) {
+        if (isNoteOn[iMessage]) {
+            const BlockMessage* blockMessage = &blockMessages[iMessage];
+            if (blockMessage->tick < 0 || ticksNoteOff[iMessage] <= blockMessage->tick) {
+                nNotesEmpty++;
+                continue;
+            }
+            BlockDef_addNote(blockDef, blockMessage->pitch, blockMessage->tick, ticksNoteOff[iMessage], blockMessage->velocity);
+            nNotes++;
+        }
+    }
+
+    nMessagesUnmatched += nBlockMessages - nMessagesUnmatched - 2 * (nNotes + nNotesEmpty);
+    if (nMessagesUnmatched > 0) {
+        Log_warning("Discarding %zu unmatched midi message(s) in block '%s'", nMessagesUnmatched, BlockDef_getName(blockDef));
+    }
+    if (nNotesEmpty > 0) {
+        Log_warning("Discarding %zu note(s) that do not end after they start in block '%s'", nNotesEmpty, BlockDef_getName(blockDef));
+    }
+
+    sfree((void**)&ticksNoteOff);
+    sfree((void**)&isNoteOn);
+}
+
+
+static bool writeSnapshotXmlFile(const ScoreSnapshot* snapshot, const char* filename) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        Log_error("Failed to write score to '%s'", filename);
+        return false;
+    }
+
+    xmlTextWriterPtr writer = xmlNewTextWriter(xmlOutputBufferCreateFile(file, NULL));
+    Log_assert(writer, "Could not create XML writer");
+    xmlTextWriterSetIndent(writer, 1);
+    xmlTextWriterSetIndentString(writer, BAD_CAST XML_INDENT_STRING);
+
+    writeSnapshotXmlDocument(snapshot, writer);
+
+    xmlTextWriterFlush(writer);
+    long bytesWritten = ftell(file);
+    bool isWritten = !ferror(file);
+    xmlFreeTextWriter(writer);
+    isWritten = fflush(file) == 0 && fsync(fileno(file)) == 0 && isWritten;
+    isWritten = fclose(file) == 0 && isWritten;
+
+    if (isWritten) {
+        Log_info("Score saved (%ld bytes).", bytesWritten);
+    } else {
+        Log_error("Failed to write score to '%s'", filename);
+    }
+    return isWritten;
+}
+
+
+// Streams the snapshot in a single pass, blockdefs before tracks
+static void writeSnapshotXmlDocument(const ScoreSnapshot* snapshot, xmlTextWriterPtr writer) {
+    const BinaryHeader* header = &snapshot->header;
+
+    xmlTextWriterStartDocument(writer, XML_VERSION, XML_ENCODING, NULL);
+
+    xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_GSCORE);
+    writeXmlAttributeString(writer, XMLATTRIB_VERSION, snapshot->strings + header->versionString);
+
+    xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_SCORE);
+    writeXmlAttributeInt(writer, XMLATTRIB_TEMPO, header->tempoBpm);
+    writeXmlAttributeInt(writer, XMLATTRIB_BEATSPERMEASURE, header->nBeatsPerMeasure);
+    writeXmlAttributeInt(writer, XMLATTRIB_TICKSPERBEAT, header->ticksPerBeat);
+    writeXmlAttributeString(writer, XMLATTRIB_KEYSIGNATURE, snapshot->strings + header->keySignatureString);
+
+    if (header->metadataString != BINARY_STRING_NONE) {
+        const char* metadata = snapshot->strings + header->metadataString;
+        xmlDocPtr xmlDocMetadata = xmlReadMemory(metadata, strlen(metadata), NULL, XML_ENCODING, 0);
+        Log_assert(xmlDocMetadata, "Could not parse %s of score snapshot", XMLNODE_METADATA);
+        writeXmlNode(writer, xmlDocGetRootElement(xmlDocMetadata));
+        xmlFreeDoc(xmlDocMetadata);
+    }
 
-                xmlUnlinkNode(*unusedBlockDef);
-                xmlFreeNode(*unusedBlockDef);
+    xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_BLOCKDEFS);
+    for (uint32_t iBlockDef = 0; iBlockDef < header->nBlockDefs; iBlockDef++) {
+        const BinaryBlockDef* blockDef = &snapshot->blockDefs[iBlockDef];
+        xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_BLOCKDEF);
+        writeXmlAttributeString(writer, XMLATTRIB_NAME, snapshot->strings + blockDef->nameString);
+        writeXmlAttributeString(writer, XMLATTRIB_COLOR, snapshot->strings + blockDef->colorString);
+
+        size_t nBlockMessages = 0;
+        BlockMessage* blockMessages = getBlockMessagesFromBinaryNotes(&snapshot->notes[blockDef->iNoteFirst], blockDef->nNotes, &nBlockMessages);
+        for (size_t i = 0; i < nBlockMessages; i++) {
+            writeXmlMidiMessage(writer, blockMessages[i].type, blockMessages[i].pitch, blockMessages[i].tick, blockMessages[i].velocity);
+        }
+        sfree((void**)&blockMessages);
+
+        xmlTextWriterEndElement(writer);
+    }
+    xmlTextWriterEndElement(writer);
+
+    xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_TRACKS);
+    for (uint32_t iTrack = 0; iTrack < header->nTracks; iTrack++) {
+        const BinaryTrack* track = &snapshot->tracks[iTrack];
+        xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_TRACK);
+        writeXmlAttributeString(writer, XMLATTRIB_PROGRAM, snapshot->strings + track->programString);
+        writeXmlAttributeFloat(writer, XMLATTRIB_VELOCITY, track->velocity);
+        writeXmlAttributeInt(writer, XMLATTRIB_IGNORENOTEOFF, track->ignoreNoteOff);
+
+        for (uint32_t iBlock = track->iBlockFirst; iBlock < track->iBlockFirst + track->nBlocks; iBlock++) {
+            const BinaryBlock* block = &snapshot->blocks[iBlock];
+            xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_BLOCK);
+            if (block->iBlockDef != BINARY_BLOCKDEF_NONE) {
+                writeXmlAttributeString(writer, XMLATTRIB_NAME, snapshot->strings + snapshot->blockDefs[block->iBlockDef].nameString);
+                writeXmlAttributeFloat(writer, XMLATTRIB_VELOCITY, block->velocity);
             }
+            xmlTextWriterEndElement(writer);
         }
 
-        StringSet_free(&usedBlockDefNames);
-        HashSet_free(&unusedBlockDefs);
+        xmlTextWriterEndElement(writer);
+    }
+    xmlTextWriterEndElement(writer);
+
+    xmlTextWriterEndDocument(writer);
+}
+
+
+static bool writeSnapshotBinaryFile(const ScoreSnapshot* snapshot, const char* filename) {
+    const BinaryHeader* header = &snapshot->header;
+    size_t fileSize = header->stringsOffset + header->stringsSize;
+
+    bool isWritten = false;
+    FILE* file = fopen(filename, "wb");
+    if (file) {
+        isWritten = fwrite(header, sizeof(*header), 1, file) == 1
+            && fwrite(snapshot->blockDefs, sizeof(BinaryBlockDef), header->nBlockDefs, file) == header->nBlockDefs
+            && fwrite(snapshot->notes, sizeof(BinaryNote), header->nNotes, file) == header->nNotes
+            && fwrite(snapshot->tracks, sizeof(BinaryTrack), header->nTracks, file) == header->nTracks
+            && fwrite(snapshot->blocks, sizeof(BinaryBlock), header->nBlocks, file) == header->nBlocks
+            && fwrite(snapshot->strings, sizeof(char), snapshot->stringsSize, file) == snapshot->stringsSize
+            && fflush(file) == 0
+            && fsync(fileno(file)) == 0;
+        isWritten = fclose(file) == 0 && isWritten;
+    }
+
+    if (isWritten) {
+        Log_info("Score saved (%zu bytes).", fileSize);
+    } else {
+        Log_error("Failed to write score to '%s'", filename);
+    }
+    return isWritten;
+}
+
+
+// Writes and syncs tempFilename in the format filename asks for. Moving it
+// over filename is left to the caller, so a failed or interrupted save never
+// leaves a partial score file behind.
+static bool writeSnapshotFile(const ScoreSnapshot* snapshot, const char* filename, const char* tempFilename) {
+    bool isWritten = isBinaryFilename(filename)
+        ? writeSnapshotBinaryFile(snapshot, tempFilename)
+        : writeSnapshotXmlFile(snapshot, tempFilename);
+    if (!isWritten) {
+        unlink(tempFilename);
     }
+    return isWritten;
+}
+
 
-    return xmlDocPruned;
+static bool moveTempFile(const char* tempFilename, const char* filename) {
+    if (rename(tempFilename, filename) != 0) {
+        Log_error("Failed to replace '%s' with '%s'", filename, tempFilename);
+        unlink(tempFilename);
+        return false;
+    }
+    return true;
+}
+
+
+static char* getTempFilename(const char* filename) {
+    char* tempFilename = ecalloc(strlen(filename) + strlen(TEMP_FILE_EXTENSION) + 1, sizeof(char));
+    return strcat(strcpy(tempFilename, filename), TEMP_FILE_EXTENSION);
+}
+
+
+static void freeSnapshot(ScoreSnapshot** psnapshot) {
+    ScoreSnapshot* snapshot = *psnapshot;
+    sfree((void**)&snapshot->strings);
+    sfree((void**)&snapshot->blocks);
+    sfree((void**)&snapshot->tracks);
+    sfree((void**)&snapshot->notes);
+    sfree((void**)&snapshot->blockDefs);
+    sfree((void**)psnapshot);
+}
+
+
+// Save thread entry point, only touches the job it is given
+static void* runSaveJob(void* data) {
+    SaveJob* saveJob = data;
+    bool isWritten = writeSnapshotFile(saveJob->snapshot, saveJob->filename, saveJob->tempFilename);
+
+    pthread_mutex_lock(&saveJob->mutex);
+    saveJob->isWritten = isWritten;
+    saveJob->isDone = true;
+    pthread_mutex_unlock(&saveJob->mutex);
+
+    return NULL;
 }
 
 
@@ -1349,18 +2771,146 @@ static int getKeySignatureIndex(const char* keySignatureName) {
 }
 
 
-static void sortMidiMessages(MidiMessage* midiMessages, size_t nMidiMessages) {
-    qsort(midiMessages, nMidiMessages, sizeof(MidiMessage), compareMidiMessages);
+static bool isBinaryFilename(const char* filename) {
+    size_t filenameLength = strlen(filename);
+    size_t extensionLength = strlen(BINARY_FILE_EXTENSION);
+    return filenameLength > extensionLength && !strcmp(filename + filenameLength - extensionLength, BINARY_FILE_EXTENSION);
+}
+
+
+static const void* getBinaryTable(const char* data, size_t dataSize, uint32_t offset, uint32_t nEntries, size_t entrySize) {
+    Log_assert(offset % BINARY_TABLE_ALIGNMENT == 0 || entrySize == sizeof(char), "Misaligned binary score table at offset %u", offset);
+    Log_assert(offset <= dataSize && nEntries <= (dataSize - offset) / entrySize, "Binary score table at offset %u reaches past the end of the file", offset);
+    return data + offset;
+}
+
+
+static const char* getBinaryString(const char* strings, uint32_t stringsSize, uint32_t offset) {
+    Log_assert(offset < stringsSize, "Binary score string offset %u out of range", offset);
+    return strings + offset;
+}
+
+
+// Returns the offset of the string in the string table
+static uint32_t addBinaryString(char** strings, size_t* stringsSize, const char* string) {
+    size_t offset = *stringsSize;
+    size_t stringSize = strlen(string) + 1;
+    *strings = erealloc(*strings, offset + stringSize, sizeof(char));
+    memcpy(*strings + offset, string, stringSize);
+    *stringsSize = offset + stringSize;
+    return offset;
 }
 
 
-static int compareMidiMessages(const void* midiMessage, const void* midiMessageOther) {
-    MidiMessage* m = (MidiMessage*)midiMessage;
-    MidiMessage* mOther = (MidiMessage*)midiMessageOther;
+// Pairs the note on and off messages of sorted messages the way the synth
+// hears them, where a note off sorts before a note on of the same tick
+static TimelineNote* getNotesFromMidiMessages(const MidiMessage* midiMessages, size_t nMidiMessages, size_t* outAmount) {
+    *outAmount = 0;
+    if (nMidiMessages == 0) {
+        return NULL;
+    }
+
+    const MidiMessage* midiMessagesOn[MIDI_MESSAGE_PITCH_COUNT] = {0};
+    TimelineNote* notes = ecalloc(nMidiMessages, sizeof(TimelineNote));
+    size_t nNotes = 0;
 
-    if (m->timestampSeconds > mOther->timestampSeconds) {
+    for (size_t i = 0; i < nMidiMessages; i++) {
+        int iPitch = midiMessages[i].pitch - MIDI_MESSAGE_PITCH_MIN;
+        if (midiMessages[i].type == MIDI_MESSAGE_TYPE_NOTEON) {
+            // Overlapping notes of a pitch sound until the first of them ends
+            if (!midiMessagesOn[iPitch]) {
+                midiMessagesOn[iPitch] = &midiMessages[i];
+            }
+        } else if (midiMessagesOn[iPitch]) {
+            notes[nNotes] = (TimelineNote){
+                .pitch = midiMessages[i].pitch,
+                .velocity = midiMessagesOn[iPitch]->velocity,
+                .tickOn = midiMessagesOn[iPitch]->tick,
+                .tickOff = midiMessages[i].tick,
+            };
+            nNotes++;
+            midiMessagesOn[iPitch] = NULL;
+        }
+    }
+
+    *outAmount = nNotes;
+    return notes;
+}
+
+
+// Restarts held notes at tick, ending them where they would have ended
+static MidiMessage* getChaseMidiMessages(const TimelineNote* heldNotes, size_t nHeldNotes, int tick, int iChannel, bool ignoreNoteOff, size_t* outAmount) {
+    *outAmount = 0;
+    if (nHeldNotes == 0) {
+        return NULL;
+    }
+
+    MidiMessage* midiMessages = ecalloc(2 * nHeldNotes, sizeof(MidiMessage));
+    size_t nMidiMessages = 0;
+
+    for (size_t i = 0; i < nHeldNotes; i++) {
+        midiMessages[nMidiMessages] = (MidiMessage){
+            .type = MIDI_MESSAGE_TYPE_NOTEON,
+            .channel = iChannel,
+            .pitch = heldNotes[i].pitch,
+            .velocity = heldNotes[i].velocity,
+            .tick = tick,
+        };
+        nMidiMessages++;
+
+        if (!ignoreNoteOff) {
+            midiMessages[nMidiMessages] = (MidiMessage){
+                .type = MIDI_MESSAGE_TYPE_NOTEOFF,
+                .channel = iChannel,
+                .pitch = heldNotes[i].pitch,
+                .velocity = 0,
+                .tick = heldNotes[i].tickOff,
+            };
+            nMidiMessages++;
+        }
+    }
+
+    *outAmount = nMidiMessages;
+    return midiMessages;
+}
+
+
+// Writes the on and off messages of the notes, at most two per note
+static size_t addNoteMidiMessages(MidiMessage* midiMessages, const Note* notes, size_t nNotes, int iChannel, int tickOffset, float velocityScale, bool ignoreNoteOff) {
+    size_t nMidiMessages = 0;
+    for (size_t i = 0; i < nNotes; i++) {
+        int velocity = (float)MIDI_MESSAGE_VELOCITY_MAX * notes[i].velocity;
+        midiMessages[nMidiMessages] = (MidiMessage){
+            .type = MIDI_MESSAGE_TYPE_NOTEON,
+            .channel = iChannel,
+            .pitch = notes[i].pitch,
+            .velocity = getMidiVelocity(velocity * velocityScale),
+            .tick = tickOffset + notes[i].tick,
+        };
+        nMidiMessages++;
+
+        if (!ignoreNoteOff) {
+            midiMessages[nMidiMessages] = (MidiMessage){
+                .type = MIDI_MESSAGE_TYPE_NOTEOFF,
+                .channel = iChannel,
+                .pitch = notes[i].pitch,
+                .velocity = 0,
+                .tick = tickOffset + notes[i].tick + notes[i].duration,
+            };
+            nMidiMessages++;
+        }
+    }
+    return nMidiMessages;
+}
+
+
+static int compareBlockMessages(const void* blockMessage, const void* blockMessageOther) {
+    BlockMessage* m = (BlockMessage*)blockMessage;
+    BlockMessage* mOther = (BlockMessage*)blockMessageOther;
+
+    if (m->tick > mOther->tick) {
         return 1;
-    } else if (m->timestampSeconds < mOther->timestampSeconds) {
+    } else if (m->tick < mOther->tick) {
         return -1;
     } else if (m->type == MIDI_MESSAGE_TYPE_NOTEON && mOther->type == MIDI_MESSAGE_TYPE_NOTEOFF) {
         return 1;
@@ -1376,20 +2926,11 @@ static int compareMidiMessages(const void* midiMessage, const void* midiMessageO
 }
 
 
-static int compareMidiMessageNodes(xmlNodePtr midiMessageNode, xmlNodePtr midiMessageNodeOther) {
-    MidiMessage midiMessage = {
-        .type = getXmlNodePropertyInt(midiMessageNode, XMLATTRIB_TYPE),
-        .pitch = getXmlNodePropertyInt(midiMessageNode, XMLATTRIB_PITCH),
-        .velocity = getXmlNodePropertyInt(midiMessageNode, XMLATTRIB_VELOCITY),
-        .timestampSeconds = getXmlNodePropertyFloat(midiMessageNode, XMLATTRIB_TIME),
-    };
-
-    MidiMessage midiMessageOther = {
-        .type = getXmlNodePropertyInt(midiMessageNodeOther, XMLATTRIB_TYPE),
-        .pitch = getXmlNodePropertyInt(midiMessageNodeOther, XMLATTRIB_PITCH),
-        .velocity = getXmlNodePropertyInt(midiMessageNodeOther, XMLATTRIB_VELOCITY),
-        .timestampSeconds = getXmlNodePropertyFloat(midiMessageNodeOther, XMLATTRIB_TIME),
-    };
-
-    return compareMidiMessages(&midiMessage, &midiMessageOther);
+// Block and track velocities scale the note velocities, the product is
+// kept within what midi allows
+static int getMidiVelocity(float velocity) {
+    if (!(velocity > MIDI_MESSAGE_VELOCITY_MIN)) {
+        return MIDI_MESSAGE_VELOCITY_MIN;  // also NaN
+    }
+    return Math_minf(velocity, MIDI_MESSAGE_VELOCITY_MAX);
 }
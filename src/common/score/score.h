@@ -18,17 +18,27 @@
 
 #pragma once
 
+#include "common/structs/scorestats.h"
+#include "common/structs/sequencerrequest.h"
+
 #include <stdbool.h>
 
 typedef struct Score Score;
 
-Score* Score_new(const char* const filename);
+Score* Score_new(const char* const filename, bool isJournaled);
 void Score_free(Score** pself);
-void Score_addNote(Score* self, int pitch, float time, float duration, float velocity);
-void Score_removeNotes(Score* self, int pitch, float timeStart, float timeEnd);
+void Score_addNote(Score* self, int pitch, int tick, int duration, float velocity);
+void Score_removeNotes(Score* self, int pitch, int tickStart, int tickEnd);
+void Score_undo(Score* self);
+void Score_redo(Score* self);
+void Score_beginEditGroup(Score* self);
+void Score_endEditGroup(Score* self);
 void Score_saveToFile(Score* self);
-void Score_playCurrentBlockDef(Score* self, int iChannel, float startTimeFraction, bool ignoreNoteOff);
-void Score_playEntireScore(Score* self, int iTimeSlotStart);
+bool Score_writeToFile(Score* self, const char* filename);
+bool Score_exportMidi(Score* self, const char* filename);
+void Score_playCurrentBlockDef(Score* self, int iChannel, int startTick, bool ignoreNoteOff, bool isLooping);
+void Score_playEntireScore(Score* self, int iTimeSlotStart, bool isLooping);
+SequencerRequest Score_getEntireScoreSequencerRequest(Score* self, int iTimeSlotStart);
 void Score_requestCurrentBlockDefNotes(Score* self);
 void Score_requestPrevBlockDefNotes(Score* self);
 void Score_requestCurrentBlockDefColor(Score* self);
@@ -47,3 +57,6 @@ void Score_changeTrackVelocity(Score* self, int iTrack);
 void Score_addBlockInstance(Score* self, int iTrack, int iTimeSlot);
 void Score_removeBlockInstance(Score* self, int iTrack, int iTimeSlot);
 void Score_toggleIgnoreNoteOff(Score* self, int iTrack);
+int Score_getBlockDurationTicks(Score* self);
+ScoreStats Score_getStats(Score* self);
+const char* Score_getDefaultKeySignatureName(void);
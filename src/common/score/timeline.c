@@ -0,0 +1,275 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#include "timeline.h"
+
+#include "common/structs/midimessage.h"
+#include "common/util/alloc.h"
+#include "common/util/log.h"
+#include "config/config.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+enum {
+    RUN_ITEMS_ALLOCATED_INITIAL = 256,
+};
+
+// The items of a track are stored as one run per time slot, laid out back to
+// back in time slot order. iRunStarts[i] is the offset of the run for time
+// slot i, and iRunStarts[SCORE_LENGTH_MAX] is the total item count.
+typedef struct {
+    void* items;
+    size_t itemSize;
+    size_t nItemsAllocated;
+    size_t iRunStarts[SCORE_LENGTH_MAX + 1];
+} TimelineRuns;
+
+typedef struct {
+    TimelineRuns midiMessageRuns;
+    TimelineRuns noteRuns;
+    TimelineRuns heldNoteRuns;  // checkpoints, run i holds the notes of earlier time slots still sounding as time slot i starts
+    int nHeldTimeSlotsValid;  // checkpoints of time slots before this are up to date
+    int heldBlockDurationTicks;  // that the checkpoints were taken with
+    bool isValid;
+} TimelineTrack;
+
+struct Timeline {
+    int nTracks;
+    TimelineTrack** tracks;
+};
+
+
+static TimelineTrack* Timeline_getTrack(Timeline* self, int iTrack);
+static void Timeline_updateHeldNotes(TimelineTrack* track, int iTimeSlotEnd, int blockDurationTicks);
+static void Timeline_setRun(TimelineRuns* runs, int iTimeSlot, const void* items, size_t nItems);
+static const void* Timeline_getRuns(TimelineRuns* runs, int iTimeSlotStart, int iTimeSlotEnd, size_t* outAmount);
+static void Timeline_reserveItems(TimelineRuns* runs, size_t nItems);
+static void Timeline_freeRuns(TimelineRuns* runs);
+
+
+Timeline* Timeline_new(void) {
+    Timeline* self = ecalloc(1, sizeof(*self));
+    return self;
+}
+
+
+void Timeline_free(Timeline** pself) {
+    Timeline* self = *pself;
+    for (int iTrack = 0; iTrack < self->nTracks; iTrack++) {
+        TimelineTrack* track = self->tracks[iTrack];
+        Timeline_freeRuns(&track->midiMessageRuns);
+        Timeline_freeRuns(&track->noteRuns);
+        Timeline_freeRuns(&track->heldNoteRuns);
+        sfree((void**)&self->tracks[iTrack]);
+    }
+    if (self->nTracks) {
+        sfree((void**)&self->tracks);
+    }
+    sfree((void**)pself);
+}
+
+
+int Timeline_countTracks(Timeline* self) {
+    return self->nTracks;
+}
+
+
+void Timeline_addTrack(Timeline* self) {
+    self->tracks = erealloc(self->tracks, self->nTracks + 1, sizeof(TimelineTrack*));
+    TimelineTrack* track = ecalloc(1, sizeof(TimelineTrack));
+    track->midiMessageRuns.itemSize = sizeof(MidiMessage);
+    track->noteRuns.itemSize = sizeof(TimelineNote);
+    track->heldNoteRuns.itemSize = sizeof(TimelineNote);
+    track->isValid = true;
+    self->tracks[self->nTracks] = track;
+    self->nTracks++;
+}
+
+
+bool Timeline_isTrackValid(Timeline* self, int iTrack) {
+    return Timeline_getTrack(self, iTrack)->isValid;
+}
+
+
+void Timeline_invalidateTrack(Timeline* self, int iTrack) {
+    Timeline_getTrack(self, iTrack)->isValid = false;
+}
+
+
+void Timeline_clearTrack(Timeline* self, int iTrack) {
+    TimelineTrack* track = Timeline_getTrack(self, iTrack);
+    memset(track->midiMessageRuns.iRunStarts, 0, sizeof(track->midiMessageRuns.iRunStarts));
+    memset(track->noteRuns.iRunStarts, 0, sizeof(track->noteRuns.iRunStarts));
+    track->nHeldTimeSlotsValid = 0;
+    track->isValid = true;
+}
+
+
+void Timeline_setTimeSlot(Timeline* self, int iTrack, int iTimeSlot, const MidiMessage* midiMessages, size_t nMidiMessages, const TimelineNote* notes, size_t nNotes) {
+    Log_assert(iTimeSlot >= 0 && iTimeSlot < SCORE_LENGTH_MAX, "Invalid time slot index %d", iTimeSlot);
+    TimelineTrack* track = Timeline_getTrack(self, iTrack);
+
+    Timeline_setRun(&track->midiMessageRuns, iTimeSlot, midiMessages, nMidiMessages);
+    Timeline_setRun(&track->noteRuns, iTimeSlot, notes, nNotes);
+
+    // Only the checkpoints of later time slots see the notes of this one
+    if (track->nHeldTimeSlotsValid > iTimeSlot + 1) {
+        track->nHeldTimeSlotsValid = iTimeSlot + 1;
+    }
+}
+
+
+const MidiMessage* Timeline_getMidiMessages(Timeline* self, int iTrack, int iTimeSlotStart, size_t* outAmount) {
+    Log_assert(iTimeSlotStart >= 0 && iTimeSlotStart <= SCORE_LENGTH_MAX, "Invalid time slot index %d", iTimeSlotStart);
+    TimelineTrack* track = Timeline_getTrack(self, iTrack);
+    Log_assert(track->isValid, "Reading midi messages from invalidated timeline track %d", iTrack);
+
+    return Timeline_getRuns(&track->midiMessageRuns, iTimeSlotStart, SCORE_LENGTH_MAX, outAmount);
+}
+
+
+// The run of a single time slot, sorted on its own
+const MidiMessage* Timeline_getTimeSlotMidiMessages(Timeline* self, int iTrack, int iTimeSlot, size_t* outAmount) {
+    Log_assert(iTimeSlot >= 0 && iTimeSlot < SCORE_LENGTH_MAX, "Invalid time slot index %d", iTimeSlot);
+    TimelineTrack* track = Timeline_getTrack(self, iTrack);
+    Log_assert(track->isValid, "Reading midi messages from invalidated timeline track %d", iTrack);
+
+    return Timeline_getRuns(&track->midiMessageRuns, iTimeSlot, iTimeSlot + 1, outAmount);
+}
+
+
+// Notes of earlier time slots that are still sounding as a time slot starts.
+// Checkpoints are only retaken from the first time slot edited since the
+// last call, so seeking to a time slot is a lookup.
+const TimelineNote* Timeline_getHeldNotes(Timeline* self, int iTrack, int iTimeSlot, int blockDurationTicks, size_t* outAmount) {
+    Log_assert(iTimeSlot >= 0 && iTimeSlot < SCORE_LENGTH_MAX, "Invalid time slot index %d", iTimeSlot);
+    TimelineTrack* track = Timeline_getTrack(self, iTrack);
+    Log_assert(track->isValid, "Reading held notes from invalidated timeline track %d", iTrack);
+
+    Timeline_updateHeldNotes(track, iTimeSlot, blockDurationTicks);
+    return Timeline_getRuns(&track->heldNoteRuns, iTimeSlot, iTimeSlot + 1, outAmount);
+}
+
+
+static TimelineTrack* Timeline_getTrack(Timeline* self, int iTrack) {
+    Log_assert(iTrack >= 0 && iTrack < self->nTracks, "Invalid track index %d", iTrack);
+    return self->tracks[iTrack];
+}
+
+
+// Each checkpoint is the previous one plus the notes of the previous time
+// slot, minus the notes that have ended by the start of the time slot
+static void Timeline_updateHeldNotes(TimelineTrack* track, int iTimeSlotEnd, int blockDurationTicks) {
+    TimelineRuns* heldNoteRuns = &track->heldNoteRuns;
+    if (blockDurationTicks != track->heldBlockDurationTicks) {
+        track->heldBlockDurationTicks = blockDurationTicks;
+        track->nHeldTimeSlotsValid = 0;
+    }
+    if (track->nHeldTimeSlotsValid == 0) {
+        heldNoteRuns->iRunStarts[0] = 0;
+        heldNoteRuns->iRunStarts[1] = 0;
+        track->nHeldTimeSlotsValid = 1;
+    }
+
+    for (int iTimeSlot = track->nHeldTimeSlotsValid; iTimeSlot <= iTimeSlotEnd; iTimeSlot++) {
+        size_t nNotesPrev = 0;
+        const TimelineNote* notesPrev = Timeline_getRuns(&track->noteRuns, iTimeSlot - 1, iTimeSlot, &nNotesPrev);
+        size_t iHeldNotesPrev = heldNoteRuns->iRunStarts[iTimeSlot - 1];
+        size_t iHeldNotes = heldNoteRuns->iRunStarts[iTimeSlot];
+        size_t nHeldNotesPrev = iHeldNotes - iHeldNotesPrev;
+
+        Timeline_reserveItems(heldNoteRuns, iHeldNotes + nHeldNotesPrev + nNotesPrev);
+        const TimelineNote* heldNotesPrev = (const TimelineNote*)heldNoteRuns->items + iHeldNotesPrev;
+        TimelineNote* heldNotes = (TimelineNote*)heldNoteRuns->items + iHeldNotes;
+        int tick = iTimeSlot * blockDurationTicks;
+        size_t nHeldNotes = 0;
+
+        for (size_t i = 0; i < nHeldNotesPrev; i++) {
+            if (heldNotesPrev[i].tickOff > tick) {
+                heldNotes[nHeldNotes] = heldNotesPrev[i];
+                nHeldNotes++;
+            }
+        }
+        for (size_t i = 0; i < nNotesPrev; i++) {
+            if (notesPrev[i].tickOn < tick && notesPrev[i].tickOff > tick) {
+                heldNotes[nHeldNotes] = notesPrev[i];
+                nHeldNotes++;
+            }
+        }
+
+        heldNoteRuns->iRunStarts[iTimeSlot + 1] = iHeldNotes + nHeldNotes;
+    }
+
+    if (track->nHeldTimeSlotsValid <= iTimeSlotEnd) {
+        track->nHeldTimeSlotsValid = iTimeSlotEnd + 1;
+    }
+}
+
+
+static void Timeline_setRun(TimelineRuns* runs, int iTimeSlot, const void* items, size_t nItems) {
+    size_t iRunStart = runs->iRunStarts[iTimeSlot];
+    size_t iRunEnd = runs->iRunStarts[iTimeSlot + 1];
+    size_t nItemsTotal = runs->iRunStarts[SCORE_LENGTH_MAX];
+    size_t nItemsPrev = iRunEnd - iRunStart;
+
+    Timeline_reserveItems(runs, nItemsTotal - nItemsPrev + nItems);
+    char* runItems = runs->items;
+
+    if (nItemsTotal > iRunEnd && nItems != nItemsPrev) {
+        memmove(&runItems[(iRunStart + nItems) * runs->itemSize], &runItems[iRunEnd * runs->itemSize], (nItemsTotal - iRunEnd) * runs->itemSize);
+    }
+    if (nItems) {
+        memcpy(&runItems[iRunStart * runs->itemSize], items, nItems * runs->itemSize);
+    }
+
+    if (nItems != nItemsPrev) {
+        for (int i = iTimeSlot + 1; i <= SCORE_LENGTH_MAX; i++) {
+            runs->iRunStarts[i] = runs->iRunStarts[i] - nItemsPrev + nItems;
+        }
+    }
+}
+
+
+static const void* Timeline_getRuns(TimelineRuns* runs, int iTimeSlotStart, int iTimeSlotEnd, size_t* outAmount) {
+    size_t iRunStart = runs->iRunStarts[iTimeSlotStart];
+    *outAmount = runs->iRunStarts[iTimeSlotEnd] - iRunStart;
+    return runs->nItemsAllocated ? (const char*)runs->items + iRunStart * runs->itemSize : NULL;
+}
+
+
+static void Timeline_reserveItems(TimelineRuns* runs, size_t nItems) {
+    if (nItems <= runs->nItemsAllocated) {
+        return;
+    }
+
+    size_t nItemsAllocated = runs->nItemsAllocated ? runs->nItemsAllocated : RUN_ITEMS_ALLOCATED_INITIAL;
+    while (nItemsAllocated < nItems) {
+        nItemsAllocated *= 2;
+    }
+
+    runs->items = erealloc(runs->items, nItemsAllocated, runs->itemSize);
+    runs->nItemsAllocated = nItemsAllocated;
+}
+
+
+static void Timeline_freeRuns(TimelineRuns* runs) {
+    if (runs->nItemsAllocated) {
+        sfree((void**)&runs->items);
+    }
+}
@@ -0,0 +1,47 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#pragma once
+
+#include "common/structs/midimessage.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct Timeline Timeline;
+
+// A note of a time slot with the tick it ends on, kept even for tracks that
+// ignore note off so that playback can start in the middle of it
+typedef struct {
+    int pitch;
+    int velocity;
+    int tickOn;
+    int tickOff;
+} TimelineNote;
+
+Timeline* Timeline_new(void);
+void Timeline_free(Timeline** pself);
+int Timeline_countTracks(Timeline* self);
+void Timeline_addTrack(Timeline* self);
+bool Timeline_isTrackValid(Timeline* self, int iTrack);
+void Timeline_invalidateTrack(Timeline* self, int iTrack);
+void Timeline_clearTrack(Timeline* self, int iTrack);
+void Timeline_setTimeSlot(Timeline* self, int iTrack, int iTimeSlot, const MidiMessage* midiMessages, size_t nMidiMessages, const TimelineNote* notes, size_t nNotes);
+const MidiMessage* Timeline_getMidiMessages(Timeline* self, int iTrack, int iTimeSlotStart, size_t* outAmount);
+const MidiMessage* Timeline_getTimeSlotMidiMessages(Timeline* self, int iTrack, int iTimeSlot, size_t* outAmount);
+const TimelineNote* Timeline_getHeldNotes(Timeline* self, int iTrack, int iTimeSlot, int blockDurationTicks, size_t* outAmount);
@@ -30,6 +30,8 @@ static const char* const XMLATTRIB_PITCH = "pitch";
 static const char* const XMLATTRIB_PROGRAM = "program";
 static const char* const XMLATTRIB_SOUNDFONT = "soundfont";
 static const char* const XMLATTRIB_TEMPO = "tempo";
+static const char* const XMLATTRIB_TICK = "tick";
+static const char* const XMLATTRIB_TICKSPERBEAT = "ticksperbeat";
 static const char* const XMLATTRIB_TIME = "time";
 static const char* const XMLATTRIB_TYPE = "type";
 static const char* const XMLATTRIB_VELOCITY = "velocity";
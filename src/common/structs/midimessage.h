@@ -6,6 +6,6 @@ typedef struct {
     int channel;
     int pitch;
     int velocity;
-    float timestampSeconds;
+    int tick;
 } MidiMessage;
 #pragma pack(pop)
@@ -3,8 +3,8 @@
 #pragma pack(push, 1)
 typedef struct {
     int pitch;
-    float time;
-    float duration;
+    int tick;
+    int duration;
     float velocity;
 } Note;
 #pragma pack(pop)
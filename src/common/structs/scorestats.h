@@ -0,0 +1,32 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct {
+    int tempoBpm;
+    int nTracks;
+    int nTimeSlots;  // length of the longest track
+    int nBlockDefs;
+    int nBlockInstances;
+    size_t nNotes;
+    size_t nMidiMessages;  // after flattening the block instances
+    float durationSeconds;
+} ScoreStats;
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "midimessage.h"
+
+#include <stddef.h>
+
+#pragma pack(push, 1)
+typedef struct {
+    size_t nMidiMessagesRemoved;
+    MidiMessage* midiMessagesRemoved;  // matched on everything but velocity
+    size_t nMidiMessagesAdded;
+    MidiMessage* midiMessagesAdded;
+} SequenceChange;
+#pragma pack(pop)
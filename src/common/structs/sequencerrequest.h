@@ -2,13 +2,19 @@
 
 #include "midimessage.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #pragma pack(push, 1)
 typedef struct {
-    float timestampStart;
-    float timestampEnd;
+    int tickStart;
+    int tickEnd;
+    float secondsPerTick;
     size_t nMidiMessages;
     MidiMessage* midiMessages;
+    bool isLooping;  // on reaching tickEnd, the loop messages repeat from tickLoopStart until stopped
+    int tickLoopStart;
+    size_t nLoopMidiMessages;
+    MidiMessage* loopMidiMessages;
 } SequencerRequest;
 #pragma pack(pop)
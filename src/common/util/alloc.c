@@ -39,6 +39,22 @@ void* ecalloc(size_t nItems, size_t itemSize) {
 }
 
 
+void* erealloc(void* pointer, size_t nItems, size_t itemSize) {
+    Log_assert(nItems > 0 && itemSize > 0, "erealloc: Invalid allocation size");
+    Log_assert(nItems <= SIZE_MAX / itemSize, "erealloc: Allocation size overflow");
+    uintptr_t pointerPrev = (uintptr_t)pointer;
+    void* pointerNew = realloc(pointer, nItems * itemSize);
+    if (!pointerNew) {
+        Log_fatal("erealloc: Failed to allocate memory");
+    }
+    if (!pointerPrev) {
+        nAllocations++;
+    }
+    allocationPointerSum += (uintptr_t)pointerNew - pointerPrev;
+    return pointerNew;
+}
+
+
 void* ememdup(const void* src, size_t nItems, size_t itemSize) {
     void* pointer = ecalloc(nItems, itemSize);
     memcpy(pointer, src, nItems * itemSize);
@@ -21,6 +21,7 @@
 #include <stddef.h>
 
 void* ecalloc(size_t nItems, size_t itemSize);
+void* erealloc(void* pointer, size_t nItems, size_t itemSize);
 void* ememdup(const void* src, size_t nItems, size_t itemSize);
 char* estrdup(const char* const string);
 void sfree(void** pptr);
@@ -52,6 +52,20 @@ Color lerpColorDeltaTimeAdjusted(Color source, Color target, float lerpWeight, f
 }
 
 
+// For colors read from untrusted places, parseHexColor() asserts this
+bool isHexColor(const char* const hexColor) {
+    if (strlen(hexColor) != 6) {
+        return false;
+    }
+    for (int iChar = 0; iChar < 6; iChar++) {
+        if (!isxdigit((unsigned char)hexColor[iChar])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
 Color parseHexColor(const char* const hexColor) {
     int stringLength = strlen(hexColor);
     Log_assert(stringLength == 6, "The color string must contain exactly 6 hexadecimal digits (%d given)", stringLength);
@@ -20,7 +20,10 @@
 
 #include "common/structs/color.h"
 
+#include <stdbool.h>
+
 Color lerpColor(Color source, Color target, float lerpWeight);
 Color lerpColorDeltaTimeAdjusted(Color source, Color target, float lerpWeight, float deltaTime);
+bool isHexColor(const char* const hexColor);
 Color parseHexColor(const char* const hexColor);
 Color generateColorFromString(const char* const string);
@@ -26,3 +26,17 @@ size_t hashDjb2(const char* str, size_t len) {
     }
     return hash;
 }
+
+
+// CRC-32 as used by zlib. Pass 0 to start, or the previous result to continue
+uint32_t hashCrc32(uint32_t crc, const void* data, size_t len) {
+    const unsigned char* bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= bytes[i];
+        for (int iBit = 0; iBit < 8; iBit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
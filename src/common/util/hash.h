@@ -19,5 +19,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
 size_t hashDjb2(const char* str, size_t len);
+uint32_t hashCrc32(uint32_t crc, const void* data, size_t len);
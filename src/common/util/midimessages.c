@@ -0,0 +1,315 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#include "midimessages.h"
+
+#include "common/constants/fluidmidi.h"
+#include "common/structs/midimessage.h"
+#include "common/util/alloc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+enum {
+    RADIX_SORT_THRESHOLD = 64,
+    RADIX_BITS = 8,
+    RADIX_BUCKET_COUNT = 1 << RADIX_BITS,
+    RADIX_KEY_DIGITS = (64 + RADIX_BITS - 1) / RADIX_BITS,
+};
+
+// Yields the messages of sorted streams in sorted order without copying them,
+// collapsing identical messages on the way. The streams must outlive it.
+struct MidiMessageMerge {
+    const MidiMessage* const* streams;
+    const size_t* nStreamMidiMessages;
+    size_t* iNextMidiMessages;
+    size_t* heap;  // min-heap of stream indices, ordered by the next message of each stream
+    size_t nHeap;
+    MidiMessage midiMessagePrev;
+    bool hasMidiMessagePrev;
+};
+
+
+static const MidiMessage* MidiMessageMerge_pop(MidiMessageMerge* self);
+static uint64_t getMidiMessageSortKey(const MidiMessage* midiMessage);
+static bool hasMidiMessageSortKeys(const MidiMessage* midiMessages, size_t nMidiMessages);
+static void siftDownMidiMessageStreams(size_t* heap, size_t nHeap, size_t iHeap, const MidiMessage* const* streams, const size_t* iNextMidiMessages);
+static bool isMidiMessageStreamBefore(size_t iStream, size_t iStreamOther, const MidiMessage* const* streams, const size_t* iNextMidiMessages);
+
+
+MidiMessageMerge* MidiMessageMerge_new(const MidiMessage* const* streams, const size_t* nStreamMidiMessages, size_t nStreams) {
+    MidiMessageMerge* self = ecalloc(1, sizeof(*self));
+    self->streams = streams;
+    self->nStreamMidiMessages = nStreamMidiMessages;
+    self->iNextMidiMessages = ecalloc(nStreams + 1, sizeof(size_t));
+    self->heap = ecalloc(nStreams + 1, sizeof(size_t));
+
+    for (size_t iStream = 0; iStream < nStreams; iStream++) {
+        if (nStreamMidiMessages[iStream] > 0) {
+            self->heap[self->nHeap] = iStream;
+            self->nHeap++;
+        }
+    }
+    for (size_t i = self->nHeap / 2; i > 0; i--) {
+        siftDownMidiMessageStreams(self->heap, self->nHeap, i - 1, streams, self->iNextMidiMessages);
+    }
+
+    return self;
+}
+
+
+void MidiMessageMerge_free(MidiMessageMerge** pself) {
+    MidiMessageMerge* self = *pself;
+    sfree((void**)&self->heap);
+    sfree((void**)&self->iNextMidiMessages);
+    sfree((void**)pself);
+}
+
+
+// Returns NULL once all streams are exhausted
+const MidiMessage* MidiMessageMerge_next(MidiMessageMerge* self) {
+    const MidiMessage* midiMessage = MidiMessageMerge_pop(self);
+    while (midiMessage && self->hasMidiMessagePrev && !memcmp(&self->midiMessagePrev, midiMessage, sizeof(MidiMessage))) {
+        midiMessage = MidiMessageMerge_pop(self);
+    }
+
+    if (midiMessage) {
+        self->midiMessagePrev = *midiMessage;
+        self->hasMidiMessagePrev = true;
+    }
+    return midiMessage;
+}
+
+
+// Stable LSD radix sort over a packed key that orders like compareMidiMessages
+void sortMidiMessages(MidiMessage* midiMessages, size_t nMidiMessages) {
+    if (nMidiMessages < RADIX_SORT_THRESHOLD || !hasMidiMessageSortKeys(midiMessages, nMidiMessages)) {
+        qsort(midiMessages, nMidiMessages, sizeof(MidiMessage), compareMidiMessages);
+        return;
+    }
+
+    uint64_t* keys = ecalloc(nMidiMessages, sizeof(uint64_t));
+    uint64_t* keysScratch = ecalloc(nMidiMessages, sizeof(uint64_t));
+    MidiMessage* midiMessagesScratch = ecalloc(nMidiMessages, sizeof(MidiMessage));
+
+    size_t counts[RADIX_KEY_DIGITS][RADIX_BUCKET_COUNT] = {0};
+    for (size_t i = 0; i < nMidiMessages; i++) {
+        keys[i] = getMidiMessageSortKey(&midiMessages[i]);
+        for (size_t iDigit = 0; iDigit < RADIX_KEY_DIGITS; iDigit++) {
+            counts[iDigit][(keys[i] >> (iDigit * RADIX_BITS)) & (RADIX_BUCKET_COUNT - 1)]++;
+        }
+    }
+
+    uint64_t* keysIn = keys;
+    uint64_t* keysOut = keysScratch;
+    MidiMessage* midiMessagesIn = midiMessages;
+    MidiMessage* midiMessagesOut = midiMessagesScratch;
+
+    for (size_t iDigit = 0; iDigit < RADIX_KEY_DIGITS; iDigit++) {
+        size_t shift = iDigit * RADIX_BITS;
+
+        // A byte shared by all keys would leave the order unchanged
+        if (counts[iDigit][(keysIn[0] >> shift) & (RADIX_BUCKET_COUNT - 1)] == nMidiMessages) {
+            continue;
+        }
+
+        size_t offsets[RADIX_BUCKET_COUNT];
+        size_t offset = 0;
+        for (size_t iBucket = 0; iBucket < RADIX_BUCKET_COUNT; iBucket++) {
+            offsets[iBucket] = offset;
+            offset += counts[iDigit][iBucket];
+        }
+
+        for (size_t i = 0; i < nMidiMessages; i++) {
+            size_t iOut = offsets[(keysIn[i] >> shift) & (RADIX_BUCKET_COUNT - 1)]++;
+            keysOut[iOut] = keysIn[i];
+            midiMessagesOut[iOut] = midiMessagesIn[i];
+        }
+
+        uint64_t* keysSwap = keysIn;
+        keysIn = keysOut;
+        keysOut = keysSwap;
+        MidiMessage* midiMessagesSwap = midiMessagesIn;
+        midiMessagesIn = midiMessagesOut;
+        midiMessagesOut = midiMessagesSwap;
+    }
+
+    if (midiMessagesIn != midiMessages) {
+        memcpy(midiMessages, midiMessagesIn, nMidiMessages * sizeof(MidiMessage));
+    }
+
+    sfree((void**)&keys);
+    sfree((void**)&keysScratch);
+    sfree((void**)&midiMessagesScratch);
+}
+
+
+bool areMidiMessagesSorted(const MidiMessage* midiMessages, size_t nMidiMessages) {
+    for (size_t i = 1; i < nMidiMessages; i++) {
+        if (compareMidiMessages(&midiMessages[i - 1], &midiMessages[i]) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Index of the first message at or after tick in sorted messages
+size_t searchMidiMessages(const MidiMessage* midiMessages, size_t nMidiMessages, int tick) {
+    size_t iLow = 0;
+    size_t iHigh = nMidiMessages;
+    while (iLow < iHigh) {
+        size_t iMid = iLow + (iHigh - iLow) / 2;
+        if (midiMessages[iMid].tick < tick) {
+            iLow = iMid + 1;
+        } else {
+            iHigh = iMid;
+        }
+    }
+    return iLow;
+}
+
+
+// Merge sorted midi message streams into one newly allocated sorted array,
+// collapsing identical messages on the way
+MidiMessage* mergeMidiMessages(const MidiMessage* const* streams, const size_t* nStreamMidiMessages, size_t nStreams, size_t* outAmount) {
+    size_t nMidiMessagesTotal = 0;
+    for (size_t iStream = 0; iStream < nStreams; iStream++) {
+        nMidiMessagesTotal += nStreamMidiMessages[iStream];
+    }
+
+    MidiMessage* midiMessages = ecalloc(nMidiMessagesTotal, sizeof(MidiMessage));
+    size_t nMidiMessages = 0;
+
+    MidiMessageMerge* merge = MidiMessageMerge_new(streams, nStreamMidiMessages, nStreams);
+    for (const MidiMessage* midiMessage = MidiMessageMerge_next(merge); midiMessage; midiMessage = MidiMessageMerge_next(merge)) {
+        midiMessages[nMidiMessages] = *midiMessage;
+        nMidiMessages++;
+    }
+    MidiMessageMerge_free(&merge);
+
+    *outAmount = nMidiMessages;
+    return midiMessages;
+}
+
+
+int compareMidiMessages(const void* midiMessage, const void* midiMessageOther) {
+    MidiMessage* m = (MidiMessage*)midiMessage;
+    MidiMessage* mOther = (MidiMessage*)midiMessageOther;
+
+    if (m->tick > mOther->tick) {
+        return 1;
+    } else if (m->tick < mOther->tick) {
+        return -1;
+    } else if (m->type == MIDI_MESSAGE_TYPE_NOTEON && mOther->type == MIDI_MESSAGE_TYPE_NOTEOFF) {
+        return 1;
+    } else if (m->type == MIDI_MESSAGE_TYPE_NOTEOFF && mOther->type == MIDI_MESSAGE_TYPE_NOTEON) {
+        return -1;
+    } else if (m->pitch > mOther->pitch) {
+        return 1;
+    } else if (m->pitch < mOther->pitch) {
+        return -1;
+    } else if (m->channel > mOther->channel) {
+        return 1;
+    } else if (m->channel < mOther->channel) {
+        return -1;
+    } else if (m->velocity > mOther->velocity) {
+        return 1;
+    } else if (m->velocity < mOther->velocity) {
+        return -1;
+    } else {
+        return 0;
+    }
+}
+
+
+static const MidiMessage* MidiMessageMerge_pop(MidiMessageMerge* self) {
+    if (self->nHeap == 0) {
+        return NULL;
+    }
+
+    size_t iStream = self->heap[0];
+    const MidiMessage* midiMessage = &self->streams[iStream][self->iNextMidiMessages[iStream]];
+
+    self->iNextMidiMessages[iStream]++;
+    if (self->iNextMidiMessages[iStream] == self->nStreamMidiMessages[iStream]) {
+        self->nHeap--;
+        self->heap[0] = self->heap[self->nHeap];
+    }
+    siftDownMidiMessageStreams(self->heap, self->nHeap, 0, self->streams, self->iNextMidiMessages);
+
+    return midiMessage;
+}
+
+
+// Tick in the high half, then note off before note on, pitch, channel and velocity
+static uint64_t getMidiMessageSortKey(const MidiMessage* midiMessage) {
+    uint64_t isNoteOn = midiMessage->type == MIDI_MESSAGE_TYPE_NOTEON;
+    return (uint64_t)midiMessage->tick << 24 | isNoteOn << 23 | (uint64_t)midiMessage->pitch << 16
+        | (uint64_t)midiMessage->channel << 8 | (uint64_t)midiMessage->velocity;
+}
+
+
+// Whether the keys order the messages exactly like compareMidiMessages.
+// Messages outside the fields' ranges are left to the comparison sort.
+static bool hasMidiMessageSortKeys(const MidiMessage* midiMessages, size_t nMidiMessages) {
+    for (size_t i = 0; i < nMidiMessages; i++) {
+        const MidiMessage* midiMessage = &midiMessages[i];
+        if (midiMessage->tick < 0
+            || midiMessage->channel < 0 || midiMessage->channel > UINT8_MAX
+            || midiMessage->pitch < 0 || midiMessage->pitch >= MIDI_MESSAGE_PITCH_COUNT
+            || midiMessage->velocity < 0 || midiMessage->velocity > UINT8_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Move the stream at heap index iHeap down until the heap property holds
+static void siftDownMidiMessageStreams(size_t* heap, size_t nHeap, size_t iHeap, const MidiMessage* const* streams, const size_t* iNextMidiMessages) {
+    size_t i = iHeap;
+    while (true) {
+        size_t iMin = i;
+        size_t iLeft = 2 * i + 1;
+        size_t iRight = 2 * i + 2;
+
+        if (iLeft < nHeap && isMidiMessageStreamBefore(heap[iLeft], heap[iMin], streams, iNextMidiMessages)) {
+            iMin = iLeft;
+        }
+        if (iRight < nHeap && isMidiMessageStreamBefore(heap[iRight], heap[iMin], streams, iNextMidiMessages)) {
+            iMin = iRight;
+        }
+        if (iMin == i) {
+            return;
+        }
+
+        size_t iStream = heap[i];
+        heap[i] = heap[iMin];
+        heap[iMin] = iStream;
+        i = iMin;
+    }
+}
+
+
+static bool isMidiMessageStreamBefore(size_t iStream, size_t iStreamOther, const MidiMessage* const* streams, const size_t* iNextMidiMessages) {
+    return compareMidiMessages(&streams[iStream][iNextMidiMessages[iStream]], &streams[iStreamOther][iNextMidiMessages[iStreamOther]]) < 0;
+}
@@ -0,0 +1,36 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#pragma once
+
+#include "common/structs/midimessage.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct MidiMessageMerge MidiMessageMerge;
+
+MidiMessageMerge* MidiMessageMerge_new(const MidiMessage* const* streams, const size_t* nStreamMidiMessages, size_t nStreams);
+void MidiMessageMerge_free(MidiMessageMerge** pself);
+const MidiMessage* MidiMessageMerge_next(MidiMessageMerge* self);
+
+void sortMidiMessages(MidiMessage* midiMessages, size_t nMidiMessages);
+bool areMidiMessagesSorted(const MidiMessage* midiMessages, size_t nMidiMessages);
+size_t searchMidiMessages(const MidiMessage* midiMessages, size_t nMidiMessages, int tick);
+MidiMessage* mergeMidiMessages(const MidiMessage* const* streams, const size_t* nStreamMidiMessages, size_t nStreams, size_t* outAmount);
+int compareMidiMessages(const void* midiMessage, const void* midiMessageOther);
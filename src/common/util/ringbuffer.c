@@ -0,0 +1,91 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#include "ringbuffer.h"
+
+#include "common/util/alloc.h"
+#include "common/util/log.h"
+
+#include <string.h>
+
+enum {
+    CACHE_LINE_SIZE = 64,
+};
+
+// The indices only ever grow and wrap around at SIZE_MAX, which the power
+// of two capacity divides. Each is written by one side only and kept on a
+// cache line of its own, so the sides do not invalidate each other's reads.
+struct RingBuffer {
+    size_t iHead;  // next item to pop, written by the consumer
+    char paddingHead[CACHE_LINE_SIZE - sizeof(size_t)];
+    size_t iTail;  // next item to push, written by the producer
+    char paddingTail[CACHE_LINE_SIZE - sizeof(size_t)];
+    size_t nItemsMax;
+    size_t itemSize;
+    unsigned char* items;
+};
+
+
+RingBuffer* RingBuffer_new(size_t nItemsMax, size_t itemSize) {
+    Log_assert(nItemsMax > 0 && itemSize > 0, "Invalid ring buffer size");
+    RingBuffer* self = ecalloc(1, sizeof(*self));
+
+    self->nItemsMax = 1;
+    while (self->nItemsMax < nItemsMax) {
+        self->nItemsMax *= 2;
+    }
+    self->itemSize = itemSize;
+    self->items = ecalloc(self->nItemsMax, itemSize);
+
+    return self;
+}
+
+
+void RingBuffer_free(RingBuffer** pself) {
+    RingBuffer* self = *pself;
+    sfree((void**)&self->items);
+    sfree((void**)pself);
+}
+
+
+// Producer side, returns false without waiting when the buffer is full
+bool RingBuffer_push(RingBuffer* self, const void* item) {
+    size_t iTail = __atomic_load_n(&self->iTail, __ATOMIC_RELAXED);
+    size_t iHead = __atomic_load_n(&self->iHead, __ATOMIC_ACQUIRE);
+    if (iTail - iHead == self->nItemsMax) {
+        return false;
+    }
+
+    memcpy(&self->items[(iTail & (self->nItemsMax - 1)) * self->itemSize], item, self->itemSize);
+    __atomic_store_n(&self->iTail, iTail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+// Consumer side, returns false when the buffer is empty
+bool RingBuffer_pop(RingBuffer* self, void* item) {
+    size_t iHead = __atomic_load_n(&self->iHead, __ATOMIC_RELAXED);
+    size_t iTail = __atomic_load_n(&self->iTail, __ATOMIC_ACQUIRE);
+    if (iHead == iTail) {
+        return false;
+    }
+
+    memcpy(item, &self->items[(iHead & (self->nItemsMax - 1)) * self->itemSize], self->itemSize);
+    __atomic_store_n(&self->iHead, iHead + 1, __ATOMIC_RELEASE);
+    return true;
+}
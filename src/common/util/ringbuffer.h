@@ -0,0 +1,32 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Lock-free queue for handing fixed size items from exactly one producer
+// thread to exactly one consumer thread. Pushing and popping never allocate
+// or block, so the producer may be a realtime audio thread.
+typedef struct RingBuffer RingBuffer;
+
+RingBuffer* RingBuffer_new(size_t nItemsMax, size_t itemSize);
+void RingBuffer_free(RingBuffer** pself);
+bool RingBuffer_push(RingBuffer* self, const void* item);
+bool RingBuffer_pop(RingBuffer* self, void* item);
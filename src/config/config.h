@@ -6,16 +6,28 @@ enum {
     N_BEATS_PER_MEASURE_DEFAULT = 4,
     TEMPO_BPM_DEFAULT = 100,
     N_BLOCK_MEASURES = 4,
+    TICKS_PER_BEAT = 960,
     SCORE_LENGTH_DEFAULT = 16,
     SCORE_LENGTH_MIN = 1,
     SCORE_LENGTH_MAX = 1024,
     N_SYNTH_TRACKS = 32,
+    JOURNAL_COMPACT_SIZE = 1024 * 1024,  // bytes of unsaved edits before the score file is rewritten
+    UNDO_HISTORY_SIZE_MAX = 4 * 1024 * 1024,  // bytes, the oldest edits are forgotten beyond this
+    SEQUENCER_LOOKAHEAD_MILLISECONDS = 200,  // how far ahead midi messages are handed to the sequencer
+    RENDER_SAMPLE_RATE = 44100,
+    RENDER_BLOCK_FRAMES = 1024,  // rendered at most between two midi messages
+    RENDER_TAIL_SECONDS_MAX = 10,  // how long notes may ring out after the score ends
+    RENDER_SEGMENT_SECONDS_MIN = 10,  // shorter scores are rendered on fewer threads
+    RENDER_SEGMENT_SECONDS_MAX = 60,  // longer scores are split further, which bounds the audio held in memory
+    RENDER_PREROLL_SECONDS = 4,  // enough for releases to fade before a segment starts
+    RENDER_PREROLL_SECONDS_MAX = 30,  // notes held longer than this are cut at segment starts
 };
 
 static const char* const BLOCK_NAME_DEFAULT = "default";
 static const char* const SYNTH_PROGRAM_NAME_DEFAULT = "Grand Piano";
 
 static const float AUDIO_VISUAL_DELAY_COMPENSATION_SECONDS = 0.1f;
+static const float RENDER_VERIFY_TOLERANCE = 1e-4f;  // largest sample difference between parallel and serial renders
 static const float NOTE_VELOCITY_DEFAULT = 0.75f;
 static const float BLOCK_VELOCITY_DEFAULT = 0.75f;
 static const float TRACK_VELOCITY_DEFAULT = 0.75f;
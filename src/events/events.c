@@ -30,17 +30,20 @@
 #include "common/structs/queryresult.h"
 #include "common/structs/vector2.h"
 #include "common/structs/vector2i.h"
+#include "common/structs/sequencechange.h"
 #include "common/structs/sequencerrequest.h"
 #include "common/structs/synthprogramchange.h"
 #include "common/util/alloc.h"
 #include "common/util/hashset.h"
 #include "common/util/log.h"
+#include "common/util/ringbuffer.h"
 #include "common/util/stringmap.h"
 
 #include <string.h>
 
 enum {
     EVENT_NAME_MAX_LENGTH = 63,
+    THREAD_EVENTS_MAX = 64,
 };
 
 #pragma pack(push, 1)
@@ -58,9 +61,17 @@ struct Event {
     HashSet* subscribers; // EventSubscriber
 };
 
+typedef struct ThreadEvent ThreadEvent;
+struct ThreadEvent {
+    void* sender;
+    const char* eventName;
+};
+
 typedef struct Events Events;
 struct Events {
     StringMap* eventMap; // str -> Event
+    RingBuffer* threadEvents; // ThreadEvent, posted on the main thread by Events_postThreadEvents()
+    size_t nThreadEventsDropped; // atomic, reported on the main thread
 };
 
 
@@ -75,6 +86,7 @@ void Events_setup(void) {
 
     instance = ecalloc(1, sizeof(*instance));
     instance->eventMap = StringMap_new(EVENT_NAME_MAX_LENGTH);
+    instance->threadEvents = RingBuffer_new(THREAD_EVENTS_MAX, sizeof(ThreadEvent));
 
     typedef struct EventTypeInitializer EventTypeInitializer;
     struct EventTypeInitializer {
@@ -99,6 +111,7 @@ void Events_setup(void) {
         {EVENT_BLOCK_INSTANCE_REMOVED, sizeof(BlockInstance)},
         {EVENT_ACTIVE_BLOCK_CHANGED, sizeof(Color)},
         {EVENT_BLOCK_COLOR_CHANGED, sizeof(Color)},
+        {EVENT_SCORE_SAVED, sizeof(int)},
         {EVENT_KEY_SIGNATURE_CHANGED, sizeof(int)},
         {EVENT_QUERY_RESULT, sizeof(QueryResult)},
         {EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT, sizeof(SynthProgramChange)},
@@ -114,6 +127,7 @@ void Events_setup(void) {
         {EVENT_SEQUENCER_STARTED, sizeof(SequencerRequest)},
         {EVENT_SEQUENCER_STOPPED, 0},
         {EVENT_SEQUENCER_PROGRESS, sizeof(float)},
+        {EVENT_SEQUENCE_CHANGED, sizeof(SequenceChange)},
         {EVENT_SYNTH_INSTRUMENT_CHANGED, sizeof(SynthProgramChange)},
     };
 
@@ -139,6 +153,7 @@ void Events_teardown(void) {
         }
     }
 
+    RingBuffer_free(&instance->threadEvents);
     StringMap_free(&instance->eventMap);
     sfree((void**)&instance);
 }
@@ -205,6 +220,34 @@ void Event_post(void* sender, const char* eventName, void* data, size_t dataSize
 }
 
 
+// For one thread besides the main thread, which must not touch the event
+// registry or run subscribers itself. The event is only queued, so posting
+// never blocks, and the event name must outlive the queue.
+void Event_postFromThread(void* sender, const char* eventName) {
+    ThreadEvent threadEvent = {sender, eventName};
+    if (!RingBuffer_push(instance->threadEvents, &threadEvent)) {
+        // Logging is not realtime safe, the drop is reported by Events_postThreadEvents()
+        __atomic_fetch_add(&instance->nThreadEventsDropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+// Called once per frame by the main loop
+void Events_postThreadEvents(void) {
+    Log_assert(instance, "events instance not created");
+
+    ThreadEvent threadEvent;
+    while (RingBuffer_pop(instance->threadEvents, &threadEvent)) {
+        Event_post(threadEvent.sender, threadEvent.eventName, NULL, 0);
+    }
+
+    size_t nThreadEventsDropped = __atomic_exchange_n(&instance->nThreadEventsDropped, 0, __ATOMIC_RELAXED);
+    if (nThreadEventsDropped > 0) {
+        Log_warning("Dropped %zu event(s) posted from another thread", nThreadEventsDropped);
+    }
+}
+
+
 static void Events_defineNewGlobalEventType(const char* eventName, size_t dataSize) {
     Log_assert(instance, "events instance not created");
     Events_defineNewEventTypeInternal(eventName, dataSize, NULL);
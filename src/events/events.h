@@ -39,6 +39,7 @@
 #define EVENT_BLOCK_INSTANCE_REMOVED "EVENT_BLOCK_INSTANCE_REMOVED"
 #define EVENT_ACTIVE_BLOCK_CHANGED "EVENT_ACTIVE_BLOCK_CHANGED"
 #define EVENT_BLOCK_COLOR_CHANGED "EVENT_BLOCK_COLOR_CHANGED"
+#define EVENT_SCORE_SAVED "EVENT_SCORE_SAVED"
 #define EVENT_KEY_SIGNATURE_CHANGED "EVENT_KEY_SIGNATURE_CHANGED"
 #define EVENT_QUERY_RESULT "EVENT_QUERY_RESULT"
 #define EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT "EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT"
@@ -54,14 +55,17 @@
 #define EVENT_SEQUENCER_STARTED "EVENT_SEQUENCER_STARTED"
 #define EVENT_SEQUENCER_STOPPED "EVENT_SEQUENCER_STOPPED"
 #define EVENT_SEQUENCER_PROGRESS "EVENT_SEQUENCER_PROGRESS"
+#define EVENT_SEQUENCE_CHANGED "EVENT_SEQUENCE_CHANGED"
 #define EVENT_SYNTH_INSTRUMENT_CHANGED "EVENT_SYNTH_INSTRUMENT_CHANGED"
 
 void Events_setup(void);
 void Events_teardown(void);
+void Events_postThreadEvents(void);
 
 void Events_defineNewLocalEventType(const char* eventName, size_t dataSize, void* receiver);
 
 void Event_subscribe(const char* eventName, void* object, void (*callback)(void* self, void* sender, void* data), size_t dataSize);
 void Event_unsubscribe(const char* eventName, void* object, void (*callback)(void* self, void* sender, void* data), size_t dataSize);
 void Event_post(void* sender, const char* eventName, void* data, size_t dataSize);
+void Event_postFromThread(void* sender, const char* eventName);
 
@@ -0,0 +1,261 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#include "midifile.h"
+
+#include "common/constants/fluidmidi.h"
+#include "common/util/alloc.h"
+#include "common/util/log.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char MIDI_FILE_HEADER_MAGIC[4] = {'M', 'T', 'h', 'd'};
+static const char MIDI_FILE_TRACK_MAGIC[4] = {'M', 'T', 'r', 'k'};
+
+enum {
+    MIDI_FILE_FORMAT = 1,  // simultaneous tracks
+    MIDI_FILE_HEADER_SIZE = 6,
+    MIDI_FILE_STATUS_NOTEOFF = 0x80,
+    MIDI_FILE_STATUS_NOTEON = 0x90,
+    MIDI_FILE_STATUS_META = 0xFF,
+    MIDI_FILE_META_TRACK_NAME = 0x03,
+    MIDI_FILE_META_END_OF_TRACK = 0x2F,
+    MIDI_FILE_META_TEMPO = 0x51,
+    MIDI_FILE_META_TIME_SIGNATURE = 0x58,
+    MIDI_FILE_META_TEXT_LENGTH_MAX = 127,
+    MIDI_FILE_BEAT_NOTE_VALUE_LOG2 = 2,  // quarter notes
+    MIDI_FILE_CLOCKS_PER_METRONOME_CLICK = 24,
+    MIDI_FILE_32ND_NOTES_PER_QUARTER_NOTE = 8,
+    MICROSECONDS_PER_MINUTE = 60000000,
+    VARIABLE_LENGTH_QUANTITY_SIZE_MAX = 4,
+};
+
+// Events are written straight to the file as they come, each track chunk
+// gets its length patched in when the track ends. Memory use does not depend
+// on the size of the score.
+struct MidiFile {
+    char* filename;
+    FILE* file;
+    int nTracks;
+    int nTracksWritten;
+    long trackLengthOffset;  // -1 outside of a track
+    int tickPrev;
+    int statusPrev;  // for running status, 0 if none
+    bool isFailed;
+};
+
+
+static void MidiFile_writeBytes(MidiFile* self, const void* bytes, size_t nBytes);
+static void MidiFile_writeUint16(MidiFile* self, uint16_t value);
+static void MidiFile_writeUint32(MidiFile* self, uint32_t value);
+static void MidiFile_writeVariableLengthQuantity(MidiFile* self, uint32_t value);
+static void MidiFile_writeDeltaTime(MidiFile* self, int tick);
+static void MidiFile_writeMetaEvent(MidiFile* self, int tick, int metaType, const void* data, size_t dataSize);
+
+
+MidiFile* MidiFile_new(const char* filename, int nTracks, int nTicksPerBeat) {
+    Log_assert(nTracks > 0 && nTracks <= UINT16_MAX, "Invalid midi file track count %d", nTracks);
+    Log_assert(nTicksPerBeat > 0 && nTicksPerBeat < 0x8000, "Invalid midi file ticks per beat %d", nTicksPerBeat);
+
+    MidiFile* self = ecalloc(1, sizeof(*self));
+    self->filename = estrdup(filename);
+    self->nTracks = nTracks;
+    self->trackLengthOffset = -1;
+
+    self->file = fopen(filename, "wb");
+    if (!self->file) {
+        Log_warning("Could not open '%s' for writing", filename);
+        self->isFailed = true;
+        return self;
+    }
+
+    MidiFile_writeBytes(self, MIDI_FILE_HEADER_MAGIC, sizeof(MIDI_FILE_HEADER_MAGIC));
+    MidiFile_writeUint32(self, MIDI_FILE_HEADER_SIZE);
+    MidiFile_writeUint16(self, MIDI_FILE_FORMAT);
+    MidiFile_writeUint16(self, nTracks);
+    MidiFile_writeUint16(self, nTicksPerBeat);
+
+    return self;
+}
+
+
+// Returns whether the complete file made it to disk
+bool MidiFile_close(MidiFile** pself) {
+    MidiFile* self = *pself;
+    Log_assert(self->trackLengthOffset == -1, "Midi file closed in the middle of a track");
+
+    if (!self->isFailed && self->nTracksWritten != self->nTracks) {
+        Log_warning("Midi file '%s' has %d of %d tracks", self->filename, self->nTracksWritten, self->nTracks);
+        self->isFailed = true;
+    }
+    if (self->file && fclose(self->file)) {
+        self->isFailed = true;
+    }
+
+    bool isWritten = !self->isFailed;
+    sfree((void**)&self->filename);
+    sfree((void**)pself);
+    return isWritten;
+}
+
+
+void MidiFile_beginTrack(MidiFile* self) {
+    Log_assert(self->trackLengthOffset == -1, "Midi file track started twice");
+    Log_assert(self->nTracksWritten < self->nTracks, "Too many tracks for midi file '%s'", self->filename);
+
+    MidiFile_writeBytes(self, MIDI_FILE_TRACK_MAGIC, sizeof(MIDI_FILE_TRACK_MAGIC));
+    self->trackLengthOffset = self->file ? ftell(self->file) : 0;
+    MidiFile_writeUint32(self, 0);  // patched in MidiFile_endTrack()
+    self->tickPrev = 0;
+    self->statusPrev = 0;
+}
+
+
+void MidiFile_endTrack(MidiFile* self) {
+    Log_assert(self->trackLengthOffset != -1, "Midi file track ended without being started");
+    MidiFile_writeMetaEvent(self, self->tickPrev, MIDI_FILE_META_END_OF_TRACK, NULL, 0);
+
+    if (!self->isFailed) {
+        long trackEndOffset = ftell(self->file);
+        uint32_t trackLength = trackEndOffset - self->trackLengthOffset - sizeof(uint32_t);
+        fseek(self->file, self->trackLengthOffset, SEEK_SET);
+        MidiFile_writeUint32(self, trackLength);
+        fseek(self->file, trackEndOffset, SEEK_SET);
+    }
+
+    self->trackLengthOffset = -1;
+    self->nTracksWritten++;
+}
+
+
+void MidiFile_writeTrackName(MidiFile* self, const char* name) {
+    size_t nameLength = strlen(name);
+    if (nameLength > MIDI_FILE_META_TEXT_LENGTH_MAX) {
+        nameLength = MIDI_FILE_META_TEXT_LENGTH_MAX;
+    }
+    MidiFile_writeMetaEvent(self, self->tickPrev, MIDI_FILE_META_TRACK_NAME, name, nameLength);
+}
+
+
+void MidiFile_writeTempo(MidiFile* self, int tempoBpm) {
+    Log_assert(tempoBpm > 0, "Invalid tempo %d", tempoBpm);
+    uint32_t microsecondsPerBeat = MICROSECONDS_PER_MINUTE / tempoBpm;
+    uint8_t data[] = {microsecondsPerBeat >> 16, microsecondsPerBeat >> 8, microsecondsPerBeat};
+    MidiFile_writeMetaEvent(self, self->tickPrev, MIDI_FILE_META_TEMPO, data, sizeof(data));
+}
+
+
+void MidiFile_writeTimeSignature(MidiFile* self, int nBeatsPerMeasure) {
+    Log_assert(nBeatsPerMeasure > 0 && nBeatsPerMeasure <= UINT8_MAX, "Invalid beats per measure %d", nBeatsPerMeasure);
+    uint8_t data[] = {
+        nBeatsPerMeasure,
+        MIDI_FILE_BEAT_NOTE_VALUE_LOG2,
+        MIDI_FILE_CLOCKS_PER_METRONOME_CLICK,
+        MIDI_FILE_32ND_NOTES_PER_QUARTER_NOTE,
+    };
+    MidiFile_writeMetaEvent(self, self->tickPrev, MIDI_FILE_META_TIME_SIGNATURE, data, sizeof(data));
+}
+
+
+// Messages within a track must come in tick order
+void MidiFile_writeMessage(MidiFile* self, const MidiMessage* midiMessage, int iChannel) {
+    Log_assert(iChannel >= 0 && iChannel < MIDI_FILE_CHANNEL_COUNT, "Invalid midi file channel %d", iChannel);
+    bool isNoteOn = midiMessage->type == MIDI_MESSAGE_TYPE_NOTEON;
+    int status = (isNoteOn ? MIDI_FILE_STATUS_NOTEON : MIDI_FILE_STATUS_NOTEOFF) | iChannel;
+
+    // Note on with velocity 0 would read as note off
+    int velocity = midiMessage->velocity;
+    if (velocity < MIDI_MESSAGE_VELOCITY_MIN) {
+        velocity = MIDI_MESSAGE_VELOCITY_MIN;
+    } else if (velocity > MIDI_MESSAGE_VELOCITY_MAX) {
+        velocity = MIDI_MESSAGE_VELOCITY_MAX;
+    }
+    if (isNoteOn && velocity == 0) {
+        velocity = 1;
+    }
+
+    MidiFile_writeDeltaTime(self, midiMessage->tick);
+    if (status != self->statusPrev) {
+        uint8_t statusByte = status;
+        MidiFile_writeBytes(self, &statusByte, 1);
+        self->statusPrev = status;
+    }
+    uint8_t data[] = {midiMessage->pitch, velocity};
+    MidiFile_writeBytes(self, data, sizeof(data));
+}
+
+
+static void MidiFile_writeBytes(MidiFile* self, const void* bytes, size_t nBytes) {
+    if (self->isFailed) {
+        return;
+    }
+    if (fwrite(bytes, 1, nBytes, self->file) != nBytes) {
+        Log_warning("Failed to write to '%s'", self->filename);
+        self->isFailed = true;
+    }
+}
+
+
+static void MidiFile_writeUint16(MidiFile* self, uint16_t value) {
+    uint8_t bytes[] = {value >> 8, value};
+    MidiFile_writeBytes(self, bytes, sizeof(bytes));
+}
+
+
+static void MidiFile_writeUint32(MidiFile* self, uint32_t value) {
+    uint8_t bytes[] = {value >> 24, value >> 16, value >> 8, value};
+    MidiFile_writeBytes(self, bytes, sizeof(bytes));
+}
+
+
+// Seven bits per byte, most significant first, the high bit marks all but the last byte
+static void MidiFile_writeVariableLengthQuantity(MidiFile* self, uint32_t value) {
+    Log_assert(value < (1u << (7 * VARIABLE_LENGTH_QUANTITY_SIZE_MAX)), "Value %u too large for a midi file", value);
+
+    uint8_t bytes[VARIABLE_LENGTH_QUANTITY_SIZE_MAX];
+    size_t nBytes = 0;
+    do {
+        bytes[VARIABLE_LENGTH_QUANTITY_SIZE_MAX - 1 - nBytes] = (value & 0x7F) | (nBytes ? 0x80 : 0);
+        value >>= 7;
+        nBytes++;
+    } while (value);
+
+    MidiFile_writeBytes(self, &bytes[VARIABLE_LENGTH_QUANTITY_SIZE_MAX - nBytes], nBytes);
+}
+
+
+static void MidiFile_writeDeltaTime(MidiFile* self, int tick) {
+    Log_assert(self->trackLengthOffset != -1, "Midi file event written outside of a track");
+    Log_assert(tick >= self->tickPrev, "Midi file events out of order (tick %d after %d)", tick, self->tickPrev);
+    MidiFile_writeVariableLengthQuantity(self, tick - self->tickPrev);
+    self->tickPrev = tick;
+}
+
+
+static void MidiFile_writeMetaEvent(MidiFile* self, int tick, int metaType, const void* data, size_t dataSize) {
+    MidiFile_writeDeltaTime(self, tick);
+    uint8_t header[] = {MIDI_FILE_STATUS_META, metaType};
+    MidiFile_writeBytes(self, header, sizeof(header));
+    MidiFile_writeVariableLengthQuantity(self, dataSize);
+    if (dataSize) {
+        MidiFile_writeBytes(self, data, dataSize);
+    }
+    self->statusPrev = 0;  // running status does not carry over meta events
+}
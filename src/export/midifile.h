@@ -0,0 +1,38 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#pragma once
+
+#include "common/structs/midimessage.h"
+
+#include <stdbool.h>
+
+enum {
+    MIDI_FILE_CHANNEL_COUNT = 16,
+};
+
+typedef struct MidiFile MidiFile;
+
+MidiFile* MidiFile_new(const char* filename, int nTracks, int nTicksPerBeat);
+bool MidiFile_close(MidiFile** pself);
+void MidiFile_beginTrack(MidiFile* self);
+void MidiFile_endTrack(MidiFile* self);
+void MidiFile_writeTrackName(MidiFile* self, const char* name);
+void MidiFile_writeTempo(MidiFile* self, int tempoBpm);
+void MidiFile_writeTimeSignature(MidiFile* self, int nBeatsPerMeasure);
+void MidiFile_writeMessage(MidiFile* self, const MidiMessage* midiMessage, int iChannel);
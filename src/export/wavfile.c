@@ -0,0 +1,187 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#include "wavfile.h"
+
+#include "common/util/alloc.h"
+#include "common/util/log.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char WAV_FILE_RIFF_MAGIC[4] = {'R', 'I', 'F', 'F'};
+static const char WAV_FILE_WAVE_MAGIC[4] = {'W', 'A', 'V', 'E'};
+static const char WAV_FILE_FORMAT_MAGIC[4] = {'f', 'm', 't', ' '};
+static const char WAV_FILE_FACT_MAGIC[4] = {'f', 'a', 'c', 't'};
+static const char WAV_FILE_DATA_MAGIC[4] = {'d', 'a', 't', 'a'};
+
+enum {
+    WAV_FILE_FORMAT_IEEE_FLOAT = 3,
+    WAV_FILE_FORMAT_SIZE = 18,
+    WAV_FILE_FACT_SIZE = 4,
+    WAV_FILE_BITS_PER_SAMPLE = 32,
+    WAV_FILE_CHANNELS_MAX = 8,
+    // Offsets of the sizes patched in by WavFile_close()
+    WAV_FILE_RIFF_SIZE_OFFSET = 4,
+    WAV_FILE_FACT_FRAMES_OFFSET = 46,
+    WAV_FILE_DATA_SIZE_OFFSET = 54,
+    WAV_FILE_HEADER_SIZE = 58,
+    WAV_FILE_WRITE_BUFFER_SIZE = 4096,
+};
+
+// 32-bit float samples, written as they come. The chunk sizes are patched in
+// when the file is closed.
+struct WavFile {
+    char* filename;
+    FILE* file;
+    int nChannels;
+    uint32_t nFrames;
+    bool isFailed;
+};
+
+
+static void WavFile_writeBytes(WavFile* self, const void* bytes, size_t nBytes);
+static void WavFile_writeUint16(WavFile* self, uint16_t value);
+static void WavFile_writeUint32(WavFile* self, uint32_t value);
+static void WavFile_patchUint32(WavFile* self, long offset, uint32_t value);
+
+
+WavFile* WavFile_new(const char* filename, int nChannels, int sampleRate) {
+    Log_assert(nChannels > 0 && nChannels <= WAV_FILE_CHANNELS_MAX, "Invalid wav file channel count %d", nChannels);
+    Log_assert(sampleRate > 0, "Invalid wav file sample rate %d", sampleRate);
+
+    WavFile* self = ecalloc(1, sizeof(*self));
+    self->filename = estrdup(filename);
+    self->nChannels = nChannels;
+
+    self->file = fopen(filename, "wb");
+    if (!self->file) {
+        Log_warning("Could not open '%s' for writing", filename);
+        self->isFailed = true;
+        return self;
+    }
+
+    uint16_t bytesPerFrame = nChannels * sizeof(float);
+
+    WavFile_writeBytes(self, WAV_FILE_RIFF_MAGIC, sizeof(WAV_FILE_RIFF_MAGIC));
+    WavFile_writeUint32(self, 0);
+    WavFile_writeBytes(self, WAV_FILE_WAVE_MAGIC, sizeof(WAV_FILE_WAVE_MAGIC));
+
+    WavFile_writeBytes(self, WAV_FILE_FORMAT_MAGIC, sizeof(WAV_FILE_FORMAT_MAGIC));
+    WavFile_writeUint32(self, WAV_FILE_FORMAT_SIZE);
+    WavFile_writeUint16(self, WAV_FILE_FORMAT_IEEE_FLOAT);
+    WavFile_writeUint16(self, nChannels);
+    WavFile_writeUint32(self, sampleRate);
+    WavFile_writeUint32(self, (uint32_t)sampleRate * bytesPerFrame);
+    WavFile_writeUint16(self, bytesPerFrame);
+    WavFile_writeUint16(self, WAV_FILE_BITS_PER_SAMPLE);
+    WavFile_writeUint16(self, 0);  // no format extension
+
+    // Required for anything but integer samples
+    WavFile_writeBytes(self, WAV_FILE_FACT_MAGIC, sizeof(WAV_FILE_FACT_MAGIC));
+    WavFile_writeUint32(self, WAV_FILE_FACT_SIZE);
+    WavFile_writeUint32(self, 0);
+
+    WavFile_writeBytes(self, WAV_FILE_DATA_MAGIC, sizeof(WAV_FILE_DATA_MAGIC));
+    WavFile_writeUint32(self, 0);
+
+    return self;
+}
+
+
+// Returns whether the complete file made it to disk
+bool WavFile_close(WavFile** pself) {
+    WavFile* self = *pself;
+
+    uint32_t dataSize = self->nFrames * self->nChannels * sizeof(float);
+    WavFile_patchUint32(self, WAV_FILE_RIFF_SIZE_OFFSET, WAV_FILE_HEADER_SIZE - 8 + dataSize);
+    WavFile_patchUint32(self, WAV_FILE_FACT_FRAMES_OFFSET, self->nFrames);
+    WavFile_patchUint32(self, WAV_FILE_DATA_SIZE_OFFSET, dataSize);
+
+    if (self->file && fclose(self->file)) {
+        self->isFailed = true;
+    }
+
+    bool isWritten = !self->isFailed;
+    sfree((void**)&self->filename);
+    sfree((void**)pself);
+    return isWritten;
+}
+
+
+// Samples are interleaved, one per channel for each frame
+void WavFile_writeFrames(WavFile* self, const float* samples, size_t nFrames) {
+    uint32_t dataSizeMax = UINT32_MAX - WAV_FILE_HEADER_SIZE;
+    if (!self->isFailed && (self->nFrames + nFrames) * self->nChannels * sizeof(float) > dataSizeMax) {
+        Log_warning("Wav file '%s' is too long", self->filename);
+        self->isFailed = true;
+    }
+
+    uint8_t buffer[WAV_FILE_WRITE_BUFFER_SIZE];
+    size_t nBufferBytes = 0;
+    for (size_t i = 0; i < nFrames * self->nChannels; i++) {
+        uint32_t bits = 0;
+        memcpy(&bits, &samples[i], sizeof(bits));
+        buffer[nBufferBytes++] = bits;
+        buffer[nBufferBytes++] = bits >> 8;
+        buffer[nBufferBytes++] = bits >> 16;
+        buffer[nBufferBytes++] = bits >> 24;
+        if (nBufferBytes == WAV_FILE_WRITE_BUFFER_SIZE) {
+            WavFile_writeBytes(self, buffer, nBufferBytes);
+            nBufferBytes = 0;
+        }
+    }
+    WavFile_writeBytes(self, buffer, nBufferBytes);
+    self->nFrames += nFrames;
+}
+
+
+static void WavFile_writeBytes(WavFile* self, const void* bytes, size_t nBytes) {
+    if (self->isFailed) {
+        return;
+    }
+    if (fwrite(bytes, 1, nBytes, self->file) != nBytes) {
+        Log_warning("Failed to write to '%s'", self->filename);
+        self->isFailed = true;
+    }
+}
+
+
+// Wav files are little-endian
+static void WavFile_writeUint16(WavFile* self, uint16_t value) {
+    uint8_t bytes[] = {value, value >> 8};
+    WavFile_writeBytes(self, bytes, sizeof(bytes));
+}
+
+
+static void WavFile_writeUint32(WavFile* self, uint32_t value) {
+    uint8_t bytes[] = {value, value >> 8, value >> 16, value >> 24};
+    WavFile_writeBytes(self, bytes, sizeof(bytes));
+}
+
+
+static void WavFile_patchUint32(WavFile* self, long offset, uint32_t value) {
+    if (self->isFailed) {
+        return;
+    }
+    long offsetEnd = ftell(self->file);
+    fseek(self->file, offset, SEEK_SET);
+    WavFile_writeUint32(self, value);
+    fseek(self->file, offsetEnd, SEEK_SET);
+}
@@ -0,0 +1,613 @@
+/* Copyright (C) 2020-2024 Martin Gulliksson <martin@gullik.cc>
+ *
+ * This file is part of gscore.
+ *
+ * gscore is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation, version 3.
+ *
+ * gscore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>
+ *
+ */
+
+#include "headless.h"
+
+#include "common/constants/fluidmidi.h"
+#include "common/score/score.h"
+#include "common/score/xmlconstants.h"
+#include "common/structs/midimessage.h"
+#include "common/structs/scorestats.h"
+#include "common/util/alloc.h"
+#include "common/util/log.h"
+#include "common/util/midimessages.h"
+#include "common/util/version.h"
+#include "config/config.h"
+#include "events/events.h"
+#include "synth/synth.h"
+
+#include <libxml/xmlwriter.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* const ARG_JOBS = "-j";
+static const char* const MIDI_FILE_EXTENSION = ".mid";
+static const char* const WAV_FILE_EXTENSION = ".wav";
+static const char* const XML_INDENT_STRING = "  ";
+
+static const size_t BENCHMARK_SORT_SIZES[] = {1000, 100000, 1000000};
+
+enum {
+    FILENAME_BUFFER_SIZE = 4096,
+    MILLISECONDS_PER_SECOND = 1000,
+    NANOSECONDS_PER_MILLISECOND = 1000000,
+    BENCHMARK_SORT_RUNS = 5,
+    BENCHMARK_LOAD_RUNS = 3,
+    BENCHMARK_FLATTEN_RUNS = 5,
+    BENCHMARK_FLATTEN_N_TRACKS = 16,
+    BENCHMARK_RANDOM_SEED = 12345,
+    GENERATE_N_BLOCKDEFS = 8000,  // with the notes below, about 100 MB of XML
+    GENERATE_N_NOTES_PER_BLOCKDEF = 100,
+    GENERATE_NAME_BUFFER_SIZE = 32,
+    KILOBYTES_PER_MEGABYTE = 1024,
+};
+
+typedef enum {
+    COMMAND_INPUT_SCORES,  // runs once per file, on the loaded score
+    COMMAND_INPUT_FILES,  // runs once per file, given only its name
+    COMMAND_INPUT_NONE,  // runs once, without files
+} CommandInput;
+
+typedef struct {
+    const char* name;
+    const char* description;
+    CommandInput input;
+    bool (*run)(Score* score, const char* filename, int nThreads);
+} HeadlessCommand;
+
+
+static bool runValidate(Score* score, const char* filename, int nThreads);
+static bool runStats(Score* score, const char* filename, int nThreads);
+static bool runExportMidi(Score* score, const char* filename, int nThreads);
+static bool runRender(Score* score, const char* filename, int nThreads);
+static bool runVerifyRender(Score* score, const char* filename, int nThreads);
+static bool runBenchmarkSort(Score* score, const char* filename, int nThreads);
+static bool runBenchmarkLoad(Score* score, const char* filename, int nThreads);
+static bool runBenchmarkFlatten(Score* score, const char* filename, int nThreads);
+static bool runGenerate(Score* score, const char* filename, int nThreads);
+static bool writeGeneratedScoreFile(FILE* file, int nTracks, long* pbytesWritten);
+static void writeGeneratedScore(xmlTextWriterPtr writer, int nTracks);
+static void writeGeneratedMalformedMessages(xmlTextWriterPtr writer, int blockDurationTicks);
+static void writeGeneratedMessage(xmlTextWriterPtr writer, int tick, int type, int pitch, float velocity);
+static MidiMessage* getBenchmarkMidiMessages(size_t nMidiMessages);
+static uint32_t getBenchmarkRandom(uint32_t* state);
+static bool makeOutputFilename(char* filenameOut, const char* filename, const char* extension);
+static const HeadlessCommand* findCommand(const char* name);
+static int processFile(const HeadlessCommand* command, const char* filename, int nThreads);
+static int processFiles(const HeadlessCommand* command, char* const* filenames, int nFilenames, int nJobs);
+static double getMilliseconds(void);
+static void printUsage(const char* programName);
+
+
+static const HeadlessCommand HEADLESS_COMMANDS[] = {
+    {"validate", "Check that the scores load", COMMAND_INPUT_SCORES, runValidate},
+    {"stats", "Print the size of the scores and how long they took to load", COMMAND_INPUT_SCORES, runStats},
+    {"export-midi", "Write each score as a midi file next to it (<filename>.mid)", COMMAND_INPUT_SCORES, runExportMidi},
+    {"render", "Render each score to a wav file next to it (<filename>.wav)", COMMAND_INPUT_SCORES, runRender},
+    {"verify-render", "Check that rendering in parallel sounds the same as rendering serially", COMMAND_INPUT_SCORES, runVerifyRender},
+    {"benchmark-sort", "Time the midi message sort against qsort on 1k, 100k and 1M messages (no files)", COMMAND_INPUT_NONE, runBenchmarkSort},
+    {"benchmark-load", "Time loading each score a few times and print the peak memory use", COMMAND_INPUT_FILES, runBenchmarkLoad},
+    {"benchmark-flatten", "Time flattening a generated score of 16 tracks of 1024 time slots for playback (no files)", COMMAND_INPUT_NONE, runBenchmarkFlatten},
+    {"generate", "Write a synthetic score of about 100 MB to each file, for benchmark-load", COMMAND_INPUT_FILES, runGenerate},
+};
+
+
+// Runs a command on score files without a window, OpenGL or audio device.
+// Every file is processed in a child process of its own, so that they run in
+// parallel and a broken file cannot take the others down with it.
+int Headless_run(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const HeadlessCommand* command = findCommand(argv[1]);
+    if (!command) {
+        Log_error("Unknown command '%s'", argv[1]);
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (command->input == COMMAND_INPUT_NONE) {
+        return command->run(NULL, NULL, 1) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int iFilenameFirst = 2;
+    int nJobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!strcmp(argv[2], ARG_JOBS)) {
+        if (argc < 5 || atoi(argv[3]) < 1) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        nJobs = atoi(argv[3]);
+        iFilenameFirst = 4;
+    }
+    if (nJobs < 1) {
+        nJobs = 1;
+    }
+
+    int nFilenames = argc - iFilenameFirst;
+    int nFailed = processFiles(command, &argv[iFilenameFirst], nFilenames, nJobs);
+
+    if (nFailed > 0) {
+        Log_error("%s failed for %d of %d file(s)", command->name, nFailed, nFilenames);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+static bool runValidate(Score* score, const char* filename, int nThreads) {
+    (void)score; (void)nThreads;
+    Log_info("%s: ok", filename);
+    return true;
+}
+
+
+static bool runStats(Score* score, const char* filename, int nThreads) {
+    (void)nThreads;
+    ScoreStats stats = Score_getStats(score);
+    Log_info("%s: %d track(s), %d time slot(s), %d block(s), %d block instance(s), %zu note(s), %zu midi message(s), %d bpm, %.1f s",
+        filename, stats.nTracks, stats.nTimeSlots, stats.nBlockDefs, stats.nBlockInstances, stats.nNotes, stats.nMidiMessages,
+        stats.tempoBpm, stats.durationSeconds);
+    return true;
+}
+
+
+static bool runExportMidi(Score* score, const char* filename, int nThreads) {
+    (void)nThreads;
+    char filenameOut[FILENAME_BUFFER_SIZE] = {0};
+    if (!makeOutputFilename(filenameOut, filename, MIDI_FILE_EXTENSION)) {
+        return false;
+    }
+    return Score_exportMidi(score, filenameOut);
+}
+
+
+static bool runRender(Score* score, const char* filename, int nThreads) {
+    char filenameOut[FILENAME_BUFFER_SIZE] = {0};
+    if (!makeOutputFilename(filenameOut, filename, WAV_FILE_EXTENSION)) {
+        return false;
+    }
+    Synth* synth = Synth_newOffline(score);
+    bool isWritten = Synth_renderToFile(synth, filenameOut, nThreads);
+    Synth_free(&synth);
+    return isWritten;
+}
+
+
+static bool runVerifyRender(Score* score, const char* filename, int nThreads) {
+    (void)filename;
+    Synth* synth = Synth_newOffline(score);
+    bool isMatching = Synth_verifyRender(synth, nThreads);
+    Synth_free(&synth);
+    return isMatching;
+}
+
+
+// Sorts shuffled messages shaped like a flattened score with sortMidiMessages
+// and with qsort on compareMidiMessages, the sort it replaced. Prints the best
+// of a few runs for each size and checks that both sorts agree.
+static bool runBenchmarkSort(Score* score, const char* filename, int nThreads) {
+    (void)score; (void)filename; (void)nThreads;
+
+    bool isMatching = true;
+    for (size_t iSize = 0; iSize < sizeof(BENCHMARK_SORT_SIZES) / sizeof(BENCHMARK_SORT_SIZES[0]); iSize++) {
+        size_t nMidiMessages = BENCHMARK_SORT_SIZES[iSize];
+        MidiMessage* midiMessages = getBenchmarkMidiMessages(nMidiMessages);
+        MidiMessage* midiMessagesSorted = ecalloc(nMidiMessages, sizeof(MidiMessage));
+        MidiMessage* midiMessagesQsorted = ecalloc(nMidiMessages, sizeof(MidiMessage));
+
+        double millisecondsSort = 0.0;
+        double millisecondsQsort = 0.0;
+        for (int iRun = 0; iRun < BENCHMARK_SORT_RUNS; iRun++) {
+            memcpy(midiMessagesSorted, midiMessages, nMidiMessages * sizeof(MidiMessage));
+            double timeStart = getMilliseconds();
+            sortMidiMessages(midiMessagesSorted, nMidiMessages);
+            double timeSorted = getMilliseconds();
+
+            memcpy(midiMessagesQsorted, midiMessages, nMidiMessages * sizeof(MidiMessage));
+            double timeQsortStart = getMilliseconds();
+            qsort(midiMessagesQsorted, nMidiMessages, sizeof(MidiMessage), compareMidiMessages);
+            double timeQsorted = getMilliseconds();
+
+            if (iRun == 0 || timeSorted - timeStart < millisecondsSort) {
+                millisecondsSort = timeSorted - timeStart;
+            }
+            if (iRun == 0 || timeQsorted - timeQsortStart < millisecondsQsort) {
+                millisecondsQsort = timeQsorted - timeQsortStart;
+            }
+        }
+
+        // Messages that compare equal are identical, so the orders must match exactly
+        bool isMatchingSize = !memcmp(midiMessagesSorted, midiMessagesQsorted, nMidiMessages * sizeof(MidiMessage));
+        Log_info("%zu midi messages: sortMidiMessages %.2f ms, qsort %.2f ms (%.1fx)%s", nMidiMessages,
+            millisecondsSort, millisecondsQsort, millisecondsQsort / millisecondsSort, isMatchingSize ? "" : ", ORDER DIFFERS");
+        isMatching = isMatching && isMatchingSize;
+
+        sfree((void**)&midiMessagesQsorted);
+        sfree((void**)&midiMessagesSorted);
+        sfree((void**)&midiMessages);
+    }
+    return isMatching;
+}
+
+
+// Each file gets a process of its own, so the peak memory use is that of
+// loading this score alone
+static bool runBenchmarkLoad(Score* score, const char* filename, int nThreads) {
+    (void)score; (void)nThreads;
+    if (access(filename, R_OK) == -1) {
+        Log_error("%s: file does not exist or is not readable", filename);
+        return false;
+    }
+
+    double millisecondsMin = 0.0;
+    double millisecondsMax = 0.0;
+    for (int iRun = 0; iRun < BENCHMARK_LOAD_RUNS; iRun++) {
+        Events_setup();
+        double timeStart = getMilliseconds();
+        Score* scoreLoaded = Score_new(filename, false);
+        Score_free(&scoreLoaded);
+        double milliseconds = getMilliseconds() - timeStart;
+        Events_teardown();
+
+        if (iRun == 0 || milliseconds < millisecondsMin) {
+            millisecondsMin = milliseconds;
+        }
+        if (iRun == 0 || milliseconds > millisecondsMax) {
+            millisecondsMax = milliseconds;
+        }
+    }
+
+    struct rusage usage = {0};
+    getrusage(RUSAGE_SELF, &usage);
+    Log_info("%s: load and free %.1f-%.1f ms over %d runs, peak RSS %ld MB", filename,
+        millisecondsMin, millisecondsMax, BENCHMARK_LOAD_RUNS, usage.ru_maxrss / KILOBYTES_PER_MEGABYTE);
+    return true;
+}
+
+
+// Flattens a generated score into one sequencer request, as playing or
+// rendering the entire score does. The first run also builds the timeline the
+// later runs reuse, so it is printed on its own.
+static bool runBenchmarkFlatten(Score* score, const char* filename, int nThreads) {
+    (void)score; (void)filename; (void)nThreads;
+
+    char filenameScore[] = "/tmp/gscore-benchmark-flatten-XXXXXX";
+    int fd = mkstemp(filenameScore);
+    FILE* file = fd == -1 ? NULL : fdopen(fd, "wb");
+    if (!file) {
+        Log_error("Could not create a temporary file for the generated score");
+        if (fd != -1) {
+            close(fd);
+            unlink(filenameScore);
+        }
+        return false;
+    }
+    bool isWritten = writeGeneratedScoreFile(file, BENCHMARK_FLATTEN_N_TRACKS, NULL);
+    if (!isWritten) {
+        Log_error("%s: failed to write the score", filenameScore);
+        unlink(filenameScore);
+        return false;
+    }
+
+    Events_setup();
+    Score* scoreLoaded = Score_new(filenameScore, false);
+    unlink(filenameScore);
+
+    size_t nMidiMessages = 0;
+    double millisecondsFirst = 0.0;
+    double millisecondsMin = 0.0;
+    for (int iRun = 0; iRun < BENCHMARK_FLATTEN_RUNS; iRun++) {
+        double timeStart = getMilliseconds();
+        SequencerRequest request = Score_getEntireScoreSequencerRequest(scoreLoaded, 0);
+        double milliseconds = getMilliseconds() - timeStart;
+        nMidiMessages = request.nMidiMessages;
+        sfree((void**)&request.midiMessages);
+
+        if (iRun == 0) {
+            millisecondsFirst = milliseconds;
+        }
+        else if (iRun == 1 || milliseconds < millisecondsMin) {
+            millisecondsMin = milliseconds;
+        }
+    }
+
+    Score_free(&scoreLoaded);
+    Events_teardown();
+
+    Log_info("%d track(s) of %d time slot(s), %zu midi message(s): first flatten %.1f ms (builds the timeline), then %.1f ms (best of %d runs)",
+        BENCHMARK_FLATTEN_N_TRACKS, SCORE_LENGTH_MAX, nMidiMessages, millisecondsFirst, millisecondsMin, BENCHMARK_FLATTEN_RUNS - 1);
+    return true;
+}
+
+
+static bool runGenerate(Score* score, const char* filename, int nThreads) {
+    (void)score; (void)nThreads;
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        Log_error("%s: could not open it for writing", filename);
+        return false;
+    }
+
+    long bytesWritten = 0;
+    if (!writeGeneratedScoreFile(file, N_SYNTH_TRACKS, &bytesWritten)) {
+        Log_error("%s: failed to write the score", filename);
+        return false;
+    }
+    Log_info("%s: %d track(s), %d time slot(s), %d block(s), %d note(s), %ld bytes", filename, N_SYNTH_TRACKS, SCORE_LENGTH_MAX,
+        GENERATE_N_BLOCKDEFS, GENERATE_N_BLOCKDEFS * GENERATE_N_NOTES_PER_BLOCKDEF, bytesWritten);
+    return true;
+}
+
+
+// Closes the file. The number of bytes written is optional.
+static bool writeGeneratedScoreFile(FILE* file, int nTracks, long* pbytesWritten) {
+    xmlTextWriterPtr writer = xmlNewTextWriter(xmlOutputBufferCreateFile(file, NULL));
+    Log_assert(writer, "Could not create XML writer");
+    xmlTextWriterSetIndent(writer, 1);
+    xmlTextWriterSetIndentString(writer, BAD_CAST XML_INDENT_STRING);
+
+    writeGeneratedScore(writer, nTracks);
+
+    xmlTextWriterFlush(writer);
+    if (pbytesWritten) {
+        *pbytesWritten = ftell(file);
+    }
+    bool isWritten = !ferror(file);
+    xmlFreeTextWriter(writer);
+    return fclose(file) == 0 && isWritten;
+}
+
+
+// Every time slot of every track is filled, cycling through the blocks. Each
+// block holds notes of random pitch and velocity, one after the other so that
+// no note ons and offs of the same pitch overlap. The first block also holds
+// messages the loader has to skip.
+static void writeGeneratedScore(xmlTextWriterPtr writer, int nTracks) {
+    uint32_t randomState = BENCHMARK_RANDOM_SEED;
+    int blockDurationTicks = N_BLOCK_MEASURES * N_BEATS_PER_MEASURE_DEFAULT * TICKS_PER_BEAT;
+    int noteSpacingTicks = blockDurationTicks / GENERATE_N_NOTES_PER_BLOCKDEF;
+    char name[GENERATE_NAME_BUFFER_SIZE] = {0};
+
+    xmlTextWriterStartDocument(writer, XML_VERSION, XML_ENCODING, NULL);
+
+    xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_GSCORE);
+    xmlTextWriterWriteAttribute(writer, BAD_CAST XMLATTRIB_VERSION, BAD_CAST VERSION);
+
+    xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_SCORE);
+    xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_TEMPO, "%d", TEMPO_BPM_DEFAULT);
+    xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_BEATSPERMEASURE, "%d", N_BEATS_PER_MEASURE_DEFAULT);
+    xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_TICKSPERBEAT, "%d", TICKS_PER_BEAT);
+    xmlTextWriterWriteAttribute(writer, BAD_CAST XMLATTRIB_KEYSIGNATURE, BAD_CAST Score_getDefaultKeySignatureName());
+
+    xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_BLOCKDEFS);
+    for (int iBlockDef = 0; iBlockDef < GENERATE_N_BLOCKDEFS; iBlockDef++) {
+        snprintf(name, GENERATE_NAME_BUFFER_SIZE, "block%d", iBlockDef);
+        xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_BLOCKDEF);
+        xmlTextWriterWriteAttribute(writer, BAD_CAST XMLATTRIB_NAME, BAD_CAST name);
+        xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_COLOR, "%06x", (unsigned)(getBenchmarkRandom(&randomState) & 0xffffff));
+
+        for (int iNote = 0; iNote < GENERATE_N_NOTES_PER_BLOCKDEF; iNote++) {
+            int tick = iNote * noteSpacingTicks;
+            int pitch = getBenchmarkRandom(&randomState) % MIDI_MESSAGE_PITCH_COUNT;
+            float velocity = (float)(getBenchmarkRandom(&randomState) % (MIDI_MESSAGE_VELOCITY_MAX + 1)) / MIDI_MESSAGE_VELOCITY_MAX;
+            writeGeneratedMessage(writer, tick, MIDI_MESSAGE_TYPE_NOTEON, pitch, velocity);
+            writeGeneratedMessage(writer, tick + noteSpacingTicks / 2, MIDI_MESSAGE_TYPE_NOTEOFF, pitch, 0.0f);
+        }
+        if (iBlockDef == 0) {
+            writeGeneratedMalformedMessages(writer, blockDurationTicks);
+        }
+
+        xmlTextWriterEndElement(writer);
+    }
+    xmlTextWriterEndElement(writer);
+
+    xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_TRACKS);
+    for (int iTrack = 0; iTrack < nTracks; iTrack++) {
+        xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_TRACK);
+        xmlTextWriterWriteAttribute(writer, BAD_CAST XMLATTRIB_PROGRAM, BAD_CAST SYNTH_PROGRAM_NAME_DEFAULT);
+        xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_VELOCITY, "%f", TRACK_VELOCITY_DEFAULT);
+        xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_IGNORENOTEOFF, "%d", 0);
+
+        for (int iTimeSlot = 0; iTimeSlot < SCORE_LENGTH_MAX; iTimeSlot++) {
+            snprintf(name, GENERATE_NAME_BUFFER_SIZE, "block%d", (iTrack * SCORE_LENGTH_MAX + iTimeSlot) % GENERATE_N_BLOCKDEFS);
+            xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_BLOCK);
+            xmlTextWriterWriteAttribute(writer, BAD_CAST XMLATTRIB_NAME, BAD_CAST name);
+            xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_VELOCITY, "%f", BLOCK_VELOCITY_DEFAULT);
+            xmlTextWriterEndElement(writer);
+        }
+
+        xmlTextWriterEndElement(writer);
+    }
+    xmlTextWriterEndElement(writer);
+
+    xmlTextWriterEndDocument(writer);
+}
+
+
+// Written after all other notes of the block, so that each note on pairs with
+// the note off following it
+static void writeGeneratedMalformedMessages(xmlTextWriterPtr writer, int blockDurationTicks) {
+    int pitch = MIDI_MESSAGE_PITCH_MAX / 2;
+    int tick = blockDurationTicks - 1;
+
+    // Without length, and ending before it starts
+    writeGeneratedMessage(writer, tick, MIDI_MESSAGE_TYPE_NOTEON, pitch, 1.0f);
+    writeGeneratedMessage(writer, tick, MIDI_MESSAGE_TYPE_NOTEOFF, pitch, 0.0f);
+    writeGeneratedMessage(writer, tick, MIDI_MESSAGE_TYPE_NOTEON, pitch, 1.0f);
+    writeGeneratedMessage(writer, tick - 1, MIDI_MESSAGE_TYPE_NOTEOFF, pitch, 0.0f);
+
+    // Unknown type, and a pitch out of range
+    writeGeneratedMessage(writer, 0, MIDI_MESSAGE_TYPE_NOTEON + MIDI_MESSAGE_TYPE_NOTEOFF + 1, pitch, 1.0f);
+    writeGeneratedMessage(writer, 0, MIDI_MESSAGE_TYPE_NOTEON, MIDI_MESSAGE_PITCH_COUNT, 1.0f);
+}
+
+
+static void writeGeneratedMessage(xmlTextWriterPtr writer, int tick, int type, int pitch, float velocity) {
+    xmlTextWriterStartElement(writer, BAD_CAST XMLNODE_MESSAGE);
+    xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_TICK, "%d", tick);
+    xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_TYPE, "%d", type);
+    xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_PITCH, "%d", pitch);
+    xmlTextWriterWriteFormatAttribute(writer, BAD_CAST XMLATTRIB_VELOCITY, "%f", velocity);
+    xmlTextWriterEndElement(writer);
+}
+
+
+// Note ons and offs at random ticks about four per tick apart, on all tracks
+static MidiMessage* getBenchmarkMidiMessages(size_t nMidiMessages) {
+    uint32_t randomState = BENCHMARK_RANDOM_SEED;
+    MidiMessage* midiMessages = ecalloc(nMidiMessages, sizeof(MidiMessage));
+    for (size_t i = 0; i < nMidiMessages; i++) {
+        bool isNoteOn = getBenchmarkRandom(&randomState) % 2;
+        midiMessages[i] = (MidiMessage){
+            .type = isNoteOn ? MIDI_MESSAGE_TYPE_NOTEON : MIDI_MESSAGE_TYPE_NOTEOFF,
+            .channel = 1 + getBenchmarkRandom(&randomState) % N_SYNTH_TRACKS,
+            .pitch = getBenchmarkRandom(&randomState) % MIDI_MESSAGE_PITCH_COUNT,
+            .velocity = isNoteOn ? getBenchmarkRandom(&randomState) % (MIDI_MESSAGE_VELOCITY_MAX + 1) : 0,
+            .tick = getBenchmarkRandom(&randomState) % (nMidiMessages / 4 + 1),
+        };
+    }
+    return midiMessages;
+}
+
+
+// xorshift32, so that every run sorts the same messages
+static uint32_t getBenchmarkRandom(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+
+static bool makeOutputFilename(char* filenameOut, const char* filename, const char* extension) {
+    int nChars = snprintf(filenameOut, FILENAME_BUFFER_SIZE, "%s%s", filename, extension);
+    if (nChars < 0 || nChars >= FILENAME_BUFFER_SIZE) {
+        Log_error("%s: file name too long", filename);
+        return false;
+    }
+    return true;
+}
+
+
+static const HeadlessCommand* findCommand(const char* name) {
+    for (size_t i = 0; i < sizeof(HEADLESS_COMMANDS) / sizeof(HEADLESS_COMMANDS[0]); i++) {
+        if (!strcmp(HEADLESS_COMMANDS[i].name, name)) {
+            return &HEADLESS_COMMANDS[i];
+        }
+    }
+    return NULL;
+}
+
+
+// Scores are opened without their journals, nothing but the output files is written
+static int processFile(const HeadlessCommand* command, const char* filename, int nThreads) {
+    if (command->input == COMMAND_INPUT_FILES) {
+        return command->run(NULL, filename, nThreads) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (access(filename, R_OK) == -1) {
+        Log_error("%s: file does not exist or is not readable", filename);
+        return EXIT_FAILURE;
+    }
+
+    double timeStart = getMilliseconds();
+
+    Events_setup();
+    Score* score = Score_new(filename, false);
+    double timeLoaded = getMilliseconds();
+    bool isSuccess = command->run(score, filename, nThreads);
+    Score_free(&score);
+    Events_teardown();
+
+    double timeEnd = getMilliseconds();
+    Log_info("%s: %s took %.1f ms (loading %.1f ms)", filename, command->name, timeEnd - timeStart, timeLoaded - timeStart);
+
+    return isSuccess ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// Returns the number of files that failed
+static int processFiles(const HeadlessCommand* command, char* const* filenames, int nFilenames, int nJobs) {
+    // Jobs left over when there are fewer files become threads, for rendering
+    int nThreads = nFilenames < nJobs ? nJobs / nFilenames : 1;
+
+    int nFailed = 0;
+    int nRunning = 0;
+    int iFilenameNext = 0;
+
+    while (iFilenameNext < nFilenames || nRunning > 0) {
+        if (iFilenameNext < nFilenames && nRunning < nJobs) {
+            const char* filename = filenames[iFilenameNext];
+            iFilenameNext++;
+
+            fflush(stdout);  // or the child would print it again
+            pid_t pid = fork();
+            if (pid == 0) {
+                exit(processFile(command, filename, nThreads));
+            } else if (pid < 0) {
+                Log_error("%s: could not start a process for it", filename);
+                nFailed++;
+            } else {
+                nRunning++;
+            }
+            continue;
+        }
+
+        int status = 0;
+        pid_t pid = wait(&status);
+        Log_assert(pid > 0, "Lost track of the running processes");
+        nRunning--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            nFailed++;
+        }
+    }
+
+    return nFailed;
+}
+
+
+static double getMilliseconds(void) {
+    struct timespec time = {0};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec * MILLISECONDS_PER_SECOND + (double)time.tv_nsec / NANOSECONDS_PER_MILLISECOND;
+}
+
+
+static void printUsage(const char* programName) {
+    printf("usage: %s command [%s jobs] file...\n       %s benchmark-sort|benchmark-flatten\n\ncommands:\n", programName, ARG_JOBS, programName);
+    for (size_t i = 0; i < sizeof(HEADLESS_COMMANDS) / sizeof(HEADLESS_COMMANDS[0]); i++) {
+        printf("    %-18s %s\n", HEADLESS_COMMANDS[i].name, HEADLESS_COMMANDS[i].description);
+    }
+}
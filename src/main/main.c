@@ -18,15 +18,97 @@
 
 #include "application/application.h"
 
+#include "common/score/score.h"
 #include "common/util/alloc.h"
 #include "common/util/log.h"
 #include "common/util/version.h"
+#include "events/events.h"
+#include "synth/synth.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char* const ARG_CONVERT = "--convert";
+static const char* const ARG_EXPORT_MIDI = "--export-midi";
+static const char* const ARG_RENDER = "--render";
+
+
+// Re-save a score under a new name, the file extensions pick the formats
+static int convertScore(const char* filenameIn, const char* filenameOut) {
+    if (access(filenameIn, F_OK) == -1) {
+        Log_error("File '%s' does not exist", filenameIn);
+        return EXIT_FAILURE;
+    }
+
+    Events_setup();
+    Score* score = Score_new(filenameIn, false);
+    bool isWritten = Score_writeToFile(score, filenameOut);
+    Score_free(&score);
+    Events_teardown();
+
+    return isWritten ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static int exportMidi(const char* filenameIn, const char* filenameOut) {
+    if (access(filenameIn, F_OK) == -1) {
+        Log_error("File '%s' does not exist", filenameIn);
+        return EXIT_FAILURE;
+    }
+
+    Events_setup();
+    Score* score = Score_new(filenameIn, false);
+    bool isWritten = Score_exportMidi(score, filenameOut);
+    Score_free(&score);
+    Events_teardown();
+
+    return isWritten ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static int render(const char* filenameIn, const char* filenameOut) {
+    if (access(filenameIn, F_OK) == -1) {
+        Log_error("File '%s' does not exist", filenameIn);
+        return EXIT_FAILURE;
+    }
+
+    Events_setup();
+    Score* score = Score_new(filenameIn, false);
+    Synth* synth = Synth_newOffline(score);
+    bool isWritten = Synth_renderToFile(synth, filenameOut, sysconf(_SC_NPROCESSORS_ONLN));
+    Synth_free(&synth);
+    Score_free(&score);
+    Events_teardown();
+
+    return isWritten ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 
 int main(int argc, char* argv[]) {
     Log_info("This is gscore %s", VERSION);
 
+    if (argc == 4 && !strcmp(argv[1], ARG_CONVERT)) {
+        int exitCode = convertScore(argv[2], argv[3]);
+        printMemoryLeakWarning();
+        return exitCode;
+    }
+
+    if (argc == 4 && !strcmp(argv[1], ARG_EXPORT_MIDI)) {
+        int exitCode = exportMidi(argv[2], argv[3]);
+        printMemoryLeakWarning();
+        return exitCode;
+    }
+
+    if (argc == 4 && !strcmp(argv[1], ARG_RENDER)) {
+        int exitCode = render(argv[2], argv[3]);
+        printMemoryLeakWarning();
+        return exitCode;
+    }
+
     if (argc != 2) {
-        Log_fatal("usage: %s filename", argv[0]);
+        Log_fatal("usage: %s filename\n       %s %s infile outfile\n       %s %s infile outfile.mid\n       %s %s infile outfile.wav",
+            argv[0], argv[0], ARG_CONVERT, argv[0], ARG_EXPORT_MIDI, argv[0], ARG_RENDER);
     }
 
     Application* application = Application_new(argv[1]);
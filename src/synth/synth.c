@@ -22,19 +22,28 @@
 #include "common/structs/midimessage.h"
 #include "common/structs/queryrequest.h"
 #include "common/structs/queryresult.h"
+#include "common/structs/sequencechange.h"
 #include "common/structs/sequencerrequest.h"
 #include "common/structs/synthprogramchange.h"
 #include "common/util/alloc.h"
 #include "common/util/log.h"
+#include "common/util/math.h"
+#include "common/util/midimessages.h"
 #include "common/util/stringmap.h"
 #include "config/config.h"
 #include "events/events.h"
+#include "export/wavfile.h"
 
 #include <fluidsynth.h>
 
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 static const char* const AUDIO_DRIVER = "alsa";
 static const char* const ENVVAR_SOUNDFONTS = "GSCORE_SOUNDFONTS";
@@ -54,6 +63,10 @@ enum {
     SYNTH_AUDIO_PERIOD_SIZE = 64,
     SYNTH_MIDI_CHANNELS = 16,
     FX_GROUP_ALL = -1,
+    RENDER_CHANNELS = 2,
+    MILLISECONDS_PER_SECOND = 1000,
+    NANOSECONDS_PER_SECOND = 1000000000,
+    MIDI_MESSAGE_TYPE_REMOVED = -1,
 };
 
 
@@ -65,20 +78,73 @@ struct SynthInstrument {
 };
 
 
+// One stretch of the score rendered on a synth and thread of its own. The
+// synth starts playing at the preroll frame, so that the notes still sounding
+// when the segment starts sound the same as in a serial render.
+typedef struct RenderSegment RenderSegment;
+struct RenderSegment {
+    WavFile* wavFile;  // written to block by block, NULL to keep the samples until the segment is joined
+    fluid_synth_t* fluidSynth;
+    const MidiMessage* midiMessages;
+    const int64_t* midiMessageFrames;
+    size_t nMidiMessages;
+    int64_t iFramePreroll;
+    int64_t iFrameStart;
+    int64_t iFrameEnd;  // -1 to keep going until the last notes have rung out
+    float* samples;
+    int64_t nFrames;
+    int64_t nFramesMax;
+    pthread_t thread;
+};
+
+
+// At most nThreads segments render at a time, the next one starts as the
+// oldest is joined
+typedef struct SynthRender SynthRender;
+struct SynthRender {
+    Synth* synth;
+    SequencerRequest sequencerRequest;
+    int64_t* midiMessageFrames;
+    RenderSegment* segments;
+    size_t nSegments;
+    size_t nSegmentsStarted;
+    size_t nSegmentsJoined;
+    int nThreads;
+};
+
+
 struct Synth {
     Score* score;
+    bool isOffline;
     fluid_settings_t* settings;
     fluid_synth_t* fluidSynth;
     fluid_audio_driver_t* audioDriver;
     int soundFontIds[MAX_SOUNDFONTS];
+    char* soundFontFilenames[MAX_SOUNDFONTS];
     size_t nSoundFonts;
+    const SynthInstrument* channelSynthInstruments[SYNTH_MIDI_CHANNELS];
     fluid_sequencer_t* sequencer;
     fluid_seq_id_t synthSequencerId;
     fluid_seq_id_t callbackId;
     bool isSequencerRunning;
     unsigned int sequencerStartTimeTicks;
-    unsigned int sequencerEndTimeTicks;
+    unsigned int sequencerEndTimeTicks;  // of the pass that is playing
+    unsigned int sequencerProgressStartTimeTicks;
     float sequencerInitialProgressFraction;
+    MidiMessage* sequenceMidiMessages;  // of the playing sequence, handed to the sequencer a window at a time
+    size_t nSequenceMidiMessages;
+    size_t nSequenceMidiMessagesMax;
+    MidiMessage* loopMidiMessages;  // replayed by every pass after the first while looping
+    size_t nLoopMidiMessages;
+    size_t nLoopMidiMessagesMax;
+    size_t iSequenceMidiMessageNext;
+    int iSequencePass;  // of the next message to schedule
+    int iSequenceProgressPass;
+    int sequenceTickStart;
+    int sequenceTickEnd;
+    int sequenceTickLoopStart;
+    float sequenceSecondsPerTick;
+    bool isSequenceLooping;
     SynthInstrument* synthInstruments;
     char* synthInstrumentListString;
     StringMap* synthInstrumentMap;
@@ -96,8 +162,30 @@ static void Synth_onRequestSequencerStart(Synth* self, void* sender, SequencerRe
 static void Synth_onSequencerStarted(Synth* self, void* sender, SequencerRequest* sequencerRequest);
 static void Synth_onRequestSequencerStop(Synth* self, void* sender, void* unused);
 static void Synth_onSequencerCallback(Synth* self, void* sender, void* unused);
+static void Synth_onSequenceChanged(Synth* self, void* sender, SequenceChange* sequenceChange);
 static void Synth_setSynthProgram(Synth* self, const char* synthProgramName, int iChannel);
+static void Synth_scheduleMidiMessages(Synth* self);
+static unsigned int Synth_getSequencerTicks(Synth* self, int iPass, int tick);
+static size_t Synth_copySequenceMidiMessages(MidiMessage** pmidiMessages, size_t* nMidiMessagesMax, const MidiMessage* midiMessages, size_t nMidiMessages, int tickEnd);
+static size_t Synth_changeSequenceMidiMessages(MidiMessage** pmidiMessages, size_t nMidiMessages, size_t* nMidiMessagesMax, const SequenceChange* sequenceChange, int tickStart, int tickEnd);
+static size_t Synth_findSequenceMidiMessageAfter(Synth* self, int iPass, unsigned int sequencerTick);
+static bool Synth_isMidiMessageAfter(Synth* self, int iPass, const MidiMessage* midiMessage, unsigned int sequencerTick);
+static bool Synth_hasNoteOffAfter(Synth* self, int iPass, const MidiMessage* midiMessages, size_t nMidiMessages, int iChannel, int pitch, unsigned int sequencerTick);
+static void Synth_stopRemovedNotes(Synth* self, int iPass, const SequenceChange* sequenceChange, unsigned int sequencerTick);
+static void Synth_loadSoundFonts(Synth* self);
+static SynthRender* Synth_startRender(Synth* self, int nThreads, WavFile* wavFile);
+static void Synth_startRenderSegment(SynthRender* render);
+static void Synth_joinRenderSegment(SynthRender* render);
+static void Synth_freeRender(SynthRender** prender);
+static fluid_synth_t* Synth_newRenderSynth(Synth* self);
+static int64_t Synth_getPrerollFrame(const SynthRender* render, const int64_t* noteOffFrames, int64_t iFrameStart, size_t* iMessageMin);
+static int64_t* Synth_getNoteOffFrames(const SynthRender* render);
+static void* Synth_renderSegment(void* data);
+static void Synth_renderSegmentFrames(RenderSegment* segment, int64_t* iFrame, int64_t iFrameTarget, float* discardedSamples);
+static double Synth_getSeconds(void);
 static void Synth_sequencerCallback(unsigned int time, fluid_event_t* event, fluid_sequencer_t* sequencer, void* data);
+static void applyMidiMessage(fluid_synth_t* fluidSynth, const MidiMessage* midiMessage);
+static bool clampMidiMessage(MidiMessage* midiMessage, int tickEnd);
 
 
 Synth* Synth_new(Score* score) {
@@ -105,11 +193,6 @@ Synth* Synth_new(Score* score) {
 
     self->score = score;
 
-    const char* soundFonts = getenv(ENVVAR_SOUNDFONTS);
-    if (!soundFonts) {
-        Log_fatal("Environment variable %s is not set", ENVVAR_SOUNDFONTS);
-    }
-
     self->settings = new_fluid_settings();
     self->fluidSynth = new_fluid_synth(self->settings);
     fluid_settings_setstr(self->settings, "audio.driver", AUDIO_DRIVER);
@@ -122,83 +205,12 @@ Synth* Synth_new(Score* score) {
         Log_fatal("Failed to initialize FluidSynth");
     }
 
-    {
-        self->nSoundFonts = 0;
-        char* soundFontsDuped = estrdup(soundFonts);
-        for (char* soundFont = strtok(soundFontsDuped, SOUNDFONTS_DELIMITER); soundFont; soundFont = strtok(NULL, SOUNDFONTS_DELIMITER)) {
-            if (self->nSoundFonts >= MAX_SOUNDFONTS) {
-                Log_fatal("Maximum number of soundfonts reached (%d)", MAX_SOUNDFONTS);
-            }
-            Log_info("Loading soundfont '%s'...", soundFont);
-            self->soundFontIds[self->nSoundFonts] = fluid_synth_sfload(self->fluidSynth, soundFont, true);
-            if (self->soundFontIds[self->nSoundFonts] == FLUID_FAILED) {
-                Log_fatal("Failed to load soundfont '%s'", soundFont);
-            }
-            else {
-                Log_info("Successfully loaded '%s'", soundFont);
-                self->nSoundFonts++;
-            }
-        }
-        sfree((void**)&soundFontsDuped);
-    }
-
-    fluid_synth_set_gain(self->fluidSynth, SYNTH_GAIN);
-    fluid_synth_reverb_on(self->fluidSynth, FX_GROUP_ALL, SYNTH_ENABLE_REVERB);
-    fluid_synth_chorus_on(self->fluidSynth, FX_GROUP_ALL, SYNTH_ENABLE_CHORUS);
+    Synth_loadSoundFonts(self);
 
     self->sequencer = new_fluid_sequencer2(0);
     self->synthSequencerId = fluid_sequencer_register_fluidsynth(self->sequencer, self->fluidSynth);
     self->callbackId = fluid_sequencer_register_client(self->sequencer, "me", Synth_sequencerCallback, NULL);
 
-    /* Parse synth instruments */
-    size_t nSynthInstruments = 0;
-    size_t synthInstrumentListStringLength = 1;  // space for null-terminator
-
-    for (size_t iSoundFont = 0; iSoundFont < self->nSoundFonts; iSoundFont++) {
-        fluid_sfont_t* soundFont = fluid_synth_get_sfont_by_id(self->fluidSynth, self->soundFontIds[iSoundFont]);
-        fluid_preset_t* preset;
-        fluid_sfont_iteration_start(soundFont);
-        while ((preset = fluid_sfont_iteration_next(soundFont))) {
-            nSynthInstruments++;
-
-            const char* synthInstrumentName = fluid_preset_get_name(preset);
-            size_t synthInstrumentNameLength = strlen(synthInstrumentName);
-            Log_assert(synthInstrumentNameLength <= MIDI_SYNTH_PROGRAM_NAME_LENGTH_MAX, "Synth instrument name too long: '%s'", synthInstrumentName);
-
-            synthInstrumentListStringLength += synthInstrumentNameLength;
-            synthInstrumentListStringLength += strlen("\n");
-        }
-    }
-
-    self->synthInstruments = ecalloc(nSynthInstruments, sizeof(SynthInstrument));
-    self->synthInstrumentListString = ecalloc(synthInstrumentListStringLength, sizeof(char));
-    self->synthInstrumentMap = StringMap_new(MIDI_SYNTH_PROGRAM_NAME_LENGTH_MAX);
-
-    size_t iSynthInstrument = 0;
-    for (size_t iSoundFont = 0; iSoundFont < self->nSoundFonts; iSoundFont++) {
-        fluid_sfont_t* soundFont = fluid_synth_get_sfont_by_id(self->fluidSynth, self->soundFontIds[iSoundFont]);
-        fluid_preset_t* preset;
-        fluid_sfont_iteration_start(soundFont);
-        while ((preset = fluid_sfont_iteration_next(soundFont))) {
-            const char* synthInstrumentName = fluid_preset_get_name(preset);
-            strcat(self->synthInstrumentListString, synthInstrumentName);
-            strcat(self->synthInstrumentListString, "\n");
-
-            SynthInstrument synthInstrument = {
-                .iSoundFont = self->soundFontIds[iSoundFont],
-                .iBank = fluid_preset_get_banknum(preset),
-                .iProgram = fluid_preset_get_num(preset),
-            };
-            self->synthInstruments[iSynthInstrument] = synthInstrument;
-
-            if (!StringMap_containsItem(self->synthInstrumentMap, synthInstrumentName)) {
-                StringMap_addItem(self->synthInstrumentMap, synthInstrumentName, &self->synthInstruments[iSynthInstrument]);
-            }
-
-            iSynthInstrument++;
-        }
-    }
-
     Event_subscribe(EVENT_PROCESS_FRAME, self, EVENT_CALLBACK(Synth_onProcessFrame), sizeof(float));
     Event_subscribe(EVENT_QUERY_RESULT, self, EVENT_CALLBACK(Synth_onQueryResult), sizeof(QueryResult));
     Event_subscribe(EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT, self, EVENT_CALLBACK(Synth_onRequestChangeSynthInstrument), sizeof(SynthProgramChange));
@@ -208,6 +220,7 @@ Synth* Synth_new(Score* score) {
     Event_subscribe(EVENT_REQUEST_SEQUENCER_START, self, EVENT_CALLBACK(Synth_onRequestSequencerStart), sizeof(SequencerRequest));
     Event_subscribe(EVENT_REQUEST_SEQUENCER_STOP, self, EVENT_CALLBACK(Synth_onRequestSequencerStop), 0);
     Event_subscribe(EVENT_SEQUENCER_STARTED, self, EVENT_CALLBACK(Synth_onSequencerStarted), sizeof(SequencerRequest));
+    Event_subscribe(EVENT_SEQUENCE_CHANGED, self, EVENT_CALLBACK(Synth_onSequenceChanged), sizeof(SequenceChange));
 
     Events_defineNewLocalEventType(EVENT_SEQUENCER_CALLBACK, 0, self);
     Event_subscribe(EVENT_SEQUENCER_CALLBACK, self, EVENT_CALLBACK(Synth_onSequencerCallback), 0);
@@ -218,26 +231,63 @@ Synth* Synth_new(Score* score) {
 }
 
 
+// Without audio driver or sequencer, for rendering the score to a file
+// faster than it plays
+Synth* Synth_newOffline(Score* score) {
+    Synth* self = ecalloc(1, sizeof(*self));
+
+    self->score = score;
+    self->isOffline = true;
+
+    self->settings = new_fluid_settings();
+    fluid_settings_setnum(self->settings, "synth.sample-rate", RENDER_SAMPLE_RATE);
+    fluid_settings_setint(self->settings, "synth.midi-channels", SYNTH_MIDI_CHANNELS);
+    self->fluidSynth = new_fluid_synth(self->settings);
+
+    Synth_loadSoundFonts(self);
+
+    Event_subscribe(EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT, self, EVENT_CALLBACK(Synth_onRequestChangeSynthInstrument), sizeof(SynthProgramChange));
+
+    Score_requestSynthPrograms(self->score);
+
+    return self;
+}
+
+
 void Synth_free(Synth** pself) {
     Synth* self = *pself;
 
-    Event_unsubscribe(EVENT_PROCESS_FRAME, self, EVENT_CALLBACK(Synth_onProcessFrame), sizeof(float));
-    Event_unsubscribe(EVENT_QUERY_RESULT, self, EVENT_CALLBACK(Synth_onQueryResult), sizeof(QueryResult));
     Event_unsubscribe(EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT, self, EVENT_CALLBACK(Synth_onRequestChangeSynthInstrument), sizeof(SynthProgramChange));
-    Event_unsubscribe(EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT_QUERY, self, EVENT_CALLBACK(Synth_onRequestChangeSynthInstrumentQuery), sizeof(int));
-    Event_unsubscribe(EVENT_REQUEST_MIDI_MESSAGE_PLAY, self, EVENT_CALLBACK(Synth_onRequestMidiMessagePlay), sizeof(MidiMessage));
-    Event_unsubscribe(EVENT_REQUEST_MIDI_CHANNEL_STOP, self, EVENT_CALLBACK(Synth_onRequestMidiChannelStop), sizeof(int));
-    Event_unsubscribe(EVENT_REQUEST_SEQUENCER_START, self, EVENT_CALLBACK(Synth_onRequestSequencerStart), sizeof(SequencerRequest));
-    Event_unsubscribe(EVENT_REQUEST_SEQUENCER_STOP, self, EVENT_CALLBACK(Synth_onRequestSequencerStop), 0);
-    Event_unsubscribe(EVENT_SEQUENCER_STARTED, self, EVENT_CALLBACK(Synth_onSequencerStarted), sizeof(SequencerRequest));
-
-    Event_unsubscribe(EVENT_SEQUENCER_CALLBACK, self, EVENT_CALLBACK(Synth_onSequencerCallback), 0);
-
-    fluid_sequencer_unregister_client(self->sequencer, self->callbackId);
-    delete_fluid_sequencer(self->sequencer);
-    delete_fluid_audio_driver(self->audioDriver);
+
+    if (!self->isOffline) {
+        Event_unsubscribe(EVENT_PROCESS_FRAME, self, EVENT_CALLBACK(Synth_onProcessFrame), sizeof(float));
+        Event_unsubscribe(EVENT_QUERY_RESULT, self, EVENT_CALLBACK(Synth_onQueryResult), sizeof(QueryResult));
+        Event_unsubscribe(EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT_QUERY, self, EVENT_CALLBACK(Synth_onRequestChangeSynthInstrumentQuery), sizeof(int));
+        Event_unsubscribe(EVENT_REQUEST_MIDI_MESSAGE_PLAY, self, EVENT_CALLBACK(Synth_onRequestMidiMessagePlay), sizeof(MidiMessage));
+        Event_unsubscribe(EVENT_REQUEST_MIDI_CHANNEL_STOP, self, EVENT_CALLBACK(Synth_onRequestMidiChannelStop), sizeof(int));
+        Event_unsubscribe(EVENT_REQUEST_SEQUENCER_START, self, EVENT_CALLBACK(Synth_onRequestSequencerStart), sizeof(SequencerRequest));
+        Event_unsubscribe(EVENT_REQUEST_SEQUENCER_STOP, self, EVENT_CALLBACK(Synth_onRequestSequencerStop), 0);
+        Event_unsubscribe(EVENT_SEQUENCER_STARTED, self, EVENT_CALLBACK(Synth_onSequencerStarted), sizeof(SequencerRequest));
+        Event_unsubscribe(EVENT_SEQUENCE_CHANGED, self, EVENT_CALLBACK(Synth_onSequenceChanged), sizeof(SequenceChange));
+
+        Event_unsubscribe(EVENT_SEQUENCER_CALLBACK, self, EVENT_CALLBACK(Synth_onSequencerCallback), 0);
+
+        fluid_sequencer_unregister_client(self->sequencer, self->callbackId);
+        delete_fluid_sequencer(self->sequencer);
+        delete_fluid_audio_driver(self->audioDriver);
+        if (self->sequenceMidiMessages) {
+            sfree((void**)&self->sequenceMidiMessages);
+        }
+        if (self->loopMidiMessages) {
+            sfree((void**)&self->loopMidiMessages);
+        }
+    }
+
     delete_fluid_synth(self->fluidSynth);
     delete_fluid_settings(self->settings);
+    for (size_t iSoundFont = 0; iSoundFont < self->nSoundFonts; iSoundFont++) {
+        sfree((void**)&self->soundFontFilenames[iSoundFont]);
+    }
     StringMap_free(&self->synthInstrumentMap);
     sfree((void**)&self->synthInstrumentListString);
     sfree((void**)&self->synthInstruments);
@@ -245,11 +295,112 @@ void Synth_free(Synth** pself) {
 }
 
 
+// Plays the entire score into a wav file as fast as the synth can go, split
+// into segments rendered on up to nThreads threads. Only for synths from
+// Synth_newOffline(). Returns whether the file was written.
+bool Synth_renderToFile(Synth* self, const char* filename, int nThreads) {
+    Log_assert(self->isOffline, "Only offline synths can render to a file");
+    Log_info("Rendering score as '%s'...", filename);
+
+    WavFile* wavFile = WavFile_new(filename, RENDER_CHANNELS, RENDER_SAMPLE_RATE);
+    SynthRender* render = Synth_startRender(self, nThreads, wavFile);
+    int64_t nFrames = 0;
+
+    // The first segment writes itself, the others are written as soon as they
+    // are done, in order
+    for (size_t iSegment = 0; iSegment < render->nSegments; iSegment++) {
+        Synth_joinRenderSegment(render);
+        RenderSegment* segment = &render->segments[iSegment];
+        if (!segment->wavFile) {
+            WavFile_writeFrames(wavFile, segment->samples, segment->nFrames);
+        }
+        nFrames += segment->nFrames;
+        sfree((void**)&segment->samples);
+    }
+
+    size_t nSegments = render->nSegments;
+    Synth_freeRender(&render);
+
+    bool isWritten = WavFile_close(&wavFile);
+    if (isWritten) {
+        Log_info("Rendered %.1f s of audio in %zu segment(s) to '%s'", (double)nFrames / RENDER_SAMPLE_RATE, nSegments, filename);
+    } else {
+        Log_warning("Failed to render score as '%s'", filename);
+    }
+    return isWritten;
+}
+
+
+// Renders the score both serially and in parallel, and checks that the
+// results match to within RENDER_VERIFY_TOLERANCE
+bool Synth_verifyRender(Synth* self, int nThreads) {
+    Log_assert(self->isOffline, "Only offline synths can render");
+
+    double timeStart = Synth_getSeconds();
+    SynthRender* renderSerial = Synth_startRender(self, 1, NULL);
+    Synth_joinRenderSegment(renderSerial);
+    double timeSerial = Synth_getSeconds() - timeStart;
+
+    timeStart = Synth_getSeconds();
+    SynthRender* renderParallel = Synth_startRender(self, nThreads, NULL);
+    for (size_t iSegment = 0; iSegment < renderParallel->nSegments; iSegment++) {
+        Synth_joinRenderSegment(renderParallel);
+    }
+    double timeParallel = Synth_getSeconds() - timeStart;
+
+    const RenderSegment* serial = &renderSerial->segments[0];
+    int64_t nFramesParallel = 0;
+    float differenceMax = 0.0f;
+    int64_t iFrameDifferenceMax = 0;
+
+    for (size_t iSegment = 0; iSegment < renderParallel->nSegments; iSegment++) {
+        const RenderSegment* segment = &renderParallel->segments[iSegment];
+        for (int64_t iFrame = 0; iFrame < segment->nFrames; iFrame++) {
+            int64_t iFrameSerial = segment->iFrameStart + iFrame;
+            for (int iChannel = 0; iChannel < RENDER_CHANNELS; iChannel++) {
+                float sample = segment->samples[iFrame * RENDER_CHANNELS + iChannel];
+                float sampleSerial = iFrameSerial < serial->nFrames ? serial->samples[iFrameSerial * RENDER_CHANNELS + iChannel] : 0.0f;
+                float difference = sample > sampleSerial ? sample - sampleSerial : sampleSerial - sample;
+                if (difference > differenceMax) {
+                    differenceMax = difference;
+                    iFrameDifferenceMax = iFrameSerial;
+                }
+            }
+        }
+        nFramesParallel += segment->nFrames;
+    }
+
+    bool isMatching = nFramesParallel == serial->nFrames && differenceMax <= RENDER_VERIFY_TOLERANCE;
+
+    Log_info("Serial render: %lld frames in %.2f s, parallel render: %lld frames in %zu segment(s) in %.2f s (%.1fx)",
+        (long long)serial->nFrames, timeSerial, (long long)nFramesParallel, renderParallel->nSegments, timeParallel,
+        timeParallel > 0.0 ? timeSerial / timeParallel : 0.0);
+    if (isMatching) {
+        Log_info("Renders match, largest difference %g", differenceMax);
+    } else {
+        Log_warning("Renders differ, largest difference %g at %.3f s", differenceMax, (double)iFrameDifferenceMax / RENDER_SAMPLE_RATE);
+    }
+
+    Synth_freeRender(&renderSerial);
+    Synth_freeRender(&renderParallel);
+    return isMatching;
+}
+
+
 static void Synth_onProcessFrame(Synth* self, void* sender, float* deltaTime) {
     (void)sender; (void)deltaTime;
     if (self->isSequencerRunning) {
+        Synth_scheduleMidiMessages(self);
+
         unsigned int sequencerTick = fluid_sequencer_get_tick(self->sequencer);
-        float progress = ((float)sequencerTick - (float)self->sequencerStartTimeTicks) / ((float)self->sequencerEndTimeTicks - (float)self->sequencerStartTimeTicks);
+        while (self->isSequenceLooping && sequencerTick >= self->sequencerEndTimeTicks) {
+            self->iSequenceProgressPass++;
+            self->sequencerProgressStartTimeTicks = self->sequencerEndTimeTicks;
+            self->sequencerEndTimeTicks = Synth_getSequencerTicks(self, self->iSequenceProgressPass, self->sequenceTickEnd);
+            self->sequencerInitialProgressFraction = (float)self->sequenceTickLoopStart / (float)self->sequenceTickEnd;
+        }
+
+        float progress = ((float)sequencerTick - (float)self->sequencerProgressStartTimeTicks) / ((float)self->sequencerEndTimeTicks - (float)self->sequencerProgressStartTimeTicks);
         float fullProgress = (1.0f - self->sequencerInitialProgressFraction) * progress + self->sequencerInitialProgressFraction;
         Event_post(self, EVENT_SEQUENCER_PROGRESS, &fullProgress, sizeof(fullProgress));
     }
@@ -285,13 +436,7 @@ static void Synth_onRequestChangeSynthInstrumentQuery(Synth* self, void* sender,
 
 static void Synth_onRequestMidiMessagePlay(Synth* self, void* sender, MidiMessage* midiMessage) {
     (void)sender;
-    if (midiMessage->type == MIDI_MESSAGE_TYPE_NOTEON) {
-        fluid_synth_noteon(self->fluidSynth, midiMessage->channel, midiMessage->pitch, midiMessage->velocity);
-    } else if (midiMessage->type == MIDI_MESSAGE_TYPE_NOTEOFF) {
-        fluid_synth_noteoff(self->fluidSynth, midiMessage->channel, midiMessage->pitch);
-    } else {
-        Log_fatal("Unknown MIDI message type %d", midiMessage->type);
-    }
+    applyMidiMessage(self->fluidSynth, midiMessage);
 }
 
 
@@ -301,51 +446,43 @@ static void Synth_onRequestMidiChannelStop(Synth* self, void* sender, int* iChan
 }
 
 
+// Keeps a copy of the messages and only queues the first
+// SEQUENCER_LOOKAHEAD_MILLISECONDS of them, every frame tops the queue up.
+// Loops queue their next pass the same way, so wrapping around costs nothing.
 static void Synth_onRequestSequencerStart(Synth* self, void* sender, SequencerRequest* sequencerRequest) {
     (void)sender;
     self->sequencerStartTimeTicks = fluid_sequencer_get_tick(self->sequencer);
-    float sequencerTimeScale = fluid_sequencer_get_time_scale(self->sequencer);
-
-    self->sequencerInitialProgressFraction = sequencerRequest->timestampStart / sequencerRequest->timestampEnd;
-
-    for (size_t i = 0; i < sequencerRequest->nMidiMessages; i++) {
-        float timestampSeconds = sequencerRequest->midiMessages[i].timestampSeconds;
-        Log_assert(timestampSeconds >= sequencerRequest->timestampStart, "Midi messages before start time");
-
+    self->sequencerProgressStartTimeTicks = self->sequencerStartTimeTicks;
+    self->sequencerInitialProgressFraction = (float)sequencerRequest->tickStart / (float)sequencerRequest->tickEnd;
+
+    self->nSequenceMidiMessages = Synth_copySequenceMidiMessages(&self->sequenceMidiMessages, &self->nSequenceMidiMessagesMax,
+        sequencerRequest->midiMessages, sequencerRequest->nMidiMessages, sequencerRequest->tickEnd);
+    self->isSequenceLooping = sequencerRequest->isLooping && sequencerRequest->tickLoopStart < sequencerRequest->tickEnd;
+    self->nLoopMidiMessages = 0;
+    if (self->isSequenceLooping) {
+        self->nLoopMidiMessages = Synth_copySequenceMidiMessages(&self->loopMidiMessages, &self->nLoopMidiMessagesMax,
+            sequencerRequest->loopMidiMessages, sequencerRequest->nLoopMidiMessages, sequencerRequest->tickEnd);
+    }
+    self->iSequenceMidiMessageNext = 0;
+    self->iSequencePass = 0;
+    self->iSequenceProgressPass = 0;
+    self->sequenceTickStart = sequencerRequest->tickStart;
+    self->sequenceTickEnd = sequencerRequest->tickEnd;
+    self->sequenceTickLoopStart = sequencerRequest->tickLoopStart;
+    self->sequenceSecondsPerTick = sequencerRequest->secondsPerTick;
+
+    Synth_scheduleMidiMessages(self);
+
+    self->sequencerEndTimeTicks = Synth_getSequencerTicks(self, 0, sequencerRequest->tickEnd);
+    if (!self->isSequenceLooping) {
         fluid_event_t* event = new_fluid_event();
         fluid_event_set_source(event, -1);
-        fluid_event_set_dest(event, self->synthSequencerId);
-        int type = sequencerRequest->midiMessages[i].type;
-        int channel = sequencerRequest->midiMessages[i].channel;
-        int pitch = sequencerRequest->midiMessages[i].pitch;
-        int velocity = sequencerRequest->midiMessages[i].velocity;
-        unsigned int midiMessageTimeTicks = self->sequencerStartTimeTicks + sequencerTimeScale * (timestampSeconds - sequencerRequest->timestampStart);
-
-        if (type == MIDI_MESSAGE_TYPE_NOTEON) {
-            fluid_event_noteon(event, channel, pitch, velocity);
-        } else if (type == MIDI_MESSAGE_TYPE_NOTEOFF) {
-            fluid_event_noteoff(event, channel, pitch);
-
-            // Prevent off and on messages on the same sequencer tick for back-to-back notes
-            if (midiMessageTimeTicks > 0) {
-                midiMessageTimeTicks--;
-            }
-        } else {
-            Log_fatal("Unknown MIDI message type %d", type);
-        }
-
-        fluid_sequencer_send_at(self->sequencer, event, midiMessageTimeTicks, true);
+        fluid_event_set_dest(event, self->callbackId);
+        fluid_event_timer(event, NULL);
+        fluid_sequencer_send_at(self->sequencer, event, self->sequencerEndTimeTicks, true);
         delete_fluid_event(event);
     }
 
-    self->sequencerEndTimeTicks = self->sequencerStartTimeTicks + sequencerTimeScale * (sequencerRequest->timestampEnd - sequencerRequest->timestampStart);
-    fluid_event_t* event = new_fluid_event();
-    fluid_event_set_source(event, -1);
-    fluid_event_set_dest(event, self->callbackId);
-    fluid_event_timer(event, NULL);
-    fluid_sequencer_send_at(self->sequencer, event, self->sequencerEndTimeTicks, true);
-    delete_fluid_event(event);
-
     Event_post(self, EVENT_SEQUENCER_STARTED, sequencerRequest, sizeof(*sequencerRequest));
 }
 
@@ -362,12 +499,13 @@ static void Synth_onRequestSequencerStop(Synth* self, void* sender, void* unused
 }
 
 
+// Runs on FluidSynth's thread, so it only queues the event for the main loop
 static void Synth_sequencerCallback(unsigned int time, fluid_event_t* event, fluid_sequencer_t* sequencer, void* data) {
     (void)time; (void)data;
     if (fluid_event_get_type(event) != FLUID_SEQ_TIMER) {
         return;
     }
-    Event_post(sequencer, EVENT_SEQUENCER_CALLBACK, NULL, 0);
+    Event_postFromThread(sequencer, EVENT_SEQUENCER_CALLBACK);
 }
 
 
@@ -381,6 +519,9 @@ static void Synth_setSynthProgram(Synth* self, const char* synthProgramName, int
             synthInstrument->iBank,
             synthInstrument->iProgram
         );
+        if (iChannel >= 0 && iChannel < SYNTH_MIDI_CHANNELS) {
+            self->channelSynthInstruments[iChannel] = synthInstrument;
+        }
 
         SynthProgramChange synthProgramChange = {0};
         snprintf(synthProgramChange.name, SYNTH_PROGRAM_CHANGE_NAME_BUFFER_SIZE, "%s", synthProgramName);
@@ -392,12 +533,678 @@ static void Synth_setSynthProgram(Synth* self, const char* synthProgramName, int
 }
 
 
+static void Synth_scheduleMidiMessages(Synth* self) {
+    unsigned int windowEndTicks = fluid_sequencer_get_tick(self->sequencer)
+        + fluid_sequencer_get_time_scale(self->sequencer) * SEQUENCER_LOOKAHEAD_MILLISECONDS / MILLISECONDS_PER_SECOND;
+    fluid_event_t* event = NULL;
+
+    for (;;) {
+        const MidiMessage* midiMessages = self->iSequencePass == 0 ? self->sequenceMidiMessages : self->loopMidiMessages;
+        size_t nMidiMessages = self->iSequencePass == 0 ? self->nSequenceMidiMessages : self->nLoopMidiMessages;
+        if (self->iSequenceMidiMessageNext == nMidiMessages) {
+            if (!self->isSequenceLooping || self->nLoopMidiMessages == 0) {
+                break;
+            }
+            self->iSequencePass++;
+            self->iSequenceMidiMessageNext = 0;
+            continue;
+        }
+
+        const MidiMessage* midiMessage = &midiMessages[self->iSequenceMidiMessageNext];
+        Log_assert(midiMessage->tick >= self->sequenceTickStart || self->iSequencePass > 0, "Midi messages before start time");
+        unsigned int midiMessageTimeTicks = Synth_getSequencerTicks(self, self->iSequencePass, midiMessage->tick);
+        if (midiMessageTimeTicks > windowEndTicks) {
+            break;
+        }
+
+        if (!event) {
+            event = new_fluid_event();
+            fluid_event_set_source(event, -1);
+            fluid_event_set_dest(event, self->synthSequencerId);
+        }
+
+        if (midiMessage->type == MIDI_MESSAGE_TYPE_NOTEON) {
+            fluid_event_noteon(event, midiMessage->channel, midiMessage->pitch, midiMessage->velocity);
+        } else if (midiMessage->type == MIDI_MESSAGE_TYPE_NOTEOFF) {
+            fluid_event_noteoff(event, midiMessage->channel, midiMessage->pitch);
+
+            // Prevent off and on messages on the same sequencer tick for back-to-back notes
+            if (midiMessageTimeTicks > 0) {
+                midiMessageTimeTicks--;
+            }
+        } else {
+            Log_fatal("Unknown MIDI message type %d", midiMessage->type);
+        }
+
+        fluid_sequencer_send_at(self->sequencer, event, midiMessageTimeTicks, true);
+        self->iSequenceMidiMessageNext++;
+    }
+
+    if (event) {
+        delete_fluid_event(event);
+    }
+}
+
+
+// Every pass is timed from the start of the sequence rather than the end of
+// the pass before, so loops stay tick exact however long they run
+static unsigned int Synth_getSequencerTicks(Synth* self, int iPass, int tick) {
+    int64_t ticksPlayed = tick - self->sequenceTickStart;
+    if (iPass > 0) {
+        int64_t loopDurationTicks = self->sequenceTickEnd - self->sequenceTickLoopStart;
+        ticksPlayed = (self->sequenceTickEnd - self->sequenceTickStart) + (iPass - 1) * loopDurationTicks + (tick - self->sequenceTickLoopStart);
+    }
+
+    double sequencerTimeScale = fluid_sequencer_get_time_scale(self->sequencer);
+    return self->sequencerStartTimeTicks + (unsigned int)lround(sequencerTimeScale * (double)ticksPlayed * (double)self->sequenceSecondsPerTick);
+}
+
+
+// Playback stops at tickEnd, so later notes are dropped and notes still
+// held there end with it
+static size_t Synth_copySequenceMidiMessages(MidiMessage** pmidiMessages, size_t* nMidiMessagesMax, const MidiMessage* midiMessages, size_t nMidiMessages, int tickEnd) {
+    if (nMidiMessages > *nMidiMessagesMax) {
+        *nMidiMessagesMax = nMidiMessages;
+        *pmidiMessages = erealloc(*pmidiMessages, *nMidiMessagesMax, sizeof(MidiMessage));
+    }
+
+    size_t nMidiMessagesCopied = 0;
+    for (size_t i = 0; i < nMidiMessages; i++) {
+        (*pmidiMessages)[nMidiMessagesCopied] = midiMessages[i];
+        if (clampMidiMessage(&(*pmidiMessages)[nMidiMessagesCopied], tickEnd)) {
+            nMidiMessagesCopied++;
+        }
+    }
+    return nMidiMessagesCopied;
+}
+
+
+// Applies the change to the messages of a pass the way they were copied.
+// Removed messages are marked and squeezed out, added ones merged in from
+// the back, so messages before the first change stay where they are.
+static size_t Synth_changeSequenceMidiMessages(MidiMessage** pmidiMessages, size_t nMidiMessages, size_t* nMidiMessagesMax, const SequenceChange* sequenceChange, int tickStart, int tickEnd) {
+    MidiMessage* midiMessages = *pmidiMessages;
+    size_t iMidiMessageChanged = nMidiMessages;
+
+    for (size_t i = 0; i < sequenceChange->nMidiMessagesRemoved; i++) {
+        MidiMessage removed = sequenceChange->midiMessagesRemoved[i];
+        if (removed.tick < tickStart || !clampMidiMessage(&removed, tickEnd)) {
+            continue;
+        }
+        for (size_t j = searchMidiMessages(midiMessages, nMidiMessages, removed.tick); j < nMidiMessages && midiMessages[j].tick == removed.tick; j++) {
+            if (midiMessages[j].type == removed.type && midiMessages[j].channel == removed.channel && midiMessages[j].pitch == removed.pitch) {
+                midiMessages[j].type = MIDI_MESSAGE_TYPE_REMOVED;
+                iMidiMessageChanged = j < iMidiMessageChanged ? j : iMidiMessageChanged;
+                break;
+            }
+        }
+    }
+
+    size_t nMidiMessagesKept = iMidiMessageChanged;
+    for (size_t i = iMidiMessageChanged; i < nMidiMessages; i++) {
+        if (midiMessages[i].type != MIDI_MESSAGE_TYPE_REMOVED) {
+            midiMessages[nMidiMessagesKept] = midiMessages[i];
+            nMidiMessagesKept++;
+        }
+    }
+
+    if (sequenceChange->nMidiMessagesAdded == 0) {
+        return nMidiMessagesKept;
+    }
+
+    MidiMessage* midiMessagesAdded = ecalloc(sequenceChange->nMidiMessagesAdded, sizeof(MidiMessage));
+    size_t nMidiMessagesAdded = 0;
+    for (size_t i = 0; i < sequenceChange->nMidiMessagesAdded; i++) {
+        midiMessagesAdded[nMidiMessagesAdded] = sequenceChange->midiMessagesAdded[i];
+        if (midiMessagesAdded[nMidiMessagesAdded].tick >= tickStart && clampMidiMessage(&midiMessagesAdded[nMidiMessagesAdded], tickEnd)) {
+            nMidiMessagesAdded++;
+        }
+    }
+    sortMidiMessages(midiMessagesAdded, nMidiMessagesAdded);
+
+    if (nMidiMessagesKept + nMidiMessagesAdded > *nMidiMessagesMax) {
+        *nMidiMessagesMax = nMidiMessagesKept + nMidiMessagesAdded;
+        *pmidiMessages = erealloc(*pmidiMessages, *nMidiMessagesMax, sizeof(MidiMessage));
+        midiMessages = *pmidiMessages;
+    }
+
+    size_t iKept = nMidiMessagesKept;
+    size_t iAdded = nMidiMessagesAdded;
+    size_t iMerged = nMidiMessagesKept + nMidiMessagesAdded;
+    while (iAdded > 0) {
+        iMerged--;
+        if (iKept > 0 && compareMidiMessages(&midiMessages[iKept - 1], &midiMessagesAdded[iAdded - 1]) > 0) {
+            iKept--;
+            midiMessages[iMerged] = midiMessages[iKept];
+        } else {
+            iAdded--;
+            midiMessages[iMerged] = midiMessagesAdded[iAdded];
+        }
+    }
+
+    sfree((void**)&midiMessagesAdded);
+    return nMidiMessagesKept + nMidiMessagesAdded;
+}
+
+
+// Index of the first message of the pass due after the sequencer tick
+static size_t Synth_findSequenceMidiMessageAfter(Synth* self, int iPass, unsigned int sequencerTick) {
+    const MidiMessage* midiMessages = iPass == 0 ? self->sequenceMidiMessages : self->loopMidiMessages;
+    size_t nMidiMessages = iPass == 0 ? self->nSequenceMidiMessages : self->nLoopMidiMessages;
+
+    size_t iLow = 0;
+    size_t iHigh = nMidiMessages;
+    while (iLow < iHigh) {
+        size_t iMid = iLow + (iHigh - iLow) / 2;
+        if (Synth_getSequencerTicks(self, iPass, midiMessages[iMid].tick) > sequencerTick) {
+            iHigh = iMid;
+        } else {
+            iLow = iMid + 1;
+        }
+    }
+    return iLow;
+}
+
+
+// Whether the pass plays the message after the sequencer tick, going by the
+// same rules as Synth_copySequenceMidiMessages()
+static bool Synth_isMidiMessageAfter(Synth* self, int iPass, const MidiMessage* midiMessage, unsigned int sequencerTick) {
+    int tickStart = iPass == 0 ? self->sequenceTickStart : self->sequenceTickLoopStart;
+    MidiMessage midiMessageClamped = *midiMessage;
+    if (midiMessage->tick < tickStart || !clampMidiMessage(&midiMessageClamped, self->sequenceTickEnd)) {
+        return false;
+    }
+    return Synth_getSequencerTicks(self, iPass, midiMessageClamped.tick) > sequencerTick;
+}
+
+
+// Whether the messages end a note sounding at the sequencer tick, that is
+// have a note off for it after the tick without a note on before that
+static bool Synth_hasNoteOffAfter(Synth* self, int iPass, const MidiMessage* midiMessages, size_t nMidiMessages, int iChannel, int pitch, unsigned int sequencerTick) {
+    int tickOnFirst = INT_MAX;
+    for (size_t i = 0; i < nMidiMessages; i++) {
+        const MidiMessage* midiMessage = &midiMessages[i];
+        if (midiMessage->type == MIDI_MESSAGE_TYPE_NOTEON && midiMessage->channel == iChannel && midiMessage->pitch == pitch
+            && Synth_isMidiMessageAfter(self, iPass, midiMessage, sequencerTick)) {
+            tickOnFirst = Math_min(tickOnFirst, midiMessage->tick);
+        }
+    }
+
+    for (size_t i = 0; i < nMidiMessages; i++) {
+        const MidiMessage* midiMessage = &midiMessages[i];
+        if (midiMessage->type == MIDI_MESSAGE_TYPE_NOTEOFF && midiMessage->channel == iChannel && midiMessage->pitch == pitch
+            && midiMessage->tick <= tickOnFirst && Synth_isMidiMessageAfter(self, iPass, midiMessage, sequencerTick)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// Notes sounding now whose note off is removed would hang, so they end
+// right away unless the change ends them later
+static void Synth_stopRemovedNotes(Synth* self, int iPass, const SequenceChange* sequenceChange, unsigned int sequencerTick) {
+    for (size_t i = 0; i < sequenceChange->nMidiMessagesRemoved; i++) {
+        const MidiMessage* midiMessage = &sequenceChange->midiMessagesRemoved[i];
+        if (midiMessage->type != MIDI_MESSAGE_TYPE_NOTEOFF) {
+            continue;
+        }
+        if (Synth_hasNoteOffAfter(self, iPass, sequenceChange->midiMessagesRemoved, sequenceChange->nMidiMessagesRemoved, midiMessage->channel, midiMessage->pitch, sequencerTick)
+            && !Synth_hasNoteOffAfter(self, iPass, sequenceChange->midiMessagesAdded, sequenceChange->nMidiMessagesAdded, midiMessage->channel, midiMessage->pitch, sequencerTick)) {
+            fluid_synth_noteoff(self->fluidSynth, midiMessage->channel, midiMessage->pitch);
+        }
+    }
+}
+
+
+// The end timer is handled a frame late, by when playback may have been
+// stopped or started anew
 static void Synth_onSequencerCallback(Synth* self, void* sender, void* unused) {
-    (void)sender; (void)unused;
+    (void)unused;
+    if (sender == self->sequencer
+        && (!self->isSequencerRunning || fluid_sequencer_get_tick(self->sequencer) < self->sequencerEndTimeTicks)) {
+        return;
+    }
+
     fluid_sequencer_remove_events(self->sequencer, -1, -1, -1);
+    self->isSequenceLooping = false;
+    self->iSequencePass = 0;
+    self->iSequenceMidiMessageNext = self->nSequenceMidiMessages;
     for (int iChannel = 0; iChannel < SYNTH_MIDI_CHANNELS; iChannel++) {
         fluid_synth_all_notes_off(self->fluidSynth, iChannel);
     }
     self->isSequencerRunning = false;
     Event_post(self, EVENT_SEQUENCER_STOPPED, NULL, 0);
 }
+
+
+// Patches the messages still to play and queues the lookahead window anew.
+// The sequencer can only drop queued events by destination, so the window
+// is dropped whole and queued again from the current tick on.
+static void Synth_onSequenceChanged(Synth* self, void* sender, SequenceChange* sequenceChange) {
+    (void)sender;
+    if (!self->isSequencerRunning) {
+        return;
+    }
+
+    unsigned int sequencerTick = fluid_sequencer_get_tick(self->sequencer);
+    int iPass = self->iSequenceProgressPass;
+    while (self->isSequenceLooping && sequencerTick >= Synth_getSequencerTicks(self, iPass, self->sequenceTickEnd)) {
+        iPass++;
+    }
+
+    Synth_stopRemovedNotes(self, iPass, sequenceChange, sequencerTick);
+
+    self->nSequenceMidiMessages = Synth_changeSequenceMidiMessages(&self->sequenceMidiMessages, self->nSequenceMidiMessages, &self->nSequenceMidiMessagesMax,
+        sequenceChange, self->sequenceTickStart, self->sequenceTickEnd);
+    if (self->isSequenceLooping) {
+        self->nLoopMidiMessages = Synth_changeSequenceMidiMessages(&self->loopMidiMessages, self->nLoopMidiMessages, &self->nLoopMidiMessagesMax,
+            sequenceChange, self->sequenceTickLoopStart, self->sequenceTickEnd);
+    }
+
+    fluid_sequencer_remove_events(self->sequencer, -1, self->synthSequencerId, -1);
+    self->iSequencePass = iPass;
+    self->iSequenceMidiMessageNext = Synth_findSequenceMidiMessageAfter(self, iPass, sequencerTick);
+    Synth_scheduleMidiMessages(self);
+}
+
+
+static void Synth_loadSoundFonts(Synth* self) {
+    const char* soundFonts = getenv(ENVVAR_SOUNDFONTS);
+    if (!soundFonts) {
+        Log_fatal("Environment variable %s is not set", ENVVAR_SOUNDFONTS);
+    }
+
+    {
+        self->nSoundFonts = 0;
+        char* soundFontsDuped = estrdup(soundFonts);
+        for (char* soundFont = strtok(soundFontsDuped, SOUNDFONTS_DELIMITER); soundFont; soundFont = strtok(NULL, SOUNDFONTS_DELIMITER)) {
+            if (self->nSoundFonts >= MAX_SOUNDFONTS) {
+                Log_fatal("Maximum number of soundfonts reached (%d)", MAX_SOUNDFONTS);
+            }
+            Log_info("Loading soundfont '%s'...", soundFont);
+            self->soundFontIds[self->nSoundFonts] = fluid_synth_sfload(self->fluidSynth, soundFont, true);
+            if (self->soundFontIds[self->nSoundFonts] == FLUID_FAILED) {
+                Log_fatal("Failed to load soundfont '%s'", soundFont);
+            }
+            else {
+                Log_info("Successfully loaded '%s'", soundFont);
+                self->soundFontFilenames[self->nSoundFonts] = estrdup(soundFont);
+                self->nSoundFonts++;
+            }
+        }
+        sfree((void**)&soundFontsDuped);
+    }
+
+    fluid_synth_set_gain(self->fluidSynth, SYNTH_GAIN);
+    fluid_synth_reverb_on(self->fluidSynth, FX_GROUP_ALL, SYNTH_ENABLE_REVERB);
+    fluid_synth_chorus_on(self->fluidSynth, FX_GROUP_ALL, SYNTH_ENABLE_CHORUS);
+
+    /* Parse synth instruments */
+    size_t nSynthInstruments = 0;
+    size_t synthInstrumentListStringLength = 1;  // space for null-terminator
+
+    for (size_t iSoundFont = 0; iSoundFont < self->nSoundFonts; iSoundFont++) {
+        fluid_sfont_t* soundFont = fluid_synth_get_sfont_by_id(self->fluidSynth, self->soundFontIds[iSoundFont]);
+        fluid_preset_t* preset;
+        fluid_sfont_iteration_start(soundFont);
+        while ((preset = fluid_sfont_iteration_next(soundFont))) {
+            nSynthInstruments++;
+
+            const char* synthInstrumentName = fluid_preset_get_name(preset);
+            size_t synthInstrumentNameLength = strlen(synthInstrumentName);
+            Log_assert(synthInstrumentNameLength <= MIDI_SYNTH_PROGRAM_NAME_LENGTH_MAX, "Synth instrument name too long: '%s'", synthInstrumentName);
+
+            synthInstrumentListStringLength += synthInstrumentNameLength;
+            synthInstrumentListStringLength += strlen("\n");
+        }
+    }
+
+    self->synthInstruments = ecalloc(nSynthInstruments, sizeof(SynthInstrument));
+    self->synthInstrumentListString = ecalloc(synthInstrumentListStringLength, sizeof(char));
+    self->synthInstrumentMap = StringMap_new(MIDI_SYNTH_PROGRAM_NAME_LENGTH_MAX);
+
+    size_t iSynthInstrument = 0;
+    for (size_t iSoundFont = 0; iSoundFont < self->nSoundFonts; iSoundFont++) {
+        fluid_sfont_t* soundFont = fluid_synth_get_sfont_by_id(self->fluidSynth, self->soundFontIds[iSoundFont]);
+        fluid_preset_t* preset;
+        fluid_sfont_iteration_start(soundFont);
+        while ((preset = fluid_sfont_iteration_next(soundFont))) {
+            const char* synthInstrumentName = fluid_preset_get_name(preset);
+            strcat(self->synthInstrumentListString, synthInstrumentName);
+            strcat(self->synthInstrumentListString, "\n");
+
+            SynthInstrument synthInstrument = {
+                .iSoundFont = self->soundFontIds[iSoundFont],
+                .iBank = fluid_preset_get_banknum(preset),
+                .iProgram = fluid_preset_get_num(preset),
+            };
+            self->synthInstruments[iSynthInstrument] = synthInstrument;
+
+            if (!StringMap_containsItem(self->synthInstrumentMap, synthInstrumentName)) {
+                StringMap_addItem(self->synthInstrumentMap, synthInstrumentName, &self->synthInstruments[iSynthInstrument]);
+            }
+
+            iSynthInstrument++;
+        }
+    }
+}
+
+
+// Splits the score into segments of equal length, each rendering on a thread
+// of its own. Segments start on RENDER_BLOCK_FRAMES boundaries, which keeps
+// the block grid FluidSynth applies midi messages on the same as in a
+// serial render. A serial render is one segment, however long. The first
+// segment goes straight into wavFile, if given.
+static SynthRender* Synth_startRender(Synth* self, int nThreads, WavFile* wavFile) {
+    SynthRender* render = ecalloc(1, sizeof(*render));
+    render->synth = self;
+    render->nThreads = nThreads;
+    render->sequencerRequest = Score_getEntireScoreSequencerRequest(self->score, 0);
+
+    const SequencerRequest* sequencerRequest = &render->sequencerRequest;
+    double framesPerTick = (double)sequencerRequest->secondsPerTick * RENDER_SAMPLE_RATE;
+    render->midiMessageFrames = ecalloc(sequencerRequest->nMidiMessages, sizeof(int64_t));
+    for (size_t i = 0; i < sequencerRequest->nMidiMessages; i++) {
+        int ticks = sequencerRequest->midiMessages[i].tick - sequencerRequest->tickStart;
+        render->midiMessageFrames[i] = (int64_t)(ticks * framesPerTick + 0.5);
+    }
+
+    int64_t iFrameLast = sequencerRequest->nMidiMessages > 0 ? render->midiMessageFrames[sequencerRequest->nMidiMessages - 1] : 0;
+    int64_t nSegments = iFrameLast / ((int64_t)RENDER_SEGMENT_SECONDS_MIN * RENDER_SAMPLE_RATE);
+    if (nSegments > nThreads) {
+        nSegments = nThreads;
+    }
+    if (nThreads > 1 && nSegments < iFrameLast / ((int64_t)RENDER_SEGMENT_SECONDS_MAX * RENDER_SAMPLE_RATE) + 1) {
+        nSegments = iFrameLast / ((int64_t)RENDER_SEGMENT_SECONDS_MAX * RENDER_SAMPLE_RATE) + 1;
+    }
+    if (nSegments < 1) {
+        nSegments = 1;
+    }
+
+    render->nSegments = nSegments;
+    render->segments = ecalloc(nSegments, sizeof(RenderSegment));
+    int64_t* noteOffFrames = nSegments > 1 ? Synth_getNoteOffFrames(render) : NULL;
+    size_t iMessagePreroll = 0;
+
+    for (int64_t iSegment = 0; iSegment < nSegments; iSegment++) {
+        RenderSegment* segment = &render->segments[iSegment];
+        segment->midiMessages = sequencerRequest->midiMessages;
+        segment->midiMessageFrames = render->midiMessageFrames;
+        segment->nMidiMessages = sequencerRequest->nMidiMessages;
+
+        segment->iFrameStart = iFrameLast * iSegment / nSegments;
+        segment->iFrameStart -= segment->iFrameStart % RENDER_BLOCK_FRAMES;
+        if (iSegment + 1 < nSegments) {
+            segment->iFrameEnd = iFrameLast * (iSegment + 1) / nSegments;
+            segment->iFrameEnd -= segment->iFrameEnd % RENDER_BLOCK_FRAMES;
+        } else {
+            segment->iFrameEnd = -1;
+        }
+        segment->iFramePreroll = iSegment > 0 ? Synth_getPrerollFrame(render, noteOffFrames, segment->iFrameStart, &iMessagePreroll) : 0;
+    }
+    render->segments[0].wavFile = wavFile;
+
+    if (noteOffFrames) {
+        sfree((void**)&noteOffFrames);
+    }
+
+    while (render->nSegmentsStarted < render->nSegments && render->nSegmentsStarted < (size_t)nThreads) {
+        Synth_startRenderSegment(render);
+    }
+    return render;
+}
+
+
+// Soundfonts are loaded here rather than on the threads, one at a time
+static void Synth_startRenderSegment(SynthRender* render) {
+    RenderSegment* segment = &render->segments[render->nSegmentsStarted];
+    segment->fluidSynth = Synth_newRenderSynth(render->synth);
+    Log_assert(pthread_create(&segment->thread, NULL, Synth_renderSegment, segment) == 0, "Could not start render thread");
+    render->nSegmentsStarted++;
+}
+
+
+// Waits for the next segment, in order, and starts the next one in its place
+static void Synth_joinRenderSegment(SynthRender* render) {
+    Log_assert(render->nSegmentsJoined < render->nSegmentsStarted, "All render segments already joined");
+    RenderSegment* segment = &render->segments[render->nSegmentsJoined];
+    pthread_join(segment->thread, NULL);
+    delete_fluid_synth(segment->fluidSynth);
+    segment->fluidSynth = NULL;
+    render->nSegmentsJoined++;
+
+    if (render->nSegmentsStarted < render->nSegments) {
+        Synth_startRenderSegment(render);
+    }
+}
+
+
+static void Synth_freeRender(SynthRender** prender) {
+    SynthRender* render = *prender;
+    render->nSegments = render->nSegmentsStarted;  // the rest are not needed anymore
+    while (render->nSegmentsJoined < render->nSegments) {
+        Synth_joinRenderSegment(render);
+    }
+    for (size_t iSegment = 0; iSegment < render->nSegments; iSegment++) {
+        if (render->segments[iSegment].samples) {
+            sfree((void**)&render->segments[iSegment].samples);
+        }
+    }
+    sfree((void**)&render->segments);
+    sfree((void**)&render->midiMessageFrames);
+    sfree((void**)&render->sequencerRequest.midiMessages);
+    sfree((void**)prender);
+}
+
+
+// A fresh synth with the soundfonts and channel programs of this one
+static fluid_synth_t* Synth_newRenderSynth(Synth* self) {
+    fluid_synth_t* fluidSynth = new_fluid_synth(self->settings);
+
+    int soundFontIds[MAX_SOUNDFONTS] = {0};
+    for (size_t iSoundFont = 0; iSoundFont < self->nSoundFonts; iSoundFont++) {
+        soundFontIds[iSoundFont] = fluid_synth_sfload(fluidSynth, self->soundFontFilenames[iSoundFont], true);
+        Log_assert(soundFontIds[iSoundFont] != FLUID_FAILED, "Failed to reload soundfont '%s'", self->soundFontFilenames[iSoundFont]);
+    }
+
+    fluid_synth_set_gain(fluidSynth, SYNTH_GAIN);
+    fluid_synth_reverb_on(fluidSynth, FX_GROUP_ALL, SYNTH_ENABLE_REVERB);
+    fluid_synth_chorus_on(fluidSynth, FX_GROUP_ALL, SYNTH_ENABLE_CHORUS);
+
+    for (int iChannel = 0; iChannel < SYNTH_MIDI_CHANNELS; iChannel++) {
+        const SynthInstrument* synthInstrument = self->channelSynthInstruments[iChannel];
+        if (!synthInstrument) {
+            continue;
+        }
+        for (size_t iSoundFont = 0; iSoundFont < self->nSoundFonts; iSoundFont++) {
+            if ((size_t)self->soundFontIds[iSoundFont] == synthInstrument->iSoundFont) {
+                fluid_synth_program_select(fluidSynth, iChannel, soundFontIds[iSoundFont], synthInstrument->iBank, synthInstrument->iProgram);
+            }
+        }
+    }
+
+    return fluidSynth;
+}
+
+
+// How far back the synth for a segment has to start. Every note that is held
+// or still releasing RENDER_PREROLL_SECONDS before the segment is replayed
+// from its start, which pulls the preroll further back, up to
+// RENDER_PREROLL_SECONDS_MAX. Segments are asked for in order, so the first
+// message within reach, *iMessageMin, only moves forward.
+static int64_t Synth_getPrerollFrame(const SynthRender* render, const int64_t* noteOffFrames, int64_t iFrameStart, size_t* iMessageMin) {
+    int64_t iFrameMin = iFrameStart - (int64_t)RENDER_PREROLL_SECONDS_MAX * RENDER_SAMPLE_RATE;
+    if (iFrameMin < 0) {
+        iFrameMin = 0;
+    }
+    int64_t iFramePreroll = iFrameStart - (int64_t)RENDER_PREROLL_SECONDS * RENDER_SAMPLE_RATE;
+    if (iFramePreroll < iFrameMin) {
+        iFramePreroll = iFrameMin;
+    }
+
+    const int64_t* midiMessageFrames = render->midiMessageFrames;
+    size_t nMidiMessages = render->sequencerRequest.nMidiMessages;
+    while (*iMessageMin < nMidiMessages && midiMessageFrames[*iMessageMin] < iFrameMin) {
+        (*iMessageMin)++;
+    }
+    size_t iMessageEnd = *iMessageMin;
+    while (iMessageEnd < nMidiMessages && midiMessageFrames[iMessageEnd] < iFramePreroll) {
+        iMessageEnd++;
+    }
+
+    // Newest first, a note sounding past the preroll pulls it back to its
+    // start, where the notes before are checked against
+    for (size_t i = iMessageEnd; i > *iMessageMin; i--) {
+        if (render->sequencerRequest.midiMessages[i - 1].type == MIDI_MESSAGE_TYPE_NOTEON
+            && midiMessageFrames[i - 1] < iFramePreroll && noteOffFrames[i - 1] > iFramePreroll) {
+            iFramePreroll = midiMessageFrames[i - 1];
+        }
+    }
+
+    return iFramePreroll - iFramePreroll % RENDER_BLOCK_FRAMES;
+}
+
+
+// For each note on, the frame of the note off that ends it, INT64_MAX for
+// notes that are never turned off. A note off ends every note on the same
+// channel and pitch, like it does in FluidSynth.
+static int64_t* Synth_getNoteOffFrames(const SynthRender* render) {
+    const SequencerRequest* sequencerRequest = &render->sequencerRequest;
+
+    int nChannels = 0;
+    for (size_t i = 0; i < sequencerRequest->nMidiMessages; i++) {
+        if (sequencerRequest->midiMessages[i].channel >= nChannels) {
+            nChannels = sequencerRequest->midiMessages[i].channel + 1;
+        }
+    }
+
+    size_t nKeys = (size_t)nChannels * MIDI_MESSAGE_PITCH_COUNT;
+    int64_t* noteOffFrames = ecalloc(sequencerRequest->nMidiMessages, sizeof(int64_t));
+    size_t* iNoteOnPrev = ecalloc(sequencerRequest->nMidiMessages, sizeof(size_t));  // links the open note ons of a key
+    size_t* iNoteOnOpen = ecalloc(nKeys > 0 ? nKeys : 1, sizeof(size_t));  // last open note on of a key, plus one
+    for (size_t i = 0; i < sequencerRequest->nMidiMessages; i++) {
+        const MidiMessage* midiMessage = &sequencerRequest->midiMessages[i];
+        size_t iKey = (size_t)midiMessage->channel * MIDI_MESSAGE_PITCH_COUNT + midiMessage->pitch - MIDI_MESSAGE_PITCH_MIN;
+        noteOffFrames[i] = INT64_MAX;
+        if (midiMessage->type == MIDI_MESSAGE_TYPE_NOTEON) {
+            iNoteOnPrev[i] = iNoteOnOpen[iKey];
+            iNoteOnOpen[iKey] = i + 1;
+        } else {
+            for (size_t iOpen = iNoteOnOpen[iKey]; iOpen > 0; iOpen = iNoteOnPrev[iOpen - 1]) {
+                noteOffFrames[iOpen - 1] = render->midiMessageFrames[i];
+            }
+            iNoteOnOpen[iKey] = 0;
+        }
+    }
+
+    sfree((void**)&iNoteOnOpen);
+    sfree((void**)&iNoteOnPrev);
+    return noteOffFrames;
+}
+
+
+static void* Synth_renderSegment(void* data) {
+    RenderSegment* segment = data;
+
+    if (segment->iFrameEnd != -1 && !segment->wavFile) {
+        segment->nFramesMax = segment->iFrameEnd - segment->iFrameStart;
+    } else {
+        segment->nFramesMax = RENDER_BLOCK_FRAMES;
+    }
+    segment->samples = ecalloc(segment->nFramesMax * RENDER_CHANNELS, sizeof(float));
+    float* discardedSamples = ecalloc(RENDER_BLOCK_FRAMES * RENDER_CHANNELS, sizeof(float));
+
+    size_t i = 0;
+    while (i < segment->nMidiMessages && segment->midiMessageFrames[i] < segment->iFramePreroll) {
+        i++;
+    }
+
+    int64_t iFrame = segment->iFramePreroll;
+    for (; i < segment->nMidiMessages; i++) {
+        if (segment->iFrameEnd != -1 && segment->midiMessageFrames[i] >= segment->iFrameEnd) {
+            break;
+        }
+        Synth_renderSegmentFrames(segment, &iFrame, segment->midiMessageFrames[i], discardedSamples);
+        applyMidiMessage(segment->fluidSynth, &segment->midiMessages[i]);
+    }
+
+    if (segment->iFrameEnd != -1) {
+        Synth_renderSegmentFrames(segment, &iFrame, segment->iFrameEnd, discardedSamples);
+    } else {
+        // Let the last notes ring out
+        int64_t iFrameTailEnd = iFrame + (int64_t)RENDER_TAIL_SECONDS_MAX * RENDER_SAMPLE_RATE;
+        while (fluid_synth_get_active_voice_count(segment->fluidSynth) > 0 && iFrame < iFrameTailEnd) {
+            Synth_renderSegmentFrames(segment, &iFrame, iFrame + RENDER_BLOCK_FRAMES, discardedSamples);
+        }
+    }
+
+    sfree((void**)&discardedSamples);
+    return NULL;
+}
+
+
+// Frames before the start of the segment only warm the synth up
+static void Synth_renderSegmentFrames(RenderSegment* segment, int64_t* iFrame, int64_t iFrameTarget, float* discardedSamples) {
+    while (*iFrame < iFrameTarget) {
+        int64_t nFrames = iFrameTarget - *iFrame;
+        if (nFrames > RENDER_BLOCK_FRAMES) {
+            nFrames = RENDER_BLOCK_FRAMES;
+        }
+
+        float* samples = discardedSamples;
+        bool isStreamed = false;
+        if (*iFrame < segment->iFrameStart) {
+            if (nFrames > segment->iFrameStart - *iFrame) {
+                nFrames = segment->iFrameStart - *iFrame;
+            }
+        } else if (segment->wavFile) {
+            samples = segment->samples;
+            isStreamed = true;
+            segment->nFrames += nFrames;
+        } else {
+            if (segment->nFrames + nFrames > segment->nFramesMax) {
+                segment->nFramesMax *= 2;
+                segment->samples = erealloc(segment->samples, segment->nFramesMax * RENDER_CHANNELS, sizeof(float));
+            }
+            samples = &segment->samples[segment->nFrames * RENDER_CHANNELS];
+            segment->nFrames += nFrames;
+        }
+
+        fluid_synth_write_float(segment->fluidSynth, nFrames, samples, 0, RENDER_CHANNELS, samples, 1, RENDER_CHANNELS);
+        if (isStreamed) {
+            WavFile_writeFrames(segment->wavFile, samples, nFrames);
+        }
+        *iFrame += nFrames;
+    }
+}
+
+
+static double Synth_getSeconds(void) {
+    struct timespec time = {0};
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / NANOSECONDS_PER_SECOND;
+}
+
+
+static void applyMidiMessage(fluid_synth_t* fluidSynth, const MidiMessage* midiMessage) {
+    if (midiMessage->type == MIDI_MESSAGE_TYPE_NOTEON) {
+        fluid_synth_noteon(fluidSynth, midiMessage->channel, midiMessage->pitch, midiMessage->velocity);
+    } else if (midiMessage->type == MIDI_MESSAGE_TYPE_NOTEOFF) {
+        fluid_synth_noteoff(fluidSynth, midiMessage->channel, midiMessage->pitch);
+    } else {
+        Log_fatal("Unknown MIDI message type %d", midiMessage->type);
+    }
+}
+
+
+// Returns whether the message is kept, see Synth_copySequenceMidiMessages()
+static bool clampMidiMessage(MidiMessage* midiMessage, int tickEnd) {
+    if (midiMessage->tick >= tickEnd && midiMessage->type == MIDI_MESSAGE_TYPE_NOTEON) {
+        return false;
+    }
+    if (midiMessage->tick > tickEnd) {
+        midiMessage->tick = tickEnd;
+    }
+    return true;
+}
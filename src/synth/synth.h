@@ -20,7 +20,12 @@
 
 #include "common/score/score.h"
 
+#include <stdbool.h>
+
 typedef struct Synth Synth;
 
 Synth* Synth_new(Score* score);
+Synth* Synth_newOffline(Score* score);
 void Synth_free(Synth** pself);
+bool Synth_renderToFile(Synth* self, const char* filename, int nThreads);
+bool Synth_verifyRender(Synth* self, int nThreads);
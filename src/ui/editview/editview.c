@@ -64,7 +64,6 @@ typedef enum {
     STATE_INVALID,
     STATE_IDLE,
     STATE_DRAGGING,
-    STATE_PLAYING,
     STATE_INITIALIZING,
     STATE_INITIALIZING_GHOST,
 } State;
@@ -96,7 +95,7 @@ struct EditView {
     bool isNotePreviewButtonPressed;
     bool isNoteRemovalButtonPressed;
     bool isZoomKeyPressed;
-    bool isPlayingLoop;
+    bool isPlaying;  // edits made meanwhile are patched into the playing sequence
     int scrollY;
     int nNotesToShow;
     Vector2i zoomTargetCursorPosition;
@@ -123,9 +122,11 @@ static void EditView_onCursorPositionUpdated(EditView* self);
 static void EditView_addNoteAtCursor(EditView* self);
 static void EditView_removeNoteAtCursor(EditView* self);
 static void EditView_removeNoteAtPosition(EditView* self, Vector2i position);
+static void EditView_stopRemovingNotes(EditView* self);
 static void EditView_previewNoteAtCursor(EditView* self);
 static void EditView_stopPreviewingAllNotes(EditView* self);
 static void EditView_logNoteAction(EditView* self, const char* const action);
+static int EditView_getTicksPerColumn(EditView* self);
 static void EditView_refreshNoteGrid(EditView* self);
 static void EditView_hide(EditView* self);
 static void EditView_hideGrids(EditView* self);
@@ -265,11 +266,19 @@ static void EditView_onCharEvent(EditView* self, void* sender, CharEvent* event)
     CharEvent* eventRenameBlock = &(CharEvent){INPUT_CHAR_R, INPUT_ACTION_PRESS, INPUT_NO_MODS};
     CharEvent* eventSetTempo = &(CharEvent){INPUT_CHAR_T, INPUT_ACTION_PRESS, INPUT_NO_MODS};
     CharEvent* eventIgnoreNoteOff = &(CharEvent){INPUT_CHAR_N, INPUT_ACTION_PRESS, INPUT_NO_MODS};
+    CharEvent* eventUndo = &(CharEvent){INPUT_CHAR_U, INPUT_ACTION_PRESS, INPUT_NO_MODS};
+    CharEvent* eventRedo = &(CharEvent){INPUT_CHAR_R, INPUT_ACTION_PRESS, INPUT_MOD_CONTROL};
     CharEvent* eventQuit = &(CharEvent){INPUT_CHAR_Q, INPUT_ACTION_PRESS, INPUT_NO_MODS};
 
     switch (self->state) {
         case STATE_IDLE:;
-            if (charEventMatches(event, eventSave)) {
+            if (charEventMatches(event, eventUndo)) {
+                Score_undo(self->score);
+            } else if (charEventMatches(event, eventRedo)) {
+                Score_redo(self->score);
+            } else if (self->isPlaying) {
+                break;  // Only note edits are heard during playback
+            } else if (charEventMatches(event, eventSave)) {
                 Score_saveToFile(self->score);
             } else if (charEventMatches(event, eventChangeSynthInstrument)) {
                 int iChannel = NOTE_PREVIEW_MIDI_CHANNEL;
@@ -320,33 +329,32 @@ static void EditView_onKeyEvent(EditView* self, void* sender, KeyEvent* event) {
         return;
     }
 
+    if (self->isPlaying) {
+        if (keyEventMatches(event, eventPlayBlock)
+                || keyEventMatches(event, eventPlayBlockFromCursor)
+                || keyEventMatches(event, eventPlayBlockLoop)
+                || keyEventMatches(event, eventPlayBlockFromCursorLoop)) {
+            Score_stopPlaying(self->score);
+        }
+        return;
+    }
+
     switch (self->state) {
         case STATE_IDLE:;
             if (keyEventMatches(event, eventPlayBlock)) {
-                Score_playCurrentBlockDef(self->score, NOTE_PREVIEW_MIDI_CHANNEL, 0.0f, self->ignoreNoteOff);
+                Score_playCurrentBlockDef(self->score, NOTE_PREVIEW_MIDI_CHANNEL, 0, self->ignoreNoteOff, false);
             } else if (keyEventMatches(event, eventPlayBlockFromCursor)) {
-                float startTimeFraction = (float)self->cursorPosition.x / (float)getGridSize().x;
-                Score_playCurrentBlockDef(self->score, NOTE_PREVIEW_MIDI_CHANNEL, startTimeFraction, self->ignoreNoteOff);
+                int startTick = self->cursorPosition.x * EditView_getTicksPerColumn(self);
+                Score_playCurrentBlockDef(self->score, NOTE_PREVIEW_MIDI_CHANNEL, startTick, self->ignoreNoteOff, false);
             } else if (keyEventMatches(event, eventPlayBlockLoop)) {
-                self->isPlayingLoop = true;
-                Score_playCurrentBlockDef(self->score, NOTE_PREVIEW_MIDI_CHANNEL, 0.0f, self->ignoreNoteOff);
+                Score_playCurrentBlockDef(self->score, NOTE_PREVIEW_MIDI_CHANNEL, 0, self->ignoreNoteOff, true);
             } else if (keyEventMatches(event, eventPlayBlockFromCursorLoop)) {
-                self->isPlayingLoop = true;
-                float startTimeFraction = (float)self->cursorPosition.x / (float)getGridSize().x;
-                Score_playCurrentBlockDef(self->score, NOTE_PREVIEW_MIDI_CHANNEL, startTimeFraction, self->ignoreNoteOff);
+                int startTick = self->cursorPosition.x * EditView_getTicksPerColumn(self);
+                Score_playCurrentBlockDef(self->score, NOTE_PREVIEW_MIDI_CHANNEL, startTick, self->ignoreNoteOff, true);
             } else if (keyEventMatches(event, eventToggleActiveBlock)) {
                 Score_toggleActiveBlockDef(self->score);
             }
             break;
-        case STATE_PLAYING:;
-            if (keyEventMatches(event, eventPlayBlock)
-                    || keyEventMatches(event, eventPlayBlockFromCursor)
-                    || keyEventMatches(event, eventPlayBlockLoop)
-                    || keyEventMatches(event, eventPlayBlockFromCursorLoop)) {
-                self->isPlayingLoop = false;
-                Score_stopPlaying(self->score);
-            }
-            break;
         default:;
     }
 }
@@ -362,7 +370,8 @@ static void EditView_onMouseButtonEvent(EditView* self, void* sender, MouseButto
 
     MouseButtonEvent* eventStartAddNote = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_LEFT, INPUT_ACTION_PRESS, INPUT_NO_MODS};
     MouseButtonEvent* eventRemoveNote = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_RIGHT, INPUT_ACTION_PRESS, INPUT_NO_MODS};
-    MouseButtonEvent* eventStopRemovingNote = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_RIGHT, INPUT_ACTION_RELEASE, INPUT_NO_MODS};
+    // Modifiers may have changed while the button was held
+    MouseButtonEvent* eventStopRemovingNote = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_RIGHT, INPUT_ACTION_RELEASE, event->mods};
     MouseButtonEvent* eventPreviewNote = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_MIDDLE, INPUT_ACTION_PRESS, INPUT_NO_MODS};
     MouseButtonEvent* eventStopPreviewingNote = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_MIDDLE, INPUT_ACTION_RELEASE, INPUT_NO_MODS};
     MouseButtonEvent* eventStopAddNote = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_LEFT, INPUT_ACTION_RELEASE, INPUT_NO_MODS};
@@ -371,6 +380,7 @@ static void EditView_onMouseButtonEvent(EditView* self, void* sender, MouseButto
     switch (self->state) {
         case STATE_IDLE:;
             if (mouseButtonEventMatches(event, eventStartAddNote)) {
+                EditView_stopRemovingNotes(self);
                 self->cursorPositionDragStart = self->cursorPosition;
                 self->state = STATE_DRAGGING;
                 Grid_hideQuad(self->cursorGrid, self->cursorHandle);
@@ -380,10 +390,14 @@ static void EditView_onMouseButtonEvent(EditView* self, void* sender, MouseButto
                 EditView_logNoteAction(self, NOTE_ACTION_ADD);
                 EditView_previewNoteAtCursor(self);
             } else if (mouseButtonEventMatches(event, eventRemoveNote)) {
+                // A drag across several notes is undone as one edit
+                if (!self->isNoteRemovalButtonPressed) {
+                    Score_beginEditGroup(self->score);
+                }
                 self->isNoteRemovalButtonPressed = true;
                 EditView_removeNoteAtCursor(self);
             } else if (mouseButtonEventMatches(event, eventStopRemovingNote)) {
-                self->isNoteRemovalButtonPressed = false;
+                EditView_stopRemovingNotes(self);
             } else if (mouseButtonEventMatches(event, eventPreviewNote)) {
                 self->isNotePreviewButtonPressed = true;
                 EditView_logNoteAction(self, NOTE_ACTION_PREVIEW);
@@ -440,7 +454,6 @@ static void EditView_onMouseScrollwheelEvent(EditView* self, void* sender, Vecto
 
     switch (self->state) {
         case STATE_IDLE:;
-        case STATE_PLAYING:;
             if (self->isZoomKeyPressed) {
                 self->nNotesToShow = Math_clampi(self->nNotesToShow - offset->y, N_NOTES_TO_SHOW_MIN, N_NOTES_TO_SHOW_MAX);
                 self->scrollY = Math_clampi(self->zoomTargetCursorPosition.y - self->mousePosition.y * self->nNotesToShow, 0, MIDI_MESSAGE_PITCH_COUNT - self->nNotesToShow);
@@ -473,16 +486,18 @@ static void EditView_onMouseScrollwheelEvent(EditView* self, void* sender, Vecto
 static void EditView_onNoteAdded(EditView* self, void* sender, Note* note) {
     (void)sender;
 
+    int nTicksPerColumn = EditView_getTicksPerColumn(self);
     Vector2i position = {
-        note->time * getGridSize().x,
+        note->tick / nTicksPerColumn,
         transformNotePitchToRowIndex(note->pitch),
     };
     Vector2i size = {
-        note->duration * (float)getGridSize().x,
+        note->duration / nTicksPerColumn,
         1,
     };
 
-    if (self->state == STATE_DRAGGING || self->state == STATE_INITIALIZING) {
+    // Notes are added in idle state by undo and redo
+    if (self->state == STATE_IDLE || self->state == STATE_DRAGGING || self->state == STATE_INITIALIZING) {
         QuadHandle noteQuadHandle = Grid_addQuad(self->notesGrid, position, size, self->blockColor);
         HashMap_addItem(self->noteQuadMap, note, (void*)noteQuadHandle);
 
@@ -492,7 +507,7 @@ static void EditView_onNoteAdded(EditView* self, void* sender, Note* note) {
     } else if (self->state == STATE_INITIALIZING_GHOST) {
         Grid_addQuad(self->ghostNotesGrid, position, size, GHOST_NOTE_COLOR);
     } else {
-        Log_fatal("Expected state to be %d, %d or %d, but was %d", STATE_DRAGGING, STATE_INITIALIZING, STATE_INITIALIZING_GHOST, self->state);
+        Log_fatal("Expected state to be %d, %d, %d or %d, but was %d", STATE_IDLE, STATE_DRAGGING, STATE_INITIALIZING, STATE_INITIALIZING_GHOST, self->state);
     }
 }
 
@@ -504,12 +519,13 @@ static void EditView_onNoteRemoved(EditView* self, void* sender, Note* note) {
     EditView_logNoteAction(self, NOTE_ACTION_REMOVE);
     QuadHandle noteQuadHandle = (QuadHandle)HashMap_getItem(self->noteQuadMap, note);
 
+    int nTicksPerColumn = EditView_getTicksPerColumn(self);
     Vector2i position = {
-        note->time * getGridSize().x,
+        note->tick / nTicksPerColumn,
         transformNotePitchToRowIndex(note->pitch),
     };
     Vector2i size = {
-        note->duration * (float)getGridSize().x,
+        note->duration / nTicksPerColumn,
         1,
     };
 
@@ -558,14 +574,7 @@ static void EditView_onSequencerStarted(EditView* self, void* sender, SequencerR
         return;
     }
 
-    Grid_hideQuad(self->cursorGrid, self->cursorHandle);
-
-
-    QuadHandle quadHandle = (QuadHandle)HashMap_getItem(self->spatialQuadMap, &self->cursorPosition);
-    if (quadHandle) {
-        Grid_updateQuadColor(self->notesGrid, quadHandle, self->blockColor);
-    }
-
+    // The cursor stays, notes can be edited during playback
     self->playbackCursorPosition = (Vector2i){0, 0};
     Grid_updateQuadPosition(self->cursorGrid, self->playbackCursorHandle, self->playbackCursorPosition);
 
@@ -573,7 +582,7 @@ static void EditView_onSequencerStarted(EditView* self, void* sender, SequencerR
     Grid_updateQuadColor(self->cursorGrid, self->playbackCursorHandle, cursorInitialColor);
     Grid_animateQuadColor(self->cursorGrid, self->playbackCursorHandle, CURSOR_COLOR, PLAYBACK_CURSOR_HIGHLIGHT_LERP_WEIGHT);
 
-    self->state = STATE_PLAYING;
+    self->isPlaying = true;
 }
 
 
@@ -588,20 +597,15 @@ static void EditView_onSequencerStopped(EditView* self, void* sender, void* unus
         }
     }
 
-    if (self->isPlayingLoop) {
-        Score_playCurrentBlockDef(self->score, NOTE_PREVIEW_MIDI_CHANNEL, 0.0f, self->ignoreNoteOff);
-    } else {
-        Grid_hideQuad(self->cursorGrid, self->playbackCursorHandle);
-        Grid_unhideQuad(self->cursorGrid, self->cursorHandle);
-
-        QuadHandle quadHandle = (QuadHandle)HashMap_getItem(self->spatialQuadMap, &self->cursorPosition);
-        if (quadHandle) {
-            Color noteHighlightColor = lerpColor(self->blockColor, HIGHLIGHT_COLOR, NOTE_HIGHLIGHT_STRENGTH);
-            Grid_updateQuadColor(self->notesGrid, quadHandle, noteHighlightColor);
-        }
+    Grid_hideQuad(self->cursorGrid, self->playbackCursorHandle);
 
-        self->state = STATE_IDLE;
+    QuadHandle quadHandle = (QuadHandle)HashMap_getItem(self->spatialQuadMap, &self->cursorPosition);
+    if (quadHandle && self->state == STATE_IDLE) {
+        Color noteHighlightColor = lerpColor(self->blockColor, HIGHLIGHT_COLOR, NOTE_HIGHLIGHT_STRENGTH);
+        Grid_updateQuadColor(self->notesGrid, quadHandle, noteHighlightColor);
     }
+
+    self->isPlaying = false;
 }
 
 
@@ -612,7 +616,7 @@ static void EditView_onSequencerProgress(EditView* self, void* sender, float* pr
         return;
     }
 
-    Log_assert(self->state == STATE_PLAYING, "Unexpected sequencer progress update in state %d", self->state);
+    Log_assert(self->isPlaying, "Unexpected sequencer progress update while not playing");
 
     Grid_unhideQuad(self->cursorGrid, self->playbackCursorHandle);
     self->playbackCursorPosition = (Vector2i){*progress * (float)getGridSize().x, 0};
@@ -710,11 +714,12 @@ static void EditView_onCursorPositionUpdated(EditView* self) {
 
 static void EditView_addNoteAtCursor(EditView* self) {
     int pitch = transformRowIndexToNotePitch(self->cursorPositionDragStart.y);
-    float time = (float)self->cursorPositionDragStart.x / (float)getGridSize().x;
+    int nTicksPerColumn = EditView_getTicksPerColumn(self);
+    int tick = self->cursorPositionDragStart.x * nTicksPerColumn;
     int dragNoteLength = Math_max(self->cursorPosition.x - self->cursorPositionDragStart.x + 1, 1);
-    float duration = dragNoteLength / (float)getGridSize().x;
+    int duration = dragNoteLength * nTicksPerColumn;
     float velocity = NOTE_VELOCITY_DEFAULT;
-    Score_addNote(self->score, pitch, time, duration, velocity);
+    Score_addNote(self->score, pitch, tick, duration, velocity);
 }
 
 
@@ -725,12 +730,29 @@ static void EditView_removeNoteAtCursor(EditView* self) {
 
 static void EditView_removeNoteAtPosition(EditView* self, Vector2i position) {
     int pitch = transformRowIndexToNotePitch(position.y);
-    float time = (float)position.x / (float)getGridSize().x;
-    Score_removeNotes(self->score, pitch, time, time + 1.0f / getGridSize().x);
+    int nTicksPerColumn = EditView_getTicksPerColumn(self);
+    int tick = position.x * nTicksPerColumn;
+    Score_removeNotes(self->score, pitch, tick, tick + nTicksPerColumn);
+}
+
+
+// Ends the edit group of a removal drag. Also called whenever the view
+// stops handling mouse input, so that the group never stays open.
+static void EditView_stopRemovingNotes(EditView* self) {
+    if (self->isNoteRemovalButtonPressed) {
+        Score_endEditGroup(self->score);
+    }
+    self->isNoteRemovalButtonPressed = false;
 }
 
 
+// The playing block shares the preview channel, so notes are not previewed
+// during playback. Stopping the preview would cut the playing notes short.
 static void EditView_previewNoteAtCursor(EditView* self) {
+    if (self->isPlaying) {
+        return;
+    }
+
     MidiMessage midiMessage = {
         .type = MIDI_MESSAGE_TYPE_NOTEON,
         .channel = NOTE_PREVIEW_MIDI_CHANNEL,
@@ -742,6 +764,10 @@ static void EditView_previewNoteAtCursor(EditView* self) {
 
 
 static void EditView_stopPreviewingAllNotes(EditView* self) {
+    if (self->isPlaying) {
+        return;
+    }
+
     int iChannel = NOTE_PREVIEW_MIDI_CHANNEL;
     Event_post(self, EVENT_REQUEST_MIDI_CHANNEL_STOP, &iChannel, sizeof(iChannel));
 }
@@ -753,6 +779,11 @@ static void EditView_logNoteAction(EditView* self, const char* const action) {
 }
 
 
+static int EditView_getTicksPerColumn(EditView* self) {
+    return Score_getBlockDurationTicks(self->score) / getGridSize().x;
+}
+
+
 static void EditView_refreshNoteGrid(EditView* self) {
     Grid_free(&self->notesGrid);
     self->notesGrid = Grid_new(getGridSize(), (Vector2){NOTES_GRID_CELL_SPACING, NOTES_GRID_CELL_SPACING});
@@ -794,7 +825,7 @@ static void EditView_refreshNoteGrid(EditView* self) {
 
 
 static void EditView_hide(EditView* self) {
-    self->isPlayingLoop = false;
+    EditView_stopRemovingNotes(self);
     Score_stopPlaying(self->score);
 
     EditView_hideGrids(self);
@@ -45,7 +45,6 @@ static const Vector2i CURSOR_SIZE = {1, 1};
 typedef enum {
     STATE_INVALID,
     STATE_IDLE,
-    STATE_PLAYING,
     STATE_INITIALIZING,
 } State;
 
@@ -70,12 +69,15 @@ struct ObjectView {
     bool isBlockAddButtonPressed;
     bool isBlockRemovalButtonPressed;
     bool isZoomKeyPressed;
+    bool isPlaying;  // edits made meanwhile are patched into the playing sequence
     int scrollX;
     int nBlocksToShow;
     int nBlocksToShowInit;
     Vector2i zoomTargetCursorPosition;
     SequencerRequest* sequencerRequest;
     size_t iPlaybackMidiMessage;
+    int playbackTickPrev;
+    bool isPlaybackLooped;  // highlights follow the loop messages once a loop has wrapped around
 };
 
 
@@ -97,6 +99,8 @@ static void ObjectView_addBlockInstanceAtCursor(ObjectView* self);
 static void ObjectView_addBlockInstanceAtPosition(ObjectView* self, Vector2i position);
 static void ObjectView_removeBlockInstanceAtCursor(ObjectView* self);
 static void ObjectView_removeBlockInstanceAtPosition(ObjectView* self, Vector2i position);
+static void ObjectView_stopAddingBlocks(ObjectView* self);
+static void ObjectView_stopRemovingBlocks(ObjectView* self);
 static void ObjectView_hide(ObjectView* self);
 static void ObjectView_unhide(ObjectView* self);
 static void ObjectView_refreshBlockGrid(ObjectView* self);
@@ -214,6 +218,9 @@ void ObjectView_free(ObjectView** pself) {
         if (self->sequencerRequest->midiMessages) {
             sfree((void**)&self->sequencerRequest->midiMessages);
         }
+        if (self->sequencerRequest->loopMidiMessages) {
+            sfree((void**)&self->sequencerRequest->loopMidiMessages);
+        }
         sfree((void**)&self->sequencerRequest);
     }
 
@@ -236,6 +243,8 @@ static void ObjectView_onCharEvent(ObjectView* self, void* sender, CharEvent* ev
     CharEvent* eventSetTempo = &(CharEvent){INPUT_CHAR_T, INPUT_ACTION_PRESS, INPUT_NO_MODS};
     CharEvent* eventIgnoreNoteOff = &(CharEvent){INPUT_CHAR_N, INPUT_ACTION_PRESS, INPUT_NO_MODS};
     CharEvent* eventChangeTrackVelocity = &(CharEvent){INPUT_CHAR_V, INPUT_ACTION_PRESS, INPUT_NO_MODS};
+    CharEvent* eventUndo = &(CharEvent){INPUT_CHAR_U, INPUT_ACTION_PRESS, INPUT_NO_MODS};
+    CharEvent* eventRedo = &(CharEvent){INPUT_CHAR_R, INPUT_ACTION_PRESS, INPUT_MOD_CONTROL};
     CharEvent* eventQuit = &(CharEvent){INPUT_CHAR_Q, INPUT_ACTION_PRESS, INPUT_NO_MODS};
 
     int iTrack = self->cursorPosition.y;
@@ -243,7 +252,13 @@ static void ObjectView_onCharEvent(ObjectView* self, void* sender, CharEvent* ev
 
     switch (self->state) {
         case STATE_IDLE:;
-            if (charEventMatches(event, eventSave)) {
+            if (charEventMatches(event, eventUndo)) {
+                Score_undo(self->score);
+            } else if (charEventMatches(event, eventRedo)) {
+                Score_redo(self->score);
+            } else if (self->isPlaying) {
+                break;  // Only note and block edits are heard during playback
+            } else if (charEventMatches(event, eventSave)) {
                 Score_saveToFile(self->score);
             } else if (charEventMatches(event, eventChangeSynthInstrument)) {
                 Event_post(self, EVENT_REQUEST_CHANGE_SYNTH_INSTRUMENT_QUERY, &iChannel, sizeof(iChannel));
@@ -278,6 +293,8 @@ static void ObjectView_onKeyEvent(ObjectView* self, void* sender, KeyEvent* even
 
     KeyEvent* eventPlayScore = &(KeyEvent){INPUT_KEY_SPACE, INPUT_ACTION_PRESS, INPUT_NO_MODS};
     KeyEvent* eventPlayScoreFromCursor = &(KeyEvent){INPUT_KEY_SPACE, INPUT_ACTION_PRESS, INPUT_MOD_CONTROL};
+    KeyEvent* eventPlayScoreLoop = &(KeyEvent){INPUT_KEY_SPACE, INPUT_ACTION_PRESS, INPUT_MOD_SHIFT};
+    KeyEvent* eventPlayScoreFromCursorLoop = &(KeyEvent){INPUT_KEY_SPACE, INPUT_ACTION_PRESS, INPUT_MOD_CONTROL | INPUT_MOD_SHIFT};
     KeyEvent* eventZoomKeyPressed = &(KeyEvent){INPUT_KEY_LEFT_CONTROL, INPUT_ACTION_PRESS, INPUT_NO_MODS};
     KeyEvent* eventZoomKeyReleased = &(KeyEvent){INPUT_KEY_LEFT_CONTROL, INPUT_ACTION_RELEASE, INPUT_MOD_CONTROL};
 
@@ -289,19 +306,29 @@ static void ObjectView_onKeyEvent(ObjectView* self, void* sender, KeyEvent* even
         return;
     }
 
+    if (self->isPlaying) {
+        if (keyEventMatches(event, eventPlayScore)
+                || keyEventMatches(event, eventPlayScoreFromCursor)
+                || keyEventMatches(event, eventPlayScoreLoop)
+                || keyEventMatches(event, eventPlayScoreFromCursorLoop)) {
+            Score_stopPlaying(self->score);
+        }
+        return;
+    }
+
     switch (self->state) {
         case STATE_IDLE:;
             if (keyEventMatches(event, eventPlayScore)) {
-                Score_playEntireScore(self->score, 0);
+                Score_playEntireScore(self->score, 0, false);
             } else if (keyEventMatches(event, eventPlayScoreFromCursor)) {
-                Score_playEntireScore(self->score, self->cursorPosition.x);
-            }
-            break;
-        case STATE_PLAYING:;
-            if (keyEventMatches(event, eventPlayScore) || keyEventMatches(event, eventPlayScoreFromCursor)) {
-                Score_stopPlaying(self->score);
+                Score_playEntireScore(self->score, self->cursorPosition.x, false);
+            } else if (keyEventMatches(event, eventPlayScoreLoop)) {
+                Score_playEntireScore(self->score, 0, true);
+            } else if (keyEventMatches(event, eventPlayScoreFromCursorLoop)) {
+                Score_playEntireScore(self->score, self->cursorPosition.x, true);
             }
             break;
+        default:;
     }
 }
 
@@ -314,27 +341,35 @@ static void ObjectView_onMouseButtonEvent(ObjectView* self, void* sender, MouseB
     }
 
     MouseButtonEvent* eventAddBlock = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_LEFT, INPUT_ACTION_PRESS, INPUT_NO_MODS};
-    MouseButtonEvent* eventStopAddingBlock = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_LEFT, INPUT_ACTION_RELEASE, INPUT_NO_MODS};
     MouseButtonEvent* eventRemoveBlock = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_RIGHT, INPUT_ACTION_PRESS, INPUT_NO_MODS};
-    MouseButtonEvent* eventStopRemovingBlock = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_RIGHT, INPUT_ACTION_RELEASE, INPUT_NO_MODS};
+    // Modifiers may have changed while the button was held
+    MouseButtonEvent* eventStopAddingBlock = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_LEFT, INPUT_ACTION_RELEASE, event->mods};
+    MouseButtonEvent* eventStopRemovingBlock = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_RIGHT, INPUT_ACTION_RELEASE, event->mods};
     MouseButtonEvent* eventPickBlockDef = &(MouseButtonEvent){INPUT_MOUSE_BUTTON_MIDDLE, INPUT_ACTION_PRESS, INPUT_NO_MODS};
 
     switch (self->state) {
         case STATE_IDLE:;
             if (mouseButtonEventMatches(event, eventAddBlock)) {
+                // Blocks added or removed in one drag are undone as one edit
+                if (!self->isBlockAddButtonPressed) {
+                    Score_beginEditGroup(self->score);
+                }
                 self->isBlockAddButtonPressed = true;
                 ObjectView_addBlockInstanceAtCursor(self);
             } else if (mouseButtonEventMatches(event, eventStopAddingBlock)) {
-                self->isBlockAddButtonPressed = false;
+                ObjectView_stopAddingBlocks(self);
                 QuadHandle quadHandle = (QuadHandle)HashMap_getItem(self->spatialQuadMap, &self->cursorPosition);
                 if (quadHandle) {
                     Grid_updateQuadColor(self->blocksGrid, quadHandle, self->blockColor);
                 }
             } else if (mouseButtonEventMatches(event, eventRemoveBlock)) {
+                if (!self->isBlockRemovalButtonPressed) {
+                    Score_beginEditGroup(self->score);
+                }
                 self->isBlockRemovalButtonPressed = true;
                 ObjectView_removeBlockInstanceAtCursor(self);
             } else if (mouseButtonEventMatches(event, eventStopRemovingBlock)) {
-                self->isBlockRemovalButtonPressed = false;
+                ObjectView_stopRemovingBlocks(self);
             } else if (mouseButtonEventMatches(event, eventPickBlockDef)) {
                 Score_pickBlockDef(self->score, self->cursorPosition.y, self->cursorPosition.x);
             }
@@ -374,7 +409,6 @@ static void ObjectView_onMouseScrollwheelEvent(ObjectView* self, void* sender, V
 
     switch (self->state) {
         case STATE_IDLE:;
-        case STATE_PLAYING:;
             if (self->isZoomKeyPressed) {
                 self->nBlocksToShow = Math_clampi(self->nBlocksToShow - offset->y, SCORE_LENGTH_MIN, SCORE_LENGTH_MAX);
                 self->scrollX = Math_clampi(self->zoomTargetCursorPosition.x - self->mousePosition.x * self->nBlocksToShow, 0, SCORE_LENGTH_MAX - self->nBlocksToShow);
@@ -473,15 +507,7 @@ static void ObjectView_onSequencerStarted(ObjectView* self, void* sender, Sequen
         return;
     }
 
-    Grid_hideQuad(self->cursorGrid, self->cursorHandle);
-
-    QuadHandle quadHandle = (QuadHandle)HashMap_getItem(self->spatialQuadMap, &self->cursorPosition);
-    BlockInstance* blockInstance = HashMap_getItem(self->spatialBlockInstanceMap, &self->cursorPosition);
-    if (quadHandle && blockInstance) {
-        Color blockColor = blockInstance->color;
-        Grid_updateQuadColor(self->blocksGrid, quadHandle, blockColor);
-    }
-
+    // The cursor stays, blocks can be edited during playback
     self->playbackCursorPosition = (Vector2i){0, 0};
     Grid_updateQuadPosition(self->cursorGrid, self->playbackCursorHandle, self->playbackCursorPosition);
 
@@ -489,11 +515,17 @@ static void ObjectView_onSequencerStarted(ObjectView* self, void* sender, Sequen
     Grid_updateQuadColor(self->cursorGrid, self->playbackCursorHandle, cursorInitialColor);
     Grid_animateQuadColor(self->cursorGrid, self->playbackCursorHandle, CURSOR_COLOR, PLAYBACK_CURSOR_HIGHLIGHT_LERP_WEIGHT);
 
-    self->state = STATE_PLAYING;
+    self->isPlaying = true;
 
     self->sequencerRequest = ememdup(sequencerRequest, 1, sizeof(SequencerRequest));
     self->sequencerRequest->midiMessages = ememdup(sequencerRequest->midiMessages, sequencerRequest->nMidiMessages, sizeof(MidiMessage));
+    self->sequencerRequest->loopMidiMessages = NULL;
+    if (sequencerRequest->isLooping) {
+        self->sequencerRequest->loopMidiMessages = ememdup(sequencerRequest->loopMidiMessages, sequencerRequest->nLoopMidiMessages, sizeof(MidiMessage));
+    }
     self->iPlaybackMidiMessage = 0;
+    self->playbackTickPrev = sequencerRequest->tickStart;
+    self->isPlaybackLooped = false;
 }
 
 
@@ -501,7 +533,6 @@ static void ObjectView_onSequencerStopped(ObjectView* self, void* sender, void*
     (void)sender; (void)unused;
 
     Grid_hideQuad(self->cursorGrid, self->playbackCursorHandle);
-    Grid_unhideQuad(self->cursorGrid, self->cursorHandle);
 
     Grid_finalizeAllColorAnimations(self->blocksGrid);
 
@@ -517,11 +548,14 @@ static void ObjectView_onSequencerStopped(ObjectView* self, void* sender, void*
         if (self->sequencerRequest->midiMessages) {
             sfree((void**)&self->sequencerRequest->midiMessages);
         }
+        if (self->sequencerRequest->loopMidiMessages) {
+            sfree((void**)&self->sequencerRequest->loopMidiMessages);
+        }
         sfree((void**)&self->sequencerRequest);
     }
     self->iPlaybackMidiMessage = 0;
 
-    self->state = STATE_IDLE;
+    self->isPlaying = false;
 }
 
 
@@ -532,30 +566,36 @@ static void ObjectView_onSequencerProgress(ObjectView* self, void* sender, float
         return;
     }
 
-    Log_assert(self->state == STATE_PLAYING, "Unexpected sequencer progress update in state %d", self->state);
+    Log_assert(self->isPlaying, "Unexpected sequencer progress update while not playing");
 
     // Try to sync audio and visuals better.
-    float progressDelta = AUDIO_VISUAL_DELAY_COMPENSATION_SECONDS / self->sequencerRequest->timestampEnd;
+    float progressDelta = AUDIO_VISUAL_DELAY_COMPENSATION_SECONDS / (self->sequencerRequest->tickEnd * self->sequencerRequest->secondsPerTick);
     float delayAdjustedProgress = Math_maxf(Math_minf(*progress + progressDelta, 1.0f), 0.0f);
 
-    int iTimeSlot = delayAdjustedProgress * (float)getGridSize().x;
+    int sequencerTick = delayAdjustedProgress * self->sequencerRequest->tickEnd;
+    int iTimeSlot = sequencerTick / Score_getBlockDurationTicks(self->score);
 
     Grid_unhideQuad(self->cursorGrid, self->playbackCursorHandle);
     self->playbackCursorPosition = (Vector2i){iTimeSlot, 0};
     Grid_updateQuadPosition(self->cursorGrid, self->playbackCursorHandle, self->playbackCursorPosition);
 
-    float sequencerTimestampSeconds = delayAdjustedProgress * self->sequencerRequest->timestampEnd;
+    if (self->sequencerRequest->isLooping && sequencerTick < self->playbackTickPrev) {
+        self->isPlaybackLooped = true;
+        self->iPlaybackMidiMessage = 0;
+    }
+    self->playbackTickPrev = sequencerTick;
 
+    const MidiMessage* midiMessages = self->isPlaybackLooped ? self->sequencerRequest->loopMidiMessages : self->sequencerRequest->midiMessages;
+    size_t nMidiMessages = self->isPlaybackLooped ? self->sequencerRequest->nLoopMidiMessages : self->sequencerRequest->nMidiMessages;
     float lerpWeights[N_SYNTH_TRACKS] = {0};
 
-    while (self->iPlaybackMidiMessage < self->sequencerRequest->nMidiMessages
-            && self->sequencerRequest->midiMessages[self->iPlaybackMidiMessage].timestampSeconds < sequencerTimestampSeconds) {
-        if (self->sequencerRequest->midiMessages[self->iPlaybackMidiMessage].type == MIDI_MESSAGE_TYPE_NOTEON) {
-            int iChannel = self->sequencerRequest->midiMessages[self->iPlaybackMidiMessage].channel;
+    while (self->iPlaybackMidiMessage < nMidiMessages && midiMessages[self->iPlaybackMidiMessage].tick < sequencerTick) {
+        if (midiMessages[self->iPlaybackMidiMessage].type == MIDI_MESSAGE_TYPE_NOTEON) {
+            int iChannel = midiMessages[self->iPlaybackMidiMessage].channel;
             Log_assert(iChannel > 0, "Synth channel index must be larger than 0, was %d", iChannel);
             int iTrack = iChannel - 1;
 
-            int velocity = self->sequencerRequest->midiMessages[self->iPlaybackMidiMessage].velocity;
+            int velocity = midiMessages[self->iPlaybackMidiMessage].velocity;
             float lerpWeight = (float)velocity / (float)MIDI_MESSAGE_VELOCITY_MAX;
 
             lerpWeights[iTrack] = Math_minf(lerpWeights[iTrack] + lerpWeight, 1.0);
@@ -665,7 +705,28 @@ static void ObjectView_removeBlockInstanceAtPosition(ObjectView* self, Vector2i
 }
 
 
+// The edit group of an add or removal drag ends with the drag. These are
+// also called whenever the view stops handling mouse input, so that the
+// groups never stay open.
+static void ObjectView_stopAddingBlocks(ObjectView* self) {
+    if (self->isBlockAddButtonPressed) {
+        Score_endEditGroup(self->score);
+    }
+    self->isBlockAddButtonPressed = false;
+}
+
+
+static void ObjectView_stopRemovingBlocks(ObjectView* self) {
+    if (self->isBlockRemovalButtonPressed) {
+        Score_endEditGroup(self->score);
+    }
+    self->isBlockRemovalButtonPressed = false;
+}
+
+
 static void ObjectView_hide(ObjectView* self) {
+    ObjectView_stopAddingBlocks(self);
+    ObjectView_stopRemovingBlocks(self);
     Score_stopPlaying(self->score);
 
     Grid_hide(self->gridlinesGrid);
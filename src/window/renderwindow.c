@@ -132,6 +132,7 @@ int RenderWindow_run(RenderWindow* self) {
         float timeNow = glfwGetTime();
         float timeDelta = timeNow - self->timePrevious;
         self->timePrevious = timeNow;
+        Events_postThreadEvents();
         Event_post(self, EVENT_PROCESS_FRAME_BEGIN, &timeDelta, sizeof(timeDelta));
         Event_post(self, EVENT_PROCESS_FRAME, &timeDelta, sizeof(timeDelta));
         Event_post(self, EVENT_PROCESS_FRAME_END, &timeDelta, sizeof(timeDelta));